@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <zlib.h>
+#include "archive.h"
+#include "log.h"
+
+#define ARCHIVE_QUEUE_LENGTH 4096
+#define ARCHIVE_FLUSH_SECONDS 1 // a partially filled block is written after this long without new games
+
+struct archive_entry {
+	struct archive_record record;
+	unsigned char moves[ARCHIVE_MAX_MOVES];
+};
+
+/*
+ * finished games are handed to the writer thread through a bounded queue. archive_game only copies
+ * the record under a short critical section and never waits, if the writer falls behind the game
+ * is dropped and counted instead of slowing down the thread that handles the move.
+ * */
+static struct {
+	struct archive_entry *queue;
+	size_t head, tail, length;
+	unsigned long dropped;
+	char running;
+	FILE *output;
+	pthread_t writer;
+	pthread_mutex_t monitor;
+	pthread_cond_t not_empty;
+} archive = { .monitor = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER };
+
+static int archive_write_block(unsigned char *raw, size_t raw_size, uint32_t number_of_records)
+{
+	struct archive_block_header header;
+	uLongf compressed_size = compressBound(raw_size);
+	unsigned char *compressed = malloc(compressed_size);
+	if(!compressed) {
+		return -4;
+	}
+	if(compress2(compressed, &compressed_size, raw, raw_size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		free(compressed);
+		return -1;
+	}
+	header.magic = ARCHIVE_MAGIC;
+	header.compressed_size = compressed_size;
+	header.raw_size = raw_size;
+	header.number_of_records = number_of_records;
+	if(fwrite(&header, sizeof(header), 1, archive.output) != 1
+	|| fwrite(compressed, 1, compressed_size, archive.output) != compressed_size
+	|| fflush(archive.output)) {
+		free(compressed);
+		return -1;
+	}
+	free(compressed);
+	return 0;
+}
+
+static void* archive_writer(void *arg)
+{
+	(void) arg;
+	unsigned char *block = malloc(ARCHIVE_BLOCK_SIZE);
+	size_t block_size = 0, entry_size;
+	uint32_t number_of_records = 0;
+	struct archive_entry entry;
+	struct timespec deadline;
+	char running = 1;
+	if(!block) {
+		log_error("archive: cannot allocate a block, archiving disabled");
+		return NULL;
+	}
+	while(running) {
+		pthread_mutex_lock(&archive.monitor);
+		while(!archive.length && archive.running) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += ARCHIVE_FLUSH_SECONDS;
+			if(pthread_cond_timedwait(&archive.not_empty, &archive.monitor, &deadline) == ETIMEDOUT && number_of_records) {
+				break;
+			}
+		}
+		if(!archive.length) {
+			running = archive.running;
+			pthread_mutex_unlock(&archive.monitor);
+			if(number_of_records && archive_write_block(block, block_size, number_of_records)) {
+				log_error("archive: error writing a block of %u games", number_of_records);
+			}
+			block_size = 0;
+			number_of_records = 0;
+			continue;
+		}
+		entry = archive.queue[archive.head];
+		archive.head = (archive.head + 1) % ARCHIVE_QUEUE_LENGTH;
+		archive.length--;
+		pthread_mutex_unlock(&archive.monitor);
+		entry_size = sizeof(struct archive_record) + entry.record.number_of_moves;
+		if(block_size + entry_size > ARCHIVE_BLOCK_SIZE) {
+			if(archive_write_block(block, block_size, number_of_records)) {
+				log_error("archive: error writing a block of %u games", number_of_records);
+			}
+			block_size = 0;
+			number_of_records = 0;
+		}
+		memcpy(block + block_size, &entry.record, sizeof(struct archive_record));
+		memcpy(block + block_size + sizeof(struct archive_record), entry.moves, entry.record.number_of_moves);
+		block_size += entry_size;
+		number_of_records++;
+	}
+	free(block);
+	return NULL;
+}
+
+int archive_start(const char *path)
+{
+	if(!path) {
+		return -3;
+	}
+	archive.queue = malloc(sizeof(struct archive_entry) * ARCHIVE_QUEUE_LENGTH);
+	if(!archive.queue) {
+		return -4;
+	}
+	archive.output = fopen(path, "ab");
+	if(!archive.output) {
+		free(archive.queue);
+		archive.queue = NULL;
+		return -1;
+	}
+	archive.head = archive.tail = archive.length = 0;
+	archive.running = 1;
+	if(pthread_create(&archive.writer, NULL, archive_writer, NULL)) {
+		archive.running = 0;
+		fclose(archive.output);
+		free(archive.queue);
+		archive.queue = NULL;
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * returns 1 if the game had to be dropped because the queue is full or archiving is off
+ * */
+int archive_game(const struct archive_record *record, const unsigned char *moves)
+{
+	if(!record || !moves || record->number_of_moves > ARCHIVE_MAX_MOVES) {
+		return -3;
+	}
+	pthread_mutex_lock(&archive.monitor);
+	if(!archive.running || archive.length == ARCHIVE_QUEUE_LENGTH) {
+		archive.dropped++;
+		pthread_mutex_unlock(&archive.monitor);
+		return 1;
+	}
+	archive.queue[archive.tail].record = *record;
+	memcpy(archive.queue[archive.tail].moves, moves, record->number_of_moves);
+	archive.tail = (archive.tail + 1) % ARCHIVE_QUEUE_LENGTH;
+	archive.length++;
+	pthread_cond_signal(&archive.not_empty);
+	pthread_mutex_unlock(&archive.monitor);
+	return 0;
+}
+
+/*
+ * drains the queue, writes the last partial block and closes the archive
+ * */
+void archive_stop(void)
+{
+	pthread_mutex_lock(&archive.monitor);
+	if(!archive.running) {
+		pthread_mutex_unlock(&archive.monitor);
+		return;
+	}
+	archive.running = 0;
+	pthread_cond_signal(&archive.not_empty);
+	pthread_mutex_unlock(&archive.monitor);
+	pthread_join(archive.writer, NULL);
+	if(archive.dropped) {
+		log_warning("archive: %lu games dropped because the writer fell behind", archive.dropped);
+	}
+	fclose(archive.output);
+	free(archive.queue);
+	archive.queue = NULL;
+}
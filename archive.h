@@ -0,0 +1,37 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include "constants.h"
+
+/*
+ * the archive is a sequence of blocks, each one a block_header followed by compressed_size bytes
+ * of deflate data. a decompressed block holds number_of_records records, every record is an
+ * archive_record immediately followed by number_of_moves cell indices (x * board_size + y).
+ * blocks are only ever appended, a reader can stream the file one block at a time.
+ * */
+#define ARCHIVE_MAGIC 0x41545454u // "TTTA"
+#define ARCHIVE_BLOCK_SIZE (64 * 1024) // uncompressed bytes per block
+#define ARCHIVE_MAX_MOVES (BOARD_SIZE * BOARD_SIZE)
+
+struct archive_block_header {
+	uint32_t magic;
+	uint32_t compressed_size;
+	uint32_t raw_size;
+	uint32_t number_of_records;
+};
+
+struct archive_record {
+	uint64_t finished_at; // seconds since the epoch
+	char player_1[USERNAMELEN]; // not null terminated if the name is USERNAMELEN long
+	char player_2[USERNAMELEN];
+	uint8_t board_size;
+	char result; // 'X', 'O' or 'D', the final value of whose_turn
+	uint8_t number_of_moves;
+} __attribute__((packed));
+
+int archive_start(const char *path);
+int archive_game(const struct archive_record *record, const unsigned char *moves);
+void archive_stop(void);
+
+#endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "archive.h"
+
+/*
+ * streams an archive written by the server to stdout as csv or json.
+ * only one block is held in memory at a time, so archives of any size can be exported.
+ * */
+
+static void print_name(const char *name, char json)
+{
+	for(size_t i = 0; i < USERNAMELEN && name[i]; ++i) {
+		if(json && (name[i] == '"' || name[i] == '\\')) {
+			putc('\\', stdout);
+		} else if(!json && (name[i] == ',' || name[i] == '"')) {
+			putc('_', stdout);
+			continue;
+		}
+		putc(name[i], stdout);
+	}
+}
+
+static void print_record(const struct archive_record *record, const unsigned char *moves, char json, char first)
+{
+	if(json) {
+		printf("%s\n\t{\"finished_at\": %lu, \"player_1\": \"", first ? "" : ",", (unsigned long) record->finished_at);
+		print_name(record->player_1, json);
+		printf("\", \"player_2\": \"");
+		print_name(record->player_2, json);
+		printf("\", \"board_size\": %u, \"result\": \"%c\", \"moves\": [", record->board_size, record->result);
+		for(unsigned int i = 0; i < record->number_of_moves; ++i) {
+			printf("%s[%u, %u]", i ? ", " : "", moves[i] / record->board_size, moves[i] % record->board_size);
+		}
+		printf("]}");
+	} else {
+		printf("%lu,", (unsigned long) record->finished_at);
+		print_name(record->player_1, json);
+		putc(',', stdout);
+		print_name(record->player_2, json);
+		printf(",%u,%c,", record->board_size, record->result);
+		for(unsigned int i = 0; i < record->number_of_moves; ++i) {
+			printf("%s%u %u", i ? ";" : "", moves[i] / record->board_size, moves[i] % record->board_size);
+		}
+		putc('\n', stdout);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct archive_block_header header;
+	struct archive_record record;
+	unsigned char *compressed = NULL, *raw = NULL, *position, *end;
+	unsigned long number_of_games = 0;
+	uLongf raw_size;
+	char json = 0;
+	FILE *input;
+	if(argc < 2 || (argc == 3 && strcmp(argv[2], "--json") && strcmp(argv[2], "--csv")) || argc > 3) {
+		fprintf(stderr, "usage: %s archive [--csv | --json]\n", argv[0]);
+		exit(1);
+	}
+	json = argc == 3 && !strcmp(argv[2], "--json");
+	input = fopen(argv[1], "rb");
+	if(!input) {
+		perror("error opening archive");
+		exit(1);
+	}
+	if(json) {
+		printf("[");
+	} else {
+		printf("finished_at,player_1,player_2,board_size,result,moves\n");
+	}
+	while(fread(&header, sizeof(header), 1, input) == 1) {
+		if(header.magic != ARCHIVE_MAGIC || header.raw_size > ARCHIVE_BLOCK_SIZE) {
+			fprintf(stderr, "corrupt block header after %lu games\n", number_of_games);
+			break;
+		}
+		compressed = realloc(compressed, header.compressed_size);
+		raw = raw ? raw : malloc(ARCHIVE_BLOCK_SIZE);
+		if(!compressed || !raw) {
+			fprintf(stderr, "error on malloc\n");
+			exit(1);
+		}
+		if(fread(compressed, 1, header.compressed_size, input) != header.compressed_size) {
+			fprintf(stderr, "truncated block after %lu games\n", number_of_games);
+			break;
+		}
+		raw_size = ARCHIVE_BLOCK_SIZE;
+		if(uncompress(raw, &raw_size, compressed, header.compressed_size) != Z_OK || raw_size != header.raw_size) {
+			fprintf(stderr, "corrupt block after %lu games\n", number_of_games);
+			break;
+		}
+		position = raw;
+		end = raw + raw_size;
+		for(uint32_t i = 0; i < header.number_of_records; ++i) {
+			if((size_t)(end - position) < sizeof(record)) {
+				break;
+			}
+			memcpy(&record, position, sizeof(record));
+			position += sizeof(record);
+			if((size_t)(end - position) < record.number_of_moves || !record.board_size) {
+				break;
+			}
+			print_record(&record, position, json, !number_of_games);
+			position += record.number_of_moves;
+			number_of_games++;
+		}
+	}
+	if(json) {
+		printf("\n]\n");
+	}
+	free(compressed);
+	free(raw);
+	fclose(input);
+	return 0;
+}
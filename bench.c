@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "game.h"
+#include "stats.h"
+#include "tournament.h"
+
+/*
+ * microbenchmarks of the engine, the registry and the request parsing helpers in game.c, and of the
+ * tournament scheduler.
+ * each benchmark is warmed up, then timed in samples of a calibrated number of iterations on a
+ * pinned cpu. the summary goes to stdout and, with every sample statistic, to a json file which
+ * can be diffed between commits. on x86 the clock is the tsc, which counts reference cycles at
+ * a constant rate rather than core cycles, so numbers are comparable only on the same machine.
+ * */
+
+#define BENCH_SAMPLES 31
+#define BENCH_WARMUP_NS 100000000ul // 100 ms
+#define BENCH_SAMPLE_NS 2000000ul // calibrate iterations so that one sample takes about 2 ms
+#define BENCH_USERS 1000
+#define BENCH_GAMES 1000
+#define BENCH_LARGE_BOARD 16
+#define BENCH_TOURNAMENT_PLAYERS 10000
+
+struct bench {
+	const char *name;
+	int (*setup)(void);
+	void (*run)(unsigned long iterations);
+	void (*teardown)(void);
+	unsigned long operations; // per iteration, set by setup
+};
+
+struct bench_result {
+	unsigned long iterations; // per sample
+	double cycles[BENCH_SAMPLES], ns[BENCH_SAMPLES]; // per operation
+	double min, median, mean, stddev, max, ns_median;
+};
+
+static volatile unsigned long sink; // keeps results alive so the calls are not optimized out
+
+static inline unsigned long bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned long cycles;
+	_mm_lfence(); // do not let earlier instructions drift into the measured region
+	cycles = __rdtsc();
+	_mm_lfence();
+	return cycles;
+#else
+	return stats_now();
+#endif
+}
+
+static unsigned long xorshift(unsigned long *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/*
+ * write_x_or_o: a drawn 3x3 game, and random games on a board large enough to show the scans
+ * */
+static struct game_board board;
+static char board_cells[BENCH_LARGE_BOARD * BENCH_LARGE_BOARD];
+static unsigned char board_moves[BENCH_LARGE_BOARD * BENCH_LARGE_BOARD];
+static size_t board_number_of_moves;
+
+static const unsigned char drawn_game[] = { 0, 4, 8, 2, 6, 3, 5, 7, 1 }; // cells in the order they are written
+
+static size_t play_game(void)
+{
+	size_t i;
+	memset(board.matrix, ' ', board.board_size * board.board_size);
+	board.whose_turn = 'x';
+	for(i = 0; i < board_number_of_moves && (board.whose_turn == 'x' || board.whose_turn == 'o'); ++i) {
+		sink += write_x_or_o(&board, board_moves[i] / board.board_size, board_moves[i] % board.board_size, board.whose_turn);
+	}
+	return i;
+}
+
+static int board_setup(size_t board_size)
+{
+	board.matrix = board_cells;
+	board.board_size = board_size;
+	board_number_of_moves = board_size * board_size;
+	board_number_of_moves = play_game(); // moves until the game ends
+	return board_number_of_moves ? 0 : -1;
+}
+
+static int write_3x3_setup(void)
+{
+	memcpy(board_moves, drawn_game, sizeof(drawn_game));
+	return board_setup(3);
+}
+
+static int write_large_setup(void)
+{
+	unsigned long state = 0x9e3779b97f4a7c15ul, j;
+	unsigned char cell;
+	for(size_t i = 0; i < BENCH_LARGE_BOARD * BENCH_LARGE_BOARD; ++i) {
+		board_moves[i] = i;
+	}
+	for(size_t i = BENCH_LARGE_BOARD * BENCH_LARGE_BOARD - 1; i; --i) { // a fixed shuffle, the same game every run
+		j = xorshift(&state) % (i + 1);
+		cell = board_moves[i];
+		board_moves[i] = board_moves[j];
+		board_moves[j] = cell;
+	}
+	return board_setup(BENCH_LARGE_BOARD);
+}
+
+static void write_run(unsigned long iterations)
+{
+	while(iterations--) {
+		play_game();
+	}
+}
+
+/*
+ * get_coordinates_from_buffer and parse_operands_from_buffer on the operands of real requests
+ * */
+static char coordinates[BOARD_SIZE * BOARD_SIZE][8];
+
+static int coordinates_setup(void)
+{
+	for(int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+		snprintf(coordinates[i], sizeof(coordinates[i]), "%d", i / BOARD_SIZE);
+		snprintf(coordinates[i] + 2, sizeof(coordinates[i]) - 2, "%d", i % BOARD_SIZE);
+	}
+	return 0;
+}
+
+static void coordinates_run(unsigned long iterations)
+{
+	unsigned long x, y;
+	for(unsigned long i = 0; i < iterations; ++i) {
+		sink += get_coordinates_from_buffer(coordinates[i % (BOARD_SIZE * BOARD_SIZE)], &x, &y) + x + y;
+	}
+}
+
+#define OPERANDS_LENGTH (USERNAMELEN + PASSWORDLEN + 2)
+
+static void operands_run(unsigned long iterations)
+{
+	char buffer[OPERANDS_LENGTH] = "user\0pass";
+	char operand1[OPERANDS_LENGTH], operand2[OPERANDS_LENGTH];
+	while(iterations--) {
+		sink += parse_operands_from_buffer(operand1, operand2, buffer, '\0', OPERANDS_LENGTH) + operand2[0];
+	}
+}
+
+static int no_setup(void)
+{
+	return 0;
+}
+
+/*
+ * find_user_by_name against a users file of BENCH_USERS lines, including the fopen every login pays
+ * */
+static char users_path[32];
+
+static int users_setup(void)
+{
+	strcpy(users_path, "/tmp/bench_usersXXXXXX");
+	int fd = mkstemp(users_path);
+	FILE *users;
+	if(fd < 0 || !(users = fdopen(fd, "w"))) {
+		return -1;
+	}
+	for(int i = 0; i < BENCH_USERS; ++i) {
+		fprintf(users, "u%03d p%03d\n", i, i);
+	}
+	return fclose(users);
+}
+
+static void users_lookup(unsigned long iterations, char *name)
+{
+	User *user;
+	while(iterations--) {
+		user = find_user_by_name(fopen(users_path, "r"), name);
+		sink += (unsigned long) user;
+		free(user);
+	}
+}
+
+static void users_last_run(unsigned long iterations)
+{
+	char name[] = "u999";
+	users_lookup(iterations, name);
+}
+
+static void users_missing_run(unsigned long iterations)
+{
+	char name[] = "none";
+	users_lookup(iterations, name);
+}
+
+static void users_teardown(void)
+{
+	unlink(users_path);
+}
+
+/*
+ * the registry under churn: one random game removed and a new one added, with BENCH_GAMES games
+ * in the registry, and the registry filled up to BENCH_GAMES and drained again in random order,
+ * which goes through every grow and shrink step. both include allocating and freeing the games,
+ * as create_new_game_request and game_boards_array_remove do.
+ * */
+static struct game_boards_array *registry;
+static unsigned long registry_state = 0x2545f4914f6cdd1dul;
+
+static struct game_board* registry_new_game(void)
+{
+	struct game_board *game = calloc(1, sizeof(struct game_board));
+	if(!game || !(game->matrix = malloc(BOARD_SIZE * BOARD_SIZE)) || pthread_mutex_init(&game->monitor, NULL)) {
+		fprintf(stderr, "error on allocating a game\n");
+		exit(1);
+	}
+	game->board_size = BOARD_SIZE;
+	game->whose_turn = 'x';
+	return game;
+}
+
+static int registry_setup(void)
+{
+	if(!(registry = array_of_games_init(REALLOC_SIZE))) {
+		return -1;
+	}
+	for(int i = 0; i < BENCH_GAMES; ++i) {
+		if(game_boards_array_add(registry, registry_new_game())) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void registry_churn_run(unsigned long iterations)
+{
+	while(iterations--) {
+		sink += game_boards_array_remove(registry, registry->array[xorshift(&registry_state) % registry->number_of_elements]);
+		sink += game_boards_array_add(registry, registry_new_game());
+	}
+}
+
+static int registry_empty_setup(void)
+{
+	return (registry = array_of_games_init(REALLOC_SIZE)) ? 0 : -1;
+}
+
+static void registry_fill_drain_run(unsigned long iterations)
+{
+	while(iterations--) {
+		for(int i = 0; i < BENCH_GAMES; ++i) {
+			sink += game_boards_array_add(registry, registry_new_game());
+		}
+		while(registry->number_of_elements) {
+			sink += game_boards_array_remove(registry, registry->array[xorshift(&registry_state) % registry->number_of_elements]);
+		}
+	}
+}
+
+static void registry_teardown(void)
+{
+	game_boards_array_free(registry);
+	registry = NULL;
+}
+
+/*
+ * a knockout of BENCH_TOURNAMENT_PLAYERS bots with random ratings, a whole tournament per iteration. the
+ * tournament workers add the games of every batch to a registry together, the bots play random moves
+ * until the game ends, then the game is removed and its result reported, as the server does.
+ * */
+static struct {
+	char over;
+	pthread_mutex_t monitor;
+	pthread_cond_t finished;
+} bench_tournament = { .monitor = PTHREAD_MUTEX_INITIALIZER, .finished = PTHREAD_COND_INITIALIZER };
+
+static void tournament_start_games(struct tournament_match **matches, size_t number_of_matches)
+{
+	struct game_board *games[TOURNAMENT_BATCH], *game;
+	struct tournament_match *match;
+	unsigned long state = (unsigned long) matches[0] | 1, cell;
+	char result;
+	for(size_t i = 0; i < number_of_matches; ++i) {
+		games[i] = registry_new_game();
+		memset(games[i]->matrix, ' ', BOARD_SIZE * BOARD_SIZE);
+		games[i]->board_size = BOARD_SIZE;
+		games[i]->match = matches[i];
+	}
+	if(game_boards_array_add_batch(registry, games, number_of_matches)) {
+		fprintf(stderr, "error on adding tournament games\n");
+		exit(1);
+	}
+	for(size_t i = 0; i < number_of_matches; ++i) {
+		game = games[i];
+		while(game->whose_turn == 'x' || game->whose_turn == 'o') {
+			cell = xorshift(&state) % (BOARD_SIZE * BOARD_SIZE);
+			if(game->matrix[cell] == ' ') {
+				sink += write_x_or_o(game, cell / BOARD_SIZE, cell % BOARD_SIZE, game->whose_turn);
+			}
+		}
+		result = game->whose_turn;
+		match = game->match;
+		sink += game_boards_array_remove(registry, game);
+		sink += tournament_report(match, result);
+	}
+}
+
+static void tournament_over(const struct tournament *tournament)
+{
+	(void) tournament;
+	pthread_mutex_lock(&bench_tournament.monitor);
+	bench_tournament.over = 1;
+	pthread_cond_signal(&bench_tournament.finished);
+	pthread_mutex_unlock(&bench_tournament.monitor);
+}
+
+static int tournament_setup(void)
+{
+	static const struct tournament_callbacks callbacks = { .start = tournament_start_games, .over = tournament_over };
+	if(!(registry = array_of_games_init(REALLOC_SIZE))) {
+		return -1;
+	}
+	return tournament_start(&callbacks);
+}
+
+static void tournament_run(unsigned long iterations)
+{
+	size_t signed_up;
+	while(iterations--) {
+		bench_tournament.over = 0;
+		for(int i = 0; i < BENCH_TOURNAMENT_PLAYERS; ++i) {
+			if(!tournament_sign_up(TOURNAMENT_KNOCKOUT, BENCH_TOURNAMENT_PLAYERS, NULL, 1000 + xorshift(&registry_state) % 1000, &signed_up)) {
+				fprintf(stderr, "error on signing up for a tournament\n");
+				exit(1);
+			}
+		}
+		pthread_mutex_lock(&bench_tournament.monitor);
+		while(!bench_tournament.over) {
+			pthread_cond_wait(&bench_tournament.finished, &bench_tournament.monitor);
+		}
+		pthread_mutex_unlock(&bench_tournament.monitor);
+	}
+}
+
+static void tournament_teardown(void)
+{
+	tournament_stop();
+	registry_teardown();
+}
+
+static struct bench benches[] = {
+	{ "write_x_or_o_3x3_game", write_3x3_setup, write_run, NULL, 0 },
+	{ "write_x_or_o_16x16_game", write_large_setup, write_run, NULL, 0 },
+	{ "get_coordinates_from_buffer", coordinates_setup, coordinates_run, NULL, 1 },
+	{ "parse_operands_from_buffer", no_setup, operands_run, NULL, 1 },
+	{ "find_user_by_name_last_of_1000", users_setup, users_last_run, users_teardown, 1 },
+	{ "find_user_by_name_missing", users_setup, users_missing_run, users_teardown, 1 },
+	{ "game_boards_array_churn_1000", registry_setup, registry_churn_run, registry_teardown, 2 },
+	{ "game_boards_array_fill_drain_1000", registry_empty_setup, registry_fill_drain_run, registry_teardown, 2 * BENCH_GAMES },
+	{ "tournament_knockout_10000", tournament_setup, tournament_run, tournament_teardown, BENCH_TOURNAMENT_PLAYERS - 1 }
+};
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+static void bench_measure(struct bench *bench, struct bench_result *result)
+{
+	unsigned long start, cycles, ns, iterations = 1;
+	double sorted[BENCH_SAMPLES], sum = 0, squares = 0;
+	start = stats_now();
+	while(stats_now() - start < BENCH_WARMUP_NS) { // warm caches, branch predictors and the allocator, and calibrate
+		ns = stats_now();
+		bench->run(iterations);
+		ns = stats_now() - ns;
+		iterations = ns ? iterations * BENCH_SAMPLE_NS / ns : iterations * 2; // converges while the caches warm up
+		iterations = iterations ? iterations : 1;
+	}
+	result->iterations = iterations;
+	for(int i = 0; i < BENCH_SAMPLES; ++i) {
+		ns = stats_now();
+		cycles = bench_cycles();
+		bench->run(iterations);
+		cycles = bench_cycles() - cycles;
+		ns = stats_now() - ns;
+		result->cycles[i] = (double) cycles / (iterations * bench->operations);
+		result->ns[i] = (double) ns / (iterations * bench->operations);
+		sum += result->cycles[i];
+	}
+	memcpy(sorted, result->cycles, sizeof(sorted));
+	qsort(sorted, BENCH_SAMPLES, sizeof(double), compare_doubles);
+	result->min = sorted[0];
+	result->median = sorted[BENCH_SAMPLES / 2];
+	result->max = sorted[BENCH_SAMPLES - 1];
+	result->mean = sum / BENCH_SAMPLES;
+	for(int i = 0; i < BENCH_SAMPLES; ++i) {
+		squares += (result->cycles[i] - result->mean) * (result->cycles[i] - result->mean);
+	}
+	result->stddev = sqrt(squares / (BENCH_SAMPLES - 1));
+	memcpy(sorted, result->ns, sizeof(sorted));
+	qsort(sorted, BENCH_SAMPLES, sizeof(double), compare_doubles);
+	result->ns_median = sorted[BENCH_SAMPLES / 2];
+}
+
+static void write_samples(FILE *output, const double *samples)
+{
+	for(int i = 0; i < BENCH_SAMPLES; ++i) {
+		fprintf(output, "%s%.3f", i ? ", " : "", samples[i]);
+	}
+}
+
+static int write_results(const char *path, const char *label, int cpu, const struct bench_result *results, size_t number_of_results)
+{
+	FILE *output = fopen(path, "w");
+	if(!output) {
+		return -1;
+	}
+	fprintf(output, "{\n\t\"label\": \"%s\",\n\t\"timestamp\": %ld,\n\t\"cpu\": %d,\n", label, (long) time(NULL), cpu);
+#if defined(__x86_64__) || defined(__i386__)
+	fprintf(output, "\t\"clock\": \"tsc\",\n");
+#else
+	fprintf(output, "\t\"clock\": \"ns\",\n");
+#endif
+#ifdef __OPTIMIZE__
+	fprintf(output, "\t\"optimized\": true,\n");
+#else
+	fprintf(output, "\t\"optimized\": false,\n");
+#endif
+	fprintf(output, "\t\"samples\": %d,\n\t\"benchmarks\": [\n", BENCH_SAMPLES);
+	for(size_t i = 0; i < number_of_results; ++i) {
+		fprintf(output, "\t\t{\n\t\t\t\"name\": \"%s\",\n\t\t\t\"operations_per_iteration\": %lu,\n\t\t\t\"iterations_per_sample\": %lu,\n",
+			benches[i].name, benches[i].operations, results[i].iterations);
+		fprintf(output, "\t\t\t\"cycles_per_operation\": { \"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, \"stddev\": %.3f, \"max\": %.3f },\n",
+			results[i].min, results[i].median, results[i].mean, results[i].stddev, results[i].max);
+		fprintf(output, "\t\t\t\"ns_per_operation_median\": %.3f,\n\t\t\t\"cycles_samples\": [", results[i].ns_median);
+		write_samples(output, results[i].cycles);
+		fprintf(output, "],\n\t\t\t\"ns_samples\": [");
+		write_samples(output, results[i].ns);
+		fprintf(output, "]\n\t\t}%s\n", i + 1 < number_of_results ? "," : "");
+	}
+	fprintf(output, "\t]\n}\n");
+	return fclose(output);
+}
+
+int main(int argc, char **argv)
+{
+	const char *output_path = "bench.json", *label = "", *filter = NULL;
+	struct bench_result results[sizeof(benches) / sizeof(*benches)];
+	size_t number_of_benches = sizeof(benches) / sizeof(*benches), measured = 0;
+	cpu_set_t cpus;
+	int cpu = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--output") && i + 1 < argc) {
+			output_path = argv[++i];
+		} else if(!strcmp(argv[i], "--label") && i + 1 < argc) {
+			label = argv[++i];
+		} else if(!strcmp(argv[i], "--cpu") && i + 1 < argc) {
+			cpu = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "--filter") && i + 1 < argc) {
+			filter = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--output path] [--label label] [--cpu n] [--filter substring]\n", argv[0]);
+			return 1;
+		}
+	}
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if(sched_setaffinity(0, sizeof(cpus), &cpus)) { // no migrations between samples
+		perror("sched_setaffinity");
+		cpu = -1;
+	}
+	printf("%-36s %12s %10s %10s %10s %10s %10s\n", "benchmark", "iterations", "min", "median", "mean", "stddev", "ns/op");
+	for(size_t i = 0; i < number_of_benches; ++i) {
+		if(filter && !strstr(benches[i].name, filter)) {
+			continue;
+		}
+		if(benches[i].setup()) {
+			fprintf(stderr, "error on setting up %s\n", benches[i].name);
+			return 1;
+		}
+		if(!benches[i].operations) {
+			benches[i].operations = board_number_of_moves; // the write_x_or_o games know their length only after setup
+		}
+		benches[measured] = benches[i];
+		bench_measure(&benches[measured], &results[measured]);
+		if(benches[i].teardown) {
+			benches[i].teardown();
+		}
+		printf("%-36s %12lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", benches[measured].name, results[measured].iterations,
+			results[measured].min, results[measured].median, results[measured].mean, results[measured].stddev, results[measured].ns_median);
+		++measured;
+	}
+	if(write_results(output_path, label, cpu, results, measured)) {
+		perror(output_path);
+		return 1;
+	}
+	printf("cycles per operation, results written to %s\n", output_path);
+	return 0;
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include "bot.h"
+#include "constants.h"
+
+#define BOT_TICK_MS 5
+#define BOT_RETRY_MS 50 // between joins that found no waiting game
+#define BOT_ALONE_RETRIES 4 // a created game nobody joined for this many retries plus two think times is left
+#define BOT_SEARCH_CELLS 10 // boards with more free cells are searched BOT_SEARCH_DEPTH moves deep
+#define BOT_SEARCH_DEPTH 3
+
+struct bot {
+	struct client_session session;
+	unsigned long next_at; // nanoseconds, bot_now() clock
+	unsigned long games;
+	unsigned int seed;
+	char create; // create a game instead of joining one
+	char logged_out;
+	char entered; // signed up for the tournament
+	unsigned long place; // in the tournament, 0 until it is over
+};
+
+struct bot_totals {
+	unsigned long moves, won, lost, tied, peer_left, abandoned;
+	unsigned long connect_failures, disconnects;
+	unsigned long placed, champions;
+};
+
+static const struct bot_options *bot_options;
+static struct bot_totals totals;
+static volatile sig_atomic_t bot_stop_requested = 0;
+static unsigned long bots_connected; // bots whose session is still open
+
+static unsigned long bot_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+static char bot_other(char character)
+{
+	return character ^ ('x' ^ 'o');
+}
+
+/*
+ * the number of cells of character in a line, -1 if the line holds anything else and cannot be completed
+ * */
+static int bot_line_value(const char *board, size_t n, size_t first, size_t step, char character)
+{
+	int count = 0;
+	for(size_t i = 0; i < n; ++i) {
+		if(board[first + i * step] == character) {
+			++count;
+		} else if(board[first + i * step] != ' ') {
+			return -1;
+		}
+	}
+	return count;
+}
+
+/*
+ * fills values with the lines through cell: its row, its column and the diagonals it lies on.
+ * the server's win rule is a full line of one character.
+ * */
+static int bot_lines(const char *board, size_t n, size_t cell, char character, int values[4])
+{
+	size_t x = cell / n, y = cell % n;
+	int lines = 0;
+	values[lines++] = bot_line_value(board, n, x * n, 1, character);
+	values[lines++] = bot_line_value(board, n, y, n, character);
+	if(x == y) {
+		values[lines++] = bot_line_value(board, n, 0, n + 1, character);
+	}
+	if(x + y == n - 1) {
+		values[lines++] = bot_line_value(board, n, n - 1, n - 1, character);
+	}
+	return lines;
+}
+
+/*
+ * whether writing character into the free cell completes a line
+ * */
+static char bot_wins_with(const char *board, size_t n, size_t cell, char character)
+{
+	int values[4], lines = bot_lines(board, n, cell, character, values);
+	for(int i = 0; i < lines; ++i) {
+		if(values[i] == (int) n - 1) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * how much a free cell is worth: lines that are still open for the bot count more the fuller they
+ * are, lines the other player could still complete count for blocking them
+ * */
+static long bot_cell_score(const char *board, size_t n, size_t cell, char character)
+{
+	int values[4], lines;
+	long score = 0;
+	if(bot_wins_with(board, n, cell, character)) {
+		return 1l << 30;
+	}
+	if(bot_wins_with(board, n, cell, bot_other(character))) {
+		return 1l << 20;
+	}
+	lines = bot_lines(board, n, cell, character, values);
+	for(int i = 0; i < lines; ++i) {
+		score += values[i] >= 0 ? 1 + 2 * values[i] : 0;
+	}
+	lines = bot_lines(board, n, cell, bot_other(character), values);
+	for(int i = 0; i < lines; ++i) {
+		score += values[i] >= 0 ? values[i] : 0;
+	}
+	return score;
+}
+
+static int bot_random(const struct client_game *game, unsigned int *seed, unsigned long *x, unsigned long *y)
+{
+	return session_random_free_cell(game, seed, x, y);
+}
+
+/*
+ * wins if it can, blocks if it has to, takes the cell on the most open lines otherwise.
+ * equal cells are chosen at random so that games between greedy bots differ.
+ * */
+static int bot_greedy(const struct client_game *game, unsigned int *seed, unsigned long *x, unsigned long *y)
+{
+	size_t n = game->board_size, cell, best = 0, ties = 0;
+	long score, best_score = -1;
+	if(n > SESSION_MAX_BOARD) {
+		return session_random_free_cell(game, seed, x, y);
+	}
+	for(cell = 0; cell < n * n; ++cell) {
+		if(game->board[cell] != ' ') {
+			continue;
+		}
+		score = bot_cell_score(game->board, n, cell, game->character);
+		if(score > best_score) {
+			best_score = score;
+			best = cell;
+			ties = 1;
+		} else if(score == best_score && !(rand_r(seed) % ++ties)) {
+			best = cell;
+		}
+	}
+	if(best_score < 0) {
+		return -1;
+	}
+	*x = best / n;
+	*y = best % n;
+	return 0;
+}
+
+/*
+ * negamax with alpha-beta pruning: positive if character, who is to move, wins. sooner wins score
+ * higher. positions at the depth limit count as a tie.
+ * */
+static long bot_negamax(char *board, size_t n, size_t free_cells, char character, int depth, long alpha, long beta)
+{
+	long value;
+	size_t cell;
+	if(!free_cells || !depth) {
+		return 0;
+	}
+	for(cell = 0; cell < n * n; ++cell) {
+		if(board[cell] == ' ' && bot_wins_with(board, n, cell, character)) {
+			return free_cells;
+		}
+	}
+	for(cell = 0; cell < n * n && alpha < beta; ++cell) {
+		if(board[cell] != ' ') {
+			continue;
+		}
+		board[cell] = character;
+		value = -bot_negamax(board, n, free_cells - 1, bot_other(character), depth - 1, -beta, -alpha);
+		board[cell] = ' ';
+		if(value > alpha) {
+			alpha = value;
+		}
+	}
+	return alpha;
+}
+
+/*
+ * plays perfectly once few cells are left and looks BOT_SEARCH_DEPTH moves ahead before that.
+ * moves the search rates equally are told apart by the greedy score.
+ * */
+static int bot_search(const struct client_game *game, unsigned int *seed, unsigned long *x, unsigned long *y)
+{
+	char board[SESSION_MAX_BOARD * SESSION_MAX_BOARD];
+	size_t n = game->board_size, free_cells = 0, cell, best = 0;
+	long value, score, best_value = 0, best_score = -1;
+	int depth;
+	if(n > SESSION_MAX_BOARD) {
+		return session_random_free_cell(game, seed, x, y);
+	}
+	memcpy(board, game->board, n * n);
+	for(cell = 0; cell < n * n; ++cell) {
+		free_cells += board[cell] == ' ';
+	}
+	depth = free_cells > BOT_SEARCH_CELLS ? BOT_SEARCH_DEPTH : (int) free_cells;
+	for(cell = 0; cell < n * n; ++cell) {
+		if(board[cell] != ' ') {
+			continue;
+		}
+		if(bot_wins_with(board, n, cell, game->character)) {
+			value = free_cells;
+		} else {
+			board[cell] = game->character;
+			value = -bot_negamax(board, n, free_cells - 1, bot_other(game->character), depth - 1, -(long) free_cells, free_cells);
+			board[cell] = ' ';
+		}
+		score = bot_cell_score(board, n, cell, game->character) + rand_r(seed) % 2;
+		if(best_score < 0 || value > best_value || (value == best_value && score > best_score)) {
+			best_value = value;
+			best_score = score;
+			best = cell;
+		}
+	}
+	if(best_score < 0) {
+		return -1;
+	}
+	*x = best / n;
+	*y = best % n;
+	return 0;
+}
+
+static const struct bot_strategy strategies[] = {
+	{ "random", bot_random },
+	{ "greedy", bot_greedy },
+	{ "search", bot_search }
+};
+
+const struct bot_strategy* bot_find_strategy(const char *name)
+{
+	for(size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); ++i) {
+		if(!strcmp(strategies[i].name, name)) {
+			return &strategies[i];
+		}
+	}
+	return NULL;
+}
+
+static void handle_stop_signal(int signal_number)
+{
+	(void) signal_number;
+	bot_stop_requested = 1;
+}
+
+static unsigned long bot_think_time(struct bot *bot)
+{
+	if(!bot_options->think) {
+		return 0;
+	}
+	return (rand_r(&bot->seed) % (2 * bot_options->think + 1)) * 1000000ul; // uniform around the mean
+}
+
+static void bot_reply(struct client_session *session, struct client_game *game, unsigned char opcode, const char *message,
+	unsigned long nanoseconds)
+{
+	struct bot *bot = session->context;
+	unsigned char code = (unsigned char) message[0];
+	(void) game;
+	(void) nanoseconds;
+	if(code >= FATAL_ERRORS) { // the server ends the session after these
+		++totals.disconnects;
+		session_close(session);
+		return;
+	}
+	switch(code) {
+		case LOGOUT_REPLY: {
+			bot->logged_out = 1;
+			session_close(session);
+		} return;
+		case NO_GAMES_AVAILABLE: { // half of the bots open a game, the others find it on their next join or leave theirs
+			bot->create = rand_r(&bot->seed) % 2;
+			bot->next_at = bot_now() + bot_think_time(bot) + BOT_RETRY_MS * 1000000ul;
+		} return;
+		case SERVER_BUSY: { // the same request again, after a back off
+			bot->next_at = bot_now() + bot_think_time(bot) + BOT_RETRY_MS * 1000000ul;
+		} return;
+		case CREATE_NEW_GAME_SUCCESS:
+		case JOIN_RANDOM_GAME_REPLY: bot->create = 0; break;
+		case TOURNAMENT_REPLY: bot->entered = 1; break;
+	}
+	if(opcode == ACTION_REQUEST && (code == ACTION_REPLY || code == GAME_IS_FINISHED)) {
+		++totals.moves;
+	}
+	bot->next_at = bot_now() + bot_think_time(bot);
+}
+
+static void bot_notify(struct client_session *session, struct client_game *game, const char *message)
+{
+	struct bot *bot = session->context;
+	(void) game;
+	if((unsigned char) message[0] == TOURNAMENT_OVER_NOTIFY) { // tournament id, place, players
+		bot->place = strtoul(message + strlen(message + 1) + 2, NULL, 10);
+		++totals.placed;
+		totals.champions += bot->place == 1;
+	}
+	bot->next_at = bot_now() + bot_think_time(bot);
+}
+
+static const struct session_handlers bot_handlers = {
+	.reply = bot_reply,
+	.notify = bot_notify
+};
+
+static void bot_count_result(const struct client_game *game)
+{
+	if(game->result == game->character - 0x20) {
+		++totals.won;
+	} else if(game->result == 'D') {
+		++totals.tied;
+	} else if(game->result == SESSION_PEER_LEFT) {
+		++totals.peer_left;
+	} else {
+		++totals.lost;
+	}
+}
+
+/*
+ * sends the next request a game needs: a rematch or leaving it once it ended, leaving it once it stalled,
+ * or a move. returns 1 if the game waits for the other player, else what the session returned.
+ * */
+static int bot_play(struct bot *bot, struct client_game *game, unsigned long now)
+{
+	struct client_session *session = &bot->session;
+	unsigned long x, y;
+	if(game->result != SESSION_PLAYING && !(game->rematch & SESSION_REMATCH_ASKED)) {
+		bot_count_result(game);
+		++bot->games;
+		if(bot_options->rematch && game->result != SESSION_PEER_LEFT && (!bot_options->games || bot->games < bot_options->games)) {
+			return session_rematch(session, game);
+		}
+		return session_leave(session, game);
+	}
+	if(game->result != SESSION_PLAYING) { // waiting for the other player to agree to the rematch
+		return game->peer_present && now < game->updated_at + bot_options->game_timeout * 1000000000ul ? 1 : session_leave(session, game);
+	}
+	if(!game->peer_present && game->free_cells == game->board_size * game->board_size && !bot_options->tournament
+	&& now >= game->updated_at + (BOT_ALONE_RETRIES * BOT_RETRY_MS + 2 * bot_options->think) * 1000000ul) {
+		bot->create = 0; // every bot may have opened a game of its own, this one joins again
+		return session_leave(session, game);
+	}
+	if(now >= game->updated_at + bot_options->game_timeout * 1000000000ul) { // nobody joined or the other player stalled
+		++totals.abandoned;
+		return session_leave(session, game);
+	}
+	if(!game->my_turn || !game->peer_present) {
+		return 1;
+	}
+	if(bot_options->strategy->choose(game, &bot->seed, &x, &y)) {
+		++totals.abandoned;
+		return session_leave(session, game);
+	}
+	return session_move(session, game, x, y);
+}
+
+/*
+ * called on every tick for bots without a request in flight whose think time is over. a bot that
+ * plays several games at once first serves the games that wait for it and then opens new ones.
+ * */
+static void bot_act(struct bot *bot, unsigned long now)
+{
+	struct client_session *session = &bot->session;
+	int ret_value = 1;
+	size_t i, playing = session->multiplexed ? session->number_of_games : session->state == SESSION_IN_GAME;
+	if(session->state == SESSION_IN_GAME) {
+		ret_value = bot_play(bot, &session->game, now);
+	} else if(session->state == SESSION_LOBBY && (bot_options->parallel > 1 || bot_options->tournament) && !session->multiplexed) {
+		ret_value = session_multiplex(session);
+	} else if(session->state == SESSION_LOBBY) {
+		for(i = 0; i < session->number_of_games && ret_value == 1; ++i) {
+			ret_value = bot_play(bot, session->games[i], now);
+		}
+		if(bot_options->tournament) { // the games come from the tournament
+			if(ret_value == 1 && !bot->entered) {
+				ret_value = session_tournament(session, bot_options->tournament, bot_options->bots);
+			} else if(ret_value == 1 && bot->place && !playing) {
+				ret_value = session_request(session, LOGOUT_REQUEST);
+			}
+		} else if(ret_value == 1 && !playing && bot_options->games && bot_options->bots > 1 && bots_connected == 1) {
+			ret_value = session_request(session, LOGOUT_REQUEST); // the other bots played their games, nobody is left to play with
+		} else if(ret_value == 1 && playing < bot_options->parallel && (!bot_options->games || bot->games + playing < bot_options->games)) {
+			ret_value = session_request(session, bot->create ? CREATE_NEW_GAME_REQUEST : JOIN_RANDOM_GAME_REQUEST);
+		} else if(ret_value == 1 && !playing && bot_options->games && bot->games >= bot_options->games) {
+			ret_value = session_request(session, LOGOUT_REQUEST);
+		}
+	}
+	if(ret_value == -2) { // the session closed itself
+		++totals.disconnects;
+	}
+}
+
+static int bot_connect(struct bot *bot, const struct sockaddr *address, socklen_t address_length)
+{
+	int one = 1, fd = socket(address->sa_family, SOCK_STREAM, 0);
+	bot->session.state = SESSION_CLOSED;
+	bot->session.fd = -1;
+	if(fd < 0) {
+		return -1;
+	}
+	if(address->sa_family == AF_INET) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	if(connect(fd, address, address_length) || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+		close(fd);
+		return -1;
+	}
+	session_init(&bot->session, fd, &bot_handlers, bot);
+	if(session_login(&bot->session, LOGIN_REQUEST, bot_options->username, bot_options->password)) {
+		session_close(&bot->session);
+		return -1;
+	}
+	return 0;
+}
+
+static void bot_print_results(double seconds)
+{
+	printf("%lu bots playing %s for %.2f s\n", bot_options->bots, bot_options->strategy->name, seconds);
+	printf("%lu moves, %.0f moves/s\n", totals.moves, totals.moves / seconds);
+	printf("%lu games: %lu won, %lu lost, %lu tied, %lu left by the other player\n",
+		totals.won + totals.lost + totals.tied + totals.peer_left, totals.won, totals.lost, totals.tied, totals.peer_left);
+	if(bot_options->tournament) {
+		printf("%lu bots placed in the tournament, %lu won it\n", totals.placed, totals.champions);
+	}
+	printf("%lu games abandoned, %lu failed connects, %lu disconnects\n", totals.abandoned, totals.connect_failures,
+		totals.disconnects);
+}
+
+/*
+ * runs the bots until every bot played its games or SIGINT or SIGTERM arrives, then prints the totals
+ * */
+int bot_run(const struct sockaddr *address, socklen_t address_length, const struct bot_options *options)
+{
+	struct bot *bots;
+	struct pollfd *fds;
+	struct sigaction action;
+	unsigned long i, n, now, start = bot_now();
+	bot_options = options;
+	bots = calloc(options->bots, sizeof(struct bot));
+	fds = calloc(options->bots, sizeof(struct pollfd));
+	if(!bots || !fds) {
+		free(bots);
+		free(fds);
+		return -1;
+	}
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	for(i = 0; i < options->bots; ++i) {
+		bots[i].seed = (unsigned int) (bot_now() ^ (i * 2654435761u));
+		if(bot_connect(&bots[i], address, address_length)) {
+			++totals.connect_failures;
+		}
+	}
+	while(!bot_stop_requested) {
+		for(i = 0, n = 0; i < options->bots; ++i) { // closed sessions have fd -1, poll skips them
+			fds[i].fd = bots[i].session.fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			n += bots[i].session.state != SESSION_CLOSED;
+		}
+		if(!(bots_connected = n)) {
+			break;
+		}
+		if(poll(fds, options->bots, BOT_TICK_MS) < 0 && errno != EINTR) {
+			break;
+		}
+		for(i = 0; i < options->bots; ++i) {
+			if(fds[i].revents && bots[i].session.state != SESSION_CLOSED && session_receive(&bots[i].session)
+			&& !bots[i].logged_out && !bot_stop_requested) {
+				++totals.disconnects;
+			}
+		}
+		now = bot_now();
+		for(i = 0; i < options->bots; ++i) {
+			if(bots[i].session.state != SESSION_CLOSED && bots[i].session.pending == SESSION_NO_REQUEST && now >= bots[i].next_at) {
+				bot_act(&bots[i], now);
+			}
+		}
+	}
+	for(i = 0; i < options->bots; ++i) {
+		session_close(&bots[i].session);
+	}
+	bot_print_results((bot_now() - start) / 1e9);
+	free(fds);
+	free(bots);
+	return 0;
+}
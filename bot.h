@@ -0,0 +1,40 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "session.h"
+
+/*
+ * headless players for soak tests and for filling empty lobbies. every bot is a client session, all
+ * bots of a process run in one poll loop. a bot joins a waiting game if there is one and creates a game
+ * otherwise, which it leaves again if nobody joins soon, plays the moves its strategy chooses until the
+ * game ends and starts over. a bot left alone by the other bots of its process logs out. with parallel
+ * above one a bot multiplexes its session and keeps that many games going at once. with a tournament
+ * format the bots sign up for one tournament of all of them instead and log out once it is over. with
+ * rematch a bot asks for another game against the same player after every game and only leaves once
+ * that player left or did not agree within the game timeout.
+ * */
+
+/*
+ * a strategy picks the next move on the session's copy of the board, it is only asked when it is the
+ * bot's turn. returns -1 if it has no move, e.g. because the board is too large to be kept locally.
+ * */
+struct bot_strategy {
+	const char *name;
+	int (*choose)(const struct client_game *game, unsigned int *seed, unsigned long *x, unsigned long *y);
+};
+
+struct bot_options {
+	unsigned long bots, games, think, game_timeout; // games per bot, 0 plays until interrupted
+	unsigned long parallel; // games a bot plays at once over its one connection
+	char tournament; // the format of the tournament to play, TOURNAMENT_* of tournament.h, 0 for none
+	char rematch; // ask the other player for a rematch after every game instead of leaving
+	const struct bot_strategy *strategy;
+	const char *username, *password;
+};
+
+const struct bot_strategy* bot_find_strategy(const char *name);
+int bot_run(const struct sockaddr *address, socklen_t address_length, const struct bot_options *options);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "capture.h"
+#include "log.h"
+
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+volatile int capture_active = 0;
+
+/*
+ * records are appended to one stdio stream with a large buffer under a mutex. a message is a few
+ * bytes, so the critical section is a memcpy and the write to disk is amortized over a megabyte.
+ * */
+static struct {
+	FILE *output;
+	char *buffer;
+	unsigned long started;
+	unsigned long failed;
+	pthread_mutex_t monitor;
+} capture_state = { .monitor = PTHREAD_MUTEX_INITIALIZER };
+
+static unsigned long capture_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+int capture_start(const char *path)
+{
+	struct capture_header header = { .magic = CAPTURE_MAGIC, .version = CAPTURE_VERSION, .started_at = time(NULL) };
+	if(!(capture_state.output = fopen(path, "wb"))) {
+		return -1;
+	}
+	if((capture_state.buffer = malloc(CAPTURE_BUFFER_SIZE))) {
+		setvbuf(capture_state.output, capture_state.buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+	}
+	if(fwrite(&header, sizeof(header), 1, capture_state.output) != 1) {
+		fclose(capture_state.output);
+		free(capture_state.buffer);
+		capture_state.output = NULL;
+		return -1;
+	}
+	capture_state.started = capture_now();
+	capture_active = 1;
+	log_info("capturing traffic to %s", (unsigned long) path);
+	return 0;
+}
+
+void capture_message(uint32_t connection, uint8_t direction, const void *data, size_t length)
+{
+	struct capture_record record = { .connection = connection, .direction = direction, .length = length };
+	pthread_mutex_lock(&capture_state.monitor);
+	if(!capture_state.output) { // capture_stop ran after the caller checked capture_active
+		pthread_mutex_unlock(&capture_state.monitor);
+		return;
+	}
+	record.timestamp = capture_now() - capture_state.started; // taken under the lock, so the file is in time order
+	if(fwrite(&record, sizeof(record), 1, capture_state.output) != 1
+	|| (length && fwrite(data, length, 1, capture_state.output) != 1)) {
+		++capture_state.failed;
+	}
+	pthread_mutex_unlock(&capture_state.monitor);
+}
+
+void capture_stop(void)
+{
+	if(!capture_active) {
+		return;
+	}
+	capture_active = 0;
+	pthread_mutex_lock(&capture_state.monitor);
+	if(fclose(capture_state.output) || capture_state.failed) {
+		log_error("capture: error on closing, %lu records lost", capture_state.failed);
+	}
+	capture_state.output = NULL;
+	free(capture_state.buffer);
+	capture_state.buffer = NULL;
+	pthread_mutex_unlock(&capture_state.monitor);
+}
@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * a capture is a capture_header followed by records, each one a capture_record immediately followed
+ * by length bytes of the message exactly as it was received or sent. timestamps are nanoseconds on
+ * the monotonic clock since the capture started. connection ids are assigned by the accept loop and
+ * are never reused within one capture.
+ * */
+#define CAPTURE_MAGIC 0x43545454u // "TTTC"
+#define CAPTURE_VERSION 1u
+
+enum {
+	CAPTURE_OPEN, // the connection was accepted, no data
+	CAPTURE_CLOSE, // the connection thread is done, no data
+	CAPTURE_REQUEST, // received from the connection
+	CAPTURE_REPLY, // sent to the connection in reply to its request
+	CAPTURE_NOTIFY // sent by this connection's thread to the other player of its game
+};
+
+struct capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t started_at; // seconds since the epoch
+};
+
+struct capture_record {
+	uint64_t timestamp;
+	uint32_t connection;
+	uint8_t direction; // CAPTURE_*
+	uint16_t length;
+} __attribute__((packed));
+
+extern volatile int capture_active;
+
+// the check keeps a disabled capture down to one load per message
+#define capture(connection, direction, data, length) do { \
+	if(capture_active) { \
+		capture_message((connection), (direction), (data), (length)); \
+	} \
+} while(0)
+
+int capture_start(const char *path);
+void capture_message(uint32_t connection, uint8_t direction, const void *data, size_t length);
+void capture_stop(void);
+
+#endif
@@ -3,76 +3,57 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netdb.h> 
 #include <stdlib.h>
 #include <termios.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "constants.h"
+#include "protocol.h"
+#include "stats.h"
+#include "session.h"
+#include "bot.h"
+#include "tournament.h"
 
 static struct termios term, term_orig;
-static char break_loop = 0;
 
-typedef struct usr {
-	char username[USERNAMELEN + 1];
-	char password[PASSWORDLEN + 1];
-} User;
-
-struct game_board {
-	char *matrix;
-	size_t board_size;
-	char character, state; // the character written to the matrix
-	unsigned long local_last_x, local_last_y, remote_last_x, remote_last_y;
-};
-
-struct session_details {
-	User *logged_in_user;
-	size_t bytes_written; // number of bytes written after the last operation
-	struct game_board *current_game;
-	char session_present, wait;
+/*
+ * the interactive client is one poll loop over stdin and the server socket. server messages are
+ * handled by the shared session state machine as soon as they arrive, also while the user types,
+ * and the prompt follows the session's state instead of a fixed sequence of reads.
+ * */
+enum {
+	INPUT_MENU,
+	INPUT_USERNAME,
+	INPUT_PASSWORD,
+	INPUT_X,
+	INPUT_Y
 };
 
-static unsigned char login_request(char*, struct session_details**);
-static unsigned char logout_request(char*, struct session_details**);
-static unsigned char create_user_request(char*, struct session_details**);
-static unsigned char join_random_game_request(char*, struct session_details**);
-static unsigned char create_new_game_request(char*, struct session_details**);
-static unsigned char leave_game_request(char*, struct session_details**);
-static unsigned char action_request(char*, struct session_details**);
-static unsigned char action_notify(char*, struct session_details**);
-static unsigned char other_player_present_notify(char*, struct session_details**);
-static unsigned char leave_game_reply(char*, struct session_details**);
-static unsigned char alloc_local_board(char*, struct session_details**);
-static unsigned char action_reply(char*, struct session_details**);
-static unsigned char game_is_finished(char*, struct session_details**);
-
-static unsigned char (*handler[NUMBER_OF_OPCODES]) (char*, struct session_details**) = {
-	[LOGIN_REQUEST] = login_request,	
-	[LOGOUT_REQUEST] = logout_request,
-	[CREATE_USER_REQUEST] = create_user_request,
-	[JOIN_RANDOM_GAME_REQUEST] = join_random_game_request,
-	[CREATE_NEW_GAME_REQUEST] = create_new_game_request,
-	[LEAVE_GAME_REQUEST] = leave_game_request,
-	[ACTION_REQUEST] = action_request,
-	[ACTION_REPLY] = action_reply,
-	[ACTION_NOTIFY] = action_notify,
-	[LEAVE_GAME_REPLY] = leave_game_reply,
-	[JOIN_RANDOM_GAME_REPLY] = alloc_local_board,
-	[GAME_IS_FINISHED] = game_is_finished,
-	[CREATE_NEW_GAME_SUCCESS] = alloc_local_board,
-	[OTHER_PLAYER_PRESENT_NOTIFY] = other_player_present_notify
+struct user_interface {
+	char input; // INPUT_*, what the next line of stdin is
+	unsigned char opcode; // LOGIN_REQUEST or CREATE_USER_REQUEST while credentials are read
+	char username[BUFFER_LENGTH];
+	unsigned long x;
+	unsigned long list_first; // where the next listing of open games starts
+	char line[BUFFER_LENGTH];
+	size_t line_length;
+	char eof, quit;
 };
 
-void print_board(struct game_board *board)
+void print_board(const struct client_game *game)
 {
-	if(!board) {
+	if(!game || game->board_size > SESSION_MAX_BOARD) {
 		return;
 	}
-	for(size_t i = 0; i < board->board_size; i++) {
-		for(size_t j = 0; j < board->board_size; j++) {
-			if(board->matrix[(board->board_size * i) + j]) {
-				putc(board->matrix[(board->board_size * i) + j], stdout);
+	for(size_t i = 0; i < game->board_size; i++) {
+		for(size_t j = 0; j < game->board_size; j++) {
+			if(game->board[(game->board_size * i) + j] != ' ') {
+				putc(game->board[(game->board_size * i) + j], stdout);
 			} else {
 				putc('_', stdout);
 			}
@@ -82,6 +63,46 @@ void print_board(struct game_board *board)
 	}
 }
 
+/*
+ * the moves at the end of a game snapshot, in the order they were made
+ * */
+static void print_moves(const char *message)
+{
+	const char *turn = message + strlen(message + 1) + 2, *cells = turn + strlen(turn + 1) + 2;
+	unsigned long board_size = strtoul(turn + 1, NULL, 10);
+	const unsigned char *moves = (const unsigned char*) cells + board_size * board_size;
+	printf("moves:");
+	for(unsigned int i = 0; board_size && i < moves[0]; ++i) {
+		printf(" %c(%lu, %lu)", cells[moves[i + 1]], moves[i + 1] / board_size, moves[i + 1] % board_size);
+	}
+	putc('\n', stdout);
+}
+
+/*
+ * the page of open games in a LIST_GAMES_REPLY, returns the index the next page starts at, 0 after the last page
+ * */
+static unsigned long print_games(const char *message, unsigned long first)
+{
+	unsigned char count = message[1];
+	const char *position = message + 2, *id, *host, *board_size;
+	unsigned long total = strtoul(position, NULL, 10);
+	position += strlen(position) + 1;
+	if(!count) {
+		printf("no open games%s\n", first ? " after these" : "");
+		return 0;
+	}
+	printf("open games %lu to %lu of %lu:\n", first + 1, first + count, total);
+	for(unsigned char i = 0; i < count; ++i) {
+		id = position;
+		host = id + strlen(id) + 1;
+		board_size = host + strlen(host) + 1;
+		position = board_size + strlen(board_size) + 1;
+		printf("game %s, %sx%s, hosted by %s for %s s\n", id, board_size, board_size, *host ? host : "nobody", position);
+		position += strlen(position) + 1;
+	}
+	return count && first + count < total ? first + count : 0;
+}
+
 void print_reply_code_meaning(const unsigned char ret_code)
 {
 	switch(ret_code) {
@@ -99,11 +120,26 @@ void print_reply_code_meaning(const unsigned char ret_code)
 		case CREATE_USER_SUCCESS:		printf("A new user has been created.\n");						break;
 		case LOGIN_SUCCESS:			printf("You successfully logged in.\n");						break;
 		case LOGOUT_REPLY:			printf("You successfully logged out.\n");						break;
+		case MULTIPLEX_REPLY:			printf("This session can hold several games now.\n");				break;
+		case SPECTATE_REPLY:			printf("You are watching the game.\n");						break;
+		case SPECTATE_NOTIFY:			printf("A player in a game you watch has made a move.\n");				break;
+		case SPECTATE_SNAPSHOT_NOTIFY:		printf("You fell behind a game you watch, this is its board now.\n");			break;
+		case GAME_SNAPSHOT_REPLY:		printf("This is the game as the server has it.\n");					break;
+		case LIST_GAMES_REPLY:			printf("These games are waiting for another player.\n");				break;
+		case MATCHMAKE_REPLY:			printf("You are waiting for an opponent of a similar rating.\n");			break;
+		case MATCH_FOUND_NOTIFY:		printf("An opponent has been found, the game begins.\n");				break;
+		case MATCH_EXPIRED_NOTIFY:		printf("No opponent of a similar rating has been found.\n");				break;
+		case TOURNAMENT_REPLY:			printf("You are signed up for the tournament.\n");					break;
+		case TOURNAMENT_OVER_NOTIFY:		printf("The tournament is over.\n");							break;
+		case REMATCH_REPLY:			printf("You asked for a rematch.\n");							break;
+		case REMATCH_NOTIFY:			printf("The other player asked for a rematch.\n");					break;
+		case MOVE_TIMEOUT_NOTIFY:		printf("A move was not made in time, the game is over.\n");				break;
 		case NO_PLAYER_PRESENT:			printf("The other player is not present in the game.\n");				break;
 		case INVALID_OPERANDS:			printf("Your input is invalid, probably out of the board's bounds.\n");			break;
 		case NO_GAMES_AVAILABLE:		printf("The server either hosts no games or no games are awaiting another player..\n");	break;
 		case NOT_IMPLEMENTED:			printf("This feature is not implemented.\n");						break;
 		case USER_ALREADY_EXISTS:		printf("A user with this name already exists.\n");					break;
+		case SERVER_BUSY:			printf("The server is busy, try again later.\n");					break;
 		case INTERNAL_SERVER_ERROR:		printf("The server encountered a fatal internal error.\n");				break;
 		case INVALID_REQUEST:			printf("The server deems this request as invalid.\n");					break;
 		case IO_ERROR:				printf("Input/output error\n");								break;
@@ -111,572 +147,414 @@ void print_reply_code_meaning(const unsigned char ret_code)
 	}
 }
 
-void print_options()
+void error(const char *msg)
 {
-	
+	perror(msg);
+	exit(3);
 }
 
-int get_coordinates_from_buffer(char *buffer, unsigned long *x, unsigned long *y)
-{
-	if(!x || !y) {
-		return 1;
-	}
-	char *next = NULL;
-	/*
-	for(unsigned long i = 0; i < BUFFER_LENGTH; ++i) {
-		if(buffer[i])
-			putc(buffer[i], stdout);
-		else
-			putc('.', stdout);
-	}
-	putc('\n', stdout);
-	*/
-	if(buffer[0] == '0' && buffer[1] == '\0') {
-		*x = 0;
-		next = buffer + 1;
-	} else {
-		*x = strtoul(buffer, &next, 10);
-		if(!*x || errno == ERANGE) {
-			return 2;
-		}
-	}
-	if(!next && buffer[2] == '0' && buffer[3] == '\0') {
-		*y = 0;
-	} else if(next && next[1] == '0' && next[2] == '\0') {
-		*y = 0;
-	} else {
-		*y = strtoul(++next, NULL, 10);
-		if(!*y || errno == ERANGE) {
-			return 3;
-		}
-	}
-	return 0;
-}
+static const char *opcode_names[] = {
+	[LOGIN_REQUEST] = "login",
+	[LOGOUT_REQUEST] = "logout",
+	[CREATE_USER_REQUEST] = "create_user",
+	[JOIN_RANDOM_GAME_REQUEST] = "join_random_game",
+	[CREATE_NEW_GAME_REQUEST] = "create_new_game",
+	[LEAVE_GAME_REQUEST] = "leave_game",
+	[ACTION_REQUEST] = "action",
+	[STATS_REQUEST] = "stats",
+	[MULTIPLEX_REQUEST] = "multiplex",
+	[SPECTATE_REQUEST] = "spectate",
+	[GAME_SNAPSHOT_REQUEST] = "game_snapshot",
+	[LIST_GAMES_REQUEST] = "list_games",
+	[MATCHMAKE_REQUEST] = "matchmake",
+	[TOURNAMENT_REQUEST] = "tournament",
+	[REMATCH_REQUEST] = "rematch",
+	[STATS_MATCH_WAIT] = "match_wait",
+	[STATS_CLASS_GAME] = "class_game",
+	[STATS_CLASS_LOBBY] = "class_lobby",
+	[STATS_CLASS_AUTH] = "class_auth"
+};
 
-unsigned char other_player_present_notify(char *buffer, struct session_details **session_details)
+/*
+ * sends a STATS_REQUEST for selector and splits the null separated numbers of the reply into values
+ * */
+static int query_stats(int sockfd, unsigned char selector, unsigned long *values, int number_of_values)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
+	char buffer[BUFFER_LENGTH];
+	char *position;
+	int n, i;
+	if(send(sockfd, buffer, encode_stats_request(buffer, selector), MSG_NOSIGNAL) < 0) {
+		error("ERROR writing to socket");
 	}
-	if((*session_details)->current_game->character == 'X' || (*session_details)->current_game->character == 'O') {
-		(*session_details)->wait = 0;
-		(*session_details)->current_game->character += 0x20;
-	} else {
-		(*session_details)->wait = 1;
+	memset(buffer, 0, BUFFER_LENGTH);
+	n = recv(sockfd, buffer, BUFFER_LENGTH - 1, 0);
+	if(n <= 0) {
+		error("ERROR reading from socket");
 	}
-	return OTHER_PLAYER_PRESENT_NOTIFY;
-}
-
-unsigned char action_notify(char *buffer, struct session_details **session_details)
-{
-	if(!*session_details) {
-		return INVALID_REQUEST;
-	}
-	unsigned long x, y;
-	unsigned char ret_code;
-	char *next = NULL;
-	size_t size = (*session_details)->current_game->board_size; // no null check yet
-	if(get_coordinates_from_buffer(buffer + 2, &x, &y)) {
-		return INTERNAL_CLIENT_ERROR;
-	}
-	/*
-	for(unsigned int i = 0; i < BUFFER_LENGTH; ++i) {
-		if(buffer[i])
-			putc(buffer[i], stdout);
-		else	putc('.', stdout);
+	if((unsigned char)*buffer != STATS_REPLY || buffer[1] != number_of_values) {
+		return -1;
 	}
-	putc('\n', stdout);
-	*/
-	if(x > (*session_details)->current_game->board_size - 1 || y > (*session_details)->current_game->board_size - 1) {
-		return INTERNAL_CLIENT_ERROR;
-	}
-	(*session_details)->current_game->matrix[(size * x) + y] = (*session_details)->current_game->character == 'x' ? 'o' : 'x';
-	(*session_details)->wait = 0;
-	(*session_details)->current_game->remote_last_x = x;
-	(*session_details)->current_game->remote_last_y = y;
-	if(buffer[1] == 'X' || buffer[1] == 'O') {
-		(*session_details)->current_game->state = buffer[1];
-		ret_code = GAME_IS_FINISHED;
-	} else {
-		ret_code = ACTION_NOTIFY;
+	position = buffer + 2;
+	for(i = 0; i < number_of_values && position < buffer + n; ++i) {
+		values[i] = strtoul(position, NULL, 10);
+		position += strlen(position) + 1;
 	}
-	return ret_code;
+	return i == number_of_values ? 0 : -1;
 }
 
-unsigned char action_reply(char *buffer, struct session_details **session_details)
+static void print_server_stats(int sockfd)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
-	}
-	if(!(*session_details)->current_game) {
-		return INVALID_REQUEST;
-	}
-	if((*session_details)->current_game->character == 'X' || (*session_details)->current_game->character == 'O') {
-		(*session_details)->current_game->character += 0x20;
+	unsigned long values[6];
+	printf("%-18s %10s %8s %10s %10s %10s %10s\n", "opcode", "count", "errors", "p50 us", "p99 us", "p999 us", "max us");
+	for(unsigned int opcode = 0; opcode < sizeof(opcode_names) / sizeof(*opcode_names); ++opcode) {
+		if(!opcode_names[opcode] || query_stats(sockfd, opcode, values, 6) || !values[0]) {
+			continue;
+		}
+		printf("%-18s %10lu %8lu %10.1f %10.1f %10.1f %10.1f\n", opcode_names[opcode], values[0], values[1],
+			values[2] / 1e3, values[3] / 1e3, values[4] / 1e3, values[5] / 1e3);
+	}
+	printf("\nerror replies:\n");
+	for(unsigned int code = ANY_ERROR; code <= LOGIN_FAILED; ++code) {
+		if(!query_stats(sockfd, code, values, 1) && values[0]) {
+			printf("%8lu  code %u: ", values[0], code);
+			print_reply_code_meaning(code);
+		}
 	}
-	unsigned long x = (*session_details)->current_game->local_last_x;
-	unsigned long y = (*session_details)->current_game->local_last_y;
-	(*session_details)->current_game->matrix[((*session_details)->current_game->board_size * x) + y] = (*session_details)->current_game->character;
-	return ACTION_REPLY;
 }
-
-unsigned char game_is_finished(char *buffer, struct session_details **session_details)
+static void print_result(const struct client_game *game)
 {
-	if((*session_details)->current_game->character == buffer[1] + 0x20) {
+	if(game->result == game->character - 0x20) {
 		printf("You won the game.\n");
-	} else if(buffer[1] == 'D') {
+	} else if(game->result == 'D') {
 		printf("Tie.\n");
-	} else {
+	} else if(game->result == 'X' || game->result == 'O') {
 		printf("You lost the game.\n");
 	}
-	free((*session_details)->current_game->matrix);
-	free((*session_details)->current_game);
-	(*session_details)->current_game = NULL;
-	break_loop = 1;
-	print_board((*session_details)->current_game);
-	return GAME_IS_FINISHED;
 }
 
-unsigned char leave_game_reply(char *buffer, struct session_details **session_details)
+static void prompt(const struct user_interface *ui, const struct client_session *session)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
+	if(session->pending != SESSION_NO_REQUEST || session->state == SESSION_CLOSED) {
+		return; // the prompt comes back with the reply
+	}
+	switch(ui->input) {
+		case INPUT_USERNAME: printf("username: "); break;
+		case INPUT_PASSWORD: printf("password: "); break;
+		case INPUT_X: printf("enter coordinate x: "); break;
+		case INPUT_Y: printf("enter coordinate y: "); break;
+		default: {
+			switch(session->state) {
+				case SESSION_CONNECTED: printf("enter 0 to login or 1 to create a user: "); break;
+				case SESSION_LOBBY: printf("enter an operation number:\n1 - log out,\n3 - join a random game,\n4 - create a new game,\n12 - list open games,\n13 - find an opponent of similar rating: "); break;
+				case SESSION_IN_GAME: printf("enter an operation number\n5 - leave the game,\n6 - make a move,\n11 - show the moves so far,\n15 - ask for a rematch of a finished game: "); break;
+			}
+		}
 	}
-	free((*session_details)->current_game->matrix);
-	free((*session_details)->current_game);
-	(*session_details)->current_game = NULL;
-	return LEAVE_GAME_REPLY;
+	fflush(stdout);
 }
 
-unsigned char alloc_local_board(char *buffer, struct session_details **session_details)
+static void client_reply(struct client_session *session, struct client_game *game, unsigned char opcode, const char *message,
+	unsigned long nanoseconds)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
+	struct user_interface *ui = session->context;
+	(void) opcode;
+	(void) nanoseconds;
+	printf("server sent code %u\n", (unsigned char) message[0]);
+	print_reply_code_meaning((unsigned char) message[0]);
+	if((unsigned char) message[0] == GAME_IS_FINISHED) {
+		print_result(game);
 	}
-	(*session_details)->current_game = calloc(1, sizeof(struct game_board));
-	if(!(*session_details)->current_game) {
-		return INTERNAL_CLIENT_ERROR;
+	if((unsigned char) message[0] == GAME_SNAPSHOT_REPLY) {
+		print_moves(message);
 	}
-	size_t board_size;
-	(*session_details)->current_game->character = buffer[1];
-	if(buffer[1] != 'x' && buffer[1] != 'o' && buffer[1] != 'X' && buffer[1] != 'O') {
-		return INTERNAL_CLIENT_ERROR; // invalid data received
+	if((unsigned char) message[0] == LIST_GAMES_REPLY) {
+		ui->list_first = print_games(message, ui->list_first);
 	}
-	board_size = strtoul(buffer + 2, NULL, 10);
-	if(!board_size || errno == ERANGE) {
-		return INTERNAL_CLIENT_ERROR;
+	if((unsigned char) message[0] == MATCHMAKE_REPLY) {
+		printf("your rating is %s\n", message + 1);
 	}
-	(*session_details)->current_game->board_size = board_size;
-	(*session_details)->current_game->matrix = calloc(board_size, board_size);
-	if(!(*session_details)->current_game->matrix) {
-		free((*session_details)->current_game);
-		return INTERNAL_CLIENT_ERROR;
+	if((unsigned char) message[0] == REMATCH_REPLY) {
+		printf(message[1] ? "The rematch begins.\n" : "Waiting for the other player to agree.\n");
 	}
-	return CREATE_NEW_GAME_SUCCESS;
-}
-
-unsigned char join_random_game_request(char *buffer, struct session_details **session_details)
-{
-	if(!*session_details) {
-		return INVALID_REQUEST;
+	if((unsigned char) message[0] == LOGOUT_REPLY) {
+		ui->quit = 1;
+	}
+	if(session->state == SESSION_IN_GAME) {
+		print_board(game);
 	}
-	buffer[0] = JOIN_RANDOM_GAME_REQUEST;
-	(*session_details)->bytes_written = 1;
-	return JOIN_RANDOM_GAME_REQUEST;
+	prompt(ui, session);
 }
 
-unsigned char create_new_game_request(char *buffer, struct session_details **session_details)
+static void client_notify(struct client_session *session, struct client_game *game, const char *message)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
+	printf("\nserver sent code %u\n", (unsigned char) message[0]);
+	print_reply_code_meaning((unsigned char) message[0]);
+	if((unsigned char) message[0] == GAME_IS_FINISHED || (unsigned char) message[0] == MOVE_TIMEOUT_NOTIFY) {
+		print_result(game);
 	}
-	buffer[0] = CREATE_NEW_GAME_REQUEST;
-	(*session_details)->bytes_written = 1;
-	return CREATE_NEW_GAME_REQUEST;
+	if((unsigned char) message[0] == REMATCH_NOTIFY && message[1]) {
+		printf("The rematch begins.\n");
+	}
+	print_board(game);
+	prompt(session->context, session);
 }
 
-unsigned char leave_game_request(char *buffer, struct session_details **session_details)
+static const struct session_handlers client_handlers = {
+	.reply = client_reply,
+	.notify = client_notify
+};
+
+/*
+ * "0" is the only input strtoul cannot tell from an error
+ * */
+static int parse_number(const char *line, unsigned long *value)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
-	}
-	buffer[0] = LEAVE_GAME_REQUEST;
-	(*session_details)->bytes_written = 1;
-	free((*session_details)->current_game->matrix);
-	free((*session_details)->current_game);
-	(*session_details)->current_game = NULL;
-	return LEAVE_GAME_REQUEST;
+	char *end;
+	errno = 0;
+	*value = strtoul(line, &end, 10);
+	return end == line || errno == ERANGE ? -1 : 0;
 }
 
-unsigned char action_request(char *buffer, struct session_details **session_details)
+static void handle_line(struct user_interface *ui, struct client_session *session, char *line)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
-	}
-	unsigned long x, y;
-	char num_buffer[BUFFER_LENGTH];
-	int n, n2;
-	memset(num_buffer, 0, BUFFER_LENGTH);
-	printf("enter coordinate x: ");
-	fgets(num_buffer, BUFFER_LENGTH, stdin);
-	if(num_buffer[0] == '0' && num_buffer[1] == '\n') { // this probably unnecessary?
-		x = 0;
-	} else {
-		x = strtoul(num_buffer, NULL, 10);
-		if(!x || errno == ERANGE) {
-			return INVALID_REQUEST;
-		}
-	}
-	printf("enter coordinate y: ");
-	memset(num_buffer, 0, BUFFER_LENGTH);
-	fgets(num_buffer, BUFFER_LENGTH, stdin);
-	if(num_buffer[0] == '0' && num_buffer[1] == '\n') {
-		y = 0;
-	} else {
-		y = strtoul(num_buffer, NULL, 10);
-		if(!y || errno == ERANGE) {
-			return INVALID_REQUEST;
+	unsigned long value;
+	int ret_value = 0;
+	switch(ui->input) {
+		case INPUT_USERNAME: {
+			snprintf(ui->username, sizeof(ui->username), "%s", line);
+			ui->input = INPUT_PASSWORD;
+			tcsetattr(STDIN_FILENO, TCSANOW, &term);
+		} break;
+		case INPUT_PASSWORD: {
+			tcsetattr(STDIN_FILENO, TCSANOW, &term_orig);
+			putc('\n', stdout);
+			ui->input = INPUT_MENU;
+			ret_value = session_login(session, ui->opcode, ui->username, line);
+		} break;
+		case INPUT_X: {
+			if(parse_number(line, &ui->x)) {
+				ui->input = INPUT_MENU;
+				ret_value = -1;
+			} else {
+				ui->input = INPUT_Y;
+			}
+		} break;
+		case INPUT_Y: {
+			ui->input = INPUT_MENU;
+			ret_value = parse_number(line, &value) ? -1 : session_move(session, &session->game, ui->x, value);
+		} break;
+		default: {
+			if(parse_number(line, &value)) {
+				break;
+			}
+			if(session->state == SESSION_CONNECTED && (value == 0 || value == 1)) {
+				ui->opcode = value ? CREATE_USER_REQUEST : LOGIN_REQUEST;
+				ui->input = INPUT_USERNAME;
+			} else if(session->state == SESSION_IN_GAME && value == 6) {
+				if(session->game.result != SESSION_PLAYING) {
+					print_reply_code_meaning(NO_FURTHER_ACTIONS_PERMITTED);
+				} else {
+					ui->input = INPUT_X;
+				}
+			} else if(session->state == SESSION_LOBBY && value == LIST_GAMES_REQUEST) { // every listing shows the next page
+				ret_value = session_list_games(session, ui->list_first);
+			} else if(session->state == SESSION_LOBBY && value == MATCHMAKE_REQUEST) {
+				ret_value = session_matchmake(session);
+			} else if(session->state == SESSION_IN_GAME && value == GAME_SNAPSHOT_REQUEST) {
+				ret_value = session_snapshot(session, &session->game);
+			} else if(session->state == SESSION_IN_GAME && value == REMATCH_REQUEST) {
+				ret_value = session_rematch(session, &session->game);
+			} else if(value == LOGOUT_REQUEST || value == JOIN_RANDOM_GAME_REQUEST || value == CREATE_NEW_GAME_REQUEST
+			|| value == LEAVE_GAME_REQUEST) {
+				ret_value = session_request(session, value);
+			} else {
+				printf("not implemented\n");
+			}
 		}
 	}
-	buffer[0] = ACTION_REQUEST;
-	n = snprintf(buffer + 1, BUFFER_LENGTH / 2, "%lu", x);
-	n2 = snprintf(buffer + 1 + n + 1, BUFFER_LENGTH / 2, "%lu", y);
-	if(n2 <= 0 || n <= 0) {
-		return INTERNAL_CLIENT_ERROR;
-	}
-	(*session_details)->bytes_written = 1 + n + n2 + 2;		
-	/*
-	for(size_t i = 0; i < (*session_details)->bytes_written; ++i) {
-		if(buffer[i])
-			putc(buffer[i], stdout);
-		else	putc('.', stdout);
+	if(ret_value == -1) {
+		fprintf(stderr, "invalid request\n");
+	} else if(ret_value == -2) {
+		error("ERROR writing to socket");
 	}
-	putc('\n', stdout);
-	*/
-	(*session_details)->current_game->local_last_x = x;
-	(*session_details)->current_game->local_last_y = y;
-	return ACTION_REQUEST;
+	prompt(ui, session);
 }
 
-unsigned char login_request(char *buffer, struct session_details **session_details)
+/*
+ * hands the complete lines read so far to handle_line, one per request: lines typed ahead wait
+ * until the reply of the request before them arrived
+ * */
+static void handle_input(struct user_interface *ui, struct client_session *session)
 {
-	if(!*session_details) {
-		(*session_details)->bytes_written = 0;
-		return INVALID_REQUEST;
-	}
-	size_t usernamelen, passwordlen;
-	char input_buffer[BUFFER_LENGTH];
-	char *c;
-	memset(input_buffer, 0, sizeof(input_buffer));
-	printf("username: ");
-	fgets(input_buffer, sizeof(input_buffer), stdin);
-	c = strchr(input_buffer, '\n');
-	if(c) {
-		*c = '\0';
-	}
-	strncpy((*session_details)->logged_in_user->username, input_buffer, USERNAMELEN);
-	(*session_details)->logged_in_user->username[USERNAMELEN] = '\0';
-	printf("password: ");
-	tcsetattr(STDIN_FILENO, TCSANOW, &term);
-	memset(input_buffer, 0, sizeof(input_buffer));
-	fgets(input_buffer, sizeof(input_buffer), stdin);
-	c = strchr(input_buffer, '\n');
-	if(c) {
-		*c = '\0';
-	}
-	strncpy((*session_details)->logged_in_user->password, input_buffer, PASSWORDLEN);
-	(*session_details)->logged_in_user->password[PASSWORDLEN] = '\0';
-	tcsetattr(STDIN_FILENO, TCSANOW, &term_orig);
-	buffer[0] = LOGIN_REQUEST;
-	usernamelen = strlen((*session_details)->logged_in_user->username);
-	passwordlen = strlen((*session_details)->logged_in_user->password);
-	if((usernamelen && passwordlen) && (usernamelen <= USERNAMELEN || passwordlen <= PASSWORDLEN)) {
-		strncpy(buffer + 1,
-			(*session_details)->logged_in_user->username,
-			usernamelen);
-		strncpy(buffer + usernamelen + 2,
-			(*session_details)->logged_in_user->password,
-			passwordlen + 1);
-	}
-	(*session_details)->bytes_written = 1 + usernamelen + passwordlen + 2; // opcode byte and two null terminators
-	(*session_details)->session_present = 1;
-	return LOGIN_REQUEST;
+	char *newline;
+	while(!ui->quit && session->pending == SESSION_NO_REQUEST && (newline = strchr(ui->line, '\n'))) {
+		*newline = '\0';
+		handle_line(ui, session, ui->line);
+		ui->line_length -= newline + 1 - ui->line;
+		memmove(ui->line, newline + 1, ui->line_length + 1);
+	}
+	if(ui->eof && session->pending == SESSION_NO_REQUEST) {
+		ui->quit = 1;
+	}
 }
 
-unsigned char logout_request(char *buffer, struct session_details **session_details)
+static void read_input(struct user_interface *ui)
 {
-	if(!*session_details) {
-		return INVALID_REQUEST;
+	ssize_t n = read(STDIN_FILENO, ui->line + ui->line_length, sizeof(ui->line) - 1 - ui->line_length);
+	if(n <= 0) {
+		ui->eof = 1;
+		return;
+	}
+	ui->line_length += n;
+	ui->line[ui->line_length] = '\0';
+	if(ui->line_length == sizeof(ui->line) - 1 && !strchr(ui->line, '\n')) { // an overlong line is dropped
+		ui->line_length = 0;
+		ui->line[0] = '\0';
 	}
-	buffer[0] = LOGOUT_REQUEST;
-	(*session_details)->session_present = 0;
-	(*session_details)->bytes_written = 1;
-	return LOGOUT_REQUEST;
 }
 
-unsigned char create_user_request(char *buffer, struct session_details **session_details)
+static void usage(const char *name)
 {
-	if(*session_details) {
-		(*session_details)->bytes_written = 0;
-		return INVALID_REQUEST;
-	}
-	size_t usernamelen, passwordlen;
-	printf("username: ");
-	fgets((*session_details)->logged_in_user->username, USERNAMELEN + 2, stdin);
-	printf("password: ");
-	tcsetattr(STDIN_FILENO, TCSANOW, &term);
-	fgets((*session_details)->logged_in_user->password, PASSWORDLEN + 2, stdin);
-	tcsetattr(STDIN_FILENO, TCSANOW, &term_orig);
-	buffer[0] = CREATE_USER_REQUEST;
-	usernamelen = strlen((*session_details)->logged_in_user->username);
-	passwordlen = strlen((*session_details)->logged_in_user->password);
-	if((usernamelen && passwordlen) && (usernamelen <= USERNAMELEN || passwordlen <= PASSWORDLEN)) {
-		strncpy(buffer + 1,
-			(*session_details)->logged_in_user->username,
-			usernamelen);
-		strncpy(buffer + usernamelen + 2,
-			(*session_details)->logged_in_user->password,
-			passwordlen + 1);
-	}
-	(*session_details)->bytes_written = 1 + usernamelen + passwordlen + 2; // opcode byte and two null terminators
-	return CREATE_USER_REQUEST;
+	fprintf(stderr,"usage %s hostname port | unix path [--stats | --bot [--bots n] [--strategy random|greedy|search] [--games n] "
+		"[--parallel n] [--tournament knockout|round-robin] [--rematch] [--think ms] [--game-timeout s] [--user name] [--password password]]\n", name);
+	exit(0);
 }
 
-void error(const char *msg)
+/*
+ * --bot: plays with the given number of bot sessions instead of reading the terminal
+ * */
+static int bot_main(int argc, char *argv[], const struct sockaddr *address, socklen_t address_length)
 {
-	perror(msg);
-	exit(3);
+	struct bot_options options = {
+		.bots = 1,
+		.games = 0,
+		.think = 0,
+		.game_timeout = 60,
+		.parallel = 1,
+		.strategy = bot_find_strategy("random"),
+		.username = "user",
+		.password = "pass"
+	};
+	for(int i = 4; i < argc; ++i) {
+		if(i + 1 == argc && strcmp(argv[i], "--rematch")) { // the only flag without a value
+			usage(argv[0]);
+		}
+		if(!strcmp(argv[i], "--bots")) {
+			options.bots = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--strategy")) {
+			options.strategy = bot_find_strategy(argv[++i]);
+		} else if(!strcmp(argv[i], "--games")) {
+			options.games = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--parallel")) {
+			options.parallel = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--tournament")) {
+			++i;
+			if(strcmp(argv[i], "knockout") && strcmp(argv[i], "round-robin")) {
+				usage(argv[0]);
+			}
+			options.tournament = !strcmp(argv[i], "knockout") ? TOURNAMENT_KNOCKOUT : TOURNAMENT_ROUND_ROBIN;
+		} else if(!strcmp(argv[i], "--rematch")) {
+			options.rematch = 1;
+		} else if(!strcmp(argv[i], "--think")) {
+			options.think = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--game-timeout")) {
+			options.game_timeout = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--user")) {
+			options.username = argv[++i];
+		} else if(!strcmp(argv[i], "--password")) {
+			options.password = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if(!options.bots || !options.parallel || !options.strategy) {
+		usage(argv[0]);
+	}
+	if(bot_run(address, address_length, &options)) {
+		error("ERROR starting the bots");
+	}
+	return 0;
 }
+
 int main(int argc, char *argv[])
 {
-	int sockfd, portno, n;
+	int sockfd, portno;
 	struct sockaddr_in serv_addr;
+	struct sockaddr_un unix_addr;
+	struct sockaddr *address = (struct sockaddr*) &serv_addr;
+	socklen_t address_length = sizeof(serv_addr);
 	struct hostent *server;
-	char command[BUFFER_LENGTH];
-	char username[USERNAMELEN + 1];
-	char password[PASSWORDLEN + 1];
-	char buffer[BUFFER_LENGTH];
-	unsigned char opcode, ret_code;
-	struct session_details *session_details = NULL;
+	struct client_session session;
+	struct user_interface ui;
+	struct pollfd fds[2];
 	tcgetattr(STDIN_FILENO, &term);
 	term_orig = term;
 	term.c_lflag &= ~ECHO;
-	if (argc < 3) {
-		fprintf(stderr,"usage %s hostname port\n", argv[0]);
-		exit(0);
+	if (argc < 3 || (argc > 3 && strcmp(argv[3], "--bot") && (strcmp(argv[3], "--stats") || argc > 4))) {
+		usage(argv[0]);
+	}
+	if(!strcmp(argv[1], "unix")) { // a server on this host listening with --unix path
+		if(strlen(argv[2]) >= sizeof(unix_addr.sun_path)) {
+			fprintf(stderr,"ERROR, socket path too long\n");
+			exit(2);
+		}
+		memset(&unix_addr, 0, sizeof(unix_addr));
+		unix_addr.sun_family = AF_UNIX;
+		strcpy(unix_addr.sun_path, argv[2]);
+		address = (struct sockaddr*) &unix_addr;
+		address_length = sizeof(unix_addr);
+	} else {
+		portno = atoi(argv[2]);
+		server = gethostbyname(argv[1]);
+		if (server == NULL) {
+			fprintf(stderr,"ERROR, no such host\n");
+			exit(2);
+		}
+		bzero((char *) &serv_addr, sizeof(serv_addr));
+		serv_addr.sin_family = AF_INET;
+		bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
+		serv_addr.sin_port = htons(portno);
+	}
+	if(argc > 3 && !strcmp(argv[3], "--bot")) {
+		return bot_main(argc, argv, address, address_length);
 	}
-	portno = atoi(argv[2]);
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	sockfd = socket(address->sa_family, SOCK_STREAM, 0);
 	if (sockfd < 0) 
 		error("ERROR opening socket");
-	server = gethostbyname(argv[1]);
-	if (server == NULL) {
-		fprintf(stderr,"ERROR, no such host\n");
-		exit(2);
-	}
-	bzero((char *) &serv_addr, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
-	serv_addr.sin_port = htons(portno);
-	if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) 
+	if (connect(sockfd, address, address_length) < 0) 
 		error("ERROR connecting");
-	session_details = calloc(1, sizeof(struct session_details));
-	if(!session_details) {
-		error("error on calloc");
-	}
-	session_details->logged_in_user = calloc(1, sizeof(User));
-	if(!session_details->logged_in_user) {
-		free(session_details);
-		session_details = NULL;
-		error("error on calloc");
-	}
-	session_details->current_game = NULL;
-	while (!break_loop) {
-		memset(buffer, 0 , BUFFER_LENGTH);
-		memset(command, 0, BUFFER_LENGTH);
-		memset(username, 0, USERNAMELEN + 1);
-		memset(command, 0, PASSWORDLEN + 1);
-		/*
-		printf("enter an operation number: ");
-		fgets(command, BUFFER_LENGTH, stdin);
-		opcode = atoi(command);
-		*/
-		printf("enter 0 to login or 1 to create a user: ");
-		fgets(command, BUFFER_LENGTH, stdin);
-		if(command[0] == '0') {
-			opcode = LOGIN_REQUEST;
-		} else if(command[0] == '1') {
-			opcode = CREATE_USER_REQUEST;
-		} else {
-			continue;
-		}
-		ret_code = handler[opcode](buffer, &session_details);
-		if(ret_code == INVALID_REQUEST) {
-			printf("\nerror on handler\n");
-			continue;
-		}
-		n = send(sockfd, buffer, session_details->bytes_written, MSG_NOSIGNAL);
-		if(n < 0) {
-			error("ERROR writing to socket");
-		}
-		memset(buffer, 0, BUFFER_LENGTH);
-		n = recv(sockfd, buffer, 255, 0);
-		if(n < 0) {
-			error("ERROR reading from socket");
+	if(argc > 3) {
+		print_server_stats(sockfd);
+		close(sockfd);
+		return 0;
+	}
+	if(fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) < 0) {
+		error("ERROR setting O_NONBLOCK");
+	}
+	memset(&ui, 0, sizeof(ui));
+	session_init(&session, sockfd, &client_handlers, &ui);
+	prompt(&ui, &session);
+	while(!ui.quit) {
+		fds[0].fd = sockfd;
+		fds[0].events = POLLIN;
+		fds[1].fd = STDIN_FILENO;
+		fds[1].events = ui.eof || strchr(ui.line, '\n') ? 0 : POLLIN; // read more once the queued lines are handled
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			error("ERROR on poll");
 		}
-		if(!n) {
-			error("error on recv");
+		if(fds[0].revents && session_receive(&session)) {
+			printf("\nthe server closed the connection\n");
+			break;
 		}
-		printf("server sent code %u, %d bytes read\n", (unsigned char)*buffer, n);
-		print_reply_code_meaning((unsigned char)*buffer);
-		if((unsigned char)*buffer != LOGIN_SUCCESS && (unsigned char)*buffer != CREATE_USER_SUCCESS) {
-			printf("some error occured\n");
-			continue;
-		} else {
-			session_details->session_present = 1;
-		}
-		while(session_details->session_present) {
-			memset(buffer, 0 , BUFFER_LENGTH);
-			memset(command, 0, BUFFER_LENGTH);
-			if(!session_details->current_game) {
-				printf("enter an operation number:\n1 - log out,\n3 - join a random game,\n4 - create a new game: ");
-				fgets(command, BUFFER_LENGTH, stdin);
-				opcode = atoi(command);
-				if(handler[opcode]) {
-					ret_code = handler[opcode](buffer, &session_details);
-					if(ret_code == INTERNAL_CLIENT_ERROR) {
-						fprintf(stderr, "error occured, exiting...\n");
-						exit(ret_code);	
-					} else if(ret_code == INVALID_REQUEST) {
-						fprintf(stderr, "invalid request\n");
-						continue;
-					}
-				} else {
-					printf("not implemented\n");
-					continue;
-				}
-			} else {
-				printf("enter an operation number\n5 - leave the game,\n6 - make a move: ");
-				fgets(command, BUFFER_LENGTH, stdin);
-				opcode = atoi(command);
-				if(opcode == 5 || opcode == 6) {
-					ret_code = handler[opcode](buffer, &session_details);
-				} else {
-					continue;
-				}
-				if(ret_code == INTERNAL_CLIENT_ERROR) {
-					fprintf(stderr, "error occured, exiting...\n");
-					exit(ret_code);
-				} else if(ret_code == INVALID_REQUEST) {
-						fprintf(stderr, "invalid request\n");
-						continue;
-				}
-			}
-			n = send(sockfd, buffer, session_details->bytes_written, MSG_NOSIGNAL);
-			if(n < 0) {
-				error("ERROR writing to socket");
-			}
-			memset(buffer, 0 , BUFFER_LENGTH);
-			n = recv(sockfd, buffer, 255, 0);
-			if(n <= 0) {
-				error("ERROR reading from socket");
-			}
-			printf("SERVER sent code %u, %d bytes read\n", (unsigned char)*buffer, n);
-			print_reply_code_meaning((unsigned char)*buffer);
-			if(handler[(unsigned char)*buffer]) {
-				ret_code = handler[(unsigned char)*buffer](buffer, &session_details);
-				if(ret_code == INTERNAL_CLIENT_ERROR) {
-					fprintf(stderr, "error occured, exiting...\n");
-					exit(ret_code);	
-				} else if(ret_code == INVALID_REQUEST) {
-						fprintf(stderr, "invalid request\n");
-						continue;
-				}
-
-			}
-			switch((unsigned char)*buffer) {
-				case INTERNAL_SERVER_ERROR: {
-					print_reply_code_meaning((unsigned char)*buffer);
-					free(session_details->current_game->matrix);
-					free(session_details->current_game);
-					session_details->current_game = NULL;
-					session_details->session_present = 0;
-					break_loop = 1;
-
-				} break;
-				case JOIN_RANDOM_GAME_REPLY: {
-					if(buffer[1] == 'x' || buffer[1] == 'o')
-						case CREATE_NEW_GAME_SUCCESS: // skip above check for these codes, looks a bit ugly i admit
-						case ACTION_REPLY: {
-						for(;;) {
-							memset(buffer, 0 , BUFFER_LENGTH);
-							n = recv(sockfd, buffer, BUFFER_LENGTH - 1, 0);
-							if(n < 0) {
-								error("ERROR reading from socket");
-							}
-							if(!n) {
-								error("disconnected");
-							}
-							printf("server sent code %u, %d bytes read\n", (unsigned char)*buffer, n);
-							print_reply_code_meaning((unsigned char)*buffer);
-							if((unsigned char)*buffer == INTERNAL_SERVER_ERROR) {
-								free(session_details->current_game->matrix);
-								free(session_details->current_game);
-								session_details->current_game = NULL;
-								session_details->session_present = 0;
-								break_loop = 1;
-							}
-							if(handler[(unsigned char)*buffer]) {
-								ret_code = handler[(unsigned char)*buffer](buffer, &session_details);
-								switch(ret_code) {
-									case INTERNAL_CLIENT_ERROR: {
-										fprintf(stderr, "error occured, exiting...\n");
-										exit(ret_code);	
-									} break;
-									case INVALID_REQUEST: {
-										fprintf(stderr, "invalid request\n");
-										continue;
-									}
-									/*
-									case GAME_IS_FINISHED: {
-										if(session_details->current_game->character == session_details->current_game->state + 0x20) {
-											printf("You won the game.\n");
-										} else {
-											printf("You lost the game.\n");
-										}
-										free(session_details->current_game->matrix);
-										free(session_details->current_game);
-										session_details->current_game = NULL;
-									} break;
-									*/
-								}
-							}
-							if(!session_details->wait) {
-								break;
-							}
-						}
-						switch((unsigned char)*buffer) {
-							case INTERNAL_SERVER_ERROR:
-							case PEER_LEFT_NOTIFY: {
-								print_reply_code_meaning((unsigned char)*buffer);
-								free(session_details->current_game->matrix);
-								free(session_details->current_game);
-								session_details->current_game = NULL;
-								session_details->session_present = 0;
-								break_loop = 1;
-							} break;
-						}
-					}
-				} break;
-			}
-			print_board(session_details->current_game);
-			if(break_loop) {
-				break;
-			}
+		if(fds[1].revents) {
+			read_input(&ui);
 		}
+		handle_input(&ui, &session);
 	}
-	free(session_details->logged_in_user);
-	free(session_details);
-	close(sockfd);
+	tcsetattr(STDIN_FILENO, TCSANOW, &term_orig);
+	session_close(&session);
 	return 0;
 }
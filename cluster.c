@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "cluster.h"
+#include "constants.h"
+#include "protocol.h"
+#include "metrics.h"
+#include "log.h"
+
+#define CLUSTER_HANDSHAKE_MS 2000 // logging a link in
+
+struct cluster_point {
+	uint32_t hash;
+	unsigned int node;
+};
+
+struct cluster_node {
+	char name[64]; // host:port as given, the ring is built from the names
+	struct sockaddr_in address;
+	atomic_long open_games;
+	atomic_ulong heard_at; // milliseconds, CLOCK_MONOTONIC, 0 never
+};
+
+struct cluster_gossip {
+	uint32_t magic;
+	uint32_t node;
+	int64_t open_games;
+};
+
+struct cluster_link {
+	int fd; // the connection to the other node
+	int client_fd;
+	atomic_char alive; // cleared once the relay stopped
+	pthread_t relay;
+};
+
+static struct {
+	struct cluster_node nodes[CLUSTER_MAX_NODES];
+	unsigned int number_of_nodes, self;
+	struct cluster_point ring[CLUSTER_MAX_NODES * CLUSTER_REPLICAS]; // sorted by hash
+	int gossip; // the UDP socket
+	int stop[2];
+	pthread_t thread;
+	char running;
+} cluster = { .gossip = -1, .stop = { -1, -1 } };
+
+static unsigned long cluster_milliseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000ul + now.tv_nsec / 1000000ul;
+}
+
+/*
+ * fnv-1a with murmur3's finalizer, consecutive game ids land all over the ring
+ * */
+static uint32_t cluster_hash(const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < length; ++i) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	return hash ^ hash >> 16;
+}
+
+static int cluster_point_compare(const void *a, const void *b)
+{
+	const struct cluster_point *x = a, *y = b;
+	return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+/*
+ * parses a node, host:port, into cluster.nodes[index]
+ * */
+static int cluster_parse_node(const char *node, size_t length, unsigned int index)
+{
+	struct addrinfo hints, *result;
+	char *colon;
+	struct cluster_node *target = &cluster.nodes[index];
+	if(!length || length >= sizeof(target->name)) {
+		return -3;
+	}
+	memcpy(target->name, node, length);
+	target->name[length] = 0;
+	if(!(colon = strrchr(target->name, ':'))) {
+		return -3;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	*colon = 0;
+	if(getaddrinfo(target->name, colon + 1, &hints, &result)) {
+		*colon = ':';
+		return -1;
+	}
+	*colon = ':';
+	memcpy(&target->address, result->ai_addr, sizeof(target->address));
+	freeaddrinfo(result);
+	return 0;
+}
+
+/*
+ * sends this node's number of open games to the others and takes in theirs
+ * */
+static void* cluster_thread(void *arg)
+{
+	struct pollfd fds[2] = { { .fd = cluster.gossip, .events = POLLIN }, { .fd = cluster.stop[0], .events = POLLIN } };
+	struct cluster_gossip message = { .magic = CLUSTER_MAGIC, .node = cluster.self };
+	unsigned long now, next = 0;
+	(void) arg;
+	for(;;) {
+		now = cluster_milliseconds();
+		if(now >= next) {
+			message.open_games = atomic_load(&gauges.open_games);
+			for(unsigned int i = 0; i < cluster.number_of_nodes; ++i) {
+				if(i != cluster.self) { // a node that is down just misses it
+					sendto(cluster.gossip, &message, sizeof(message), MSG_DONTWAIT, (struct sockaddr*) &cluster.nodes[i].address,
+						sizeof(cluster.nodes[i].address));
+				}
+			}
+			next = now + CLUSTER_GOSSIP_MS;
+		}
+		if(poll(fds, 2, next - now) < 0 && errno != EINTR) {
+			log_error("cluster: error on poll: %s", (unsigned long) strerror(errno));
+			break;
+		}
+		if(fds[1].revents) {
+			break;
+		}
+		if(fds[0].revents) {
+			struct cluster_gossip received;
+			while(recv(cluster.gossip, &received, sizeof(received), MSG_DONTWAIT) == sizeof(received)) {
+				if(received.magic != CLUSTER_MAGIC || received.node >= cluster.number_of_nodes || received.node == cluster.self) {
+					continue;
+				}
+				atomic_store(&cluster.nodes[received.node].open_games, received.open_games);
+				atomic_store(&cluster.nodes[received.node].heard_at, cluster_milliseconds());
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * nodes is the comma separated list of every node's host:port, the same on every node, self is this
+ * node's index in it
+ * */
+int cluster_start(const char *nodes, unsigned int self)
+{
+	struct sockaddr_in address;
+	const char *end;
+	char name[sizeof(cluster.nodes[0].name) + 16];
+	int n;
+	if(!nodes) {
+		return -3;
+	}
+	for(cluster.number_of_nodes = 0; *nodes; ++cluster.number_of_nodes) {
+		end = strchr(nodes, ',');
+		end = end ? end : nodes + strlen(nodes);
+		if(cluster.number_of_nodes == CLUSTER_MAX_NODES || cluster_parse_node(nodes, end - nodes, cluster.number_of_nodes)) {
+			return -3;
+		}
+		nodes = *end ? end + 1 : end;
+	}
+	if(self >= cluster.number_of_nodes) {
+		return -3;
+	}
+	cluster.self = self;
+	for(unsigned int i = 0; i < cluster.number_of_nodes; ++i) {
+		for(unsigned int replica = 0; replica < CLUSTER_REPLICAS; ++replica) {
+			n = snprintf(name, sizeof(name), "%s#%u", cluster.nodes[i].name, replica);
+			cluster.ring[i * CLUSTER_REPLICAS + replica].hash = cluster_hash(name, n);
+			cluster.ring[i * CLUSTER_REPLICAS + replica].node = i;
+		}
+	}
+	qsort(cluster.ring, cluster.number_of_nodes * CLUSTER_REPLICAS, sizeof(struct cluster_point), cluster_point_compare);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = cluster.nodes[self].address.sin_port;
+	if((cluster.gossip = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 || bind(cluster.gossip, (struct sockaddr*) &address, sizeof(address))
+	|| pipe(cluster.stop)) {
+		cluster_stop();
+		return -1;
+	}
+	if(pthread_create(&cluster.thread, NULL, cluster_thread, NULL)) {
+		cluster_stop();
+		return -2;
+	}
+	cluster.running = 1;
+	return 0;
+}
+
+void cluster_stop(void)
+{
+	if(cluster.running && write(cluster.stop[1], "", 1) == 1) {
+		pthread_join(cluster.thread, NULL);
+	}
+	cluster.running = 0;
+	if(cluster.gossip >= 0) {
+		close(cluster.gossip);
+		cluster.gossip = -1;
+	}
+	if(cluster.stop[0] >= 0) {
+		close(cluster.stop[0]);
+		close(cluster.stop[1]);
+		cluster.stop[0] = cluster.stop[1] = -1;
+	}
+}
+
+char cluster_running(void)
+{
+	return cluster.running;
+}
+
+unsigned int cluster_self(void)
+{
+	return cluster.self;
+}
+
+/*
+ * the node owning game_id: the node of the first point of the ring at or after the id's hash
+ * */
+unsigned int cluster_owner(uint32_t game_id)
+{
+	size_t low = 0, high = cluster.number_of_nodes * CLUSTER_REPLICAS, middle;
+	uint32_t hash = cluster_hash(&game_id, sizeof(game_id));
+	if(!cluster.running) {
+		return cluster.self;
+	}
+	while(low < high) {
+		middle = (low + high) / 2;
+		if(cluster.ring[middle].hash < hash) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return cluster.ring[low % (cluster.number_of_nodes * CLUSTER_REPLICAS)].node;
+}
+
+/*
+ * another node that has open games, at random, -1 if none has
+ * */
+int cluster_pick(void)
+{
+	unsigned int candidates[CLUSTER_MAX_NODES], number_of_candidates = 0;
+	unsigned long now = cluster_milliseconds(), heard_at;
+	if(!cluster.running) {
+		return -1;
+	}
+	for(unsigned int i = 0; i < cluster.number_of_nodes; ++i) {
+		heard_at = atomic_load(&cluster.nodes[i].heard_at);
+		if(i != cluster.self && heard_at && now - heard_at < CLUSTER_PEER_TIMEOUT_MS && atomic_load(&cluster.nodes[i].open_games) > 0) {
+			candidates[number_of_candidates++] = i;
+		}
+	}
+	return number_of_candidates ? (int) candidates[random() % number_of_candidates] : -1;
+}
+
+/*
+ * sends a request on fd and reads the reply's code, -1 if it fails
+ * */
+static int cluster_handshake(int fd, const char *request, size_t length)
+{
+	char buffer[BUFFER_LENGTH];
+	if(!length || send(fd, request, length, MSG_NOSIGNAL) != (ssize_t) length || recv(fd, buffer, BUFFER_LENGTH, 0) <= 0) {
+		return -1;
+	}
+	return (unsigned char) buffer[0];
+}
+
+static void* cluster_relay(void *arg)
+{
+	struct cluster_link *link = arg;
+	char buffer[BUFFER_LENGTH];
+	ssize_t n;
+	while((n = recv(link->fd, buffer, BUFFER_LENGTH, 0)) > 0) {
+		if(send(link->client_fd, buffer, n, MSG_NOSIGNAL) < 0) {
+			break;
+		}
+	}
+	atomic_store(&link->alive, 0);
+	return NULL;
+}
+
+/*
+ * connects to node and logs in as username, multiplexed. what the node sends on the link afterwards is
+ * relayed to client_fd. NULL if the node cannot be reached or refuses the login.
+ * */
+struct cluster_link* cluster_link_open(unsigned int node, const char *username, const char *password, int client_fd)
+{
+	struct timeval timeout = { .tv_sec = CLUSTER_HANDSHAKE_MS / 1000, .tv_usec = CLUSTER_HANDSHAKE_MS % 1000 * 1000 }, none = { 0 };
+	struct cluster_link *link;
+	char buffer[BUFFER_LENGTH];
+	int nodelay = 1;
+	if(!cluster.running || node >= cluster.number_of_nodes || node == cluster.self || !(link = calloc(1, sizeof(struct cluster_link)))) {
+		return NULL;
+	}
+	link->client_fd = client_fd;
+	if((link->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		free(link);
+		return NULL;
+	}
+	setsockopt(link->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	setsockopt(link->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if(connect(link->fd, (struct sockaddr*) &cluster.nodes[node].address, sizeof(cluster.nodes[node].address))
+	|| cluster_handshake(link->fd, buffer, encode_credentials_request(buffer, LOGIN_REQUEST, username, password)) != LOGIN_SUCCESS
+	|| cluster_handshake(link->fd, buffer, encode_request(buffer, MULTIPLEX_REQUEST)) != MULTIPLEX_REPLY) {
+		log_warning("cluster: error on opening a link to node %u", node);
+		close(link->fd);
+		free(link);
+		return NULL;
+	}
+	setsockopt(link->fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+	atomic_store(&link->alive, 1);
+	if(pthread_create(&link->relay, NULL, cluster_relay, link)) {
+		close(link->fd);
+		free(link);
+		return NULL;
+	}
+	return link;
+}
+
+char cluster_link_alive(struct cluster_link *link)
+{
+	return atomic_load(&link->alive);
+}
+
+int cluster_link_send(struct cluster_link *link, const char *buffer, size_t length)
+{
+	if(!atomic_load(&link->alive) || send(link->fd, buffer, length, MSG_NOSIGNAL) != (ssize_t) length) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * the other node sees the session leave its games, as if its client disconnected
+ * */
+void cluster_link_close(struct cluster_link *link)
+{
+	if(!link) {
+		return;
+	}
+	shutdown(link->fd, SHUT_RDWR);
+	pthread_join(link->relay, NULL);
+	close(link->fd);
+	free(link);
+}
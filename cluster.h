@@ -0,0 +1,42 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * cluster mode: several servers, the nodes, serve one service. every node is started with the same list
+ * of nodes and its own index in it. a consistent hash ring with CLUSTER_REPLICAS points per node maps
+ * every game id to the node that owns it and a node only gives its games ids it owns, so a game id names
+ * its node. a node added to the list takes over about 1 / n of the ids.
+ *
+ * a multiplexed session plays the games of another node through a link: a connection to that node's
+ * port, logged in as the session's user and multiplexed as well. a game-scoped request naming a game
+ * of that node goes over the link as it is, and what the node sends on the link, its replies and its
+ * notifies, is relayed to the session's client as it is.
+ *
+ * the nodes gossip their number of open games over UDP on their port every CLUSTER_GOSSIP_MS. a join
+ * that finds no open game on its node goes to a node that has some. matchmaking and tournaments are
+ * partitioned, every node pairs the sessions connected to it.
+ * */
+#define CLUSTER_MAX_NODES 16
+#define CLUSTER_REPLICAS 64
+#define CLUSTER_GOSSIP_MS 200
+#define CLUSTER_PEER_TIMEOUT_MS 1000 // a node not heard of for this long is left out of joins
+#define CLUSTER_FORWARDED 'F' // follows the opcode of a join forwarded by another node, it is not forwarded again
+#define CLUSTER_MAGIC 0x43545454u // "TTTC"
+
+struct cluster_link;
+
+int cluster_start(const char *nodes, unsigned int self);
+void cluster_stop(void);
+char cluster_running(void);
+unsigned int cluster_self(void);
+unsigned int cluster_owner(uint32_t game_id);
+int cluster_pick(void);
+struct cluster_link* cluster_link_open(unsigned int node, const char *username, const char *password, int client_fd);
+char cluster_link_alive(struct cluster_link *link);
+int cluster_link_send(struct cluster_link *link, const char *buffer, size_t length);
+void cluster_link_close(struct cluster_link *link);
+
+#endif
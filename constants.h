@@ -1,9 +1,22 @@
+#ifndef CONSTANTS_H
+#define CONSTANTS_H
+
 #define NUMBER_OF_OPCODES 256
 #define BUFFER_LENGTH 256
 #define USERNAMELEN 4
 #define PASSWORDLEN 4
 #define BOARD_SIZE 3
 #define REALLOC_SIZE 5
+#define SNAPSHOT_FILE "games.snapshot"
+#define ARCHIVE_FILE "games.archive"
+#define TRACE_FILE "trace.json"
+#define RATINGS_FILE "ratings.txt"
+#define LOGIN_TIMEOUT 10 // seconds, the defaults of the server's deadlines
+#define IDLE_TIMEOUT 300
+#define MOVE_TIMEOUT 60
+#define MAX_CONNECTIONS 4096 // the defaults of the server's admission caps, 0 is no cap
+#define MAX_GAMES 65536
+#define MAX_PENDING 64 // requests being handled at once before lobby requests are shed
 
 enum {
 	LOGIN_REQUEST,
@@ -13,11 +26,19 @@ enum {
 	CREATE_NEW_GAME_REQUEST,
 	LEAVE_GAME_REQUEST,
 	ACTION_REQUEST,
-	INTERNAL_CLIENT_ERROR
+	INTERNAL_CLIENT_ERROR,
+	STATS_REQUEST,
+	MULTIPLEX_REQUEST,
+	SPECTATE_REQUEST,
+	GAME_SNAPSHOT_REQUEST,
+	LIST_GAMES_REQUEST,
+	MATCHMAKE_REQUEST,
+	TOURNAMENT_REQUEST,
+	REMATCH_REQUEST
 };
 
 enum {
-	PEER_LEFT_NOTIFY = 233,
+	PEER_LEFT_NOTIFY = 200, // leaves room below 255 for new reply codes
 	CANNOT_WRITE_HERE,
 	ACTION_NOTIFY,
 	OTHER_PLAYER_PRESENT_NOTIFY,
@@ -31,11 +52,27 @@ enum {
 	CREATE_USER_SUCCESS,
 	LOGIN_SUCCESS,
 	LOGOUT_REPLY,
+	STATS_REPLY,
+	MULTIPLEX_REPLY,
+	SPECTATE_REPLY,
+	SPECTATE_NOTIFY,
+	SPECTATE_SNAPSHOT_NOTIFY,
+	GAME_SNAPSHOT_REPLY,
+	LIST_GAMES_REPLY,
+	MATCHMAKE_REPLY,
+	MATCH_FOUND_NOTIFY,
+	MATCH_EXPIRED_NOTIFY,
+	TOURNAMENT_REPLY,
+	TOURNAMENT_OVER_NOTIFY,
+	REMATCH_REPLY,
+	REMATCH_NOTIFY,
+	MOVE_TIMEOUT_NOTIFY,
 	NO_PLAYER_PRESENT, // begin non fatal
 	INVALID_OPERANDS,
 	NO_GAMES_AVAILABLE,
 	NOT_IMPLEMENTED,
 	USER_ALREADY_EXISTS,
+	SERVER_BUSY,
 	INTERNAL_SERVER_ERROR, // begin fatal
 	INVALID_REQUEST,
 	IO_ERROR,
@@ -44,6 +81,8 @@ enum {
 
 enum {
 	ANY_ERROR = NO_PLAYER_PRESENT, // begin error codes
-	NO_ERROR = LOGOUT_REPLY,
+	NO_ERROR = MOVE_TIMEOUT_NOTIFY,
 	FATAL_ERRORS = INTERNAL_SERVER_ERROR
 };
+
+#endif
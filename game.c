@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "game.h"
+#include "log.h"
+#include "metrics.h"
+
+/*
+ * a game is open while it waits for a player to take its free seat
+ * */
+char game_is_open(const struct game_board *game)
+{
+	return (!game->player_1 || !game->player_2) && (game->whose_turn == 'x' || game->whose_turn == 'o');
+}
+
+/*
+ * the fd of the player sitting opposite of fd, -1 if that seat is empty
+ * */
+int game_peer_fd(const struct game_board *game, int fd)
+{
+	if(fd == game->player1_fd) {
+		return game->player_2 ? game->player2_fd : -1;
+	}
+	return game->player_1 ? game->player1_fd : -1;
+}
+
+/*
+ * whether the player sitting opposite of fd multiplexes its session
+ * */
+char game_peer_multiplexed(const struct game_board *game, int fd)
+{
+	return fd == game->player1_fd ? game->player2_multiplexed : game->player1_multiplexed;
+}
+
+struct game_boards_array* array_of_games_init(const size_t size)
+{
+	struct game_boards_array *array = NULL;
+	array = malloc(sizeof(struct game_boards_array));
+	if(!array || !size) {
+		free(array);
+		return NULL;
+	}
+	array->array = NULL;
+	array->array_size = size;
+	array->number_of_elements = 0;
+	array->visited = NULL;
+	array->array = calloc(size, sizeof(struct game_board*));
+	if(!array->array || pthread_mutex_init(&array->monitor, NULL)) {
+		free(array);
+		return NULL;
+	}
+	return array;
+}
+
+void game_boards_array_free(struct game_boards_array *ptr)
+{
+	if(!ptr) {
+		return;
+	}
+	for(size_t i = 0; i < ptr->number_of_elements; ++i) {
+		free(ptr->array[i]->matrix);
+		free(ptr->array[i]->spectators);
+		pthread_mutex_destroy(&ptr->array[i]->monitor);
+		free(ptr->array[i]);
+	}
+	pthread_mutex_destroy(&ptr->monitor);
+	free(ptr->visited);
+	free(ptr->array);
+	free(ptr);
+}
+
+int game_boards_array_add(struct game_boards_array *array, struct game_board *game)
+{
+	if(!array || !game) {
+		return -3;
+	}
+	int ret_value;
+	if((ret_value = pthread_mutex_lock(&array->monitor))) {
+		return ret_value;
+	}
+	if(!array->array_size) {
+		pthread_mutex_unlock(&array->monitor);
+		return -2;
+	}
+	if(array->number_of_elements == array->array_size) {
+		pthread_mutex_unlock(&array->monitor);
+		return -1;
+	}
+	struct game_board **new;
+	char *visited_new = NULL;
+	game->index = array->number_of_elements;
+	if(!array->visited) { // first add to array, visited is kept as long as the array itself
+		array->visited = calloc(array->array_size, 1);
+		if(!array->visited) {
+			pthread_mutex_unlock(&array->monitor);
+			return -4;
+		}
+	}
+	array->array[array->number_of_elements++] = game;
+	if(array->number_of_elements == array->array_size) {
+		new = realloc(array->array, sizeof(struct game_board*) * (array->array_size + REALLOC_SIZE));
+		if(new) { // in case of realloc error, the pointer remains valid, not null 
+			array->array = new;
+			visited_new = realloc(array->visited, array->array_size + REALLOC_SIZE);
+		}
+		if(!new || !visited_new) {
+			array->array[--array->number_of_elements] = NULL;
+			pthread_mutex_unlock(&array->monitor);
+			return -4;
+		}
+		memset(visited_new + array->array_size, 0, REALLOC_SIZE);
+		memset(new + array->array_size, 0, sizeof(struct game_board*) * REALLOC_SIZE);
+		array->visited = visited_new;
+		array->array_size += REALLOC_SIZE;
+	}
+	gauge_add(gauges.games, 1);
+	gauge_set(gauges.registry_size, array->array_size);
+	return pthread_mutex_unlock(&array->monitor);
+}
+
+/*
+ * adds number_of_games games under one lock and grows the array at most once, e.g. for the games of a
+ * tournament round. no game is added on error.
+ * */
+int game_boards_array_add_batch(struct game_boards_array *array, struct game_board **games, size_t number_of_games)
+{
+	if(!array || !games) {
+		return -3;
+	}
+	int ret_value;
+	if((ret_value = pthread_mutex_lock(&array->monitor))) {
+		return ret_value;
+	}
+	if(!array->array_size) {
+		pthread_mutex_unlock(&array->monitor);
+		return -2;
+	}
+	struct game_board **new;
+	char *visited_new;
+	size_t size = array->array_size, needed = array->number_of_elements + number_of_games + 1; // add() expects a free slot
+	if(needed > size) {
+		size += (needed - size + REALLOC_SIZE - 1) / REALLOC_SIZE * REALLOC_SIZE;
+		new = realloc(array->array, sizeof(struct game_board*) * size);
+		if(!new) {
+			pthread_mutex_unlock(&array->monitor);
+			return -4;
+		}
+		array->array = new;
+		memset(new + array->array_size, 0, sizeof(struct game_board*) * (size - array->array_size));
+		if(array->visited) {
+			if(!(visited_new = realloc(array->visited, size))) {
+				pthread_mutex_unlock(&array->monitor);
+				return -4;
+			}
+			memset(visited_new + array->array_size, 0, size - array->array_size);
+			array->visited = visited_new;
+		}
+		array->array_size = size;
+	}
+	if(!array->visited && !(array->visited = calloc(array->array_size, 1))) {
+		pthread_mutex_unlock(&array->monitor);
+		return -4;
+	}
+	for(size_t i = 0; i < number_of_games; ++i) {
+		games[i]->index = array->number_of_elements;
+		array->array[array->number_of_elements++] = games[i];
+	}
+	gauge_add(gauges.games, number_of_games);
+	gauge_set(gauges.registry_size, array->array_size);
+	return pthread_mutex_unlock(&array->monitor);
+}
+
+int game_boards_array_remove(struct game_boards_array *array, struct game_board* game)
+{
+	if(!game || !array) {
+		return 3;
+	}
+	int ret_value;
+	if((ret_value = pthread_mutex_lock(&array->monitor))) {
+		return ret_value;
+	}
+	size_t index = game->index;
+	if(!array->number_of_elements || array->number_of_elements - 1 < index) {
+		log_warning("on remove %lu %lu", array->number_of_elements, index);
+		pthread_mutex_unlock(&array->monitor);
+		return 2;
+	}
+	char *visited_new;
+	struct game_board **array_new;
+	if(array->array[index] != game) {
+		pthread_mutex_unlock(&array->monitor);
+		return 2;
+	}
+	if((ret_value = pthread_mutex_destroy(&game->monitor))) {
+		pthread_mutex_unlock(&array->monitor);
+		return ret_value;
+	}
+	if(index < array->number_of_elements - 1) { // this comparison is probably redundant
+		array->array[index] = array->array[array->number_of_elements - 1]; // move the last element to the deleted one's place
+		array->array[index]->index = index; // update the moved element's index
+	}
+	array->array[array->number_of_elements-- - 1] = NULL;
+	gauge_add(gauges.games, -1);
+	if(game_is_open(game)) {
+		gauge_add(gauges.open_games, -1);
+	}
+	log_debug("removed %p", (unsigned long) game);
+	free(game->matrix);
+	free(game->spectators);
+	free(game);
+	// begin questionable realloc
+	if(array->array_size - array->number_of_elements == REALLOC_SIZE * 2 && array->array_size > REALLOC_SIZE * 2) {
+		array_new = realloc(array->array, sizeof(struct game_board*) * (array->array_size - REALLOC_SIZE));
+		if(!array_new) {
+			pthread_mutex_unlock(&array->monitor);
+			return -1;
+		}
+		array->array = array_new;
+		if(array->visited) {
+			visited_new = realloc(array->visited, array->array_size - REALLOC_SIZE);
+			if(!visited_new) {
+				pthread_mutex_unlock(&array->monitor);
+				return -1;
+			}
+			array->visited = visited_new;
+		}
+		array->array_size -= REALLOC_SIZE; // keep some free slots, add() expects the array to never be full
+	}
+	if(array->number_of_elements) {
+		memset(array->visited, 0, array->number_of_elements);
+	} else {
+		free(array->visited);
+		array->visited = NULL;
+	}
+	gauge_set(gauges.registry_size, array->array_size);
+	return pthread_mutex_unlock(&array->monitor);
+}
+
+/*
+ * the following code is suboptimal, to put it mildly. and it's quite poorly designed. TODO
+ * */
+int write_x_or_o(struct game_board *board, size_t x, size_t y, const char character)
+{
+	if(!board || !character) {
+	 	return -1;
+	}
+	if(board->whose_turn != character) {
+		log_debug("return -4 %c %c", board->whose_turn, character);
+		return -4;
+	}
+	size_t i;
+	if(x > (board->board_size - 1) || y > (board->board_size - 1)) { // behaviour is undefined is size happens to be zero
+		log_debug("return -2");
+		return -2;
+	} // matrix indexing looks ugly because it's a 1d array for more efficiency... (1 pointer dereference fewer)
+	if(board->matrix[(board->board_size * x) + y] != 'x' && board->matrix[(board->board_size * x) + y] != 'o' && (character == 'x' || character == 'o')) {
+		log_debug("write");
+		board->matrix[(board->board_size * x) + y] = character;	
+	} else {
+		log_debug("return -5");
+		return -5;
+	}
+	for(i = 0; i < board->board_size; i++) {
+		if(board->matrix[(board->board_size * x) + i] != character) {
+			break;
+		}
+	}
+	if(i == board->board_size) {
+		board->whose_turn = character - 0x20; // make it uppercase, which means the game is over
+		return 0; // the one who wrote won the game 
+	} 
+	for(i = 0; i < board->board_size; i++) {
+		if(board->matrix[(board->board_size * i) + y] != character) {
+			break;
+		}
+	}
+	if(i == board->board_size) {
+		board->whose_turn = character - 0x20;
+		return 0;
+	}
+	if(x == y) {
+		for(i = 0; i < board->board_size; i++) {
+			if(board->matrix[(board->board_size * i) + i] != character) {
+				break;
+			}
+		}
+		if(i == board->board_size) {
+			board->whose_turn = character - 0x20;
+			return 0;
+		}
+	}
+	if(x + y == board->board_size - 1) {
+		for(i = 0; i < board->board_size; i++) {
+			if(board->matrix[(board->board_size * i) + board->board_size - 1 - i] != character) {
+				break;
+			}
+		}
+		if(i == board->board_size) {
+			board->whose_turn = character - 0x20;
+			return 0;
+		}
+	}
+	for(i = 0; i < board->board_size * board->board_size; ++i) {
+		if(board->matrix[i] != 'x' && board->matrix[i] != 'o') {
+			break;
+		}
+	}
+	if(i == board->board_size * board->board_size) {
+		log_debug("tie");
+		board->whose_turn = 'D';
+	} else {
+		board->whose_turn = character == 'x' ? 'o' : 'x';
+	}
+	return 0;
+}
+
+/*
+ * causes undefined behaviour if buffer_size is longer than the buffer itself
+ * */
+char* find_character_in_buffer(char *buffer, size_t buffer_size, const char character)
+{
+	if(!buffer || !buffer_size) {
+		return NULL;
+	}
+	for(size_t i = 0; i < buffer_size; i++) {
+		if(buffer[i] == character) {
+			return buffer + i;
+		}
+	}
+	return NULL;
+}
+
+User* find_user_by_name(FILE *input_file, char* name)
+{
+	if(!input_file || !name) {
+		return NULL;
+	}
+	char *password_start;
+	char string[USERNAMELEN + PASSWORDLEN + 3];
+	char username[USERNAMELEN + 1];
+	char password[PASSWORDLEN + 1];
+	User *found_user = NULL;
+	memset(username, 0, USERNAMELEN + 1);
+	memset(password, 0, PASSWORDLEN + 1);
+	memset(string, 0, USERNAMELEN + PASSWORDLEN + 3);
+	while((fgets(string, USERNAMELEN + PASSWORDLEN + 3, input_file))) {
+		if(strncmp(string, name, USERNAMELEN)) {
+			continue;
+		}
+		memcpy(username, string, USERNAMELEN); // terminated by the memset, strncpy warns of the truncation at -O2
+		password_start = find_character_in_buffer(string, USERNAMELEN + PASSWORDLEN + 3, ' ');
+		if(password_start) {
+			// pointer arithmetic in order to check buffer bounds
+			if((password_start - string) + 1 >= USERNAMELEN + PASSWORDLEN + 3) {
+				break;
+			}
+			password_start++;
+		} else {
+			break;
+		}
+		strncpy(password, password_start, PASSWORDLEN);
+		found_user = malloc(sizeof(User));
+		if(found_user) {
+			memcpy(found_user->username, username, USERNAMELEN + 1);
+			memcpy(found_user->password, password, PASSWORDLEN + 1);
+		} else {
+			fprintf(stderr, "error: cannot allocate %lu bytes\n", sizeof(User));
+			exit(1);
+		}
+		break;
+	}
+	fclose(input_file);
+	return found_user;
+}
+
+int parse_operands_from_buffer(char *operand1, char *operand2, char *buffer, const char separator, size_t buffer_size)
+{
+	if(!operand1 || !operand2 || !buffer || !buffer_size) {
+		return -1;
+	}
+	memset(operand1, 0, buffer_size);
+	memset(operand2, 0, buffer_size);
+	char *op2_start = find_character_in_buffer(buffer, buffer_size, separator);
+	if(op2_start) {
+		 // checking buffer size with pointer arithmetic
+		if((size_t)((op2_start - buffer) + 1) >= buffer_size) {
+			return 2;
+		}
+		op2_start++;
+	} else {
+		return 1;
+	} // this might break if the separator is not \0
+	strncpy(operand1, buffer, buffer_size - 1);
+	strncpy(operand2, op2_start, buffer_size - 1);
+	return 0;
+}
+
+int get_coordinates_from_buffer(char *buffer, unsigned long *x, unsigned long *y)
+{
+	if(!x || !y) {
+		return 1;
+	}
+	char *next = NULL;
+	if(buffer[0] == '0' && buffer[1] == '\0') {
+		*x = 0;
+		next = buffer + 1;
+	} else {
+		*x = strtoul(buffer, &next, 10);
+		if(!*x || errno == ERANGE) {
+			return 2;
+		}
+	}
+	if(next[1] == '0' && next[2] == '\0') {
+		*y = 0;
+	} else {
+		*y = strtoul(++next, NULL, 10);
+		if(!*y || errno == ERANGE) {
+			return 3;
+		}
+	}
+	log_debug("coor: %lu %lu", *x, *y);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "constants.h"
+#include "archive.h"
+#include "timer.h"
+
+/*
+ * the game engine, the registry of games and the request parsing helpers. they have no other state
+ * than their arguments, so the server and the microbenchmarks link the same code.
+ * */
+
+struct spectator;
+struct tournament_match;
+
+typedef struct usr {
+	char username[USERNAMELEN + 1];
+	char password[PASSWORDLEN + 1];
+} User;
+
+struct game_board {
+	char *matrix;
+	User *player_1;
+	User *player_2;
+	User *host;
+	char whose_turn;
+	size_t board_size;
+	size_t index;
+	uint32_t id; // names the game in the messages of multiplexed sessions, unlike index it never changes
+	time_t created_at; // restored games count from the restore
+	unsigned long player1_last_x, player1_last_y;
+	unsigned long player2_last_x, player2_last_y;
+	unsigned char moves[ARCHIVE_MAX_MOVES]; // cell indices in the order they were written
+	unsigned char number_of_moves;
+	int player1_fd, player2_fd;
+	char player1_multiplexed, player2_multiplexed; // the session in the seat wants the game id in notifications
+	struct spectator **spectators; // sessions watching the game, see spectate.h
+	size_t number_of_spectators, spectators_size;
+	struct tournament_match *match; // the match of a tournament the game is played for, see tournament.h
+	User *rematch; // the player who asked for a rematch of the finished game
+	struct timer deadline; // the move deadline of the player whose turn it is
+	unsigned int shared; // the game's entry in the shared registry while its seat is open to other processes, 0 for none
+	unsigned long snapshot_generation; // the last snapshot that copied the game, see game_boards_array_snapshot
+	pthread_mutex_t monitor;
+};
+
+struct game_boards_array {
+	struct game_board **array;
+	char *visited; // this array is used in selecting a random game to join
+	size_t number_of_elements;
+	size_t array_size;
+	pthread_mutex_t monitor;
+};
+
+char game_is_open(const struct game_board *game);
+int game_peer_fd(const struct game_board *game, int fd);
+char game_peer_multiplexed(const struct game_board *game, int fd);
+struct game_boards_array* array_of_games_init(const size_t size);
+void game_boards_array_free(struct game_boards_array *ptr);
+int game_boards_array_add(struct game_boards_array *array, struct game_board *game);
+int game_boards_array_add_batch(struct game_boards_array *array, struct game_board **games, size_t number_of_games);
+int game_boards_array_remove(struct game_boards_array *array, struct game_board* game);
+int write_x_or_o(struct game_board *board, size_t x, size_t y, const char character);
+char* find_character_in_buffer(char *buffer, size_t buffer_size, const char character);
+User* find_user_by_name(FILE *input_file, char* name);
+int parse_operands_from_buffer(char *operand1, char *operand2, char *buffer, const char separator, size_t buffer_size);
+int get_coordinates_from_buffer(char *buffer, unsigned long *x, unsigned long *y);
+
+#endif
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "constants.h"
+#include "session.h"
+#include "stats.h"
+
+/*
+ * headless load generator. every simulated player is a client session on a non-blocking socket,
+ * the players are spread over a few threads which each run one epoll loop. a player logs in and then
+ * keeps creating or joining games, plays random free cells until the game ends and leaves again. with
+ * --list a player first looks at the open games in the lobby some of the time, with --matchmake it lets
+ * the matchmaker find some of its games instead. the wait for the matchmaker is reported as match_wait.
+ * request latencies go into the same per-opcode histograms the server uses for STATS_REQUEST.
+ * spectators log in the same way and watch one game that is being played after the other.
+ * */
+
+#define LOADGEN_EVENTS 256
+#define LOADGEN_TICK_MS 5
+
+struct player {
+	struct client_session session;
+	char connecting; // waiting for the non-blocking connect, the session is not initialized yet
+	char spectator, watching;
+	char listed; // looked at the open games before the next create or join
+	unsigned long matchmaking_since; // nanoseconds, stats_now() clock
+	unsigned long next_at, game_deadline; // nanoseconds, stats_now() clock
+	unsigned int seed;
+	unsigned int node; // the player connects to port + node
+};
+
+struct loadgen_options {
+	struct sockaddr_in address;
+	struct sockaddr_un unix_address; // used if its path is set, the server was started with --unix
+	unsigned long players, spectators, threads, duration, think, game_timeout;
+	unsigned int nodes; // servers on consecutive ports, e.g. the nodes of a cluster
+	unsigned int create_percent, leave_percent, list_percent, matchmake_percent;
+	const char *username, *password;
+};
+
+struct loadgen_thread {
+	pthread_t thread;
+	struct player *players;
+	unsigned long number_of_players;
+	int epfd;
+};
+
+static struct loadgen_options options = {
+	.players = 100,
+	.threads = 4,
+	.duration = 10,
+	.think = 0,
+	.game_timeout = 5,
+	.nodes = 1,
+	.create_percent = 50,
+	.leave_percent = 0,
+	.username = "user",
+	.password = "pass"
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+static atomic_ulong games_finished, games_abandoned, connect_failures, disconnects;
+static atomic_ulong spectated_moves, spectator_snapshots;
+
+static void handle_stop_signal(int signal_number)
+{
+	(void) signal_number;
+	stop_requested = 1;
+}
+
+static unsigned long think_time(struct player *player)
+{
+	if(!options.think) {
+		return 0;
+	}
+	return (rand_r(&player->seed) % (2 * options.think + 1)) * 1000000ul; // uniform around the mean
+}
+
+static void player_close(struct player *player)
+{
+	if(player->connecting) {
+		close(player->session.fd); // also removes the fd from the epoll set
+		player->connecting = 0;
+	}
+	session_close(&player->session);
+}
+
+static void player_reply(struct client_session *session, struct client_game *game, unsigned char opcode, const char *message,
+	unsigned long nanoseconds)
+{
+	struct player *player = session->context;
+	unsigned char code = (unsigned char) message[0];
+	(void) game;
+	stats_record(opcode, code, nanoseconds);
+	if(code >= FATAL_ERRORS) { // the server ends the session after these
+		atomic_fetch_add(&disconnects, 1);
+		player_close(player);
+		return;
+	}
+	if(player->spectator) {
+		player->watching = code == SPECTATE_REPLY;
+		player->next_at = stats_now() + (player->watching ? 0 : 50000000ul); // retry later if nothing is being played
+		return;
+	}
+	if(opcode == ACTION_REQUEST && code == GAME_IS_FINISHED) { // counted once, by the player who made the last move
+		atomic_fetch_add(&games_finished, 1);
+	}
+	if(code == ACTION_REPLY || code == CREATE_NEW_GAME_SUCCESS || code == JOIN_RANDOM_GAME_REPLY) {
+		player->game_deadline = stats_now() + options.game_timeout * 1000000000ul;
+	}
+	player->next_at = stats_now() + think_time(player);
+}
+
+static void player_notify(struct client_session *session, struct client_game *game, const char *message)
+{
+	struct player *player = session->context;
+	(void) game;
+	if(player->spectator) {
+		if((unsigned char) message[0] == SPECTATE_SNAPSHOT_NOTIFY) {
+			atomic_fetch_add(&spectator_snapshots, 1);
+		} else if(message[strlen(message + 1) + 3] == 'L') { // game id, character, whose turn: a player left
+			player->watching = 0;
+		} else {
+			atomic_fetch_add(&spectated_moves, 1);
+		}
+		return;
+	}
+	if((unsigned char) message[0] == MATCH_FOUND_NOTIFY || (unsigned char) message[0] == MATCH_EXPIRED_NOTIFY) {
+		stats_record(STATS_MATCH_WAIT, (unsigned char) message[0], stats_now() - player->matchmaking_since);
+	}
+	player->game_deadline = stats_now() + options.game_timeout * 1000000000ul;
+	player->next_at = stats_now() + think_time(player);
+}
+
+static const struct session_handlers player_handlers = {
+	.reply = player_reply,
+	.notify = player_notify
+};
+
+/*
+ * called on every tick for players without a request in flight whose think time is over
+ * */
+static void player_act(struct player *player, unsigned long now)
+{
+	struct client_session *session = &player->session;
+	struct client_game *game = &session->game;
+	unsigned long x, y;
+	unsigned char opcode;
+	int ret_value = 0;
+	if(player->spectator) {
+		if(session->state == SESSION_LOBBY && !player->watching) {
+			ret_value = session_spectate(session, 0);
+		}
+		if(ret_value == -2) {
+			atomic_fetch_add(&disconnects, 1);
+		}
+		return;
+	}
+	switch(session->state) {
+		case SESSION_LOBBY: {
+			if(!player->listed && options.list_percent && (unsigned int) (rand_r(&player->seed) % 100) < options.list_percent) {
+				player->listed = 1;
+				ret_value = session_list_games(session, 0);
+				break;
+			}
+			player->listed = 0;
+			if(session->matchmaking) {
+				break;
+			}
+			if(options.matchmake_percent && (unsigned int) (rand_r(&player->seed) % 100) < options.matchmake_percent) {
+				player->matchmaking_since = now;
+				ret_value = session_matchmake(session);
+				break;
+			}
+			opcode = (unsigned int) (rand_r(&player->seed) % 100) < options.create_percent ? CREATE_NEW_GAME_REQUEST : JOIN_RANDOM_GAME_REQUEST;
+			ret_value = session_request(session, opcode);
+		} break;
+		case SESSION_IN_GAME: {
+			if(game->result != SESSION_PLAYING) {
+				ret_value = session_request(session, LEAVE_GAME_REQUEST);
+			} else if(now >= player->game_deadline) { // nobody joined or the other player stalled
+				atomic_fetch_add(&games_abandoned, 1);
+				ret_value = session_request(session, LEAVE_GAME_REQUEST);
+			} else if(game->my_turn && game->peer_present) {
+				if(options.leave_percent && (unsigned int) (rand_r(&player->seed) % 100) < options.leave_percent) {
+					atomic_fetch_add(&games_abandoned, 1);
+					ret_value = session_request(session, LEAVE_GAME_REQUEST);
+				} else if(!session_random_free_cell(game, &player->seed, &x, &y)) {
+					ret_value = session_move(session, game, x, y);
+				}
+			}
+		} break;
+	}
+	if(ret_value == -2) { // the session closed itself
+		atomic_fetch_add(&disconnects, 1);
+	}
+}
+
+static int player_connect(struct player *player, int epfd)
+{
+	struct epoll_event event = { .events = EPOLLOUT, .data.ptr = player };
+	struct sockaddr_in address = options.address;
+	int one = 1, fd, unix_socket = options.unix_address.sun_path[0] != 0, connected;
+	player->session.state = SESSION_CLOSED;
+	fd = socket(unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	if(unix_socket) {
+		connected = connect(fd, (struct sockaddr*) &options.unix_address, sizeof(options.unix_address));
+	} else {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		address.sin_port = htons(ntohs(address.sin_port) + player->node);
+		connected = connect(fd, (struct sockaddr*) &address, sizeof(address));
+	}
+	if((connected && errno != EINPROGRESS)
+	|| epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event)) {
+		close(fd);
+		return -1;
+	}
+	player->session.fd = fd;
+	player->connecting = 1;
+	return 0;
+}
+
+/*
+ * the socket became writable, the connection either succeeded or failed
+ * */
+static void player_connected(struct player *player, int epfd)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = player };
+	int error = 0, fd = player->session.fd, ret_value;
+	socklen_t length = sizeof(error);
+	if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) || error || epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &event)) {
+		atomic_fetch_add(&connect_failures, 1);
+		player_close(player);
+		return;
+	}
+	player->connecting = 0;
+	session_init(&player->session, fd, &player_handlers, player);
+	if((ret_value = session_login(&player->session, LOGIN_REQUEST, options.username, options.password))) {
+		atomic_fetch_add(ret_value == -2 ? &disconnects : &connect_failures, 1); // -1 means the credentials do not fit
+		player_close(player);
+	}
+}
+
+static void* loadgen_thread(void *arg)
+{
+	struct loadgen_thread *thread = arg;
+	struct epoll_event events[LOADGEN_EVENTS];
+	struct player *player;
+	unsigned long i, now, alive;
+	int n;
+	for(i = 0; i < thread->number_of_players; ++i) {
+		thread->players[i].seed = (unsigned int) (stats_now() ^ (i * 2654435761u));
+		if(player_connect(&thread->players[i], thread->epfd)) {
+			atomic_fetch_add(&connect_failures, 1);
+		}
+	}
+	while(!stop_requested) {
+		n = epoll_wait(thread->epfd, events, LOADGEN_EVENTS, LOADGEN_TICK_MS);
+		for(int j = 0; j < n; ++j) {
+			player = events[j].data.ptr;
+			if(player->connecting) {
+				player_connected(player, thread->epfd);
+			} else if(player->session.state != SESSION_CLOSED && session_receive(&player->session) && !stop_requested) {
+				atomic_fetch_add(&disconnects, 1);
+			}
+		}
+		now = stats_now();
+		alive = 0;
+		for(i = 0; i < thread->number_of_players; ++i) {
+			player = &thread->players[i];
+			if(player->connecting) {
+				++alive;
+				continue;
+			}
+			if(player->session.state == SESSION_CLOSED) {
+				continue;
+			}
+			++alive;
+			if(player->session.pending == SESSION_NO_REQUEST && now >= player->next_at) {
+				player_act(player, now);
+			}
+		}
+		if(!alive) {
+			break;
+		}
+	}
+	for(i = 0; i < thread->number_of_players; ++i) {
+		player_close(&thread->players[i]);
+	}
+	return NULL;
+}
+
+static void print_results(double seconds)
+{
+	unsigned long requests, errors;
+	stats_print(stdout, &requests, &errors);
+	printf("\n%lu requests in %.2f s, %.0f requests/s, %lu errors\n", requests, seconds, requests / seconds, errors);
+	printf("%lu games finished (%.0f/s), %lu abandoned\n", atomic_load(&games_finished), atomic_load(&games_finished) / seconds,
+		atomic_load(&games_abandoned));
+	if(options.spectators) {
+		printf("%lu moves seen by spectators (%.0f/s), %lu snapshots\n", atomic_load(&spectated_moves),
+			atomic_load(&spectated_moves) / seconds, atomic_load(&spectator_snapshots));
+	}
+	printf("%lu failed connects, %lu disconnects\n", atomic_load(&connect_failures), atomic_load(&disconnects));
+	if(stats_reply_count(NO_GAMES_AVAILABLE) || stats_reply_count(NOT_YOUR_TURN) || stats_reply_count(CANNOT_WRITE_HERE)
+	|| stats_reply_count(SERVER_BUSY)) {
+		printf("replies: %lu no games available, %lu not your turn, %lu cannot write here, %lu server busy\n",
+			stats_reply_count(NO_GAMES_AVAILABLE), stats_reply_count(NOT_YOUR_TURN), stats_reply_count(CANNOT_WRITE_HERE),
+			stats_reply_count(SERVER_BUSY));
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage %s hostname port | unix path [--players n] [--spectators n] [--threads n] [--duration s] [--think ms] "
+		"[--create percent] [--leave percent] [--list percent] [--matchmake percent] [--game-timeout s] [--user name] [--password password] [--nodes n]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct hostent *server;
+	struct loadgen_thread *threads;
+	struct player *players;
+	struct sigaction action;
+	unsigned long i, first = 0, start, total;
+	if(argc < 3) {
+		usage(argv[0]);
+	}
+	for(int j = 3; j < argc; ++j) {
+		if(j + 1 == argc) {
+			usage(argv[0]);
+		}
+		if(!strcmp(argv[j], "--players")) {
+			options.players = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--spectators")) {
+			options.spectators = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--threads")) {
+			options.threads = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--duration")) {
+			options.duration = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--think")) {
+			options.think = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--create")) {
+			options.create_percent = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--leave")) {
+			options.leave_percent = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--matchmake")) {
+			options.matchmake_percent = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--list")) {
+			options.list_percent = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--game-timeout")) {
+			options.game_timeout = strtoul(argv[++j], NULL, 10);
+		} else if(!strcmp(argv[j], "--user")) {
+			options.username = argv[++j];
+		} else if(!strcmp(argv[j], "--password")) {
+			options.password = argv[++j];
+		} else if(!strcmp(argv[j], "--nodes")) {
+			options.nodes = strtoul(argv[++j], NULL, 10);
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if(!options.players || !options.threads || !options.nodes || options.create_percent > 100 || options.leave_percent > 100 || options.list_percent > 100 || options.matchmake_percent > 100) {
+		usage(argv[0]);
+	}
+	total = options.players + options.spectators;
+	if(options.threads > total) {
+		options.threads = total;
+	}
+	if(!strcmp(argv[1], "unix")) {
+		if(strlen(argv[2]) >= sizeof(options.unix_address.sun_path) || options.nodes > 1) {
+			usage(argv[0]);
+		}
+		options.unix_address.sun_family = AF_UNIX;
+		strcpy(options.unix_address.sun_path, argv[2]);
+	} else {
+		if(!(server = gethostbyname(argv[1]))) {
+			fprintf(stderr, "no such host %s\n", argv[1]);
+			return 1;
+		}
+		options.address.sin_family = AF_INET;
+		memcpy(&options.address.sin_addr.s_addr, server->h_addr, server->h_length);
+		options.address.sin_port = htons(atoi(argv[2]));
+	}
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGALRM, &action, NULL);
+	if(stats_init()) {
+		fprintf(stderr, "error on stats init\n");
+		return 1;
+	}
+	players = calloc(total, sizeof(struct player));
+	threads = calloc(options.threads, sizeof(struct loadgen_thread));
+	if(!players || !threads) {
+		fprintf(stderr, "error on calloc\n");
+		return 1;
+	}
+	for(i = 0; i < total; ++i) { // spread evenly over the threads
+		players[i].spectator = i * options.spectators / total != (i + 1) * options.spectators / total;
+		players[i].node = i % options.nodes;
+	}
+	start = stats_now();
+	for(i = 0; i < options.threads; ++i) { // the first players % threads threads get one player more
+		threads[i].players = players + first;
+		threads[i].number_of_players = total / options.threads + (i < total % options.threads);
+		first += threads[i].number_of_players;
+		if((threads[i].epfd = epoll_create1(0)) < 0 || pthread_create(&threads[i].thread, NULL, loadgen_thread, &threads[i])) {
+			fprintf(stderr, "error on starting thread %lu\n", i);
+			return 1;
+		}
+	}
+	alarm(options.duration);
+	for(i = 0; i < options.threads; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		close(threads[i].epfd);
+	}
+	print_results((stats_now() - start) / 1e9);
+	free(threads);
+	free(players);
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include "lobby.h"
+#include "log.h"
+
+static struct {
+	struct game_boards_array *games;
+	struct lobby_snapshot *_Atomic current;
+	atomic_uint epoch;
+	atomic_ulong readers[2]; // readers of the epochs with an even and with an odd number
+	char running;
+	pthread_t publisher;
+	pthread_mutex_t monitor;
+	pthread_cond_t stop;
+} lobby = { .monitor = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER };
+
+/*
+ * copies the open games of the registry, NULL if there is no memory for the copy
+ * */
+static struct lobby_snapshot* lobby_collect(void)
+{
+	struct game_boards_array *games = lobby.games;
+	struct lobby_snapshot *snapshot;
+	struct lobby_game *entry;
+	struct game_board *game;
+	User *host;
+	size_t i;
+	pthread_mutex_lock(&games->monitor);
+	snapshot = malloc(sizeof(struct lobby_snapshot) + sizeof(struct lobby_game) * games->number_of_elements);
+	if(!snapshot) {
+		pthread_mutex_unlock(&games->monitor);
+		return NULL;
+	}
+	snapshot->number_of_games = 0;
+	for(i = 0; i < games->number_of_elements; ++i) {
+		game = games->array[i];
+		pthread_mutex_lock(&game->monitor);
+		if(game_is_open(game)) {
+			entry = &snapshot->games[snapshot->number_of_games++];
+			host = game->player_1 ? game->player_1 : game->player_2;
+			memset(entry->host, 0, sizeof(entry->host));
+			if(host) {
+				memcpy(entry->host, host->username, USERNAMELEN);
+			}
+			entry->id = game->id;
+			entry->board_size = game->board_size;
+			entry->created_at = game->created_at;
+		}
+		pthread_mutex_unlock(&game->monitor);
+	}
+	pthread_mutex_unlock(&games->monitor);
+	return snapshot;
+}
+
+/*
+ * swaps in snapshot and frees the one it replaces once nobody reads it any more. the publisher is the
+ * only writer, so the epoch moves on by one per swap.
+ * */
+static void lobby_publish(struct lobby_snapshot *snapshot)
+{
+	struct lobby_snapshot *previous = atomic_exchange(&lobby.current, snapshot);
+	unsigned int epoch = atomic_fetch_add(&lobby.epoch, 1);
+	while(atomic_load(&lobby.readers[epoch & 1])) { // a reader holds a page's worth of encoding at most
+		sched_yield();
+	}
+	free(previous);
+}
+
+static void* lobby_publisher(void *arg)
+{
+	struct lobby_snapshot *snapshot;
+	struct timespec deadline;
+	(void) arg;
+	pthread_mutex_lock(&lobby.monitor);
+	while(lobby.running) {
+		pthread_mutex_unlock(&lobby.monitor);
+		if((snapshot = lobby_collect())) {
+			lobby_publish(snapshot);
+		} else {
+			log_error("lobby: cannot allocate a snapshot of the open games");
+		}
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LOBBY_PUBLISH_MS * 1000000l;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+		deadline.tv_nsec %= 1000000000l;
+		pthread_mutex_lock(&lobby.monitor);
+		while(lobby.running && pthread_cond_timedwait(&lobby.stop, &lobby.monitor, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&lobby.monitor);
+	return NULL;
+}
+
+int lobby_start(struct game_boards_array *games)
+{
+	struct lobby_snapshot *snapshot;
+	if(!games) {
+		return -3;
+	}
+	lobby.games = games;
+	if(!(snapshot = lobby_collect())) { // the first snapshot is there before the first connection
+		return -4;
+	}
+	atomic_store(&lobby.current, snapshot);
+	lobby.running = 1;
+	if(pthread_create(&lobby.publisher, NULL, lobby_publisher, NULL)) {
+		lobby.running = 0;
+		free(atomic_exchange(&lobby.current, NULL));
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * readers that come after this see no snapshot, i.e. an empty lobby
+ * */
+void lobby_stop(void)
+{
+	pthread_mutex_lock(&lobby.monitor);
+	if(!lobby.running) {
+		pthread_mutex_unlock(&lobby.monitor);
+		return;
+	}
+	lobby.running = 0;
+	pthread_cond_signal(&lobby.stop);
+	pthread_mutex_unlock(&lobby.monitor);
+	pthread_join(lobby.publisher, NULL);
+	lobby_publish(NULL);
+}
+
+/*
+ * the current snapshot, NULL if the lobby is not running. it stays valid until lobby_read_end is called
+ * with the epoch stored here.
+ * */
+const struct lobby_snapshot* lobby_read_begin(unsigned int *epoch)
+{
+	unsigned int e;
+	while(1) {
+		e = atomic_load(&lobby.epoch);
+		atomic_fetch_add(&lobby.readers[e & 1], 1);
+		if(atomic_load(&lobby.epoch) == e) { // else the publisher may already wait for the other epoch
+			break;
+		}
+		atomic_fetch_sub(&lobby.readers[e & 1], 1);
+	}
+	*epoch = e;
+	return atomic_load(&lobby.current);
+}
+
+void lobby_read_end(unsigned int epoch)
+{
+	atomic_fetch_sub(&lobby.readers[epoch & 1], 1);
+}
@@ -0,0 +1,36 @@
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "game.h"
+
+/*
+ * the list of open games that LIST_GAMES_REQUEST pages through. a publisher thread copies the open games
+ * out of the registry every LOBBY_PUBLISH_MS into an immutable snapshot and swaps it in, readers never
+ * take the registry's lock. a reader pins the snapshot it reads with lobby_read_begin: readers count
+ * themselves in one of two epochs, the publisher moves on to the next epoch after the swap and frees the
+ * previous snapshot once the readers of the old epoch are gone.
+ * */
+#define LOBBY_PUBLISH_MS 100
+#define LOBBY_PAGE_LENGTH 6 // games per LIST_GAMES_REPLY, the longest page fits into BUFFER_LENGTH
+
+struct lobby_game {
+	uint32_t id;
+	char host[USERNAMELEN + 1]; // the player waiting in the game, empty for a restored game nobody sits in
+	size_t board_size;
+	time_t created_at;
+};
+
+struct lobby_snapshot {
+	size_t number_of_games;
+	struct lobby_game games[];
+};
+
+int lobby_start(struct game_boards_array *games);
+void lobby_stop(void);
+const struct lobby_snapshot* lobby_read_begin(unsigned int *epoch);
+void lobby_read_end(unsigned int epoch);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "log.h"
+
+#define LOG_RING_LENGTH 256 // entries per thread, must be a power of two
+#define LOG_IDLE_SLEEP_NS 10000000 // how long the logger sleeps when every ring was empty
+
+struct log_entry {
+	const char *format;
+	unsigned long arguments[LOG_MAX_ARGUMENTS];
+	struct timespec time;
+	unsigned char level, number_of_arguments;
+};
+
+/*
+ * single producer (the owning thread), single consumer (the logger thread) ring.
+ * head and tail only ever grow, the entry index is taken modulo the ring length.
+ * */
+struct log_ring {
+	struct log_entry entries[LOG_RING_LENGTH];
+	_Atomic size_t head, tail;
+	atomic_ulong dropped;
+	atomic_char orphaned; // set when the owning thread exits, the logger frees the ring once drained
+	struct log_ring *next;
+};
+
+volatile int log_level = LOG_INFO;
+
+static struct {
+	struct log_ring *rings;
+	pthread_mutex_t monitor; // protects the list of rings, taken on thread registration only
+	pthread_key_t key;
+	pthread_t thread;
+	atomic_char running;
+} logger = { .monitor = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct log_ring *thread_ring = NULL;
+
+static const char *level_names[] = {
+	[LOG_DEBUG] = "debug",
+	[LOG_INFO] = "info",
+	[LOG_WARNING] = "warning",
+	[LOG_ERROR] = "error"
+};
+
+static void log_ring_orphan(void *ring)
+{
+	atomic_store_explicit(&((struct log_ring*) ring)->orphaned, 1, memory_order_release);
+}
+
+static struct log_ring* log_ring_register(void)
+{
+	struct log_ring *ring = calloc(1, sizeof(struct log_ring));
+	if(!ring) {
+		return NULL;
+	}
+	pthread_mutex_lock(&logger.monitor);
+	ring->next = logger.rings;
+	logger.rings = ring;
+	pthread_mutex_unlock(&logger.monitor);
+	pthread_setspecific(logger.key, ring);
+	return ring;
+}
+
+void log_write(int level, const char *format, const unsigned long *arguments, unsigned int number_of_arguments)
+{
+	struct log_ring *ring = thread_ring;
+	struct log_entry *entry;
+	size_t head;
+	if(!ring) {
+		if(!atomic_load_explicit(&logger.running, memory_order_relaxed) || !(ring = thread_ring = log_ring_register())) {
+			return;
+		}
+	}
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_LENGTH) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	entry = &ring->entries[head & (LOG_RING_LENGTH - 1)];
+	if(number_of_arguments > LOG_MAX_ARGUMENTS) {
+		number_of_arguments = LOG_MAX_ARGUMENTS;
+	}
+	entry->format = format;
+	memcpy(entry->arguments, arguments, number_of_arguments * sizeof(unsigned long));
+	entry->number_of_arguments = number_of_arguments;
+	entry->level = level;
+	clock_gettime(CLOCK_REALTIME, &entry->time);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void print_unsigned(FILE *output, unsigned long value, unsigned int base)
+{
+	char digits[24];
+	int i = 0;
+	do {
+		digits[i++] = "0123456789abcdef"[value % base];
+		value /= base;
+	} while(value);
+	while(i) {
+		putc(digits[--i], output);
+	}
+}
+
+/*
+ * a minimal printf that takes its arguments from the entry instead of a va_list
+ */
+static void log_format(FILE *output, const struct log_entry *entry)
+{
+	unsigned int argument = 0;
+	unsigned long value;
+	char length;
+	for(const char *c = entry->format; *c; ++c) {
+		if(*c != '%') {
+			putc(*c, output);
+			continue;
+		}
+		if(*++c == '%') {
+			putc('%', output);
+			continue;
+		}
+		for(length = 0; *c == 'l' || *c == 'z' || *c == 'h'; ++c) {
+			length = *c;
+		}
+		if(!*c) {
+			break;
+		}
+		value = argument < entry->number_of_arguments ? entry->arguments[argument++] : 0;
+		switch(*c) {
+			case 'd': case 'i': {
+				long signed_value = length == 'l' || length == 'z' ? (long) value : (long)(int) value;
+				if(signed_value < 0) {
+					putc('-', output);
+					value = -(unsigned long) signed_value;
+				}
+				print_unsigned(output, value, 10);
+			} break;
+			case 'u': print_unsigned(output, length ? value : (unsigned int) value, 10); break;
+			case 'x': print_unsigned(output, length ? value : (unsigned int) value, 16); break;
+			case 'p': fputs("0x", output); print_unsigned(output, value, 16); break;
+			case 'c': putc((unsigned char) value, output); break;
+			case 's': fputs(value ? (const char*) value : "(null)", output); break;
+			default: putc('%', output); putc(*c, output); break;
+		}
+	}
+	putc('\n', output);
+}
+
+static int log_drain(void)
+{
+	struct log_ring *ring, **link;
+	struct log_entry *entry;
+	size_t head, tail;
+	unsigned long dropped;
+	char orphaned;
+	struct tm time_fields;
+	FILE *output;
+	int count = 0;
+	pthread_mutex_lock(&logger.monitor);
+	link = &logger.rings;
+	while((ring = *link)) {
+		pthread_mutex_unlock(&logger.monitor); // new rings are only ever pushed in front of this one
+		orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for(tail = atomic_load_explicit(&ring->tail, memory_order_relaxed); tail != head; ++tail) {
+			entry = &ring->entries[tail & (LOG_RING_LENGTH - 1)];
+			output = entry->level >= LOG_WARNING ? stderr : stdout;
+			localtime_r(&entry->time.tv_sec, &time_fields);
+			fprintf(output, "%02d:%02d:%02d.%06ld %s: ", time_fields.tm_hour, time_fields.tm_min,
+				time_fields.tm_sec, entry->time.tv_nsec / 1000, level_names[entry->level]);
+			log_format(output, entry);
+			count++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		if((dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed))) {
+			fprintf(stderr, "logger: %lu messages dropped, ring full\n", dropped);
+		}
+		pthread_mutex_lock(&logger.monitor);
+		while(*link != ring) { // rings registered meanwhile were pushed between link and ring
+			link = &(*link)->next;
+		}
+		if(orphaned) {
+			*link = ring->next;
+			free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+	pthread_mutex_unlock(&logger.monitor);
+	if(count) {
+		fflush(stdout);
+	}
+	return count;
+}
+
+static void* log_thread(void *arg)
+{
+	(void) arg;
+	struct timespec idle = { .tv_sec = 0, .tv_nsec = LOG_IDLE_SLEEP_NS };
+	while(atomic_load(&logger.running)) {
+		if(!log_drain()) {
+			nanosleep(&idle, NULL);
+		}
+	}
+	log_drain();
+	return NULL;
+}
+
+int log_set_level(const char *name)
+{
+	for(int i = LOG_DEBUG; i <= LOG_ERROR; ++i) {
+		if(!strcasecmp(name, level_names[i])) {
+			log_level = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int log_start(void)
+{
+	if(pthread_key_create(&logger.key, log_ring_orphan)) {
+		return -1;
+	}
+	atomic_store(&logger.running, 1);
+	if(pthread_create(&logger.thread, NULL, log_thread, NULL)) {
+		atomic_store(&logger.running, 0);
+		pthread_key_delete(logger.key);
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * flushes whatever is still queued, messages logged after this are discarded
+ * */
+void log_stop(void)
+{
+	if(!atomic_exchange(&logger.running, 0)) {
+		return;
+	}
+	pthread_join(logger.thread, NULL);
+}
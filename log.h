@@ -0,0 +1,48 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+ * asynchronous logger. a log call copies the format pointer and up to LOG_MAX_ARGUMENTS integer
+ * arguments into a lock-free ring owned by the calling thread, formatting and output happen later
+ * on the logger's own thread. because formatting is deferred:
+ * - arguments are widened to unsigned long, pointers have to be cast explicitly,
+ * - floating point arguments are not supported,
+ * - %s arguments must stay valid after the call returns (string literals, argv, strerror).
+ * supported conversions are %d %i %u %x %c %s %p %% with optional l, z and h length modifiers.
+ * messages below LOG_COMPILED_LEVEL are removed at compile time, e.g. -DLOG_COMPILED_LEVEL=LOG_INFO
+ * strips every debug message from the binary. the runtime threshold is set with log_set_level.
+ * */
+
+enum {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARNING,
+	LOG_ERROR
+};
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_MAX_ARGUMENTS 6
+
+extern volatile int log_level;
+
+#define log_at(level, format, ...) do { \
+	if((level) >= LOG_COMPILED_LEVEL && (level) >= log_level) { \
+		log_write((level), (format), (const unsigned long[]){ 0, ##__VA_ARGS__ } + 1, \
+			sizeof((const unsigned long[]){ 0, ##__VA_ARGS__ }) / sizeof(unsigned long) - 1); \
+	} \
+} while(0)
+
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_warning(...) log_at(LOG_WARNING, __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+
+void log_write(int level, const char *format, const unsigned long *arguments, unsigned int number_of_arguments);
+int log_set_level(const char *name);
+int log_start(void);
+void log_stop(void);
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "matchmaker.h"
+#include "metrics.h"
+#include "stats.h"
+
+struct match_queue {
+	struct match_ticket *head, *tail;
+};
+
+static struct {
+	struct match_queue queues[MATCHMAKER_BUCKETS];
+	struct matchmaker_callbacks callbacks;
+	char running;
+	pthread_t thread;
+	pthread_mutex_t monitor;
+	pthread_cond_t stop, done; // done: a callback returned
+} matchmaker = { .monitor = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+static void matchmaker_remove(struct match_ticket *ticket)
+{
+	struct match_queue *queue = &matchmaker.queues[ticket->bucket];
+	if(ticket->previous) {
+		ticket->previous->next = ticket->next;
+	} else {
+		queue->head = ticket->next;
+	}
+	if(ticket->next) {
+		ticket->next->previous = ticket->previous;
+	} else {
+		queue->tail = ticket->previous;
+	}
+	ticket->previous = ticket->next = NULL;
+	gauge_add(gauges.matchmaking, -1);
+}
+
+/*
+ * the oldest other ticket of the nearest bucket at most window buckets away, lower buckets first
+ * */
+static struct match_ticket* matchmaker_find_partner(const struct match_ticket *ticket, unsigned long window)
+{
+	struct match_ticket *partner;
+	unsigned long distance;
+	long bucket;
+	int side;
+	for(distance = 0; distance <= window && distance < MATCHMAKER_BUCKETS; ++distance) {
+		for(side = -1; side <= 1; side += 2) {
+			bucket = (long) ticket->bucket + side * (long) distance;
+			if(bucket < 0 || bucket >= MATCHMAKER_BUCKETS || (!distance && side > 0)) {
+				continue;
+			}
+			for(partner = matchmaker.queues[bucket].head; partner == ticket; partner = partner->next);
+			if(partner) {
+				return partner;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * one pairing tick. the pairs and the given up tickets are taken out of the queues under the lock and
+ * chained through partner, the callbacks run after the lock is released.
+ * */
+static void matchmaker_tick(void)
+{
+	struct match_ticket *ticket, *next, *partner, *paired = NULL, *expired = NULL;
+	unsigned long now = stats_now(), waited;
+	pthread_mutex_lock(&matchmaker.monitor);
+	for(unsigned int bucket = 0; bucket < MATCHMAKER_BUCKETS; ++bucket) {
+		for(ticket = matchmaker.queues[bucket].head; ticket; ticket = next) {
+			next = ticket->next;
+			waited = (now - ticket->enqueued_at) / 1000000ul;
+			if(waited >= MATCHMAKER_MAX_WAIT_MS) {
+				matchmaker_remove(ticket);
+				ticket->state = MATCH_PAIRING;
+				ticket->partner = expired;
+				expired = ticket;
+				continue;
+			}
+			if(!(partner = matchmaker_find_partner(ticket, 1 + waited / MATCHMAKER_WIDEN_MS))) {
+				continue;
+			}
+			if(partner == next) {
+				next = partner->next;
+			}
+			matchmaker_remove(ticket);
+			matchmaker_remove(partner);
+			ticket->state = partner->state = MATCH_PAIRING;
+			partner->partner = paired; // the list runs through the partners, a ticket points to its partner
+			ticket->partner = partner;
+			paired = ticket;
+		}
+	}
+	pthread_mutex_unlock(&matchmaker.monitor);
+	while(paired) {
+		ticket = paired;
+		partner = ticket->partner;
+		paired = partner->partner;
+		ticket->partner = partner->partner = NULL;
+		matchmaker.callbacks.pair(ticket, partner);
+		stats_record(STATS_MATCH_WAIT, ticket->game ? MATCH_FOUND_NOTIFY : MATCH_EXPIRED_NOTIFY, now - ticket->enqueued_at);
+		stats_record(STATS_MATCH_WAIT, partner->game ? MATCH_FOUND_NOTIFY : MATCH_EXPIRED_NOTIFY, now - partner->enqueued_at);
+		pthread_mutex_lock(&matchmaker.monitor);
+		ticket->state = partner->state = MATCH_DONE;
+		pthread_cond_broadcast(&matchmaker.done);
+		pthread_mutex_unlock(&matchmaker.monitor);
+	}
+	while(expired) {
+		ticket = expired;
+		expired = ticket->partner;
+		ticket->partner = NULL;
+		ticket->game = NULL;
+		matchmaker.callbacks.expire(ticket);
+		stats_record(STATS_MATCH_WAIT, MATCH_EXPIRED_NOTIFY, now - ticket->enqueued_at);
+		pthread_mutex_lock(&matchmaker.monitor);
+		ticket->state = MATCH_DONE;
+		pthread_cond_broadcast(&matchmaker.done);
+		pthread_mutex_unlock(&matchmaker.monitor);
+	}
+}
+
+static void* matchmaker_thread(void *arg)
+{
+	struct timespec deadline;
+	(void) arg;
+	pthread_mutex_lock(&matchmaker.monitor);
+	while(matchmaker.running) {
+		pthread_mutex_unlock(&matchmaker.monitor);
+		matchmaker_tick();
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += MATCHMAKER_TICK_MS * 1000000l;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+		deadline.tv_nsec %= 1000000000l;
+		pthread_mutex_lock(&matchmaker.monitor);
+		while(matchmaker.running && pthread_cond_timedwait(&matchmaker.stop, &matchmaker.monitor, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&matchmaker.monitor);
+	return NULL;
+}
+
+int matchmaker_start(const struct matchmaker_callbacks *callbacks)
+{
+	if(!callbacks || !callbacks->pair || !callbacks->expire) {
+		return -3;
+	}
+	matchmaker.callbacks = *callbacks;
+	matchmaker.running = 1;
+	if(pthread_create(&matchmaker.thread, NULL, matchmaker_thread, NULL)) {
+		matchmaker.running = 0;
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * tickets still queued stay queued, their owners take them back with matchmaker_collect
+ * */
+void matchmaker_stop(void)
+{
+	pthread_mutex_lock(&matchmaker.monitor);
+	if(!matchmaker.running) {
+		pthread_mutex_unlock(&matchmaker.monitor);
+		return;
+	}
+	matchmaker.running = 0;
+	pthread_cond_signal(&matchmaker.stop);
+	pthread_mutex_unlock(&matchmaker.monitor);
+	pthread_join(matchmaker.thread, NULL);
+}
+
+/*
+ * queues ticket, the caller sets user, fd, multiplexed, games and rating. the ticket belongs to the
+ * matchmaker until matchmaker_collect gives it back.
+ * */
+int matchmaker_enqueue(struct match_ticket *ticket)
+{
+	struct match_queue *queue;
+	if(!ticket) {
+		return -3;
+	}
+	ticket->enqueued_at = stats_now();
+	ticket->game = NULL;
+	ticket->state = MATCH_QUEUED;
+	ticket->bucket = ticket->rating < 0 ? 0 : ticket->rating / MATCHMAKER_BUCKET_WIDTH;
+	ticket->bucket = ticket->bucket < MATCHMAKER_BUCKETS ? ticket->bucket : MATCHMAKER_BUCKETS - 1;
+	ticket->partner = ticket->next = NULL;
+	pthread_mutex_lock(&matchmaker.monitor);
+	if(!matchmaker.running) {
+		pthread_mutex_unlock(&matchmaker.monitor);
+		return -1;
+	}
+	queue = &matchmaker.queues[ticket->bucket];
+	ticket->previous = queue->tail;
+	if(queue->tail) {
+		queue->tail->next = ticket;
+	} else {
+		queue->head = ticket;
+	}
+	queue->tail = ticket;
+	gauge_add(gauges.matchmaking, 1);
+	pthread_mutex_unlock(&matchmaker.monitor);
+	return 0;
+}
+
+/*
+ * returns 0 if the ticket is done, ticket->game holds the outcome and the ticket belongs to the caller
+ * again. a ticket that is still queued is taken out of its queue with cancel, else 1 is returned and it
+ * stays queued. waits while the ticket is handed to a callback.
+ * */
+int matchmaker_collect(struct match_ticket *ticket, char cancel)
+{
+	pthread_mutex_lock(&matchmaker.monitor);
+	while(ticket->state == MATCH_PAIRING) {
+		pthread_cond_wait(&matchmaker.done, &matchmaker.monitor);
+	}
+	if(ticket->state == MATCH_QUEUED) {
+		if(!cancel) {
+			pthread_mutex_unlock(&matchmaker.monitor);
+			return 1;
+		}
+		matchmaker_remove(ticket);
+		ticket->state = MATCH_DONE;
+	}
+	pthread_mutex_unlock(&matchmaker.monitor);
+	return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef MATCHMAKER_H
+#define MATCHMAKER_H
+
+#include <stdint.h>
+#include "game.h"
+
+/*
+ * pairs players of similar rating. a waiting player is a ticket in the queue of its rating bucket, every
+ * bucket is MATCHMAKER_BUCKET_WIDTH rating points wide and first in, first out. the matchmaker thread
+ * pairs the queued tickets every MATCHMAKER_TICK_MS: a ticket is matched with the oldest ticket of the
+ * nearest bucket within its window, which starts at the neighbouring buckets and grows by one bucket on
+ * either side every MATCHMAKER_WIDEN_MS it waited. so finding a partner looks at a bounded number of
+ * queues and does not depend on the number of waiting players. a ticket that waited MATCHMAKER_MAX_WAIT_MS
+ * is given up.
+ *
+ * the pairs and the given up tickets are handed to the callbacks outside of the matchmaker's lock, the
+ * callbacks set ticket->game. the owner of a ticket learns the outcome with matchmaker_collect.
+ * */
+#define MATCHMAKER_TICK_MS 100
+#define MATCHMAKER_BUCKET_WIDTH 50
+#define MATCHMAKER_BUCKETS 64 // ratings from 3150 on share the last bucket
+#define MATCHMAKER_WIDEN_MS 2000
+#define MATCHMAKER_MAX_WAIT_MS 30000
+
+enum {
+	MATCH_QUEUED,
+	MATCH_PAIRING, // handed to a callback
+	MATCH_DONE
+};
+
+struct match_ticket {
+	User *user;
+	int fd;
+	char multiplexed;
+	struct game_boards_array *games; // the registry the game is added to
+	int rating;
+	unsigned long enqueued_at; // nanoseconds, stats_now() clock
+	struct game_board *game; // the game the ticket was matched into, NULL if none was found in time
+	char state; // MATCH_*
+	unsigned int bucket;
+	struct match_ticket *previous, *next, *partner;
+};
+
+struct matchmaker_callbacks {
+	void (*pair)(struct match_ticket *ticket, struct match_ticket *partner);
+	void (*expire)(struct match_ticket *ticket);
+};
+
+int matchmaker_start(const struct matchmaker_callbacks *callbacks);
+void matchmaker_stop(void);
+int matchmaker_enqueue(struct match_ticket *ticket);
+int matchmaker_collect(struct match_ticket *ticket, char cancel);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "stats.h"
+#include "log.h"
+
+#define METRICS_RESPONSE_LENGTH (16 * 1024)
+
+static struct {
+	int listener;
+	int stop[2]; // a pipe written to when the listener is released
+	pthread_t thread;
+	char running;
+} metrics = { .listener = -1 };
+
+struct server_gauges gauges;
+
+static long process_threads(void)
+{
+	char line[128];
+	long threads = 0;
+	FILE *status = fopen("/proc/self/status", "r");
+	if(!status) {
+		return 0;
+	}
+	while(fgets(line, sizeof(line), status)) {
+		if(!strncmp(line, "Threads:", 8)) {
+			threads = strtol(line + 8, NULL, 10);
+			break;
+		}
+	}
+	fclose(status);
+	return threads;
+}
+
+#define append(...) do { \
+	int written = snprintf(body + length, METRICS_RESPONSE_LENGTH - length, __VA_ARGS__); \
+	if(written > 0 && (size_t) written < METRICS_RESPONSE_LENGTH - length) { \
+		length += written; \
+	} \
+} while(0)
+
+static size_t metrics_render(char *body)
+{
+	struct stats_summary summary;
+	struct mallinfo2 memory = mallinfo2();
+	size_t length = 0;
+	append("# HELP tictactoe_connections Client connections being served.\n# TYPE tictactoe_connections gauge\n");
+	append("tictactoe_connections %ld\n", atomic_load(&gauges.connections));
+	append("# HELP tictactoe_games Games in the registry.\n# TYPE tictactoe_games gauge\n");
+	append("tictactoe_games %ld\n", atomic_load(&gauges.games));
+	append("# HELP tictactoe_open_games Games waiting for a second player.\n# TYPE tictactoe_open_games gauge\n");
+	append("tictactoe_open_games %ld\n", atomic_load(&gauges.open_games));
+	append("# HELP tictactoe_registry_size Allocated slots of the game registry.\n# TYPE tictactoe_registry_size gauge\n");
+	append("tictactoe_registry_size %ld\n", atomic_load(&gauges.registry_size));
+	append("# HELP tictactoe_spectators Sessions watching games.\n# TYPE tictactoe_spectators gauge\n");
+	append("tictactoe_spectators %ld\n", atomic_load(&gauges.spectators));
+	append("# HELP tictactoe_matchmaking Sessions waiting for the matchmaker.\n# TYPE tictactoe_matchmaking gauge\n");
+	append("tictactoe_matchmaking %ld\n", atomic_load(&gauges.matchmaking));
+	append("# HELP tictactoe_pending_requests Requests being handled.\n# TYPE tictactoe_pending_requests gauge\n");
+	append("tictactoe_pending_requests %ld\n", atomic_load(&gauges.pending));
+	append("# HELP tictactoe_rejected_connections_total Connections turned away because the server was busy.\n# TYPE tictactoe_rejected_connections_total counter\n");
+	append("tictactoe_rejected_connections_total %ld\n", atomic_load(&gauges.rejected));
+	append("# HELP tictactoe_shed_requests_total Requests answered with SERVER_BUSY.\n# TYPE tictactoe_shed_requests_total counter\n");
+	append("tictactoe_shed_requests_total %ld\n", atomic_load(&gauges.shed));
+	append("# HELP tictactoe_threads Threads of the server process.\n# TYPE tictactoe_threads gauge\n");
+	append("tictactoe_threads %ld\n", process_threads());
+	append("# HELP tictactoe_heap_bytes Heap memory in use.\n# TYPE tictactoe_heap_bytes gauge\n");
+	append("tictactoe_heap_bytes %zu\n", memory.uordblks + memory.hblkhd);
+	struct stats_summary summaries[STATS_OPCODES];
+	for(unsigned char opcode = 0; opcode < STATS_OPCODES; ++opcode) {
+		stats_opcode_summary(opcode, &summaries[opcode]);
+	}
+	// every sample of a metric family has to follow its TYPE line in one group
+	append("# HELP tictactoe_requests_total Requests handled.\n# TYPE tictactoe_requests_total counter\n");
+	for(unsigned char opcode = 0; opcode < STATS_OPCODES; ++opcode) {
+		if(stats_opcode_names[opcode] && opcode < STATS_MATCH_WAIT) {
+			append("tictactoe_requests_total{opcode=\"%s\"} %lu\n", stats_opcode_names[opcode], summaries[opcode].count);
+		}
+	}
+	append("# HELP tictactoe_request_errors_total Requests answered with an error code.\n# TYPE tictactoe_request_errors_total counter\n");
+	for(unsigned char opcode = 0; opcode < STATS_OPCODES; ++opcode) {
+		if(stats_opcode_names[opcode] && opcode < STATS_MATCH_WAIT) {
+			append("tictactoe_request_errors_total{opcode=\"%s\"} %lu\n", stats_opcode_names[opcode], summaries[opcode].errors);
+		}
+	}
+	append("# HELP tictactoe_request_latency_seconds Request handling latency.\n# TYPE tictactoe_request_latency_seconds summary\n");
+	for(unsigned char opcode = 0; opcode < STATS_OPCODES; ++opcode) {
+		if(!stats_opcode_names[opcode] || opcode >= STATS_MATCH_WAIT) {
+			continue;
+		}
+		summary = summaries[opcode];
+		append("tictactoe_request_latency_seconds{opcode=\"%s\",quantile=\"0.5\"} %.9f\n", stats_opcode_names[opcode], summary.p50 / 1e9);
+		append("tictactoe_request_latency_seconds{opcode=\"%s\",quantile=\"0.99\"} %.9f\n", stats_opcode_names[opcode], summary.p99 / 1e9);
+		append("tictactoe_request_latency_seconds{opcode=\"%s\",quantile=\"0.999\"} %.9f\n", stats_opcode_names[opcode], summary.p999 / 1e9);
+		append("tictactoe_request_latency_seconds_count{opcode=\"%s\"} %lu\n", stats_opcode_names[opcode], summary.count);
+	}
+	summary = summaries[STATS_MATCH_WAIT];
+	append("# HELP tictactoe_matchmaking_wait_seconds Time from MATCHMAKE_REQUEST to a match or giving up.\n"
+		"# TYPE tictactoe_matchmaking_wait_seconds summary\n");
+	append("tictactoe_matchmaking_wait_seconds{quantile=\"0.5\"} %.9f\n", summary.p50 / 1e9);
+	append("tictactoe_matchmaking_wait_seconds{quantile=\"0.99\"} %.9f\n", summary.p99 / 1e9);
+	append("tictactoe_matchmaking_wait_seconds{quantile=\"0.999\"} %.9f\n", summary.p999 / 1e9);
+	append("tictactoe_matchmaking_wait_seconds_count %lu\n", summary.count);
+	append("# HELP tictactoe_class_latency_seconds Request latency by class, waiting for a worker included.\n"
+		"# TYPE tictactoe_class_latency_seconds summary\n");
+	for(unsigned char opcode = STATS_CLASS_GAME; opcode <= STATS_CLASS_AUTH; ++opcode) {
+		summary = summaries[opcode];
+		const char *class = stats_opcode_names[opcode] + 6; // without class_
+		append("tictactoe_class_latency_seconds{class=\"%s\",quantile=\"0.5\"} %.9f\n", class, summary.p50 / 1e9);
+		append("tictactoe_class_latency_seconds{class=\"%s\",quantile=\"0.99\"} %.9f\n", class, summary.p99 / 1e9);
+		append("tictactoe_class_latency_seconds{class=\"%s\",quantile=\"0.999\"} %.9f\n", class, summary.p999 / 1e9);
+		append("tictactoe_class_latency_seconds_count{class=\"%s\"} %lu\n", class, summary.count);
+	}
+	return length;
+}
+
+/*
+ * answers every request with the metrics page, scrapers are expected to ask for /metrics
+ * */
+static void metrics_serve(int fd, char *body)
+{
+	char request[1024], header[256];
+	size_t length;
+	int header_length;
+	if(recv(fd, request, sizeof(request) - 1, 0) <= 0) {
+		return;
+	}
+	length = metrics_render(body);
+	header_length = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", length);
+	if(send(fd, header, header_length, MSG_NOSIGNAL) < 0 || send(fd, body, length, MSG_NOSIGNAL) < 0) {
+		log_warning("metrics: error on send: %s", (unsigned long) strerror(errno));
+	}
+}
+
+static void* metrics_thread(void *arg)
+{
+	struct pollfd fds[2] = { { .fd = metrics.listener, .events = POLLIN }, { .fd = metrics.stop[0], .events = POLLIN } };
+	char *body = malloc(METRICS_RESPONSE_LENGTH);
+	struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+	int fd;
+	(void) arg;
+	if(!body) {
+		log_error("metrics: cannot allocate the response buffer, listener stopped");
+		return NULL;
+	}
+	for(;;) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno != EINTR) {
+				log_warning("metrics: error on poll: %s", (unsigned long) strerror(errno));
+			}
+			continue;
+		}
+		if(fds[1].revents) {
+			break;
+		}
+		fd = accept(metrics.listener, NULL, NULL);
+		if(fd < 0) {
+			if(errno != EINTR) {
+				log_warning("metrics: error on accept: %s", (unsigned long) strerror(errno));
+			}
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)); // a stuck scraper must not block the next one forever
+		metrics_serve(fd, body);
+		close(fd);
+	}
+	free(body);
+	return NULL;
+}
+
+/*
+ * serves the metrics on fd, a listening socket, e.g. one taken over from the binary this one upgraded
+ * */
+int metrics_adopt(int fd)
+{
+	if(fd < 0 || metrics.running) {
+		return -3;
+	}
+	if(pipe(metrics.stop)) {
+		return -1;
+	}
+	metrics.listener = fd;
+	if(pthread_create(&metrics.thread, NULL, metrics_thread, NULL)) {
+		close(metrics.stop[0]);
+		close(metrics.stop[1]);
+		metrics.listener = -1;
+		return -2;
+	}
+	metrics.running = 1;
+	return 0;
+}
+
+/*
+ * starts the metrics listener on the loopback interface
+ * */
+int metrics_start(unsigned short port)
+{
+	struct sockaddr_in address;
+	int reuse = 1, ret_value;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if(bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+		close(fd);
+		return -1;
+	}
+	if((ret_value = metrics_adopt(fd))) {
+		close(fd);
+	}
+	return ret_value;
+}
+
+/*
+ * stops serving the metrics and returns the listening socket, still open, -1 if there is none
+ * */
+int metrics_release(void)
+{
+	int fd = metrics.listener;
+	if(!metrics.running) {
+		return -1;
+	}
+	if(write(metrics.stop[1], "", 1) != 1) {
+		log_warning("metrics: error on stopping the listener: %s", (unsigned long) strerror(errno));
+	}
+	pthread_join(metrics.thread, NULL);
+	close(metrics.stop[0]);
+	close(metrics.stop[1]);
+	metrics.listener = -1;
+	metrics.running = 0;
+	return fd;
+}
@@ -0,0 +1,31 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+
+/*
+ * gauges exported by the metrics listener. they are plain atomics updated next to the state they
+ * mirror, so a scrape never takes the registry's or a game's lock.
+ * */
+struct server_gauges {
+	atomic_long connections; // connections admitted and not closed yet
+	atomic_long pending; // requests being handled
+	atomic_long games; // games in the registry
+	atomic_long open_games; // games in the registry with a free seat
+	atomic_long registry_size; // array_size of the registry
+	atomic_long spectators; // sessions that spectate, until the writer thread closed them
+	atomic_long matchmaking; // sessions waiting for the matchmaker
+	atomic_long rejected; // connections turned away at accept, a counter
+	atomic_long shed; // requests answered with SERVER_BUSY, a counter
+};
+
+extern struct server_gauges gauges;
+
+#define gauge_add(gauge, value) atomic_fetch_add_explicit(&(gauge), (value), memory_order_relaxed)
+#define gauge_set(gauge, value) atomic_store_explicit(&(gauge), (value), memory_order_relaxed)
+
+int metrics_start(unsigned short port);
+int metrics_adopt(int fd);
+int metrics_release(void);
+
+#endif
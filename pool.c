@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "pool.h"
+#include "log.h"
+
+struct pool_queue {
+	struct pool_job *head, *tail;
+};
+
+static struct {
+	struct pool_queue queues[POOL_CLASSES];
+	pthread_t *workers;
+	unsigned int number_of_workers;
+	char running;
+	pthread_mutex_t monitor;
+	pthread_cond_t work;
+} pool = { .monitor = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER };
+
+/*
+ * the oldest job of the first class up to last that has one, the caller holds the monitor
+ * */
+static struct pool_job* pool_take(unsigned int last)
+{
+	struct pool_queue *queue;
+	struct pool_job *job;
+	for(unsigned int class = 0; class <= last; ++class) {
+		queue = &pool.queues[class];
+		if(queue->head) {
+			job = queue->head;
+			queue->head = job->next;
+			if(!queue->head) {
+				queue->tail = NULL;
+			}
+			job->next = NULL;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * runs the jobs of the classes up to the one given as arg, until the pool stops and the queues are empty
+ * */
+static void* pool_worker(void *arg)
+{
+	unsigned int last = (uintptr_t) arg;
+	struct pool_job *job;
+	if(last == POOL_AUTH && setpriority(PRIO_PROCESS, syscall(SYS_gettid), POOL_AUTH_NICE)) { // a thread's nice is its own on linux
+		log_warning("pool: error setting the nice of a worker: %s", (unsigned long) strerror(errno));
+	}
+	pthread_mutex_lock(&pool.monitor);
+	for(;;) {
+		if(!(job = pool_take(last))) {
+			if(!pool.running) {
+				break;
+			}
+			pthread_cond_wait(&pool.work, &pool.monitor);
+			continue;
+		}
+		pthread_mutex_unlock(&pool.monitor);
+		job->run(job);
+		pthread_mutex_lock(&pool.monitor);
+		job->done = 1;
+		pthread_cond_signal(&job->finished);
+	}
+	pthread_mutex_unlock(&pool.monitor);
+	return NULL;
+}
+
+int pool_start(unsigned int workers)
+{
+	unsigned int auth_workers = (workers + POOL_AUTH_SHARE - 1) / POOL_AUTH_SHARE;
+	uintptr_t last;
+	if(!workers) {
+		return -3;
+	}
+	pool.workers = malloc(sizeof(pthread_t) * workers);
+	if(!pool.workers) {
+		return -2;
+	}
+	pool.running = 1;
+	for(pool.number_of_workers = 0; pool.number_of_workers < workers; ++pool.number_of_workers) {
+		last = pool.number_of_workers < workers - auth_workers ? POOL_LOBBY : POOL_AUTH;
+		if(pthread_create(&pool.workers[pool.number_of_workers], NULL, pool_worker, (void*) last)) {
+			pool_stop();
+			return -2;
+		}
+	}
+	return 0;
+}
+
+/*
+ * the workers run the jobs that are queued before they exit, later jobs are refused by pool_run
+ * */
+void pool_stop(void)
+{
+	pthread_mutex_lock(&pool.monitor);
+	if(!pool.running) {
+		pthread_mutex_unlock(&pool.monitor);
+		return;
+	}
+	pool.running = 0;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.monitor);
+	for(unsigned int i = 0; i < pool.number_of_workers; ++i) {
+		pthread_join(pool.workers[i], NULL);
+	}
+	free(pool.workers);
+	pool.workers = NULL;
+	pool.number_of_workers = 0;
+}
+
+/*
+ * queues job in class and waits until a worker ran it. returns -1 without running it if the pool is not
+ * running, the caller runs it itself then.
+ * */
+int pool_run(struct pool_job *job, unsigned int class)
+{
+	struct pool_queue *queue;
+	if(!job || !job->run || class >= POOL_CLASSES) {
+		return -3;
+	}
+	job->done = 0;
+	job->next = NULL;
+	if(pthread_cond_init(&job->finished, NULL)) {
+		return -2;
+	}
+	pthread_mutex_lock(&pool.monitor);
+	if(!pool.running) {
+		pthread_mutex_unlock(&pool.monitor);
+		pthread_cond_destroy(&job->finished);
+		return -1;
+	}
+	queue = &pool.queues[class];
+	if(queue->tail) {
+		queue->tail->next = job;
+	} else {
+		queue->head = job;
+	}
+	queue->tail = job;
+	if(class == POOL_LOBBY) { // every worker runs lobby jobs, only some run the other classes
+		pthread_cond_signal(&pool.work);
+	} else {
+		pthread_cond_broadcast(&pool.work);
+	}
+	while(!job->done) {
+		pthread_cond_wait(&job->finished, &pool.monitor);
+	}
+	pthread_mutex_unlock(&pool.monitor);
+	pthread_cond_destroy(&job->finished);
+	return 0;
+}
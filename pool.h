@@ -0,0 +1,38 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+/*
+ * a bounded pool of worker threads for the requests that may wait: the lobby's and the logins. every
+ * class has its run queue and an idle worker takes the oldest job of the first class with one, so lobby
+ * requests go before logins and sign ups. logins read the users file, only 1 / POOL_AUTH_SHARE of the
+ * workers run them, so a login storm leaves the others to the lobby. those workers run at a nice of
+ * POOL_AUTH_NICE, the kernel schedules the connection threads that carry the games' moves and the lobby's
+ * workers before them.
+ *
+ * a job lives on the stack of whoever runs it with pool_run, which returns once the job ran.
+ * */
+#define POOL_WORKERS 4
+#define POOL_AUTH_SHARE 2 // a half of the workers, rounded up, run logins
+#define POOL_AUTH_NICE 5
+
+enum {
+	POOL_LOBBY,
+	POOL_AUTH,
+	POOL_CLASSES
+};
+
+struct pool_job {
+	void (*run)(struct pool_job *job);
+	void *context; // owned by the caller
+	char done;
+	pthread_cond_t finished;
+	struct pool_job *next;
+};
+
+int pool_start(unsigned int workers);
+void pool_stop(void);
+int pool_run(struct pool_job *job, unsigned int class);
+
+#endif
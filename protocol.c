@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "protocol.h"
+#include "constants.h"
+
+/*
+ * LOGIN_REQUEST and CREATE_USER_REQUEST: opcode, username, null, password, null
+ * */
+size_t encode_credentials_request(char *buffer, unsigned char opcode, const char *username, const char *password)
+{
+	size_t usernamelen = strlen(username), passwordlen = strlen(password);
+	if(!usernamelen || !passwordlen || usernamelen > USERNAMELEN || passwordlen > PASSWORDLEN) {
+		return 0;
+	}
+	buffer[0] = opcode;
+	memcpy(buffer + 1, username, usernamelen + 1);
+	memcpy(buffer + usernamelen + 2, password, passwordlen + 1);
+	return 1 + usernamelen + passwordlen + 2; // opcode byte and two null terminators
+}
+
+/*
+ * requests without operands, e.g. LOGOUT_REQUEST or JOIN_RANDOM_GAME_REQUEST
+ * */
+size_t encode_request(char *buffer, unsigned char opcode)
+{
+	buffer[0] = opcode;
+	return 1;
+}
+
+/*
+ * ACTION_REQUEST: opcode, x, null, y, null with both coordinates in decimal
+ * */
+size_t encode_action_request(char *buffer, unsigned long x, unsigned long y)
+{
+	int n, n2;
+	buffer[0] = ACTION_REQUEST;
+	n = snprintf(buffer + 1, BUFFER_LENGTH / 2, "%lu", x);
+	n2 = snprintf(buffer + 1 + n + 1, BUFFER_LENGTH / 2, "%lu", y);
+	if(n <= 0 || n2 <= 0) {
+		return 0;
+	}
+	return 1 + n + n2 + 2;
+}
+
+/*
+ * requests that name a game and have no further operands, i.e. LEAVE_GAME_REQUEST and GAME_SNAPSHOT_REQUEST
+ * of a multiplexed session and SPECTATE_REQUEST: opcode, game id, null
+ * */
+size_t encode_game_request(char *buffer, unsigned char opcode, uint32_t game_id)
+{
+	int n;
+	buffer[0] = opcode;
+	n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u", game_id);
+	return n > 0 ? 1 + n + 1 : 0;
+}
+
+/*
+ * ACTION_REQUEST of a multiplexed session: opcode, game id, null, x, null, y, null
+ * */
+size_t encode_game_action_request(char *buffer, uint32_t game_id, unsigned long x, unsigned long y)
+{
+	int n;
+	size_t length;
+	n = snprintf(buffer + 1, BUFFER_LENGTH / 4, "%u", game_id);
+	if(n <= 0 || !(length = encode_action_request(buffer + n + 1, x, y))) {
+		return 0;
+	}
+	buffer[0] = ACTION_REQUEST; // encode_action_request wrote its opcode over the null after the id
+	buffer[n + 1] = '\0';
+	return n + 1 + length;
+}
+
+/*
+ * LIST_GAMES_REQUEST: opcode, index of the first open game to list, null
+ * */
+size_t encode_list_games_request(char *buffer, unsigned long first)
+{
+	int n;
+	buffer[0] = LIST_GAMES_REQUEST;
+	n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%lu", first);
+	return n > 0 ? 1 + n + 1 : 0;
+}
+
+/*
+ * TOURNAMENT_REQUEST: opcode, format ('k' or 'r'), number of players, null
+ * */
+size_t encode_tournament_request(char *buffer, char format, unsigned long players)
+{
+	int n;
+	buffer[0] = TOURNAMENT_REQUEST;
+	buffer[1] = format;
+	n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", players);
+	return n > 0 ? 2 + n + 1 : 0;
+}
+
+size_t encode_stats_request(char *buffer, unsigned char selector)
+{
+	buffer[0] = STATS_REQUEST;
+	buffer[1] = selector;
+	return 2;
+}
+
+static size_t skip_strings(const char *buffer, size_t length, size_t offset, size_t number_of_strings)
+{
+	const char *end;
+	while(number_of_strings--) {
+		if(offset >= length || !(end = memchr(buffer + offset, '\0', length - offset))) {
+			return 0;
+		}
+		offset = end - buffer + 1;
+	}
+	return offset;
+}
+
+/*
+ * the server does not frame its messages, several of them can arrive in one recv and a message
+ * can be split between two. returns the length of the message at the start of buffer,
+ * or 0 if length bytes do not hold all of it yet.
+ * */
+size_t server_message_length(const char *buffer, size_t length)
+{
+	size_t offset, end, cells;
+	if(!length) {
+		return 0;
+	}
+	switch((unsigned char) buffer[0]) {
+		case CREATE_NEW_GAME_SUCCESS:
+		case JOIN_RANDOM_GAME_REPLY:
+		case MATCH_FOUND_NOTIFY: return skip_strings(buffer, length, 2, 1); // player character, board size
+		case MATCHMAKE_REPLY: return skip_strings(buffer, length, 1, 1); // rating
+		case TOURNAMENT_REPLY: return skip_strings(buffer, length, 1, 2); // tournament id, players signed up
+		case TOURNAMENT_OVER_NOTIFY: return skip_strings(buffer, length, 1, 3); // tournament id, place, players
+		case ACTION_NOTIFY: return skip_strings(buffer, length, 2, 2); // whose turn, x, y
+		case GAME_IS_FINISHED: return length >= 2 ? 2 : 0; // result
+		case REMATCH_REPLY:
+		case REMATCH_NOTIFY: return length >= 2 ? 2 : 0; // character, null for an offer
+		case MOVE_TIMEOUT_NOTIFY: return length >= 2 ? 2 : 0; // result
+		case STATS_REPLY: return length >= 2 ? skip_strings(buffer, length, 2, (unsigned char) buffer[1]) : 0; // count, values
+		case LIST_GAMES_REPLY: { // count, number of open games, id, host, board size and age of every game
+			return length >= 2 ? skip_strings(buffer, length, 2, 1 + 4 * (size_t)(unsigned char) buffer[1]) : 0;
+		}
+		case SPECTATE_NOTIFY: { // game id, the character that moved, whose turn or the result, x, y
+			offset = skip_strings(buffer, length, 1, 1);
+			return offset ? skip_strings(buffer, length, offset + 2, 2) : 0;
+		}
+		case SPECTATE_REPLY:
+		case SPECTATE_SNAPSHOT_NOTIFY:
+		case GAME_SNAPSHOT_REPLY: { // game id, whose turn or the result, board size, the cells, number of moves, moves
+			offset = skip_strings(buffer, length, 1, 1);
+			if(!offset || !(end = skip_strings(buffer, length, offset + 1, 1))) {
+				return 0;
+			}
+			cells = strtoul(buffer + offset + 1, NULL, 10);
+			cells *= cells;
+			if(length - end <= cells) {
+				return 0;
+			}
+			end += cells;
+			return length - end > (unsigned char) buffer[end] ? end + 1 + (unsigned char) buffer[end] : 0;
+		}
+		default: return 1;
+	}
+}
+
+/*
+ * server_message_length for multiplexed sessions. replies that start a game and MATCH_FOUND_NOTIFY end with
+ * the game id, other notifications carry it right after their code, otherwise they are laid out as in other
+ * sessions.
+ * a game that ends with the other player's move is announced by an ACTION_NOTIFY whose turn is the
+ * result, so GAME_IS_FINISHED is always a reply.
+ * */
+size_t multiplexed_message_length(const char *buffer, size_t length)
+{
+	size_t offset;
+	if(!length) {
+		return 0;
+	}
+	switch((unsigned char) buffer[0]) {
+		case CREATE_NEW_GAME_SUCCESS:
+		case JOIN_RANDOM_GAME_REPLY:
+		case MATCH_FOUND_NOTIFY: return skip_strings(buffer, length, 2, 2); // player character, board size, game id
+		case OTHER_PLAYER_PRESENT_NOTIFY:
+		case PEER_LEFT_NOTIFY: return skip_strings(buffer, length, 1, 1); // game id
+		case ACTION_NOTIFY: { // game id, whose turn or the result, x, y
+			offset = skip_strings(buffer, length, 1, 1);
+			return offset ? skip_strings(buffer, length, offset + 1, 2) : 0;
+		}
+		case REMATCH_NOTIFY: // game id, character
+		case MOVE_TIMEOUT_NOTIFY: { // game id, result
+			offset = skip_strings(buffer, length, 1, 1);
+			return offset && length > offset ? offset + 1 : 0;
+		}
+		default: return server_message_length(buffer, length);
+	}
+}
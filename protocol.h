@@ -0,0 +1,47 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * encoders for client requests and framing of server messages, shared by the interactive client
+ * and the load generator. every encoder writes one request to buffer (at least BUFFER_LENGTH bytes)
+ * and returns its length in bytes, 0 if the operands do not fit.
+ *
+ * a session that sent MULTIPLEX_REQUEST names the game in every game-scoped request: LEAVE_GAME_REQUEST,
+ * ACTION_REQUEST, GAME_SNAPSHOT_REQUEST and REMATCH_REQUEST carry the game id right after the opcode. the server then adds the game id to the
+ * replies that start a game and right after the code of every notification, see multiplexed_message_length.
+ *
+ * SPECTATE_REQUEST carries a game id too, in every session. the messages about watched games carry it
+ * right after their code and are framed the same way whether the session is multiplexed or not.
+ *
+ * SPECTATE_REPLY, SPECTATE_SNAPSHOT_NOTIFY and GAME_SNAPSHOT_REPLY carry a whole game, so that a spectator
+ * or a player catches up in one message: game id, null, whose turn or the result, board size, null, the
+ * cells, the number of moves in one byte and the moves as cell indices (x * board size + y) in the order
+ * they were made. the moves are raw bytes and may be null.
+ *
+ * the game MATCHMAKE_REQUEST finds starts with MATCH_FOUND_NOTIFY, which is laid out like JOIN_RANDOM_GAME_REPLY
+ * in either kind of session. so do the games of a tournament, which only multiplexed sessions enter. the
+ * tournament's end, TOURNAMENT_OVER_NOTIFY, is not about a game and carries no game id.
+ *
+ * REMATCH_REPLY and REMATCH_NOTIFY carry one character: null while only one player asked for a rematch,
+ * else the player's character in the game that started again, uppercase if the player begins.
+ *
+ * a player who does not move within the server's move timeout loses the game, both players get a
+ * MOVE_TIMEOUT_NOTIFY with the result. the server also closes connections that do not log in or that
+ * send nothing within its login and idle timeouts, spectators excepted.
+ * */
+
+size_t encode_credentials_request(char *buffer, unsigned char opcode, const char *username, const char *password);
+size_t encode_request(char *buffer, unsigned char opcode);
+size_t encode_action_request(char *buffer, unsigned long x, unsigned long y);
+size_t encode_stats_request(char *buffer, unsigned char selector);
+size_t encode_list_games_request(char *buffer, unsigned long first);
+size_t encode_tournament_request(char *buffer, char format, unsigned long players);
+size_t encode_game_request(char *buffer, unsigned char opcode, uint32_t game_id);
+size_t encode_game_action_request(char *buffer, uint32_t game_id, unsigned long x, unsigned long y);
+size_t server_message_length(const char *buffer, size_t length);
+size_t multiplexed_message_length(const char *buffer, size_t length);
+
+#endif
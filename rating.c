@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "rating.h"
+#include "constants.h"
+
+struct rating_entry {
+	char username[USERNAMELEN + 1]; // empty for a free slot
+	double rating;
+};
+
+/*
+ * open addressing with linear probing, the table is doubled before it is half full
+ * */
+static struct {
+	struct rating_entry *table;
+	size_t size, number_of_users;
+	pthread_mutex_t monitor;
+} ratings = { .monitor = PTHREAD_MUTEX_INITIALIZER };
+
+static size_t rating_hash(const char *username)
+{
+	size_t hash = 14695981039346656037ul; // fnv-1a
+	for(; *username; ++username) {
+		hash = (hash ^ (unsigned char) *username) * 1099511628211ul;
+	}
+	return hash;
+}
+
+static struct rating_entry* rating_slot(struct rating_entry *table, size_t size, const char *username)
+{
+	size_t i = rating_hash(username) & (size - 1);
+	while(table[i].username[0] && strncmp(table[i].username, username, USERNAMELEN)) {
+		i = (i + 1) & (size - 1);
+	}
+	return &table[i];
+}
+
+static int rating_grow(void)
+{
+	size_t size = ratings.size ? ratings.size * 2 : 64;
+	struct rating_entry *table = calloc(size, sizeof(struct rating_entry));
+	if(!table) {
+		return -4;
+	}
+	for(size_t i = 0; i < ratings.size; ++i) {
+		if(ratings.table[i].username[0]) {
+			*rating_slot(table, size, ratings.table[i].username) = ratings.table[i];
+		}
+	}
+	free(ratings.table);
+	ratings.table = table;
+	ratings.size = size;
+	return 0;
+}
+
+/*
+ * the entry of username, created with RATING_INITIAL if there is none. only creating an entry may grow
+ * the table and move the other entries. the caller holds the monitor.
+ * */
+static struct rating_entry* rating_find(const char *username)
+{
+	struct rating_entry *entry;
+	if(ratings.size && (entry = rating_slot(ratings.table, ratings.size, username))->username[0]) {
+		return entry;
+	}
+	if((ratings.number_of_users + 1) * 2 > ratings.size && rating_grow()) {
+		return NULL;
+	}
+	entry = rating_slot(ratings.table, ratings.size, username);
+	strncpy(entry->username, username, USERNAMELEN);
+	entry->rating = RATING_INITIAL;
+	ratings.number_of_users++;
+	return entry;
+}
+
+/*
+ * a missing file is an empty table
+ * */
+int rating_load(const char *path)
+{
+	char username[USERNAMELEN + 1];
+	struct rating_entry *entry;
+	double rating;
+	FILE *input = fopen(path, "r");
+	if(!input) {
+		return 0;
+	}
+	pthread_mutex_lock(&ratings.monitor);
+	while(fscanf(input, "%4s %lf", username, &rating) == 2) {
+		if(!(entry = rating_find(username))) {
+			pthread_mutex_unlock(&ratings.monitor);
+			fclose(input);
+			return -4;
+		}
+		entry->rating = rating;
+	}
+	pthread_mutex_unlock(&ratings.monitor);
+	fclose(input);
+	return 0;
+}
+
+int rating_save(const char *path)
+{
+	FILE *output = fopen(path, "w");
+	int ret_value = 0;
+	if(!output) {
+		return -1;
+	}
+	pthread_mutex_lock(&ratings.monitor);
+	for(size_t i = 0; i < ratings.size; ++i) {
+		if(ratings.table[i].username[0] && fprintf(output, "%s %.1f\n", ratings.table[i].username, ratings.table[i].rating) < 0) {
+			ret_value = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ratings.monitor);
+	if(fclose(output)) {
+		ret_value = -1;
+	}
+	return ret_value;
+}
+
+int rating_get(const char *username)
+{
+	struct rating_entry *entry;
+	int rating = RATING_INITIAL;
+	pthread_mutex_lock(&ratings.monitor);
+	if(ratings.size) {
+		entry = rating_slot(ratings.table, ratings.size, username);
+		rating = entry->username[0] ? (int) lround(entry->rating) : RATING_INITIAL;
+	}
+	pthread_mutex_unlock(&ratings.monitor);
+	return rating;
+}
+
+/*
+ * result is the final whose_turn of the game: 'X', 'O' or 'D'
+ * */
+int rating_update(const char *player_x, const char *player_o, char result)
+{
+	struct rating_entry *x, *o;
+	double expected, score;
+	switch(result) {
+		case 'X': score = 1; break;
+		case 'O': score = 0; break;
+		case 'D': score = 0.5; break;
+		default: return -3;
+	}
+	pthread_mutex_lock(&ratings.monitor);
+	if(!rating_find(player_x) || !(o = rating_find(player_o))) {
+		pthread_mutex_unlock(&ratings.monitor);
+		return -4;
+	}
+	x = rating_find(player_x); // creating o may have moved x
+	expected = 1 / (1 + pow(10, (o->rating - x->rating) / 400));
+	x->rating += RATING_K * (score - expected);
+	o->rating -= RATING_K * (score - expected);
+	pthread_mutex_unlock(&ratings.monitor);
+	return 0;
+}
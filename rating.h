@@ -0,0 +1,17 @@
+#ifndef RATING_H
+#define RATING_H
+
+/*
+ * elo ratings of the users, kept in memory in a hash table by username and saved to a text file with
+ * one "username rating" line per user. every finished game between two seated players moves both
+ * ratings by up to RATING_K points, a user that never finished a game has RATING_INITIAL.
+ * */
+#define RATING_INITIAL 1500
+#define RATING_K 32
+
+int rating_load(const char *path);
+int rating_save(const char *path);
+int rating_get(const char *username);
+int rating_update(const char *player_x, const char *player_o, char result);
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "constants.h"
+#include "capture.h"
+#include "protocol.h"
+#include "stats.h"
+
+/*
+ * replays the requests of a capture (server --capture path) against a server. every captured
+ * connection is opened at its original time and sends its requests in the original order, at the
+ * original times scaled by --speed, or as fast as the replies come back with --flat-out. a request
+ * is never sent before the reply to the previous one arrived, the server reads one request per recv.
+ * the server's replies can differ from the captured ones, e.g. join_random_game picks another game,
+ * so the replay counts the replies whose code differs from the capture.
+ * */
+
+#define REPLAY_EVENTS 256
+#define REPLAY_TICK_MS 1
+#define REPLAY_NO_REQUEST 0xff
+
+enum {
+	REPLAY_WAITING, // not opened yet
+	REPLAY_CONNECTING,
+	REPLAY_OPEN,
+	REPLAY_DONE
+};
+
+struct replay_request {
+	uint64_t timestamp;
+	const char *data;
+	uint16_t length;
+};
+
+struct replay_connection {
+	uint64_t open_at, close_at;
+	struct replay_request *requests;
+	size_t number_of_requests, next_request;
+	unsigned char *replies; // first byte of every captured reply
+	size_t number_of_replies, next_reply;
+	int fd;
+	char state, seen;
+	char multiplexed; // framing switches once the server accepted a MULTIPLEX_REQUEST
+	unsigned char pending; // opcode of the request in flight, REPLAY_NO_REQUEST if none
+	unsigned long sent_at;
+	size_t received;
+	char buffer[BUFFER_LENGTH];
+};
+
+static struct {
+	struct sockaddr_in address;
+	double speed;
+	char flat_out;
+	unsigned long timeout;
+} options = { .speed = 1, .flat_out = 0, .timeout = 5 };
+
+static struct replay_connection *connections;
+static uint32_t number_of_connections;
+static unsigned long start, sent, mismatched, timeouts, connect_failures, disconnects, lag_total, lag_max;
+
+/*
+ * the whole capture is read into memory and indexed by connection. connection ids are assigned
+ * in accept order, so the connections are already sorted by open_at.
+ * */
+static char* load_capture(const char *path, size_t *size)
+{
+	FILE *input = fopen(path, "rb");
+	char *data;
+	long length;
+	if(!input || fseek(input, 0, SEEK_END) || (length = ftell(input)) < 0 || fseek(input, 0, SEEK_SET)) {
+		if(input) {
+			fclose(input);
+		}
+		return NULL;
+	}
+	data = malloc(length ? length : 1);
+	if(!data || fread(data, 1, length, input) != (size_t) length) {
+		free(data);
+		fclose(input);
+		return NULL;
+	}
+	fclose(input);
+	*size = length;
+	return data;
+}
+
+static int index_capture(char *data, size_t size, uint64_t *duration)
+{
+	struct capture_header header;
+	struct capture_record record;
+	struct replay_connection *connection;
+	size_t offset;
+	if(size < sizeof(header)) {
+		return -1;
+	}
+	memcpy(&header, data, sizeof(header));
+	if(header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+		return -1;
+	}
+	for(int pass = 0; pass < 3; ++pass) { // find the connections, count their messages, then fill in the messages
+		for(offset = sizeof(header); offset + sizeof(record) <= size; offset += sizeof(record) + record.length) {
+			memcpy(&record, data + offset, sizeof(record));
+			if(offset + sizeof(record) + record.length > size) {
+				break; // the server was killed in the middle of a write
+			}
+			*duration = record.timestamp;
+			if(!pass) {
+				number_of_connections = record.connection + 1 > number_of_connections ? record.connection + 1 : number_of_connections;
+				continue;
+			}
+			connection = &connections[record.connection];
+			switch(record.direction) {
+				case CAPTURE_OPEN: {
+					connection->seen = 1;
+					connection->open_at = record.timestamp;
+					connection->close_at = UINT64_MAX; // still open when the capture ended
+				} break;
+				case CAPTURE_CLOSE: connection->close_at = record.timestamp; break;
+				case CAPTURE_REQUEST: {
+					if(pass == 2) {
+						connection->requests[connection->number_of_requests].timestamp = record.timestamp;
+						connection->requests[connection->number_of_requests].data = data + offset + sizeof(record);
+						connection->requests[connection->number_of_requests].length = record.length;
+					}
+					connection->number_of_requests += record.length > 0;
+				} break;
+				case CAPTURE_REPLY: {
+					if(pass == 2) {
+						connection->replies[connection->number_of_replies] = data[offset + sizeof(record)];
+					}
+					connection->number_of_replies += record.length > 0;
+				} break;
+			}
+		}
+		if(!pass && !(connections = calloc(number_of_connections ? number_of_connections : 1, sizeof(struct replay_connection)))) {
+			return -4;
+		}
+		for(uint32_t i = 0; pass == 1 && i < number_of_connections; ++i) {
+			connections[i].requests = malloc((connections[i].number_of_requests + 1) * sizeof(struct replay_request));
+			connections[i].replies = malloc(connections[i].number_of_replies + 1);
+			if(!connections[i].requests || !connections[i].replies) {
+				return -4;
+			}
+			connections[i].number_of_requests = connections[i].number_of_replies = 0;
+		}
+	}
+	return 0;
+}
+
+static unsigned long scheduled(uint64_t timestamp)
+{
+	if(options.flat_out) {
+		return start;
+	}
+	return start + (unsigned long) (timestamp / options.speed);
+}
+
+static void connection_close(struct replay_connection *connection)
+{
+	if(connection->fd >= 0) {
+		close(connection->fd);
+	}
+	connection->fd = -1;
+	connection->state = REPLAY_DONE;
+}
+
+static void connection_open(struct replay_connection *connection, int epfd)
+{
+	struct epoll_event event = { .events = EPOLLOUT, .data.ptr = connection };
+	int one = 1;
+	connection->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(connection->fd < 0
+	|| (connect(connection->fd, (struct sockaddr*) &options.address, sizeof(options.address)) && errno != EINPROGRESS)
+	|| epoll_ctl(epfd, EPOLL_CTL_ADD, connection->fd, &event)) {
+		++connect_failures;
+		connection_close(connection);
+		return;
+	}
+	setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	connection->pending = REPLAY_NO_REQUEST;
+	connection->state = REPLAY_CONNECTING;
+}
+
+static void connection_connected(struct replay_connection *connection, int epfd)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if(getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) || error || epoll_ctl(epfd, EPOLL_CTL_MOD, connection->fd, &event)) {
+		++connect_failures;
+		connection_close(connection);
+		return;
+	}
+	connection->state = REPLAY_OPEN;
+}
+
+static void connection_message(struct replay_connection *connection, const char *message)
+{
+	unsigned char code = (unsigned char) message[0];
+	if(code == ACTION_NOTIFY || code == OTHER_PLAYER_PRESENT_NOTIFY || code == PEER_LEFT_NOTIFY || code == REMATCH_NOTIFY
+	|| (code == GAME_IS_FINISHED && connection->pending != ACTION_REQUEST && !connection->multiplexed)) {
+		return; // sent by the other player's thread
+	}
+	if(code == SPECTATE_NOTIFY || code == SPECTATE_SNAPSHOT_NOTIFY) {
+		return; // sent by the spectator writer, not captured
+	}
+	if(code == MATCH_FOUND_NOTIFY || code == MATCH_EXPIRED_NOTIFY || code == TOURNAMENT_OVER_NOTIFY || code == MOVE_TIMEOUT_NOTIFY) {
+		return; // sent by the matchmaker, the tournament workers or the timer wheel, not captured
+	}
+	if(connection->pending == REPLAY_NO_REQUEST) {
+		return;
+	}
+	stats_record(connection->pending, code, stats_now() - connection->sent_at);
+	if(code == MULTIPLEX_REPLY) {
+		connection->multiplexed = 1;
+	}
+	if(connection->next_reply < connection->number_of_replies && connection->replies[connection->next_reply] != code) {
+		++mismatched;
+	}
+	++connection->next_reply;
+	connection->pending = REPLAY_NO_REQUEST;
+}
+
+static void connection_receive(struct replay_connection *connection)
+{
+	ssize_t n;
+	size_t length;
+	for(;;) {
+		n = recv(connection->fd, connection->buffer + connection->received, BUFFER_LENGTH - connection->received, 0);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+		if(n <= 0) {
+			if(connection->pending != REPLAY_NO_REQUEST || connection->next_request < connection->number_of_requests) {
+				++disconnects; // the server closed the connection before the replay was done with it
+			}
+			connection_close(connection);
+			return;
+		}
+		connection->received += n;
+		while((length = (connection->multiplexed ? multiplexed_message_length : server_message_length)(connection->buffer,
+			connection->received))) {
+			connection_message(connection, connection->buffer);
+			connection->received -= length;
+			memmove(connection->buffer, connection->buffer + length, connection->received);
+		}
+		if(connection->received == BUFFER_LENGTH) {
+			++disconnects;
+			connection_close(connection);
+			return;
+		}
+	}
+}
+
+/*
+ * sends the next request once its time has come and the previous one was answered,
+ * closes the connection after the last one at its captured close time
+ * */
+static void connection_act(struct replay_connection *connection, unsigned long now)
+{
+	struct replay_request *request;
+	unsigned long due;
+	if(connection->pending != REPLAY_NO_REQUEST) {
+		if(now - connection->sent_at > options.timeout * 1000000000ul) {
+			++timeouts;
+			++connection->next_reply;
+			connection->pending = REPLAY_NO_REQUEST;
+		}
+		return;
+	}
+	if(connection->next_request == connection->number_of_requests) {
+		if(connection->close_at == UINT64_MAX || now >= scheduled(connection->close_at)) {
+			connection_close(connection);
+		}
+		return;
+	}
+	request = &connection->requests[connection->next_request];
+	due = scheduled(request->timestamp);
+	if(now < due) {
+		return;
+	}
+	if(send(connection->fd, request->data, request->length, MSG_NOSIGNAL) != request->length) {
+		++disconnects;
+		connection_close(connection);
+		return;
+	}
+	if(!options.flat_out) {
+		lag_total += now - due;
+		lag_max = now - due > lag_max ? now - due : lag_max;
+	}
+	++sent;
+	++connection->next_request;
+	connection->pending = (unsigned char) request->data[0];
+	connection->sent_at = stats_now();
+}
+
+static void replay(void)
+{
+	struct epoll_event events[REPLAY_EVENTS];
+	struct replay_connection *connection;
+	uint32_t first_active = 0, next_to_open = 0;
+	unsigned long now;
+	int epfd = epoll_create1(0), n;
+	if(epfd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	start = stats_now();
+	while(first_active < number_of_connections) {
+		n = epoll_wait(epfd, events, REPLAY_EVENTS, REPLAY_TICK_MS);
+		for(int i = 0; i < n; ++i) {
+			connection = events[i].data.ptr;
+			if(connection->state == REPLAY_CONNECTING) {
+				connection_connected(connection, epfd);
+			} else if(connection->state == REPLAY_OPEN) {
+				connection_receive(connection);
+			}
+		}
+		now = stats_now();
+		for(; next_to_open < number_of_connections; ++next_to_open) {
+			connection = &connections[next_to_open];
+			if(!connection->seen) {
+				connection->state = REPLAY_DONE;
+				continue;
+			}
+			if(now < scheduled(connection->open_at)) {
+				break;
+			}
+			connection_open(connection, epfd);
+		}
+		for(uint32_t i = first_active; i < next_to_open; ++i) {
+			if(connections[i].state == REPLAY_OPEN) {
+				connection_act(&connections[i], now);
+			}
+		}
+		while(first_active < next_to_open && connections[first_active].state == REPLAY_DONE) {
+			++first_active;
+		}
+	}
+	close(epfd);
+}
+
+int main(int argc, char *argv[])
+{
+	struct hostent *server;
+	uint64_t duration = 0;
+	unsigned long requests, errors;
+	double seconds;
+	size_t size;
+	char *data;
+	if(argc < 4) {
+		fprintf(stderr, "usage %s hostname port capture [--speed factor | --flat-out] [--timeout s]\n", argv[0]);
+		return 1;
+	}
+	for(int i = 4; i < argc; ++i) {
+		if(!strcmp(argv[i], "--speed") && i + 1 < argc) {
+			options.speed = strtod(argv[++i], NULL);
+		} else if(!strcmp(argv[i], "--flat-out")) {
+			options.flat_out = 1;
+		} else if(!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+			options.timeout = strtoul(argv[++i], NULL, 10);
+		} else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if(options.speed <= 0) {
+		fprintf(stderr, "speed has to be positive\n");
+		return 1;
+	}
+	if(!(server = gethostbyname(argv[1]))) {
+		fprintf(stderr, "no such host %s\n", argv[1]);
+		return 1;
+	}
+	options.address.sin_family = AF_INET;
+	memcpy(&options.address.sin_addr.s_addr, server->h_addr, server->h_length);
+	options.address.sin_port = htons(atoi(argv[2]));
+	if(!(data = load_capture(argv[3], &size)) || index_capture(data, size, &duration)) {
+		fprintf(stderr, "cannot read capture %s\n", argv[3]);
+		return 1;
+	}
+	if(stats_init()) {
+		fprintf(stderr, "error on stats init\n");
+		return 1;
+	}
+	replay();
+	seconds = (stats_now() - start) / 1e9;
+	stats_print(stdout, &requests, &errors);
+	printf("\n%lu requests in %.2f s (captured %.2f s), %.0f requests/s, %lu errors\n", sent, seconds, duration / 1e9, requests / seconds, errors);
+	printf("%lu replies differ from the capture, %lu timeouts, %lu failed connects, %lu disconnects\n", mismatched, timeouts,
+		connect_failures, disconnects);
+	if(!options.flat_out && sent) {
+		printf("requests sent behind schedule by %.1f us on average, %.1f us at most\n", lag_total / 1e3 / sent, lag_max / 1e3);
+	}
+	return 0;
+}
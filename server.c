@@ -6,37 +6,52 @@
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <sys/un.h>
 #include "constants.h"
+#include "archive.h"
+#include "log.h"
+#include "stats.h"
+#include "metrics.h"
+#include "trace.h"
+#include "game.h"
+#include "capture.h"
+#include "spectate.h"
+#include "lobby.h"
+#include "rating.h"
+#include "matchmaker.h"
+#include "tournament.h"
+#include "timer.h"
+#include "pool.h"
+#include "upgrade.h"
+#include "shared.h"
+#include "cluster.h"
 
-typedef struct usr {
-	char username[USERNAMELEN + 1];
-	char password[PASSWORDLEN + 1];
-} User;
-
-struct game_board {
-	char *matrix;
-	User *player_1;
-	User *player_2;
-	User *host;
-	char whose_turn;
-	size_t board_size;
-	size_t index;
-	unsigned long player1_last_x, player1_last_y;
-	unsigned long player2_last_x, player2_last_y;
-	int player1_fd, player2_fd;
-	pthread_mutex_t monitor;
-};
-
-struct game_boards_array {
-	struct game_board **array;
-	char *visited; // this array is used in selecting a random game to join
-	size_t number_of_elements;
-	size_t array_size;
+/*
+ * a session's place in a tournament, shared by the session and the tournament until both let go of it.
+ * the tournament's workers hand the session its games through pending, the session takes them into its
+ * joined games before it handles its next request.
+ * */
+struct tournament_entry {
+	User *user;
+	int fd;
+	struct game_boards_array *games;
+	struct game_board **pending;
+	size_t number_of_pending, pending_size;
+	char gone; // the session ended, the games it would have played are lost
+	char over; // TOURNAMENT_OVER_NOTIFY was sent
+	int references;
 	pthread_mutex_t monitor;
 };
 
@@ -45,13 +60,27 @@ struct session_details {
 	size_t bytes_written; // number of bytes written after the last operation
 	int fd;
 	char session_present;
+	char multiplexed; // game-scoped requests name their game, current_game is only set while one is handled
 	struct game_board *current_game;
+	struct game_board **joined_games; // the games of a multiplexed session, only its own thread touches them
+	size_t number_of_joined_games, joined_games_size;
+	struct spectator *spectator; // set once the session spectates, it cannot take a seat afterwards
+	struct match_ticket *ticket; // set while the session waits for the matchmaker and until it took the game
+	struct tournament_entry *entry; // set from signing up for a tournament until the session learned its place
 	struct game_boards_array *games;
+	char handed_over; // an upgrade handed the session to the next binary, its thread lets go of it
+	int32_t handover_index; // the session's index in the upgrade's messages
+	struct session_details *next_parked; // the sessions parked for an upgrade
+	struct cluster_link **links; // the session's links to the other nodes of a cluster, by node, see cluster.h
+	char forwarded; // the request went over a link, the other node answers it
 };
 
 struct arguments {
 	int fd;
+	uint32_t connection; // id of the connection in traffic captures
 	struct game_boards_array *games;
+	struct timer *deadline; // the connection's login and idle deadline, owned by connection_thread
+	struct session_details *session; // a session taken over from the binary this one upgraded, it is logged in
 };
 
 unsigned char login_request(char*, struct session_details**);
@@ -61,6 +90,14 @@ unsigned char create_new_game_request(char*, struct session_details**);
 unsigned char join_random_game_request(char*, struct session_details**);
 unsigned char leave_game_request(char*, struct session_details**);
 unsigned char action_request(char*, struct session_details**);
+unsigned char stats_request(char*, struct session_details**);
+unsigned char multiplex_request(char*, struct session_details**);
+unsigned char spectate_request(char*, struct session_details**);
+unsigned char game_snapshot_request(char*, struct session_details**);
+unsigned char list_games_request(char*, struct session_details**);
+unsigned char matchmake_request(char*, struct session_details**);
+unsigned char tournament_request(char*, struct session_details**);
+unsigned char rematch_request(char*, struct session_details**);
 
 static unsigned char (*handler[NUMBER_OF_OPCODES])(char*, struct session_details**) = {
 	[LOGIN_REQUEST] =			login_request,	
@@ -69,287 +106,341 @@ static unsigned char (*handler[NUMBER_OF_OPCODES])(char*, struct session_details
 	[CREATE_NEW_GAME_REQUEST] =		create_new_game_request,
 	[JOIN_RANDOM_GAME_REQUEST] =		join_random_game_request,
 	[LEAVE_GAME_REQUEST] = 			leave_game_request,
-	[ACTION_REQUEST] =			action_request
+	[ACTION_REQUEST] =			action_request,
+	[STATS_REQUEST] =			stats_request,
+	[MULTIPLEX_REQUEST] =			multiplex_request,
+	[SPECTATE_REQUEST] =			spectate_request,
+	[GAME_SNAPSHOT_REQUEST] =		game_snapshot_request,
+	[LIST_GAMES_REQUEST] =			list_games_request,
+	[MATCHMAKE_REQUEST] =			matchmake_request,
+	[TOURNAMENT_REQUEST] =			tournament_request,
+	[REMATCH_REQUEST] =			rematch_request
 };
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t snapshot_requested = 0;
+static volatile sig_atomic_t shutdown_requested = 0;
+static volatile sig_atomic_t trace_requested = 0;
+static atomic_uint next_game_id = 1; // 0 is no game
+static atomic_uint number_of_connections; // ids of the connections in traffic captures
+static struct game_boards_array *shared_games; // the registry players of other processes join games of
+static unsigned long login_timeout = LOGIN_TIMEOUT, idle_timeout = IDLE_TIMEOUT, move_timeout = MOVE_TIMEOUT; // seconds, 0 never times out
+static unsigned long max_connections = MAX_CONNECTIONS, max_games = MAX_GAMES, max_pending = MAX_PENDING; // 0 is no cap
+static unsigned int workers = POOL_WORKERS; // 0 runs every request on its connection's thread
 
-struct game_boards_array* array_of_games_init(const size_t size)
-{
-	struct game_boards_array *array = NULL;
-	array = malloc(sizeof(struct game_boards_array));
-	if(!array || !size) {
-		free(array);
-		return NULL;
-	}
-	array->array = NULL;
-	array->array_size = size;
-	array->number_of_elements = 0;
-	array->visited = NULL;
-	array->array = calloc(size, sizeof(struct game_board*));
-	if(!array->array || pthread_mutex_init(&array->monitor, NULL)) {
-		free(array);
-		return NULL;
-	}
-	return array;
-}
+enum {
+	UPGRADE_IDLE,
+	UPGRADE_PARKING, // the sessions park between two requests
+	UPGRADE_DRAINING // the sessions that could go were handed over, this binary serves the others until they end
+};
+
+/*
+ * hot upgrades, see upgrade.h. a session counts itself in once it logged in, its thread waits for the
+ * next request in receive_request, which parks it while an upgrade is under way.
+ * */
+static struct {
+	const char *path; // NULL if the server takes no upgrades
+	int listener;
+	int wake[2]; // a pipe that is readable while the sessions have to park
+	char state;
+	long sessions, number_of_parked;
+	struct session_details *parked;
+	pthread_mutex_t monitor;
+	pthread_cond_t changed;
+} upgrade = { .listener = -1, .wake = { -1, -1 }, .monitor = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER };
 
-void game_boards_array_free(struct game_boards_array *ptr)
+/*
+ * the id of a new game, in a cluster one this node owns
+ * */
+static uint32_t new_game_id(void)
 {
-	if(!ptr) {
-		return;
-	}
-	for(size_t i = 0; i < ptr->array_size; ++i) {
-		free(ptr->array[i]->matrix);
-		pthread_mutex_destroy(&ptr->array[i]->monitor);
-		free(ptr->array[i]);
-	}
-	pthread_mutex_destroy(&ptr->monitor);
-	free(ptr->visited);
-	free(ptr->array);
-	free(ptr);
+	uint32_t id;
+	do {
+		id = atomic_fetch_add(&next_game_id, 1);
+	} while(!id || cluster_owner(id) != cluster_self()); // 0 is no game also once the ids wrapped
+	return id;
 }
 
-int game_boards_array_add(struct game_boards_array *array, struct game_board *game)
+/*
+ * on-disk layout of a registry snapshot: a header followed by one record per game,
+ * each record immediately followed by board_size * board_size matrix cells and number_of_moves moves.
+ * all integers are stored in host byte order, snapshots are not meant to move between machines.
+ * */
+#define SNAPSHOT_MAGIC 0x53545454u // "TTTS"
+#define SNAPSHOT_VERSION 2u
+#define SNAPSHOT_CHUNK 1024 // games copied per hold of the registry lock
+
+struct snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t number_of_games;
+};
+
+enum {
+	SEAT_PLAYER1 = 1,
+	SEAT_PLAYER2 = 2,
+	HOST_PLAYER1 = 4,
+	HOST_PLAYER2 = 8
+};
+
+struct snapshot_record {
+	uint32_t board_size;
+	char whose_turn;
+	uint8_t seats; // SEAT_* and HOST_* flags
+	char player_1[USERNAMELEN];
+	char player_2[USERNAMELEN];
+	uint32_t player1_last_x, player1_last_y;
+	uint32_t player2_last_x, player2_last_y;
+	uint8_t number_of_moves;
+} __attribute__((packed));
+
+/*
+ * writes every game of the registry to path. the games are copied into memory from the last one down,
+ * SNAPSHOT_CHUNK of them per hold of the registry lock, and each game is locked only while its own
+ * record is copied, so a move waits at most for the copy of its game and a lobby operation for the copy
+ * of one chunk. a removal in between moves the last game into the freed index, so from the last one down
+ * no game is skipped, and one that was copied already and moves down is known by its snapshot generation.
+ * games added in between are left for the next snapshot.
+ * the file is written to a temporary name and renamed, so a crash never leaves a truncated snapshot.
+ * */
+int game_boards_array_snapshot(struct game_boards_array *array, const char *path)
 {
-	if(!array || !game) {
+	if(!array || !path) {
 		return -3;
 	}
+	static atomic_ulong snapshots = 0;
+	char temporary_path[PATH_MAX];
+	struct snapshot_header header;
+	struct snapshot_record *record;
+	struct game_board *game;
+	char *snapshot, *position, *grown;
+	size_t snapshot_size, used, needed, i, cells, chunk;
+	unsigned long generation = atomic_fetch_add(&snapshots, 1) + 1;
+	FILE *output;
 	int ret_value;
+	if(snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= (int)sizeof(temporary_path)) {
+		return -3;
+	}
 	if((ret_value = pthread_mutex_lock(&array->monitor))) {
 		return ret_value;
 	}
-	if(!array->array_size) {
-		pthread_mutex_unlock(&array->monitor);
-		return -2;
-	}
-	if(array->number_of_elements == array->array_size) {
+	i = array->number_of_elements;
+	snapshot_size = sizeof(header) + i * (sizeof(struct snapshot_record) + BOARD_SIZE * BOARD_SIZE + ARCHIVE_MAX_MOVES);
+	snapshot = malloc(snapshot_size);
+	if(!snapshot) {
 		pthread_mutex_unlock(&array->monitor);
-		return -1;
+		return -4;
 	}
-	struct game_board **new;
-	char *visited_new;
-	game->index = array->number_of_elements;
-	if(!array->visited) { // first add to array
-		array->visited = calloc(1, 1);
-		if(!array->visited) {
-			pthread_mutex_unlock(&array->monitor);
-			return -4;
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.number_of_games = 0;
+	position = snapshot + sizeof(header);
+	for(;;) {
+		for(chunk = 0; chunk < SNAPSHOT_CHUNK && i; ++chunk) {
+			if(--i >= array->number_of_elements) { // removed since, the games above it moved down
+				continue;
+			}
+			game = array->array[i];
+			cells = game->board_size * game->board_size;
+			needed = sizeof(struct snapshot_record) + cells + ARCHIVE_MAX_MOVES;
+			if((size_t) (position - snapshot) + needed > snapshot_size) { // room was reserved for BOARD_SIZE boards
+				used = position - snapshot;
+				snapshot_size = 2 * snapshot_size + needed;
+				if(!(grown = realloc(snapshot, snapshot_size))) {
+					pthread_mutex_unlock(&array->monitor);
+					free(snapshot);
+					return -4;
+				}
+				snapshot = grown;
+				position = snapshot + used;
+			}
+			record = (struct snapshot_record*) position;
+			memset(record, 0, sizeof(struct snapshot_record));
+			pthread_mutex_lock(&game->monitor);
+			if(game->snapshot_generation == generation) {
+				pthread_mutex_unlock(&game->monitor);
+				continue;
+			}
+			game->snapshot_generation = generation;
+			record->board_size = game->board_size;
+			record->whose_turn = game->whose_turn;
+			if(game->player_1) {
+				record->seats |= SEAT_PLAYER1;
+				memcpy(record->player_1, game->player_1->username, USERNAMELEN);
+			}
+			if(game->player_2) {
+				record->seats |= SEAT_PLAYER2;
+				memcpy(record->player_2, game->player_2->username, USERNAMELEN);
+			}
+			if(game->host && game->host == game->player_1) {
+				record->seats |= HOST_PLAYER1;
+			} else if(game->host && game->host == game->player_2) {
+				record->seats |= HOST_PLAYER2;
+			}
+			record->player1_last_x = game->player1_last_x;
+			record->player1_last_y = game->player1_last_y;
+			record->player2_last_x = game->player2_last_x;
+			record->player2_last_y = game->player2_last_y;
+			record->number_of_moves = game->number_of_moves;
+			memcpy(position + sizeof(struct snapshot_record), game->matrix, cells);
+			memcpy(position + sizeof(struct snapshot_record) + cells, game->moves, game->number_of_moves);
+			pthread_mutex_unlock(&game->monitor);
+			position += sizeof(struct snapshot_record) + cells + record->number_of_moves;
+			++header.number_of_games;
 		}
-	}
-	array->array[array->number_of_elements++] = game;
-	if(array->number_of_elements == array->array_size) {
-		new = realloc(array->array, sizeof(struct game_board*) * (array->array_size + REALLOC_SIZE));
-		visited_new = realloc(array->visited, array->number_of_elements);
-		if(!new || !visited_new) {// in case of realloc error, the pointer remains valid, not null 
-			array->number_of_elements--;
-			pthread_mutex_unlock(&array->monitor);
-			return -4;
+		if((ret_value = pthread_mutex_unlock(&array->monitor))) {
+			free(snapshot);
+			return ret_value;
+		}
+		if(!i) {
+			break;
+		}
+		if((ret_value = pthread_mutex_lock(&array->monitor))) { // the lobby got its turn in between
+			free(snapshot);
+			return ret_value;
 		}
-		array->array_size += REALLOC_SIZE;
-		array->array = new;
-		visited_new[array->number_of_elements - 1] = 0;
-		array->visited = visited_new;
-		memset(new + array->number_of_elements, 0, REALLOC_SIZE);
-	}
-	return pthread_mutex_unlock(&array->monitor);
-}
-
-int game_boards_array_remove(struct game_boards_array *array, struct game_board* game)
-{
-	if(!game || !array) {
-		return 3;
-	}
-	int ret_value;
-	if((ret_value = pthread_mutex_lock(&array->monitor))) {
-		return ret_value;
-	}
-	size_t index = game->index;
-	if(!array->number_of_elements || array->number_of_elements - 1 < index) {
-		printf("on remove %lu %lu\n", array->number_of_elements, index);
-		pthread_mutex_unlock(&array->monitor);
-		return 2;
 	}
-	char *visited_new;
-	struct game_board **array_new;
-	free(array->array[index]->matrix);
-	if((ret_value = pthread_mutex_destroy(&array->array[index]->monitor))) {
-		pthread_mutex_unlock(&array->monitor);
-		return ret_value;
+	memcpy(snapshot, &header, sizeof(header));
+	output = fopen(temporary_path, "wb");
+	if(!output) {
+		free(snapshot);
+		return -1;
 	}
-	if(index < array->number_of_elements - 1) { // this comparison is probably redundant
-		array->array[index] = array->array[array->number_of_elements - 1]; // move the last element to the deleted one's place
-		array->array[index]->index = index; // update the moved element's index
-	}
-	array->array[array->number_of_elements-- - 1] = NULL;
-	free(array->array[index]);
-	// begin questionable realloc
-	if(array->array_size - array->number_of_elements == REALLOC_SIZE * 2 && array->array_size > REALLOC_SIZE * 2) {
-		array_new = realloc(array->array, sizeof(struct game_board*) * array->array_size);
-		if(!array_new) {
-			pthread_mutex_unlock(&array->monitor);
-			return -1;
-		}
-		array->array_size -= REALLOC_SIZE * 2;
-		array->array = array_new;
+	snapshot_size = position - snapshot; // the size above reserved room for full move lists
+	if(fwrite(snapshot, 1, snapshot_size, output) != snapshot_size) {
+		fclose(output);
+		free(snapshot);
+		unlink(temporary_path);
+		return -1;
 	}
-	if(array->number_of_elements) {
-		visited_new = realloc(array->visited, array->number_of_elements);
-		if(!visited_new) {
-			pthread_mutex_unlock(&array->monitor);
-			return -1;
-		}
-		array->visited = visited_new;
-		memset(array->visited, 0, array->number_of_elements);
-	} else {
-		free(array->visited);
-		array->visited = NULL;
+	free(snapshot);
+	if(fclose(output) || rename(temporary_path, path)) {
+		unlink(temporary_path);
+		return -1;
 	}
-	printf("removed %p\n", game);
-	return pthread_mutex_unlock(&array->monitor);
-}
-
-void error(const char *msg)
-{
-	perror(msg);
-	exit(1);
+	log_info("snapshot of %lu games written to %s", (unsigned long) header.number_of_games, (unsigned long) path);
+	return 0;
 }
 
 /*
- * the following code is suboptimal, to put it mildly. and it's quite poorly designed. TODO
+ * maps a snapshot written by game_boards_array_snapshot and rebuilds the registry from it.
+ * connections do not survive a restart, so every seat comes back empty and the games can be
+ * taken over with join_random_game_request. finished and abandoned games are not restored.
  * */
-int write_x_or_o(struct game_board *board, size_t x, size_t y, const char character)
+struct game_boards_array* game_boards_array_restore(const char *path)
 {
-	if(!board || !character) {
-	 	return -1;
+	if(!path) {
+		return NULL;
 	}
-	if(board->whose_turn != character) {
-		printf("return -4 %c %c\n", board->whose_turn, character);
-		return -4;
+	struct game_boards_array *array = NULL;
+	struct snapshot_header header;
+	struct snapshot_record record;
+	struct game_board *game;
+	struct stat file_status;
+	char *snapshot, *position, *end;
+	size_t cells, i;
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		return NULL;
 	}
-	size_t i, j;
-	if(x > (board->board_size - 1) || y > (board->board_size - 1)) { // behaviour is undefined is size happens to be zero
-		printf("return -2\n");
-		return -2;
-	} // matrix indexing looks ugly because it's a 1d array for more efficiency... (1 pointer dereference fewer)
-	if(board->matrix[(board->board_size * x) + y] != 'x' && board->matrix[(board->board_size * x) + y] != 'o' && (character == 'x' || character == 'o')) {
-		printf("write\n");
-		board->matrix[(board->board_size * x) + y] = character;	
-	} else {
-		printf("return -5\n");
-		return -5;
+	if(fstat(fd, &file_status) || (size_t) file_status.st_size < sizeof(header)) {
+		close(fd);
+		return NULL;
 	}
-	for(i = 0; i < board->board_size; i++) {
-		if(board->matrix[(board->board_size * x) + i] != character) {
-			break;
-		}
+	snapshot = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if(snapshot == MAP_FAILED) {
+		return NULL;
 	}
-	if(i == board->board_size) {
-		board->whose_turn = character - 0x20; // make it uppercase, which means the game is over
-		return 0; // the one who wrote won the game 
-	} 
-	for(i = 0; i < board->board_size; i++) {
-		if(board->matrix[(board->board_size * i) + y] != character) {
-			break;
-		}
+	madvise(snapshot, file_status.st_size, MADV_SEQUENTIAL);
+	end = snapshot + file_status.st_size;
+	memcpy(&header, snapshot, sizeof(header));
+	if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+		munmap(snapshot, file_status.st_size);
+		return NULL;
 	}
-	if(i == board->board_size) {
-		board->whose_turn = character - 0x20;
-		return 0;
+	// size the registry up front, growing it by REALLOC_SIZE per add would realloc once every few games
+	array = array_of_games_init(header.number_of_games + REALLOC_SIZE);
+	if(!array || !(array->visited = calloc(array->array_size, 1))) {
+		game_boards_array_free(array);
+		munmap(snapshot, file_status.st_size);
+		return NULL;
 	}
-	if(x == y || y == (board->board_size - x)) {
-		for(i = 0; i < board->board_size; i++) {
-			if(board->matrix[(board->board_size * i) + i] != character) {
-				break;
-			}
-		}
-		if(i == board->board_size) {
-			board->whose_turn = character - 0x20;
-			return 0;
+	position = snapshot + sizeof(header);
+	for(i = 0; i < header.number_of_games; ++i) {
+		if((size_t)(end - position) < sizeof(record)) {
+			break;
 		}
-		j = board->board_size - 1;
-		for(i = 0; i < board->board_size && j; i++) {
-			if(board->matrix[(board->board_size * i) + j] != character) {
-				break;
-			}
-			--j;
+		memcpy(&record, position, sizeof(record));
+		cells = (size_t) record.board_size * record.board_size;
+		if(!record.board_size || record.number_of_moves > ARCHIVE_MAX_MOVES
+		|| (size_t)(end - position) - sizeof(record) < cells + record.number_of_moves) {
+			break;
 		}
-		if(!j && board->matrix[(board->board_size * (i - 1)) + j] == character) { // the last comparison is outside the loop to prevent j's underflow
-			board->whose_turn = character - 0x20;
-			return 0;
+		position += sizeof(record);
+		if(record.whose_turn != 'x' && record.whose_turn != 'o') {
+			position += cells + record.number_of_moves;
+			continue;
 		}
-	}
-	for(i = 0; i < board->board_size; ++i)
-		for(j = 0; j < board->board_size; ++j) {
-			if(board->matrix[(board->board_size * i) + j] == ' ') {
-				break;
+		game = calloc(1, sizeof(struct game_board));
+		if(!game || !(game->matrix = malloc(cells)) || pthread_mutex_init(&game->monitor, NULL)) {
+			if(game) {
+				free(game->matrix);
 			}
+			free(game);
+			break;
 		}
-	if(i == board->board_size && j == board->board_size) {
-		printf("tie\n");
-		board->whose_turn = 'D';
-	} else {
-		board->whose_turn = character == 'x' ? 'o' : 'x';
+		memcpy(game->matrix, position, cells);
+		position += cells;
+		memcpy(game->moves, position, record.number_of_moves);
+		game->number_of_moves = record.number_of_moves;
+		position += record.number_of_moves;
+		game->board_size = record.board_size;
+		game->whose_turn = record.whose_turn;
+		game->player1_last_x = record.player1_last_x;
+		game->player1_last_y = record.player1_last_y;
+		game->player2_last_x = record.player2_last_x;
+		game->player2_last_y = record.player2_last_y;
+		game->player1_fd = -1;
+		game->player2_fd = -1;
+		game->id = new_game_id();
+		game->created_at = time(NULL);
+		game->index = array->number_of_elements;
+		array->array[array->number_of_elements++] = game;
+	}
+	gauge_set(gauges.games, array->number_of_elements);
+	gauge_set(gauges.open_games, array->number_of_elements); // every seat of a restored game is free
+	gauge_set(gauges.registry_size, array->array_size);
+	munmap(snapshot, file_status.st_size);
+	if(i != header.number_of_games) {
+		log_error("snapshot %s is truncated or corrupt, restored %lu of %lu games",
+			(unsigned long) path, array->number_of_elements, (unsigned long) header.number_of_games);
 	}
-	return 0;
+	return array;
 }
 
-/*
- * causes undefined behaviour if buffer_size is longer than the buffer itself
- * */
-char* find_character_in_buffer(char *buffer, size_t buffer_size, const char character)
+void sigusr1_handler(int signal_number)
 {
-	if(!buffer || !buffer_size) {
-		return NULL;
-	}
-	for(size_t i = 0; i < buffer_size; i++) {
-		if(buffer[i] == character) {
-			return buffer + i;
-		}
-	}
-	return NULL;
+	(void) signal_number;
+	snapshot_requested = 1;
 }
 
-User* find_user_by_name(FILE *input_file, char* name)
+void sigusr2_handler(int signal_number)
 {
-	if(!input_file || !name) {
-		return NULL;
-	}
-	char *password_start;
-	char string[USERNAMELEN + PASSWORDLEN + 3];
-	char username[USERNAMELEN + 1];
-	char password[PASSWORDLEN + 1];
-	User *found_user = NULL;
-	memset(username, 0, USERNAMELEN + 1);
-	memset(password, 0, PASSWORDLEN + 1);
-	memset(string, 0, USERNAMELEN + PASSWORDLEN + 3);
-	while((fgets(string, USERNAMELEN + PASSWORDLEN + 3, input_file))) {
-		if(strncmp(strncpy(username, string, USERNAMELEN), name, USERNAMELEN)) {
-			continue;
-		}
-		password_start = find_character_in_buffer(string, USERNAMELEN + PASSWORDLEN + 3, ' ');
-		if(password_start) {
-			// pointer arithmetic in order to check buffer bounds
-			if((password_start - string) + 1 >= USERNAMELEN + PASSWORDLEN + 3) {
-				break;
-			}
-			password_start++;
-		} else {
-			break;
-		}
-		strncpy(password, password_start, PASSWORDLEN);
-		found_user = malloc(sizeof(User));
-		if(found_user) {
-			memcpy(found_user->username, username, USERNAMELEN + 1);
-			memcpy(found_user->password, password, PASSWORDLEN + 1);
-		} else {
-			fprintf(stderr, "error: cannot allocate %lu bytes\n", sizeof(User));
-			exit(1);
-		}
-		break;
-	}
-	fclose(input_file);
-	return found_user;
+	(void) signal_number;
+	trace_requested = 1;
+}
+
+void sigint_handler(int signal_number)
+{
+	(void) signal_number;
+	shutdown_requested = 1;
+}
+
+void error(const char *msg)
+{
+	perror(msg);
+	exit(1);
 }
 
 int create_new_user(char *username, char *password)
@@ -381,136 +472,444 @@ int create_new_user(char *username, char *password)
 	return pthread_mutex_unlock(&mutex);
 }
 
-int parse_operands_from_buffer(char *operand1, char *operand2, char *buffer, const char separator, size_t buffer_size)
+static int joined_games_reserve(struct session_details *session_details)
 {
-	if(!operand1 || !operand2 || !buffer || !buffer_size) {
+	struct game_board **joined_games;
+	if(session_details->number_of_joined_games < session_details->joined_games_size) {
+		return 0;
+	}
+	joined_games = realloc(session_details->joined_games,
+		sizeof(struct game_board*) * (session_details->joined_games_size + REALLOC_SIZE));
+	if(!joined_games) {
 		return -1;
 	}
-	memset(operand1, 0, buffer_size);
-	memset(operand2, 0, buffer_size);
-	char *op2_start = find_character_in_buffer(buffer, buffer_size, separator);
-	if(op2_start) {
-		 // checking buffer size with pointer arithmetic
-		if((size_t)((op2_start - buffer) + 1) >= buffer_size) {
-			return 2;
-		}
-		op2_start++;
-	} else {
-		return 1;
-	} // this might break if the separator is not \0
-	strncpy(operand1, buffer, buffer_size - 1);
-	strncpy(operand2, op2_start, buffer_size - 1);
+	session_details->joined_games = joined_games;
+	session_details->joined_games_size += REALLOC_SIZE;
 	return 0;
 }
 
-int get_coordinates_from_buffer(char *buffer, unsigned long *x, unsigned long *y)
+static void joined_games_remove(struct session_details *session_details, struct game_board *game)
 {
-	if(!x || !y) {
-		return 1;
-	}
-	char *next = NULL;
-	if(buffer[0] == '0' && buffer[1] == '\0') {
-		*x = 0;
-		next = buffer + 1;
-	} else {
-		*x = strtoul(buffer, &next, 10);
-		if(!*x || errno == ERANGE) {
-			return 2;
+	for(size_t i = 0; i < session_details->number_of_joined_games; ++i) {
+		if(session_details->joined_games[i] == game) {
+			session_details->joined_games[i] = session_details->joined_games[--session_details->number_of_joined_games];
+			return;
 		}
 	}
-	if(next[1] == '0' && next[2] == '\0') {
-		*y = 0;
-	} else {
-		*y = strtoul(++next, NULL, 10);
-		if(!*y || errno == ERANGE) {
-			return 3;
+}
+
+/*
+ * makes the game named by the id after the opcode current and takes the id out of buffer, so that the
+ * request is laid out as in sessions that are not multiplexed. current_game is NULL if the session holds
+ * no game with that id.
+ * */
+static void select_joined_game(char *buffer, struct session_details *session_details)
+{
+	char *end;
+	unsigned long id = strtoul(buffer + 1, &end, 10);
+	session_details->current_game = NULL;
+	if(end == buffer + 1 || *end) {
+		return;
+	}
+	for(size_t i = 0; i < session_details->number_of_joined_games; ++i) {
+		if(session_details->joined_games[i]->id == id) {
+			session_details->current_game = session_details->joined_games[i];
+			break;
 		}
 	}
-	printf("coor: %lu %lu\n", *x, *y);
-	return 0;
+	memmove(buffer + 1, end + 1, BUFFER_LENGTH - (end + 1 - buffer));
 }
 
-unsigned char create_new_game_request(char *buffer, struct session_details **session_details)
+/*
+ * the session's link to node. a link that broke is replaced if open is set, NULL if there is none.
+ * */
+static struct cluster_link* session_link(struct session_details *session, unsigned int node, char open)
 {
-	if(!*session_details) {
-		buffer[0] = INVALID_REQUEST;
-		return INVALID_REQUEST;
+	struct cluster_link **link;
+	if(!session->links && (!open || !(session->links = calloc(CLUSTER_MAX_NODES, sizeof(struct cluster_link*))))) {
+		return NULL;
 	}
-	if(!(*session_details)->session_present || (*session_details)->current_game) {
-		buffer[0] = INVALID_REQUEST;
-		(*session_details)->bytes_written = 1;
-		return INVALID_REQUEST;
+	link = &session->links[node];
+	if(*link && !cluster_link_alive(*link) && open) { // the games on the other node ended with it
+		cluster_link_close(*link);
+		*link = NULL;
 	}
-	(*session_details)->current_game = calloc(1, sizeof(struct game_board));
-	if(!(*session_details)->current_game) {
-		buffer[0] = INTERNAL_SERVER_ERROR;
-		(*session_details)->bytes_written = 1;
-		return INTERNAL_SERVER_ERROR;
+	if(!*link && open) {
+		*link = cluster_link_open(node, session->logged_in_user->username, session->logged_in_user->password, session->fd);
 	}
-	struct game_board *game = (*session_details)->current_game;
-	char to_uppercase = random() % 2 ? 0x20 : 0;
-	game->board_size = BOARD_SIZE; // not hardcoded board size maybe?
-	game->matrix = malloc(game->board_size * game->board_size);
-	game->player_1 = NULL;
-	game->player_2 = NULL;
-	if(!game->matrix || pthread_mutex_init(&game->monitor, NULL)) {
-		free(game);
-		(*session_details)->current_game = NULL;
-		buffer[0] = INTERNAL_SERVER_ERROR;
-		(*session_details)->bytes_written = 1;
-		return INTERNAL_SERVER_ERROR;
+	return *link;
+}
+
+static void close_links(struct session_details *session)
+{
+	if(!session->links) {
+		return;
 	}
-	memset(game->matrix, ' ', game->board_size * game->board_size); // empty cells are spaces
-	game->player1_fd = -1; // initialize fds to unusable values
-	game->player2_fd = -1;
-	if(random() % 2) {
-		game->player_1 = (*session_details)->logged_in_user;
-		game->player1_fd = (*session_details)->fd;
-	} else {
-		game->player_2 = (*session_details)->logged_in_user;
-		game->player2_fd = (*session_details)->fd;
+	for(unsigned int node = 0; node < CLUSTER_MAX_NODES; ++node) {
+		cluster_link_close(session->links[node]);
 	}
-	game->host = (*session_details)->logged_in_user;
-	memset(buffer + 2, 0, BUFFER_LENGTH - 2);
-	buffer[0] = CREATE_NEW_GAME_SUCCESS;
-	buffer[1] = game->player_1 ? 'x' : 'o' - to_uppercase; // inform the client which player he is 
-	switch(buffer[1]) {
-		case 'O': case 'x': game->whose_turn = 'o'; break;
-		case 'X': case 'o': game->whose_turn = 'x'; break;
+	free(session->links);
+	session->links = NULL;
+}
+
+/*
+ * sends a game-scoped request of a multiplexed session over its link to the node that owns the game,
+ * returns whether it did. a game the session holds on this node is played here whatever its id.
+ * */
+static char forward_game_request(struct session_details *session, const char *buffer, size_t length)
+{
+	struct cluster_link *link;
+	unsigned int node;
+	char *end;
+	unsigned long id = strtoul(buffer + 1, &end, 10);
+	if(!session->links || end == buffer + 1 || *end || id > UINT32_MAX) {
+		return 0;
 	}
-	int bytes_written = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", game->board_size); //count not including null terminator
-	if(bytes_written > 0 && !game_boards_array_add((*session_details)->games, game)) {
-		(*session_details)->bytes_written = 3 + bytes_written;  // three first buffer bytes and a null terminator
-	} else {
-		free(game);
-		(*session_details)->current_game = NULL;
-		buffer[0] = INTERNAL_SERVER_ERROR;
-		(*session_details)->bytes_written = 1;
-		return INTERNAL_SERVER_ERROR;
+	for(size_t i = 0; i < session->number_of_joined_games; ++i) {
+		if(session->joined_games[i]->id == id) {
+			return 0;
+		}
 	}
-	printf("fd %d created a game, %c\n", game->player1_fd < 0 ? game->player2_fd : game->player1_fd, buffer[1]);
-	return CREATE_NEW_GAME_SUCCESS;
+	node = cluster_owner(id);
+	if(node == cluster_self() || !(link = session_link(session, node, 0))) {
+		return 0;
+	}
+	return !cluster_link_send(link, buffer, length);
 }
 
-unsigned char join_random_game_request(char *buffer, struct session_details **session_details)
+/*
+ * multiplexed sessions learn the id of a game they start playing at the end of the reply
+ * */
+static size_t append_game_id(char *buffer, size_t length, const struct game_board *game)
 {
-	if(!*session_details) {
-		buffer[0] = INVALID_REQUEST;
-		return INVALID_REQUEST;
-	}
-	if(!(*session_details)->session_present || (*session_details)->current_game) {
-		buffer[0] = INVALID_REQUEST;
-		(*session_details)->bytes_written = 1;
-		return INVALID_REQUEST;
+	int n = snprintf(buffer + length, BUFFER_LENGTH - length, "%u", game->id);
+	return n > 0 ? length + n + 1 : 0;
+}
+
+/*
+ * the snapshot of a game that lets a spectator or a player catch up in one message, used by SPECTATE_REPLY,
+ * SPECTATE_SNAPSHOT_NOTIFY and GAME_SNAPSHOT_REPLY: code, game id, null, whose turn or the result, board size,
+ * null, the cells, the number of moves in one byte, the moves as cell indices (x * board size + y) in the
+ * order they were made. whose turn is 'L' once a player left. returns 0 if the game does not fit.
+ * */
+static size_t encode_game_snapshot(char *buffer, unsigned char code, const struct game_board *game)
+{
+	size_t cells = game->board_size * game->board_size, length;
+	int n, n2;
+	buffer[0] = code;
+	n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u", game->id);
+	if(n <= 0) {
+		return 0;
 	}
-	if(pthread_mutex_lock(&(*session_details)->games->monitor)) { 
-		buffer[0] = INTERNAL_SERVER_ERROR;
-		(*session_details)->bytes_written = 1;
-		return INTERNAL_SERVER_ERROR;
+	buffer[n + 2] = game->whose_turn ? game->whose_turn : 'L';
+	n2 = snprintf(buffer + n + 3, BUFFER_LENGTH - n - 3, "%lu", game->board_size);
+	length = n + n2 + 4;
+	if(n2 <= 0 || length + cells + 1 + game->number_of_moves > BUFFER_LENGTH) {
+		return 0;
+	}
+	memcpy(buffer + length, game->matrix, cells);
+	length += cells;
+	buffer[length++] = game->number_of_moves;
+	memcpy(buffer + length, game->moves, game->number_of_moves);
+	return length + game->number_of_moves;
+}
+
+/*
+ * tells the spectators of game about a move, the caller holds the game's lock. the message is encoded
+ * once and shared by all of them. SPECTATE_NOTIFY: code, game id, null, the character that moved, whose
+ * turn or the result, x, null, y, null. a player leaving ends the broadcast of the game, it is announced
+ * with a null character, whose turn 'L' and empty coordinates, and the spectators are dropped from the game.
+ * */
+static void publish_move(struct game_board *game, char character, unsigned long x, unsigned long y)
+{
+	char buffer[BUFFER_LENGTH];
+	struct broadcast *broadcast, *snapshot = NULL;
+	size_t i, length;
+	int n;
+	if(!game->number_of_spectators) {
+		return;
+	}
+	buffer[0] = SPECTATE_NOTIFY;
+	if(character) {
+		n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u%c%c%c%lu%c%lu", game->id, 0, character, game->whose_turn, x, 0, y);
+	} else {
+		n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u%c%c%c%c", game->id, 0, 0, 'L', 0);
+	}
+	if(n <= 0 || n >= BUFFER_LENGTH - 1 || !(broadcast = broadcast_new(game->id, buffer, n + 2))) {
+		log_error("error on publishing a move of game %u", game->id);
+		return;
+	}
+	for(i = 0; i < game->number_of_spectators; ++i) {
+		if(!spectate_publish(game->spectators[i], broadcast)) {
+			continue;
+		}
+		if(!snapshot && (length = encode_game_snapshot(buffer, SPECTATE_SNAPSHOT_NOTIFY, game))) { // encoded once too
+			snapshot = broadcast_new(game->id, buffer, length);
+		}
+		if(snapshot) {
+			spectate_resync(game->spectators[i], snapshot);
+		}
+	}
+	broadcast_release(broadcast);
+	broadcast_release(snapshot);
+	if(!character) {
+		game->number_of_spectators = 0;
+	}
+	spectate_wake();
+}
+
+/*
+ * sends the spectators of game a snapshot of it instead of a move, the caller holds the game's lock
+ * */
+static void publish_snapshot(struct game_board *game)
+{
+	char buffer[BUFFER_LENGTH];
+	struct broadcast *snapshot;
+	size_t length;
+	if(!game->number_of_spectators) {
+		return;
+	}
+	if(!(length = encode_game_snapshot(buffer, SPECTATE_SNAPSHOT_NOTIFY, game)) || !(snapshot = broadcast_new(game->id, buffer, length))) {
+		log_error("error on publishing a snapshot of game %u", game->id);
+		return;
+	}
+	for(size_t i = 0; i < game->number_of_spectators; ++i) {
+		if(spectate_publish(game->spectators[i], snapshot)) {
+			spectate_resync(game->spectators[i], snapshot);
+		}
+	}
+	broadcast_release(snapshot);
+	spectate_wake();
+}
+
+/*
+ * a game with an empty board and no players that is not in the registry yet
+ * */
+static struct game_board* game_new(void)
+{
+	struct game_board *game = calloc(1, sizeof(struct game_board));
+	if(!game) {
+		return NULL;
+	}
+	game->board_size = BOARD_SIZE; // not hardcoded board size maybe?
+	game->matrix = malloc(game->board_size * game->board_size);
+	game->id = new_game_id();
+	game->created_at = time(NULL);
+	if(!game->matrix || pthread_mutex_init(&game->monitor, NULL)) {
+		free(game->matrix);
+		free(game);
+		return NULL;
+	}
+	memset(game->matrix, ' ', game->board_size * game->board_size); // empty cells are spaces
+	game->player1_fd = -1; // initialize fds to unusable values
+	game->player2_fd = -1;
+	return game;
+}
+
+/*
+ * frees a game of game_new that never made it into the registry
+ * */
+static void game_free(struct game_board *game)
+{
+	free(game->matrix);
+	pthread_mutex_destroy(&game->monitor);
+	free(game);
+}
+
+static void move_deadline_expired(struct timer *timer);
+
+/*
+ * starts the move deadline of the player whose turn it is, or stops it when the game does not wait for a
+ * move. called whenever a game's players or whose turn it is changed.
+ * */
+static void update_move_deadline(struct game_board *game)
+{
+	if(move_timeout && game->player_1 && game->player_2 && (game->whose_turn == 'x' || game->whose_turn == 'o')) {
+		timer_arm(&game->deadline, move_timeout * 1000, move_deadline_expired, game);
+	} else {
+		timer_cancel(&game->deadline);
+	}
+}
+
+/*
+ * answers a request with SERVER_BUSY, the client may try again later
+ * */
+static unsigned char server_busy(char *buffer, struct session_details *session)
+{
+	buffer[0] = SERVER_BUSY;
+	if(session) {
+		session->bytes_written = 1;
+	}
+	gauge_add(gauges.shed, 1);
+	return SERVER_BUSY;
+}
+
+static char games_full(void)
+{
+	return max_games && atomic_load(&gauges.games) >= (long) max_games;
+}
+
+unsigned char create_new_game_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	if(!(*session_details)->session_present || (*session_details)->current_game || (*session_details)->spectator
+	|| ((*session_details)->ticket && !(*session_details)->multiplexed)) { // a waiting session gets its game from the matchmaker
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	if(games_full()) {
+		return server_busy(buffer, *session_details);
+	}
+	if((*session_details)->multiplexed && joined_games_reserve(*session_details)) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	(*session_details)->current_game = game_new();
+	if(!(*session_details)->current_game) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	struct game_board *game = (*session_details)->current_game;
+	char to_uppercase = random() % 2 ? 0x20 : 0;
+	if(random() % 2) {
+		game->player_1 = (*session_details)->logged_in_user;
+		game->player1_fd = (*session_details)->fd;
+		game->player1_multiplexed = (*session_details)->multiplexed;
+	} else {
+		game->player_2 = (*session_details)->logged_in_user;
+		game->player2_fd = (*session_details)->fd;
+		game->player2_multiplexed = (*session_details)->multiplexed;
+	}
+	game->host = (*session_details)->logged_in_user;
+	memset(buffer + 2, 0, BUFFER_LENGTH - 2);
+	buffer[0] = CREATE_NEW_GAME_SUCCESS;
+	buffer[1] = game->player_1 ? 'x' : 'o' - to_uppercase; // inform the client which player he is 
+	switch(buffer[1]) {
+		case 'O': case 'x': game->whose_turn = 'o'; break;
+		case 'X': case 'o': game->whose_turn = 'x'; break;
+	}
+	int bytes_written = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", game->board_size); //count not including null terminator
+	if(bytes_written > 0 && !game_boards_array_add((*session_details)->games, game)) {
+		(*session_details)->bytes_written = 3 + bytes_written;  // three first buffer bytes and a null terminator
+		gauge_add(gauges.open_games, 1);
+		game->shared = shared_publish(game->id);
+		if((*session_details)->multiplexed) {
+			(*session_details)->bytes_written = append_game_id(buffer, (*session_details)->bytes_written, game);
+			(*session_details)->joined_games[(*session_details)->number_of_joined_games++] = game;
+		}
+	} else {
+		game_free(game);
+		(*session_details)->current_game = NULL;
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	log_debug("fd %d created a game, %c", game->player1_fd < 0 ? game->player2_fd : game->player1_fd, buffer[1]);
+	return CREATE_NEW_GAME_SUCCESS;
+}
+
+/*
+ * seats the session in the free seat of an open game. returns the session's character as in
+ * JOIN_RANDOM_GAME_REPLY, uppercase if it moves first, or 0 if no seat is free.
+ * */
+static char take_seat(struct game_board *game, struct session_details *session)
+{
+	if(!game->player_1) {
+		game->player_1 = session->logged_in_user;
+		game->player1_fd = session->fd;
+		game->player1_multiplexed = session->multiplexed;
+		log_debug("fd %d joined", session->fd);
+		return game->whose_turn == 'x' ? 'X' : 'x';
+	} else if(!game->player_2) {
+		game->player_2 = session->logged_in_user;
+		game->player2_fd = session->fd;
+		game->player2_multiplexed = session->multiplexed;
+		log_debug("fd %d joined", session->fd);
+		return game->whose_turn == 'o' ? 'O' : 'o';
+	}
+	return 0;
+}
+
+/*
+ * joins an open game of another server process sharing the registry, see shared.h. the session is handed
+ * over to that process, which answers the request, unless no game is found.
+ * */
+static unsigned char join_shared_game(char *buffer, struct session_details *session)
+{
+	struct shared_join join;
+	if(session->number_of_joined_games || session->ticket || session->entry || session->links) { // its games and waits stay with this process
+		return NO_GAMES_AVAILABLE;
+	}
+	memset(&join, 0, sizeof(join));
+	memcpy(join.username, session->logged_in_user->username, USERNAMELEN);
+	memcpy(join.password, session->logged_in_user->password, PASSWORDLEN);
+	join.multiplexed = session->multiplexed;
+	if(shared_join(&join, session->fd)) {
+		return NO_GAMES_AVAILABLE;
+	}
+	session->handed_over = 1;
+	session->bytes_written = 0;
+	log_debug("fd %d joined game %u of another process", session->fd, join.game_id);
+	buffer[0] = JOIN_RANDOM_GAME_REPLY;
+	return JOIN_RANDOM_GAME_REPLY;
+}
+
+/*
+ * joins an open game of another node of the cluster over the session's link to it, the node answers
+ * the request. only multiplexed sessions play on other nodes, their requests name the game's node.
+ * */
+static unsigned char join_cluster_game(char *buffer, struct session_details *session)
+{
+	struct cluster_link *link;
+	int node;
+	if(!session->multiplexed || buffer[1] == CLUSTER_FORWARDED || (node = cluster_pick()) < 0
+	|| !(link = session_link(session, node, 1))) {
+		buffer[0] = NO_GAMES_AVAILABLE;
+		return NO_GAMES_AVAILABLE;
+	}
+	buffer[0] = JOIN_RANDOM_GAME_REQUEST;
+	buffer[1] = CLUSTER_FORWARDED;
+	if(cluster_link_send(link, buffer, 2)) {
+		buffer[0] = NO_GAMES_AVAILABLE;
+		return NO_GAMES_AVAILABLE;
+	}
+	session->forwarded = 1;
+	session->bytes_written = 0;
+	log_debug("fd %d joins a game of node %d", session->fd, node);
+	return JOIN_RANDOM_GAME_REPLY;
+}
+
+unsigned char join_random_game_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	if(!(*session_details)->session_present || (*session_details)->current_game || (*session_details)->spectator
+	|| ((*session_details)->ticket && !(*session_details)->multiplexed)) { // a waiting session gets its game from the matchmaker
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	if((*session_details)->multiplexed && joined_games_reserve(*session_details)) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	if(pthread_mutex_lock(&(*session_details)->games->monitor)) { 
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
 	}
 	struct game_boards_array *games = (*session_details)->games;
 	size_t roll, roll_prev, size, i = 0;
-	char which, to_uppercase;
+	char seat, was_open;
 	size = games->number_of_elements;
 	roll_prev = UINT_MAX; // initial value for more elegant loop
 	for(;;) {
@@ -523,7 +922,10 @@ unsigned char join_random_game_request(char *buffer, struct session_details **se
 				(*session_details)->bytes_written = 1;
 				return INTERNAL_SERVER_ERROR;
 			}
-			return NO_GAMES_AVAILABLE;
+			if(join_shared_game(buffer, *session_details) == JOIN_RANDOM_GAME_REPLY) {
+				return JOIN_RANDOM_GAME_REPLY;
+			}
+			return join_cluster_game(buffer, *session_details);
 		}
 		roll = random() % size;
 		if(roll == roll_prev || games->visited[roll]) {
@@ -531,35 +933,34 @@ unsigned char join_random_game_request(char *buffer, struct session_details **se
 		}
 		games->visited[roll] = 1;
 		++i;
-		if(!games->array[roll]->player_1) {
-			games->array[roll]->player_1 = (*session_details)->logged_in_user;
-			games->array[roll]->player1_fd = (*session_details)->fd;
-			printf("fd %d joined\n", (*session_details)->fd);
-			to_uppercase = games->array[roll]->whose_turn == 'x' ? 0x20 : 0;
-			which = 0;
-			break;
-		} else if(!games->array[roll]->player_2) {
-			games->array[roll]->player_2 = (*session_details)->logged_in_user;
-			games->array[roll]->player2_fd = (*session_details)->fd;
-			printf("fd %d joined\n", (*session_details)->fd);
-			to_uppercase = games->array[roll]->whose_turn == 'o' ? 0x20 : 0;
-			which = 1;
+		was_open = game_is_open(games->array[roll]);
+		if(!was_open) { // finished and abandoned games keep a free seat but cannot be played
+			roll_prev = roll;
+			continue;
+		}
+		if(games->array[roll]->player_1 == (*session_details)->logged_in_user
+		|| games->array[roll]->player_2 == (*session_details)->logged_in_user) { // a multiplexed session's own game
+			roll_prev = roll;
+			continue;
+		}
+		if(games->array[roll]->shared && shared_claim(games->array[roll]->shared)) { // a player of another process takes the seat
+			roll_prev = roll;
+			continue;
+		}
+		if((seat = take_seat(games->array[roll], *session_details))) {
 			break;
 		}
 		roll_prev = roll;
 	}
 	memset(games->visited, 0, games->number_of_elements);
+	shared_release(games->array[roll]->shared);
+	games->array[roll]->shared = 0;
+	gauge_add(gauges.open_games, game_is_open(games->array[roll]) - was_open);
+	update_move_deadline(games->array[roll]);
 	(*session_details)->current_game = games->array[roll]; 
 	buffer[0] = JOIN_RANDOM_GAME_REPLY;
-	buffer[1] = !which ? 'x' : 'o';
-	/*
-	if(((*session_details)->current_game->player_1 == (*session_details)->logged_in_user && (*session_details)->current_game->whose_turn == 'x')
-	|| ((*session_details)->current_game->player_2 == (*session_details)->logged_in_user && (*session_details)->current_game->whose_turn == 'o')) {
-		to_uppercase = 0x20;
-	}
-	*/
-	buffer[1] -= to_uppercase; //upppercase indicates that this player will begin the game
-	printf("join %c\n", buffer[1]);
+	buffer[1] = seat; //upppercase indicates that this player will begin the game
+	log_debug("join %c", buffer[1]);
 	int bytes_written = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", (*session_details)->current_game->board_size);
 	if(pthread_mutex_unlock(&games->monitor)) {
 		buffer[0] = INTERNAL_SERVER_ERROR;
@@ -568,6 +969,10 @@ unsigned char join_random_game_request(char *buffer, struct session_details **se
 	}
 	if(bytes_written > 0) {
 		(*session_details)->bytes_written = 3 + bytes_written; 
+		if((*session_details)->multiplexed) {
+			(*session_details)->bytes_written = append_game_id(buffer, (*session_details)->bytes_written, (*session_details)->current_game);
+			(*session_details)->joined_games[(*session_details)->number_of_joined_games++] = (*session_details)->current_game;
+		}
 	} else {
 		(*session_details)->current_game = NULL;
 		buffer[0] = INTERNAL_SERVER_ERROR;
@@ -577,45 +982,182 @@ unsigned char join_random_game_request(char *buffer, struct session_details **se
 	return JOIN_RANDOM_GAME_REPLY;
 }
 
+/*
+ * gives up the session's seat in game, the last player to leave removes the game.
+ * the session does not hold the game afterwards, also if that fails.
+ * */
+static int leave_game(struct session_details *session_details, struct game_board *game)
+{
+	int ret_value;
+	char was_open, last_player, forfeit;
+	joined_games_remove(session_details, game);
+	session_details->current_game = NULL;
+	if((ret_value = pthread_mutex_lock(&game->monitor))) {
+		return ret_value;
+	}
+	was_open = game_is_open(game);
+	forfeit = game->match && (game->whose_turn == 'x' || game->whose_turn == 'o'); // reported once, by whoever ends the game
+	forfeit = forfeit ? (session_details->logged_in_user == game->player_1 ? 'O' : 'X') : 0;
+	game->whose_turn = 0;
+	update_move_deadline(game);
+	publish_move(game, 0, 0, 0);
+	if(game->host == session_details->logged_in_user) {
+		game->host = NULL;
+	}
+	if(session_details->logged_in_user == game->player_1) {
+		game->player_1 = NULL;
+	} else if(session_details->logged_in_user == game->player_2) {
+		game->player_2 = NULL;
+	}
+	gauge_add(gauges.open_games, game_is_open(game) - was_open);
+	if(game->shared && !shared_claim(game->shared)) { // a seat another process claimed already is refused by adopt_shared_player
+		shared_release(game->shared);
+	}
+	game->shared = 0;
+	last_player = !game->player_1 && !game->player_2; // decided under the lock, so only one of two leaving players removes the game
+	if((ret_value = pthread_mutex_unlock(&game->monitor))) {
+		return ret_value;
+	}
+	if(forfeit && tournament_report(game->match, forfeit)) {
+		log_error("error on reporting game %u", game->id);
+	}
+	if(last_player) {
+		timer_cancel_sync(&game->deadline); // an expiring deadline still uses the game
+	}
+	if(last_player && (ret_value = game_boards_array_remove(session_details->games, game))) {
+		return ret_value;
+	}
+	log_debug("remove 1");
+	return 0;
+}
+
 unsigned char leave_game_request(char *buffer, struct session_details **session_details)
 {
 	if(!*session_details) {
 		buffer[0] = INVALID_REQUEST;
 		return INVALID_REQUEST;
 	}
+	if((*session_details)->multiplexed && !(*session_details)->current_game) { // no game of this session has that id
+		buffer[0] = INVALID_OPERANDS;
+		(*session_details)->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
 	if(!(*session_details)->session_present || !(*session_details)->current_game) {
 		buffer[0] = INVALID_REQUEST;
 		(*session_details)->bytes_written = 1;
 		return INVALID_REQUEST;
 	}
-	if(pthread_mutex_lock(&(*session_details)->current_game->monitor)) {
+	if(leave_game(*session_details, (*session_details)->current_game)) {
 		buffer[0] = INTERNAL_SERVER_ERROR;
 		(*session_details)->bytes_written = 1;
 		return INTERNAL_SERVER_ERROR;
 	}
-	struct game_board *game = (*session_details)->current_game;
-	int ret_value;
-	game->whose_turn = 0;
-	if(game->host == (*session_details)->logged_in_user) {
-		game->host = NULL;
+	buffer[0] = LEAVE_GAME_REPLY;
+	(*session_details)->bytes_written = 1;
+	return LEAVE_GAME_REPLY;
+}
+
+/*
+ * GAME_SNAPSHOT_REQUEST: opcode, and the game id with a null in multiplexed sessions. answers with the board
+ * and the moves of the player's game, see encode_game_snapshot, e.g. for a player that resumed a restored game.
+ * */
+unsigned char game_snapshot_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
 	}
-	if((*session_details)->logged_in_user == game->player_1) {
-		game->player_1 = NULL;
-	} else if((*session_details)->logged_in_user == game->player_2) {
-		game->player_2 = NULL;
+	if((*session_details)->multiplexed && !(*session_details)->current_game) { // no game of this session has that id
+		buffer[0] = INVALID_OPERANDS;
+		(*session_details)->bytes_written = 1;
+		return INVALID_OPERANDS;
 	}
-	ret_value = pthread_mutex_unlock(&game->monitor);
-	if(ret_value || (!game->player_1 && !game->player_2 && game_boards_array_remove((*session_details)->games, game))) {
+	if(!(*session_details)->session_present || !(*session_details)->current_game) {
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	struct game_board *game = (*session_details)->current_game;
+	size_t length;
+	if(pthread_mutex_lock(&game->monitor)) {
 		buffer[0] = INTERNAL_SERVER_ERROR;
 		(*session_details)->bytes_written = 1;
 		return INTERNAL_SERVER_ERROR;
-	} else {
-		printf("remove 1\n");
 	}
-	(*session_details)->current_game = NULL;
-	buffer[0] = LEAVE_GAME_REPLY;
-	(*session_details)->bytes_written = 1;
-	return LEAVE_GAME_REPLY;
+	length = encode_game_snapshot(buffer, GAME_SNAPSHOT_REPLY, game);
+	pthread_mutex_unlock(&game->monitor);
+	if(!length) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	(*session_details)->bytes_written = length;
+	return GAME_SNAPSHOT_REPLY;
+}
+
+/*
+ * hands a finished game over to the archive writer, the caller holds the game's lock
+ * */
+void archive_finished_game(struct game_board *game)
+{
+	struct archive_record record;
+	memset(&record, 0, sizeof(record));
+	record.finished_at = time(NULL);
+	if(game->player_1) {
+		memcpy(record.player_1, game->player_1->username, USERNAMELEN);
+	}
+	if(game->player_2) {
+		memcpy(record.player_2, game->player_2->username, USERNAMELEN);
+	}
+	record.board_size = game->board_size;
+	record.result = game->whose_turn;
+	record.number_of_moves = game->number_of_moves;
+	archive_game(&record, game->moves);
+}
+
+/*
+ * runs on the timer thread once a player did not move in time: the player loses the game, which is
+ * finished as by a last move. both players are told with MOVE_TIMEOUT_NOTIFY: code, the game id and a
+ * null in multiplexed sessions, the result. it is sent under the game's lock, so that it never goes to
+ * the socket of a player that left.
+ * */
+static void move_deadline_expired(struct timer *timer)
+{
+	struct game_board *game = timer->context;
+	struct tournament_match *match;
+	char buffer[BUFFER_LENGTH], result;
+	size_t length;
+	int n;
+	pthread_mutex_lock(&game->monitor);
+	if(timer_armed(timer) || !game->player_1 || !game->player_2 || (game->whose_turn != 'x' && game->whose_turn != 'o')) {
+		pthread_mutex_unlock(&game->monitor); // a move or a player leaving came first
+		return;
+	}
+	result = game->whose_turn == 'x' ? 'O' : 'X';
+	game->whose_turn = result;
+	publish_snapshot(game);
+	archive_finished_game(game);
+	if(rating_update(game->player_1->username, game->player_2->username, result)) {
+		log_error("error on rating game %u", game->id);
+	}
+	for(int i = 0; i < 2; ++i) {
+		buffer[0] = MOVE_TIMEOUT_NOTIFY;
+		length = 1;
+		if(i ? game->player2_multiplexed : game->player1_multiplexed) {
+			n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u", game->id);
+			length += n > 0 ? n + 1 : 0;
+		}
+		buffer[length++] = result;
+		if(send(i ? game->player2_fd : game->player1_fd, buffer, length, MSG_NOSIGNAL) < 0) {
+			log_warning("error on send: %s", (unsigned long) strerror(errno));
+		}
+	}
+	match = game->match;
+	log_info("game %u timed out, %c won", game->id, result);
+	pthread_mutex_unlock(&game->monitor);
+	if(match && tournament_report(match, result)) {
+		log_error("error on reporting game %u", game->id);
+	}
 }
 
 unsigned char action_request(char *buffer, struct session_details **session_details)
@@ -624,16 +1166,23 @@ unsigned char action_request(char *buffer, struct session_details **session_deta
 		buffer[0] = INVALID_REQUEST;
 		return INVALID_REQUEST;
 	}
+	if((*session_details)->multiplexed && !(*session_details)->current_game) { // no game of this session has that id
+		buffer[0] = INVALID_OPERANDS;
+		(*session_details)->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
 	if(!(*session_details)->session_present || !(*session_details)->current_game) {
 		buffer[0] = INVALID_REQUEST;
 		(*session_details)->bytes_written = 1;
 		return INVALID_REQUEST;
 	}
+	unsigned long span = trace_span_begin();
 	if(pthread_mutex_lock(&(*session_details)->current_game->monitor)) {
 		buffer[0] = INTERNAL_SERVER_ERROR;
 		(*session_details)->bytes_written = 1;
 		return INTERNAL_SERVER_ERROR;
 	}
+	trace_span_end("wait game lock", span);
 	if(!(*session_details)->current_game->whose_turn || (*session_details)->current_game->whose_turn == 'D') {
 		buffer[0] = NO_FURTHER_ACTIONS_PERMITTED;
 		(*session_details)->bytes_written = 1;
@@ -666,17 +1215,20 @@ unsigned char action_request(char *buffer, struct session_details **session_deta
 	unsigned long x, y;
 	int ret_value;
 	if(get_coordinates_from_buffer(buffer + 1, &x, &y)) {
+		pthread_mutex_unlock(&(*session_details)->current_game->monitor);
 		buffer[0] = INVALID_OPERANDS;
 		(*session_details)->bytes_written = 1;
 		return INVALID_OPERANDS;
 	}
+	span = trace_span_begin();
 	ret_value = write_x_or_o((*session_details)->current_game, x, y, character);
+	trace_span_end("write_x_or_o", span);
 	switch(ret_value) {
 		case -2: {
 			pthread_mutex_unlock(&(*session_details)->current_game->monitor);
 			buffer[0] = INVALID_OPERANDS;
 			(*session_details)->bytes_written = 1;
-			printf("hello operands 2\n");
+			log_debug("hello operands 2");
 			return INVALID_OPERANDS;
 		}
 		case -5: {
@@ -692,10 +1244,14 @@ unsigned char action_request(char *buffer, struct session_details **session_deta
 			pthread_mutex_unlock(&(*session_details)->current_game->monitor);
 			buffer[0] = INTERNAL_SERVER_ERROR;
 			(*session_details)->bytes_written = 1;
-			printf("hello internal 3, %d\n", ret_value);
+			log_error("hello internal 3, %d", ret_value);
 			return INTERNAL_SERVER_ERROR;
 		}
 	}
+	if((*session_details)->current_game->number_of_moves < ARCHIVE_MAX_MOVES) {
+		(*session_details)->current_game->moves[(*session_details)->current_game->number_of_moves++] =
+			(*session_details)->current_game->board_size * x + y;
+	}
 	if((*session_details)->logged_in_user == (*session_details)->current_game->player_1) {
 		(*session_details)->current_game->player1_last_x = x;
 		(*session_details)->current_game->player1_last_y = y;
@@ -703,11 +1259,18 @@ unsigned char action_request(char *buffer, struct session_details **session_deta
 		(*session_details)->current_game->player2_last_x = x;
 		(*session_details)->current_game->player2_last_y = y;
 	}
+	publish_move((*session_details)->current_game, character, x, y);
+	update_move_deadline((*session_details)->current_game);
 	if((*session_details)->current_game->whose_turn == 'X' || (*session_details)->current_game->whose_turn == 'O'
 	|| (*session_details)->current_game->whose_turn == 'D') {
 		buffer[0] = GAME_IS_FINISHED;
 		buffer[1] = (*session_details)->current_game->whose_turn;
 		(*session_details)->bytes_written = 2;
+		archive_finished_game((*session_details)->current_game);
+		if(rating_update((*session_details)->current_game->player_1->username, (*session_details)->current_game->player_2->username,
+		(*session_details)->current_game->whose_turn)) {
+			log_error("error on rating game %u", (*session_details)->current_game->id);
+		}
 		if(pthread_mutex_unlock(&(*session_details)->current_game->monitor)) {
 			buffer[0] = INTERNAL_SERVER_ERROR;
 			(*session_details)->bytes_written = 1;
@@ -724,7 +1287,87 @@ unsigned char action_request(char *buffer, struct session_details **session_deta
 	(*session_details)->bytes_written = 1;
 	return ACTION_REPLY;
 }
-unsigned char logout_request(char *buffer, struct session_details **session_details)
+
+/*
+ * starts a finished game again between the same players, the players swap sides and x begins. the game
+ * keeps its place in the registry, its id and its board, so a series of games costs no allocation.
+ * the caller holds the game's lock.
+ * */
+static void restart_game(struct game_board *game)
+{
+	User *player = game->player_1;
+	int fd = game->player1_fd;
+	char multiplexed = game->player1_multiplexed;
+	game->player_1 = game->player_2;
+	game->player1_fd = game->player2_fd;
+	game->player1_multiplexed = game->player2_multiplexed;
+	game->player_2 = player;
+	game->player2_fd = fd;
+	game->player2_multiplexed = multiplexed;
+	memset(game->matrix, ' ', game->board_size * game->board_size);
+	game->number_of_moves = 0;
+	game->player1_last_x = game->player1_last_y = game->player2_last_x = game->player2_last_y = 0;
+	game->whose_turn = 'x';
+	game->rematch = NULL;
+	game->created_at = time(NULL);
+	update_move_deadline(game);
+	publish_snapshot(game);
+}
+
+/*
+ * REMATCH_REQUEST: opcode, and the game id with a null in multiplexed sessions. the first player to ask for
+ * a rematch of a finished game is answered with REMATCH_REPLY and a null character, the other player learns
+ * about it from a REMATCH_NOTIFY with a null character. once the other player asks too the game starts again,
+ * see restart_game, and both learn their new character from the REMATCH_REPLY and the REMATCH_NOTIFY,
+ * uppercase for the player who begins. tournament games are not played again.
+ * */
+unsigned char rematch_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	if((*session_details)->multiplexed && !(*session_details)->current_game) { // no game of this session has that id
+		buffer[0] = INVALID_OPERANDS;
+		(*session_details)->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
+	if(!(*session_details)->session_present || !(*session_details)->current_game) {
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	struct game_board *game = (*session_details)->current_game;
+	User *user = (*session_details)->logged_in_user;
+	if(pthread_mutex_lock(&game->monitor)) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	(*session_details)->bytes_written = 1;
+	if(!game->player_1 || !game->player_2) {
+		buffer[0] = NO_PLAYER_PRESENT;
+	} else if((game->whose_turn != 'X' && game->whose_turn != 'O' && game->whose_turn != 'D') || game->match) {
+		buffer[0] = INVALID_OPERANDS;
+	} else if(!game->rematch || game->rematch == user) {
+		game->rematch = user;
+		buffer[0] = REMATCH_REPLY;
+		buffer[1] = 0;
+		(*session_details)->bytes_written = 2;
+	} else {
+		restart_game(game);
+		buffer[0] = REMATCH_REPLY;
+		buffer[1] = game->player_1 == user ? 'X' : 'o'; // x begins
+		(*session_details)->bytes_written = 2;
+	}
+	if(pthread_mutex_unlock(&game->monitor)) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	return (unsigned char) buffer[0];
+}
+unsigned char logout_request(char *buffer, struct session_details **session_details)
 {
 	if(!*session_details) {
 		buffer[0] = INVALID_REQUEST;
@@ -831,223 +1474,1955 @@ unsigned char create_user_request(char *buffer, struct session_details **session
 	return INTERNAL_SERVER_ERROR;
 }
 
-void* connection_handler(void *arg)
+/*
+ * answers with the counters of the opcode or reply code in buffer[1]: the number of values in the second
+ * byte, then for request opcodes count, errors, p50, p99, p999 and max latency in nanoseconds,
+ * for reply codes how often they were sent.
+ * needs no login, so monitoring tools can ask before or instead of logging in.
+ * */
+unsigned char stats_request(char *buffer, struct session_details **session_details)
 {
-	unsigned long last_x, last_y;
-	char buffer[BUFFER_LENGTH];
-	int n, n2, peer_fd, ret_value;
-	unsigned char return_code, opcode;
-	struct arguments *arguments = (struct arguments*) arg;
-	int fd = arguments->fd;
-	struct game_boards_array *games = arguments->games;
-	struct session_details *session_details = NULL;
-	size_t bytes_written;
-	session_details = calloc(1, sizeof(struct session_details));
-	if(!session_details) {
-		free(arg);
-		close(fd);
-		return NULL;
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
 	}
-	session_details->games = games;
-	session_details->current_game = NULL;
+	unsigned char selector = buffer[1];
+	struct stats_summary summary;
+	int n;
 	memset(buffer, 0, BUFFER_LENGTH);
-	session_details->fd = fd;
-	n = recv(fd, buffer, BUFFER_LENGTH - 1, 0);
-	if(n < 0) {
-		perror("error on recv");
-		return NULL;
-	} else if(!n) {
-		shutdown(fd, SHUT_RDWR);
-		free(arg);
-		return NULL;
+	if(!stats_opcode_summary(selector, &summary)) {
+		buffer[1] = 6;
+		n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu%c%lu%c%lu%c%lu%c%lu%c%lu", summary.count, 0, summary.errors, 0,
+			summary.p50, 0, summary.p99, 0, summary.p999, 0, summary.max);
+	} else {
+		buffer[1] = 1;
+		n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", stats_reply_count(selector));
 	}
-	if(buffer[0] != LOGIN_REQUEST && buffer[0] != CREATE_USER_REQUEST) {
-		return_code = INVALID_REQUEST;
-		n2 = send(fd, &return_code, 1, MSG_NOSIGNAL);
-		if(n2 < 0) {
-			perror("error on send");
-		}
-		close(fd);
-		free(arg);
+	if(n <= 0 || n >= BUFFER_LENGTH - 2) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		(*session_details)->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	buffer[0] = STATS_REPLY;
+	(*session_details)->bytes_written = n + 3; // opcode byte, number of values and the last null terminator
+	return STATS_REPLY;
+}
+
+/*
+ * from now on the session names the game in every game-scoped request and can hold any number of
+ * games, see protocol.h. only allowed while it holds no game.
+ * */
+unsigned char multiplex_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	if(!(*session_details)->session_present || (*session_details)->current_game || (*session_details)->multiplexed) {
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	(*session_details)->multiplexed = 1;
+	buffer[0] = MULTIPLEX_REPLY;
+	(*session_details)->bytes_written = 1;
+	return MULTIPLEX_REPLY;
+}
+
+/*
+ * the game with id, or for id 0 a random game that is being played. the caller holds the registry's lock,
+ * the game's state is read without its lock and has to be checked again under it.
+ * */
+static struct game_board* find_game_to_spectate(struct game_boards_array *games, uint32_t id)
+{
+	struct game_board *game;
+	size_t i, start;
+	if(!games->number_of_elements) {
 		return NULL;
-	} else {
-		opcode = (unsigned char) buffer[0];
-		return_code = handler[opcode](buffer, &session_details);	
-		bytes_written = session_details->bytes_written;
-		n2 = send(fd, buffer, bytes_written, MSG_NOSIGNAL);
-		if(n2 < 0) {
-			perror("error on send");
-			free(arg);
-			return NULL;
+	}
+	start = id ? 0 : (size_t) random() % games->number_of_elements;
+	for(i = 0; i < games->number_of_elements; ++i) {
+		game = games->array[(start + i) % games->number_of_elements];
+		if(id ? game->id == id : game->player_1 && game->player_2 && (game->whose_turn == 'x' || game->whose_turn == 'o')) {
+			return game;
 		}
-		if((return_code >= FATAL_ERRORS)) {
-			free(session_details->logged_in_user);
-			free(session_details);
-			session_details = NULL;
+	}
+	return NULL;
+}
+
+/*
+ * SPECTATE_REQUEST: opcode, game id, null. the reply carries the board, see encode_game_snapshot,
+ * after it the session gets every move of the game until a player leaves. id 0 picks a game that is
+ * being played. a session that holds a seat cannot spectate and a spectating session cannot take one.
+ * */
+unsigned char spectate_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	if(!(*session_details)->session_present || (*session_details)->current_game || (*session_details)->number_of_joined_games
+	|| (*session_details)->ticket || (*session_details)->entry) {
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	struct session_details *session = *session_details;
+	struct game_boards_array *games = session->games;
+	struct game_board *game;
+	struct spectator **spectators;
+	unsigned char return_code = SPECTATE_REPLY;
+	char *end;
+	size_t i, length = 0;
+	unsigned long id = strtoul(buffer + 1, &end, 10);
+	if(end == buffer + 1 || *end || id > UINT32_MAX) {
+		buffer[0] = INVALID_OPERANDS;
+		session->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
+	if(!session->spectator && !(session->spectator = spectate_attach(session->fd))) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		session->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	if(pthread_mutex_lock(&games->monitor)) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		session->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	if(!(game = find_game_to_spectate(games, id))) {
+		pthread_mutex_unlock(&games->monitor);
+		return_code = id ? INVALID_OPERANDS : NO_GAMES_AVAILABLE;
+		buffer[0] = return_code;
+		session->bytes_written = 1;
+		return return_code;
+	}
+	pthread_mutex_lock(&game->monitor);
+	for(i = 0; i < game->number_of_spectators && game->spectators[i] != session->spectator; ++i);
+	if(!game->whose_turn || (!game->player_1 && !game->player_2) || i < game->number_of_spectators) { // abandoned or watched already
+		return_code = id ? INVALID_OPERANDS : NO_GAMES_AVAILABLE;
+	} else if(game->number_of_spectators == game->spectators_size) {
+		spectators = realloc(game->spectators, sizeof(struct spectator*) * (game->spectators_size + REALLOC_SIZE));
+		if(spectators) {
+			game->spectators = spectators;
+			game->spectators_size += REALLOC_SIZE;
+		} else {
+			return_code = INTERNAL_SERVER_ERROR;
 		}
-		printf("end login %u\n", return_code);
 	}
-	while(session_details && session_details->session_present) {
-		memset(buffer, 0, BUFFER_LENGTH);
-		n = recv(fd, buffer, BUFFER_LENGTH - 1, 0);
-		if(n <= 0) {
-			perror("error on recv");
-			if(session_details->current_game) {
-				printf("remove2\n");
-				if((ret_value = game_boards_array_remove(session_details->games, session_details->current_game))) {
-					fprintf(stderr, "error on remove? %d\n", ret_value);
-				}
-				peer_fd = fd == session_details->current_game->player1_fd ?	session_details->current_game->player2_fd : 
-												session_details->current_game->player1_fd; 
-				printf("sending leave notify\n");
-				buffer[0] = PEER_LEFT_NOTIFY;
-				n = send(peer_fd, buffer, 1, MSG_NOSIGNAL);
-				if(n < 0) {
-					fprintf(stderr, "error on sending peer left notify\n");
-				}
-			}
+	if(return_code == SPECTATE_REPLY && !(length = encode_game_snapshot(buffer, SPECTATE_REPLY, game))) {
+		return_code = INTERNAL_SERVER_ERROR;
+	}
+	if(return_code == SPECTATE_REPLY) {
+		spectate_hold(session->spectator); // moves made from now on are queued behind this reply
+		game->spectators[game->number_of_spectators++] = session->spectator;
+	}
+	pthread_mutex_unlock(&game->monitor);
+	pthread_mutex_unlock(&games->monitor);
+	if(return_code != SPECTATE_REPLY) {
+		buffer[0] = return_code;
+		length = 1;
+	}
+	session->bytes_written = length;
+	return return_code;
+}
+
+/*
+ * LIST_GAMES_REQUEST: opcode, index of the first game, null. the reply lists up to LOBBY_PAGE_LENGTH open
+ * games from there: code, the number of games in the reply in one byte, the number of open games, null,
+ * then id, host, board size and age in seconds of every game, each followed by a null. the games come
+ * from the lobby snapshot, which is up to LOBBY_PUBLISH_MS old, the registry is not locked.
+ * */
+unsigned char list_games_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	if(!(*session_details)->session_present) {
+		buffer[0] = INVALID_REQUEST;
+		(*session_details)->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	const struct lobby_snapshot *snapshot;
+	const struct lobby_game *entry;
+	unsigned int epoch;
+	unsigned char count = 0;
+	size_t length, total;
+	time_t now = time(NULL);
+	char *end;
+	int n;
+	unsigned long first = strtoul(buffer + 1, &end, 10);
+	if(end == buffer + 1 || *end) {
+		buffer[0] = INVALID_OPERANDS;
+		(*session_details)->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
+	snapshot = lobby_read_begin(&epoch);
+	total = snapshot ? snapshot->number_of_games : 0;
+	n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", total);
+	length = n + 3;
+	for(; first < total && count < LOBBY_PAGE_LENGTH; ++first, ++count) {
+		entry = &snapshot->games[first];
+		n = snprintf(buffer + length, BUFFER_LENGTH - length, "%u%c%s%c%lu%c%lu", entry->id, 0, entry->host, 0,
+			entry->board_size, 0, now > entry->created_at ? (unsigned long)(now - entry->created_at) : 0ul);
+		if(n <= 0 || (size_t) n >= BUFFER_LENGTH - length) {
 			break;
 		}
-		opcode = (unsigned char) buffer[0];
-		if(handler[opcode]) {
-			return_code = handler[opcode](buffer, &session_details);
-			bytes_written = session_details->bytes_written;
-			if((return_code >= FATAL_ERRORS)) {
-				free(session_details->logged_in_user);
-				free(session_details);
-				session_details = NULL;
-			}
-			n2 = send(fd, buffer, bytes_written, MSG_NOSIGNAL);
-			if(n2 < 0) {
-				perror("error on send");
-				break;
-			}
-			switch((unsigned char)*buffer) {
-				case JOIN_RANDOM_GAME_REPLY: {
-					peer_fd = session_details->current_game->host == session_details->current_game->player_1 ?
-						session_details->current_game->player1_fd :
-						session_details->current_game->player2_fd;
-					buffer[0] = OTHER_PLAYER_PRESENT_NOTIFY;
-					n2 = send(peer_fd, buffer, 1, MSG_NOSIGNAL);
-					if(n2 < 0) {
-						perror("error on send");
-						break;
-					}
-				} break;
-				case ACTION_REPLY: {
-					printf("sending notify...\n");
-					int count1, count2 = -1;
-					char *next = NULL;
-					memset(buffer, 0, BUFFER_LENGTH);
-					buffer[0] = ACTION_NOTIFY;
-					buffer[1] = session_details->current_game->whose_turn;
-					if(session_details->current_game->whose_turn == 'o') {
-						last_x = session_details->current_game->player1_last_x;
-						last_y = session_details->current_game->player1_last_y;
-						peer_fd = session_details->current_game->player2_fd;
-					} else if(session_details->current_game->whose_turn == 'x') {
-						last_x = session_details->current_game->player2_last_x;
-						last_y = session_details->current_game->player2_last_y;
-						peer_fd = session_details->current_game->player1_fd;
-					}
-					printf("last %lu %lu\n", last_x, last_y);
-					count1 = snprintf(buffer + 2, BUFFER_LENGTH / 2, "%lu", last_x);
-					if(count1 > 0) {
-						next = buffer + count1 + 3;
-						count2 = snprintf(next, BUFFER_LENGTH / 2, "%lu", last_y);
-					}
-					if(count1 <= 0 || count2 <= 0) {
-						perror("error on sending notify");
-					}
-					bytes_written = 2 + count1 + count2 + 2;
-					n2 = send(peer_fd, buffer, bytes_written, MSG_NOSIGNAL);
-					if(n2 < 0) {
-						perror("error on send");
-					}
-					printf("sent to %d\n", peer_fd);
-				} break;
-				case GAME_IS_FINISHED: {
-					buffer[0] = GAME_IS_FINISHED;
-					buffer[1] = session_details->current_game->whose_turn;
-					n = send(peer_fd, buffer, 2, MSG_NOSIGNAL);
-				} break;
-			}
-		} else {
-			buffer[0] = NOT_IMPLEMENTED;
-			n2 = send(fd, buffer, 1, MSG_NOSIGNAL);
-			if(n2 < 0) {
-				perror("error on send");
-				break;
-			}
-		}
+		length += n + 1;
 	}
-	printf("end connection\n");
-	free(arg);
-	free(session_details);
-	shutdown(fd, SHUT_RDWR);
-	return NULL;
+	lobby_read_end(epoch);
+	buffer[0] = LIST_GAMES_REPLY;
+	buffer[1] = count;
+	(*session_details)->bytes_written = length;
+	return LIST_GAMES_REPLY;
 }
 
-int main(int argc, char **argv)
+/*
+ * MATCHMAKE_REQUEST: opcode. queues the session for the matchmaker and answers with the player's rating
+ * and a null. the game follows as MATCH_FOUND_NOTIFY, laid out like JOIN_RANDOM_GAME_REPLY, or
+ * MATCH_EXPIRED_NOTIFY if no player of a similar rating came along, see matchmaker.h. a multiplexed
+ * session goes on playing its other games meanwhile.
+ * */
+unsigned char matchmake_request(char *buffer, struct session_details **session_details)
 {
-	int sockfd, newsockfd, portno;
-	pthread_t thread;
-	pthread_attr_t attributes;
-	socklen_t clilen;
-	struct sockaddr_in serv_addr, cli_addr;
-	struct game_boards_array *games = array_of_games_init(REALLOC_SIZE);
-	struct arguments *arg;
-	if(!games) {
-		error("error on mallocing stuff");
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
 	}
-	//signal(SIGINT, sigint_handler);
-	if(argc < 2) {
-		fprintf(stderr,"ERROR, no port provided\n");
-		exit(1);
+	struct session_details *session = *session_details;
+	struct match_ticket *ticket;
+	int n;
+	if(!session->session_present || session->ticket || session->spectator || (!session->multiplexed && session->current_game)) {
+		buffer[0] = INVALID_REQUEST;
+		session->bytes_written = 1;
+		return INVALID_REQUEST;
 	}
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if(sockfd < 0) {
-		error("ERROR opening socket");
+	if(games_full()) { // the match would not get a game
+		return server_busy(buffer, session);
 	}
-	memset((char *) &serv_addr, 0,  sizeof(serv_addr));
-	portno = atoi(argv[1]);
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = INADDR_ANY;
-	serv_addr.sin_port = htons(portno);
-	if(bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-		error("ERROR on binding");
+	ticket = calloc(1, sizeof(struct match_ticket));
+	if(!ticket) {
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		session->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
 	}
-	listen(sockfd, 5);
-	clilen = sizeof(cli_addr);
-	if(pthread_attr_init(&attributes)) {
-		error("error initialising thread attributes structure");
+	ticket->user = session->logged_in_user;
+	ticket->fd = session->fd;
+	ticket->multiplexed = session->multiplexed;
+	ticket->games = session->games;
+	ticket->rating = rating_get(session->logged_in_user->username);
+	session->ticket = ticket; // queued after the reply was sent, so that the reply comes before the match
+	buffer[0] = MATCHMAKE_REPLY;
+	n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%d", ticket->rating);
+	session->bytes_written = n + 2;
+	return MATCHMAKE_REPLY;
+}
+
+/*
+ * the session takes the game the matchmaker seated it in, before it handles its next request. with
+ * cancel a session that is still waiting stops waiting.
+ * */
+static void collect_match(struct session_details *session_details, char cancel)
+{
+	struct match_ticket *ticket = session_details->ticket;
+	if(!ticket || matchmaker_collect(ticket, cancel)) {
+		return;
 	}
-	if(pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED)) {
-		error("error setting thread attribute to detached state");
+	session_details->ticket = NULL;
+	if(ticket->game && !session_details->multiplexed) {
+		session_details->current_game = ticket->game;
+	} else if(ticket->game && !joined_games_reserve(session_details)) {
+		session_details->joined_games[session_details->number_of_joined_games++] = ticket->game;
+	} else if(ticket->game && leave_game(session_details, ticket->game)) {
+		log_error("error on leaving matched game %u", ticket->game->id);
 	}
-	srandom(time(NULL));
-	for(;;) {
-		newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
-		if (newsockfd < 0) {
-			error("error on accept");
-		}
-		printf("Got a connection from %s on port %d\n", inet_ntoa(cli_addr.sin_addr), htons(cli_addr.sin_port));
-		//int *copy_newsockfd = malloc(sizeof(int));
-		arg = malloc(sizeof(struct arguments));
-		if(arg) {
-			arg->fd = newsockfd;	
-			arg->games = games;
-			if(pthread_create(&thread, &attributes, connection_handler, arg)) {
-				fprintf(stderr, "failed to create thread\n");	
-				free(arg);
-				arg = NULL;
-			}
-		} else {
-			error("error on malloc");
+	free(ticket);
+}
+
+static void send_match_notify(const struct match_ticket *ticket, const char *buffer, size_t length)
+{
+	if(send(ticket->fd, buffer, length, MSG_NOSIGNAL) < 0) {
+		log_warning("error on send: %s", (unsigned long) strerror(errno));
+	}
+}
+
+static void expire_match(struct match_ticket *ticket)
+{
+	char code = MATCH_EXPIRED_NOTIFY;
+	send_match_notify(ticket, &code, 1);
+}
+
+/*
+ * runs on the matchmaker thread: seats the two players in a new game and tells both about it
+ * */
+static void match_players(struct match_ticket *ticket, struct match_ticket *partner)
+{
+	struct match_ticket *player_x = random() % 2 ? ticket : partner, *player_o = player_x == ticket ? partner : ticket;
+	struct game_board *game = game_new();
+	char buffer[BUFFER_LENGTH];
+	size_t length;
+	int n;
+	if(!game) {
+		expire_match(ticket);
+		expire_match(partner);
+		return;
+	}
+	game->player_1 = player_x->user;
+	game->player1_fd = player_x->fd;
+	game->player1_multiplexed = player_x->multiplexed;
+	game->player_2 = player_o->user;
+	game->player2_fd = player_o->fd;
+	game->player2_multiplexed = player_o->multiplexed;
+	game->host = ticket->user;
+	game->whose_turn = random() % 2 ? 'x' : 'o';
+	if(game_boards_array_add(ticket->games, game)) {
+		game_free(game);
+		expire_match(ticket);
+		expire_match(partner);
+		return;
+	}
+	ticket->game = partner->game = game;
+	update_move_deadline(game);
+	for(int i = 0; i < 2; ++i) {
+		buffer[0] = MATCH_FOUND_NOTIFY;
+		buffer[1] = i ? 'o' : 'x';
+		buffer[1] -= buffer[1] == game->whose_turn ? 0x20 : 0; // uppercase begins
+		n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", game->board_size);
+		length = n + 3;
+		if((i ? player_o : player_x)->multiplexed) {
+			length = append_game_id(buffer, length, game);
 		}
+		send_match_notify(i ? player_o : player_x, buffer, length);
 	}
-	game_boards_array_free(games);
-	pthread_attr_destroy(&attributes);
-	close(sockfd);
+}
+
+/*
+ * TOURNAMENT_REQUEST: opcode, the format ('k' knockout, 'r' round robin), the number of players, null.
+ * signs the session up for the open tournament of that format and size and answers with the tournament's
+ * id, null, the number of players signed up, null. the tournament begins once it is full, see tournament.h.
+ * its games start with MATCH_FOUND_NOTIFY, so only multiplexed sessions play in tournaments: the next game
+ * may start before the player left the last one. TOURNAMENT_OVER_NOTIFY tells the player its place.
+ * */
+unsigned char tournament_request(char *buffer, struct session_details **session_details)
+{
+	if(!*session_details) {
+		buffer[0] = INVALID_REQUEST;
+		return INVALID_REQUEST;
+	}
+	struct session_details *session = *session_details;
+	struct tournament_entry *entry;
+	size_t size, signed_up;
+	uint32_t id;
+	char *end;
+	int n;
+	if(!session->session_present || !session->multiplexed || session->entry || session->spectator) {
+		buffer[0] = INVALID_REQUEST;
+		session->bytes_written = 1;
+		return INVALID_REQUEST;
+	}
+	size = strtoul(buffer + 2, &end, 10);
+	if(end == buffer + 2 || *end || (buffer[1] != TOURNAMENT_KNOCKOUT && buffer[1] != TOURNAMENT_ROUND_ROBIN)) {
+		buffer[0] = INVALID_OPERANDS;
+		session->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
+	if(games_full()) {
+		return server_busy(buffer, session);
+	}
+	entry = calloc(1, sizeof(struct tournament_entry));
+	if(!entry || pthread_mutex_init(&entry->monitor, NULL)) {
+		free(entry);
+		buffer[0] = INTERNAL_SERVER_ERROR;
+		session->bytes_written = 1;
+		return INTERNAL_SERVER_ERROR;
+	}
+	entry->user = session->logged_in_user;
+	entry->fd = session->fd;
+	entry->games = session->games;
+	entry->references = 2;
+	session->entry = entry; // before the tournament can begin and hand out games
+	if(!(id = tournament_sign_up(buffer[1], size, entry, rating_get(session->logged_in_user->username), &signed_up))) {
+		session->entry = NULL;
+		pthread_mutex_destroy(&entry->monitor);
+		free(entry);
+		buffer[0] = INVALID_OPERANDS; // the size is out of range
+		session->bytes_written = 1;
+		return INVALID_OPERANDS;
+	}
+	buffer[0] = TOURNAMENT_REPLY;
+	n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u%c%lu", id, 0, signed_up);
+	session->bytes_written = n + 2;
+	return TOURNAMENT_REPLY;
+}
+
+static void tournament_entry_release(struct tournament_entry *entry)
+{
+	char last;
+	pthread_mutex_lock(&entry->monitor);
+	last = !--entry->references;
+	pthread_mutex_unlock(&entry->monitor);
+	if(last) {
+		pthread_mutex_destroy(&entry->monitor);
+		free(entry->pending);
+		free(entry);
+	}
+}
+
+/*
+ * the session takes the tournament games it was seated in into its joined games, before it handles its
+ * next request. with withdraw the session ends, the tournament's later games are lost without a seat.
+ * a session that learned its place lets go of the tournament and may sign up for the next one.
+ * */
+static void collect_tournament_games(struct session_details *session_details, char withdraw)
+{
+	struct tournament_entry *entry = session_details->entry;
+	struct game_board *game;
+	char over;
+	if(!entry) {
+		return;
+	}
+	pthread_mutex_lock(&entry->monitor);
+	while(entry->number_of_pending) {
+		game = entry->pending[--entry->number_of_pending];
+		if(!joined_games_reserve(session_details)) {
+			session_details->joined_games[session_details->number_of_joined_games++] = game;
+		} else if(leave_game(session_details, game)) { // lost, the entry's lock comes before the game's
+			log_error("error on leaving tournament game %u", game->id);
+		}
+	}
+	entry->gone = withdraw;
+	over = entry->over;
+	pthread_mutex_unlock(&entry->monitor);
+	if(withdraw || over) {
+		session_details->entry = NULL;
+		tournament_entry_release(entry);
+	}
+}
+
+/*
+ * locks the entries of both players, in the order of their addresses
+ * */
+static void tournament_entries_lock(struct tournament_entry *x, struct tournament_entry *o, char lock)
+{
+	struct tournament_entry *first = x < o ? x : o, *second = x < o ? o : x;
+	if(lock) {
+		pthread_mutex_lock(&first->monitor);
+		pthread_mutex_lock(&second->monitor);
+	} else {
+		pthread_mutex_unlock(&second->monitor);
+		pthread_mutex_unlock(&first->monitor);
+	}
+}
+
+static int tournament_entry_add(struct tournament_entry *entry, struct game_board *game)
+{
+	struct game_board **pending;
+	if(entry->number_of_pending == entry->pending_size) {
+		pending = realloc(entry->pending, sizeof(struct game_board*) * (entry->pending_size + REALLOC_SIZE));
+		if(!pending) {
+			return -4;
+		}
+		entry->pending = pending;
+		entry->pending_size += REALLOC_SIZE;
+	}
+	entry->pending[entry->number_of_pending++] = game;
+	return 0;
+}
+
+/*
+ * runs on a tournament worker: starts the games of a batch of matches. the games go into the registry
+ * together, then every player that is still there is seated and told with a MATCH_FOUND_NOTIFY, laid
+ * out as for the matchmaker with x beginning. a match with a player gone is lost by that player without
+ * a game. the notify is sent under the entry's lock, so that it never goes to the socket of an ended session.
+ * */
+static void start_tournament_games(struct tournament_match **matches, size_t number_of_matches)
+{
+	struct game_board *games[TOURNAMENT_BATCH];
+	struct tournament_entry *x, *o;
+	struct game_boards_array *registry = ((struct tournament_entry*) matches[0]->player_x->owner)->games;
+	char buffer[BUFFER_LENGTH], result;
+	size_t i, added = 0, length;
+	int n;
+	for(i = 0; i < number_of_matches; ++i) {
+		x = matches[i]->player_x->owner;
+		o = matches[i]->player_o->owner;
+		if(!(games[added] = game_new())) {
+			log_error("error on starting a tournament game");
+			if(tournament_report(matches[i], 'D')) {
+				log_error("error on reporting a tournament game");
+			}
+			continue;
+		}
+		games[added]->player_1 = x->user;
+		games[added]->player1_fd = x->fd;
+		games[added]->player1_multiplexed = 1;
+		games[added]->player_2 = o->user;
+		games[added]->player2_fd = o->fd;
+		games[added]->player2_multiplexed = 1;
+		games[added]->host = x->user;
+		games[added]->whose_turn = 'x';
+		games[added]->match = matches[i];
+		++added;
+	}
+	if(added && game_boards_array_add_batch(registry, games, added)) {
+		log_error("error on adding %lu tournament games", added);
+		for(i = 0; i < added; ++i) {
+			if(tournament_report(games[i]->match, 'D')) {
+				log_error("error on reporting a tournament game");
+			}
+			game_free(games[i]);
+		}
+		return;
+	}
+	for(i = 0; i < added; ++i) {
+		x = games[i]->match->player_x->owner;
+		o = games[i]->match->player_o->owner;
+		tournament_entries_lock(x, o, 1);
+		result = x->gone ? 'O' : o->gone ? 'X' : 0;
+		if(!result && tournament_entry_add(x, games[i])) {
+			result = 'D';
+		} else if(!result && tournament_entry_add(o, games[i])) {
+			--x->number_of_pending;
+			result = 'D';
+		}
+		for(int j = 0; j < 2 && !result; ++j) {
+			buffer[0] = MATCH_FOUND_NOTIFY;
+			buffer[1] = j ? 'o' : 'X'; // uppercase begins
+			n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", games[i]->board_size);
+			length = append_game_id(buffer, n + 3, games[i]);
+			if(send((j ? o : x)->fd, buffer, length, MSG_NOSIGNAL) < 0) {
+				log_warning("error on send: %s", (unsigned long) strerror(errno));
+			}
+		}
+		tournament_entries_lock(x, o, 0);
+		if(!result) {
+			update_move_deadline(games[i]);
+		} else { // nobody took a seat, the game goes without being played
+			games[i]->player_1 = games[i]->player_2 = NULL;
+			games[i]->whose_turn = 0;
+			if(tournament_report(games[i]->match, result)) {
+				log_error("error on reporting a tournament game");
+			}
+			if(game_boards_array_remove(registry, games[i])) {
+				log_error("error on removing a tournament game");
+			}
+		}
+	}
+}
+
+/*
+ * runs on a tournament worker: TOURNAMENT_OVER_NOTIFY: code, tournament id, null, place, null, number of
+ * players, null to every player that is still there
+ * */
+static void end_tournament(const struct tournament *tournament)
+{
+	struct tournament_entry *entry;
+	char buffer[BUFFER_LENGTH];
+	int n;
+	for(size_t i = 0; i < tournament->number_of_players; ++i) {
+		entry = tournament->players[i].owner;
+		buffer[0] = TOURNAMENT_OVER_NOTIFY;
+		n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u%c%u%c%lu", tournament->id, 0, tournament->players[i].place, 0,
+			tournament->number_of_players);
+		pthread_mutex_lock(&entry->monitor);
+		if(!entry->gone && send(entry->fd, buffer, n + 2, MSG_NOSIGNAL) < 0) {
+			log_warning("error on send: %s", (unsigned long) strerror(errno));
+		}
+		entry->over = 1;
+		pthread_mutex_unlock(&entry->monitor);
+		tournament_entry_release(entry);
+	}
+}
+
+/*
+ * takes the session out of the spectator lists of the games it watches. the games drop their spectators
+ * when a player leaves, so the session does not keep a list of them, the registry is searched instead.
+ * */
+static void stop_spectating(struct session_details *session_details)
+{
+	struct game_boards_array *games = session_details->games;
+	struct game_board *game;
+	size_t i, j;
+	if(!session_details->spectator) {
+		return;
+	}
+	pthread_mutex_lock(&games->monitor); // no game can be removed while it is looked at
+	for(i = 0; i < games->number_of_elements; ++i) {
+		game = games->array[i];
+		if(!game->number_of_spectators) { // read without the game's lock, only this thread adds the session to a game
+			continue;
+		}
+		pthread_mutex_lock(&game->monitor);
+		for(j = 0; j < game->number_of_spectators; ++j) {
+			if(game->spectators[j] == session_details->spectator) {
+				game->spectators[j] = game->spectators[--game->number_of_spectators];
+				break;
+			}
+		}
+		pthread_mutex_unlock(&game->monitor);
+	}
+	pthread_mutex_unlock(&games->monitor);
+}
+
+/*
+ * the socket of a spectating session belongs to the spectate writer thread, see spectate.h
+ * */
+static ssize_t send_reply(int fd, struct spectator *spectator, const char *buffer, size_t length)
+{
+	if(spectator) {
+		return spectate_reply(spectator, buffer, length);
+	}
+	return send(fd, buffer, length, MSG_NOSIGNAL);
+}
+
+#define REQUEST_GAME POOL_CLASSES // the class of the requests of a running game, they never wait for the pool
+
+/*
+ * the requests of a running game run on their connection's thread, the players are waiting on them.
+ * the lobby's requests and the logins and sign ups run on the pool, in that order.
+ * */
+static unsigned int request_class(unsigned char opcode)
+{
+	switch(opcode) {
+		case ACTION_REQUEST: case LEAVE_GAME_REQUEST: case GAME_SNAPSHOT_REQUEST: case REMATCH_REQUEST: case LOGOUT_REQUEST:
+			return REQUEST_GAME;
+		case LOGIN_REQUEST: case CREATE_USER_REQUEST:
+			return POOL_AUTH;
+	}
+	return POOL_LOBBY;
+}
+
+/*
+ * whether a request is turned away when pending requests are being handled already. the requests of a
+ * running game are always served. the others are shed once max_pending requests are in the handlers, so
+ * a server that falls behind keeps its games going and tells new work to come back later instead of
+ * queueing it on every lock.
+ * */
+static char shed_request(unsigned int class, long pending)
+{
+	return class != REQUEST_GAME && max_pending && pending >= (long) max_pending;
+}
+
+struct dispatch_job {
+	struct pool_job job;
+	unsigned char opcode, return_code;
+	char *buffer;
+	struct session_details **session_details;
+};
+
+static void run_dispatch_job(struct pool_job *job)
+{
+	struct dispatch_job *dispatch = job->context;
+	dispatch->return_code = handler[dispatch->opcode](dispatch->buffer, dispatch->session_details);
+}
+
+/*
+ * calls the handler of opcode, on the pool unless the request belongs to a game, and records how long it
+ * took and what it answered
+ * */
+unsigned char dispatch_request(unsigned char opcode, char *buffer, struct session_details **session_details)
+{
+	unsigned long start = stats_now(), span = trace_span_begin(), nanoseconds;
+	unsigned int class = request_class(opcode);
+	struct dispatch_job dispatch = { .job = { .run = run_dispatch_job, .context = &dispatch }, .opcode = opcode,
+		.buffer = buffer, .session_details = session_details };
+	if(shed_request(class, gauge_add(gauges.pending, 1))) {
+		dispatch.return_code = server_busy(buffer, *session_details);
+	} else if(class == REQUEST_GAME || !workers || pool_run(&dispatch.job, class)) {
+		run_dispatch_job(&dispatch.job);
+	}
+	gauge_add(gauges.pending, -1);
+	nanoseconds = stats_now() - start;
+	stats_record(opcode, dispatch.return_code, nanoseconds);
+	stats_record_latency(class == REQUEST_GAME ? STATS_CLASS_GAME : class == POOL_AUTH ? STATS_CLASS_AUTH : STATS_CLASS_LOBBY,
+		nanoseconds);
+	trace_span_end(opcode < STATS_OPCODES && stats_opcode_names[opcode] ? stats_opcode_names[opcode] : "unknown opcode", span);
+	return dispatch.return_code;
+}
+
+/*
+ * ACTION_NOTIFY: whose turn, x, null, y, null with the coordinates of the move the other player made.
+ * a multiplexed player is told about a move that ended the game this way too, whose turn is the result then.
+ * */
+static size_t encode_action_notify(char *buffer, char whose_turn, unsigned long x, unsigned long y)
+{
+	int n, n2;
+	memset(buffer, 0, BUFFER_LENGTH);
+	buffer[0] = ACTION_NOTIFY;
+	buffer[1] = whose_turn;
+	n = snprintf(buffer + 2, BUFFER_LENGTH / 2, "%lu", x);
+	n2 = snprintf(buffer + 2 + n + 1, BUFFER_LENGTH / 2, "%lu", y);
+	if(n <= 0 || n2 <= 0) {
+		log_error("error on encoding an action notify");
+	}
+	return 2 + n + 1 + n2 + 1;
+}
+
+/*
+ * sends a notification about a game to the player on peer_fd, if the seat is taken. a multiplexed
+ * player gets the game id right after the code.
+ * */
+static void send_notify(uint32_t connection, int peer_fd, char peer_multiplexed, uint32_t game_id, const char *message,
+	size_t length)
+{
+	char buffer[BUFFER_LENGTH];
+	unsigned long span;
+	int n;
+	if(peer_fd < 0) {
+		return;
+	}
+	if(peer_multiplexed) {
+		buffer[0] = message[0];
+		n = snprintf(buffer + 1, BUFFER_LENGTH - 1, "%u", game_id);
+		if(n <= 0 || n + 1 + length > BUFFER_LENGTH) {
+			log_error("error on encoding a notify");
+			return;
+		}
+		memcpy(buffer + n + 2, message + 1, length - 1);
+		message = buffer;
+		length += n + 1;
+	}
+	capture(connection, CAPTURE_NOTIFY, message, length);
+	span = trace_span_begin();
+	if(send(peer_fd, message, length, MSG_NOSIGNAL) < 0) {
+		log_warning("error on send: %s", (unsigned long) strerror(errno));
+	}
+	trace_span_end("send notify", span);
+}
+
+/*
+ * gives up every seat the session holds and tells the other players
+ * */
+static void leave_games(uint32_t connection, struct session_details *session_details)
+{
+	char buffer[BUFFER_LENGTH];
+	struct game_board *game;
+	int peer_fd;
+	char peer_multiplexed;
+	uint32_t game_id;
+	for(;;) {
+		if(session_details->multiplexed && session_details->number_of_joined_games) {
+			session_details->current_game = session_details->joined_games[session_details->number_of_joined_games - 1];
+		}
+		if(!(game = session_details->current_game)) {
+			break;
+		}
+		peer_fd = game_peer_fd(game, session_details->fd);
+		peer_multiplexed = game_peer_multiplexed(game, session_details->fd);
+		game_id = game->id;
+		if(leave_game(session_details, game)) {
+			log_error("error on leaving game %u", game_id);
+		}
+		buffer[0] = PEER_LEFT_NOTIFY;
+		send_notify(connection, peer_fd, peer_multiplexed, game_id, buffer, 1);
+	}
+}
+
+/*
+ * runs on the timer thread: a connection that did not log in or did not send anything in time is shut
+ * down. its thread sees the end of the stream and ends the session as if the client had disconnected.
+ * */
+static void connection_timed_out(struct timer *timer)
+{
+	int fd = (int)(intptr_t) timer->context;
+	log_info("connection on fd %d timed out", fd);
+	shutdown(fd, SHUT_RDWR);
+}
+
+/*
+ * (re)starts a connection's deadline, seconds 0 stops it
+ * */
+static void arm_connection_deadline(struct timer *deadline, int fd, unsigned long seconds)
+{
+	if(seconds) {
+		timer_arm(deadline, seconds * 1000, connection_timed_out, (void*)(intptr_t) fd);
+	} else {
+		timer_cancel(deadline);
+	}
+}
+
+/*
+ * the deadline is cancelled first, so that it cannot shut down a new connection that reuses the descriptor
+ * */
+static void close_connection(int fd, struct timer *deadline)
+{
+	timer_cancel_sync(deadline);
+	close(fd);
+}
+
+/*
+ * counts a session that logged in or ended in or out of the ones an upgrade parks. a session that ends while the
+ * others park waits until they go on, so that it does not leave a game that is being handed over.
+ * */
+static void count_session(long delta)
+{
+	if(!upgrade.path) {
+		return;
+	}
+	pthread_mutex_lock(&upgrade.monitor);
+	upgrade.sessions += delta;
+	pthread_cond_broadcast(&upgrade.changed);
+	while(delta < 0 && upgrade.state == UPGRADE_PARKING) {
+		pthread_cond_wait(&upgrade.changed, &upgrade.monitor);
+	}
+	pthread_mutex_unlock(&upgrade.monitor);
+}
+
+/*
+ * parks the session until the upgrade is over, returns whether it was handed over
+ * */
+static char park_session(struct session_details *session_details)
+{
+	pthread_mutex_lock(&upgrade.monitor);
+	if(upgrade.state != UPGRADE_PARKING) {
+		pthread_mutex_unlock(&upgrade.monitor);
+		return 0;
+	}
+	session_details->next_parked = upgrade.parked;
+	upgrade.parked = session_details;
+	++upgrade.number_of_parked;
+	pthread_cond_broadcast(&upgrade.changed);
+	while(upgrade.state == UPGRADE_PARKING) {
+		pthread_cond_wait(&upgrade.changed, &upgrade.monitor);
+	}
+	pthread_mutex_unlock(&upgrade.monitor);
+	return session_details->handed_over;
+}
+
+/*
+ * receives the session's next request, what recv returned. 0 also if the session was handed over.
+ * */
+static int receive_request(struct session_details *session_details, char *buffer)
+{
+	struct pollfd fds[2] = { { .fd = session_details->fd, .events = POLLIN }, { .fd = upgrade.wake[0], .events = POLLIN } };
+	if(!upgrade.path) {
+		return recv(session_details->fd, buffer, BUFFER_LENGTH - 1, 0);
+	}
+	for(;;) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if(fds[1].revents && park_session(session_details)) {
+			return 0;
+		}
+		if(fds[0].revents) {
+			return recv(session_details->fd, buffer, BUFFER_LENGTH - 1, 0);
+		}
+	}
+}
+
+/*
+ * parks every session that logged in, returns -1 if some did not park within UPGRADE_PARK_MS
+ * */
+static int park_sessions(void)
+{
+	struct timespec deadline;
+	int ret_value = 0;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += UPGRADE_PARK_MS % 1000 * 1000000l;
+	deadline.tv_sec += UPGRADE_PARK_MS / 1000 + deadline.tv_nsec / 1000000000l;
+	deadline.tv_nsec %= 1000000000l;
+	pthread_mutex_lock(&upgrade.monitor);
+	upgrade.state = UPGRADE_PARKING;
+	if(write(upgrade.wake[1], "", 1) != 1) {
+		ret_value = -1;
+	}
+	while(!ret_value && upgrade.number_of_parked < upgrade.sessions) {
+		if(pthread_cond_timedwait(&upgrade.changed, &upgrade.monitor, &deadline) == ETIMEDOUT) {
+			log_warning("upgrade: %ld of %ld sessions did not park in time", upgrade.sessions - upgrade.number_of_parked,
+				upgrade.sessions);
+			ret_value = -1;
+		}
+	}
+	pthread_mutex_unlock(&upgrade.monitor);
+	return ret_value;
+}
+
+/*
+ * lets the parked sessions go on, the ones that were handed over end
+ * */
+static void resume_sessions(char state)
+{
+	char byte;
+	while(read(upgrade.wake[0], &byte, 1) == 1); // before the state changes, so that no thread sees the pipe readable after
+	pthread_mutex_lock(&upgrade.monitor);
+	upgrade.state = state;
+	upgrade.parked = NULL;
+	upgrade.number_of_parked = 0;
+	pthread_cond_broadcast(&upgrade.changed);
+	pthread_mutex_unlock(&upgrade.monitor);
+}
+
+struct handover_game {
+	struct game_board *game;
+	struct session_details *seats[2];
+};
+
+/*
+ * decides which of the parked sessions and which games go to the next binary, the sessions that go get
+ * handed_over set. a game goes if every player in it goes, a session goes unless it spectates, waits for
+ * the matchmaker or plays a tournament and if every game it plays goes. games that are watched or played
+ * for a tournament stay. returns the number of games that go, moving holds them, or -1.
+ * */
+static long plan_hand_over(struct session_details *parked, struct game_boards_array *games, struct handover_game **moving)
+{
+	struct session_details *session, **seats;
+	struct game_board *game, **held;
+	size_t number_of_games, number_of_held, i, j;
+	long number_of_moving = 0;
+	char *keep, changed;
+	for(session = parked; session; session = session->next_parked) {
+		session->handed_over = !session->spectator && !session->ticket && !session->entry && !session->links;
+	}
+	pthread_mutex_lock(&games->monitor);
+	number_of_games = games->number_of_elements;
+	seats = calloc(2 * number_of_games + 1, sizeof(struct session_details*));
+	keep = calloc(number_of_games + 1, 1);
+	*moving = malloc(sizeof(struct handover_game) * (number_of_games + 1));
+	if(!seats || !keep || !*moving) {
+		pthread_mutex_unlock(&games->monitor);
+		free(seats);
+		free(keep);
+		free(*moving);
+		return -1;
+	}
+	for(session = parked; session; session = session->next_parked) {
+		held = session->multiplexed ? session->joined_games : &session->current_game;
+		number_of_held = session->multiplexed ? session->number_of_joined_games : session->current_game != NULL;
+		for(j = 0; j < number_of_held; ++j) {
+			game = held[j];
+			if(game->player_1 == session->logged_in_user) {
+				seats[2 * game->index] = session;
+			} else if(game->player_2 == session->logged_in_user) {
+				seats[2 * game->index + 1] = session;
+			} else { // holds a game without a seat in it, both stay
+				keep[game->index] = 1;
+				session->handed_over = 0;
+			}
+		}
+	}
+	for(i = 0; i < number_of_games; ++i) {
+		game = games->array[i];
+		pthread_mutex_lock(&game->monitor);
+		keep[i] |= game->match || game->number_of_spectators || (game->player_1 && !seats[2 * i]) || (game->player_2 && !seats[2 * i + 1]);
+		pthread_mutex_unlock(&game->monitor);
+	}
+	do { // a session that stays keeps its games and a game that stays keeps its players, up to a fixed point
+		changed = 0;
+		for(i = 0; i < 2 * number_of_games; ++i) {
+			if(!(session = seats[i])) {
+				continue;
+			}
+			if(keep[i / 2] && session->handed_over) {
+				session->handed_over = 0;
+				changed = 1;
+			} else if(!keep[i / 2] && !session->handed_over) {
+				keep[i / 2] = 1;
+				changed = 1;
+			}
+		}
+	} while(changed);
+	for(i = 0; i < number_of_games; ++i) {
+		if(!keep[i]) {
+			(*moving)[number_of_moving].game = games->array[i];
+			(*moving)[number_of_moving].seats[0] = seats[2 * i];
+			(*moving)[number_of_moving++].seats[1] = seats[2 * i + 1];
+		}
+	}
+	pthread_mutex_unlock(&games->monitor);
+	free(seats);
+	free(keep);
+	return number_of_moving;
+}
+
+/*
+ * sends the sessions that were handed over and the games in moving, their deadlines are stopped
+ * */
+static int send_hand_over(int channel, int sockfd, int metrics_fd, struct session_details *parked, struct handover_game *moving,
+	long number_of_moving)
+{
+	char message[sizeof(struct upgrade_game) + BOARD_SIZE * BOARD_SIZE + ARCHIVE_MAX_MOVES];
+	struct upgrade_header header = { .magic = UPGRADE_MAGIC, .version = UPGRADE_VERSION, .number_of_games = number_of_moving };
+	struct upgrade_session record;
+	struct upgrade_game *game_record = (struct upgrade_game*) message;
+	struct session_details *session;
+	struct game_board *game;
+	size_t cells;
+	char has_metrics = metrics_fd >= 0;
+	int32_t number_of_sessions = 0;
+	for(session = parked; session; session = session->next_parked) {
+		session->handover_index = session->handed_over ? number_of_sessions++ : -1;
+	}
+	header.number_of_sessions = number_of_sessions;
+	header.next_game_id = atomic_load(&next_game_id);
+	if(upgrade_send(channel, &header, sizeof(header), sockfd) || upgrade_send(channel, &has_metrics, 1, metrics_fd)) {
+		return -1;
+	}
+	for(session = parked; session; session = session->next_parked) {
+		if(!session->handed_over) {
+			continue;
+		}
+		memset(&record, 0, sizeof(record));
+		memcpy(record.username, session->logged_in_user->username, USERNAMELEN);
+		memcpy(record.password, session->logged_in_user->password, PASSWORDLEN);
+		record.multiplexed = session->multiplexed;
+		if(upgrade_send(channel, &record, sizeof(record), session->fd)) {
+			return -1;
+		}
+	}
+	for(long i = 0; i < number_of_moving; ++i) {
+		game = moving[i].game;
+		timer_cancel_sync(&game->deadline); // the next binary starts it again
+		cells = game->board_size * game->board_size;
+		if(cells > BOARD_SIZE * BOARD_SIZE) {
+			return -1;
+		}
+		memset(game_record, 0, sizeof(struct upgrade_game));
+		pthread_mutex_lock(&game->monitor);
+		game_record->id = game->id;
+		game_record->board_size = game->board_size;
+		game_record->created_at = game->created_at;
+		game_record->player1_session = game->player_1 ? moving[i].seats[0]->handover_index : -1;
+		game_record->player2_session = game->player_2 ? moving[i].seats[1]->handover_index : -1;
+		game_record->player1_last_x = game->player1_last_x;
+		game_record->player1_last_y = game->player1_last_y;
+		game_record->player2_last_x = game->player2_last_x;
+		game_record->player2_last_y = game->player2_last_y;
+		game_record->whose_turn = game->whose_turn;
+		game_record->host = game->host && game->host == game->player_1 ? 1 : game->host && game->host == game->player_2 ? 2 : 0;
+		game_record->rematch = game->rematch && game->rematch == game->player_1 ? 1 : game->rematch && game->rematch == game->player_2 ? 2 : 0;
+		game_record->number_of_moves = game->number_of_moves;
+		memcpy(message + sizeof(struct upgrade_game), game->matrix, cells);
+		memcpy(message + sizeof(struct upgrade_game) + cells, game->moves, game->number_of_moves);
+		pthread_mutex_unlock(&game->monitor);
+		if(upgrade_send(channel, message, sizeof(struct upgrade_game) + cells + game_record->number_of_moves, -1)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * hands the listening sockets, the sessions that can go and their games over to the binary connected
+ * on channel. returns 0 once it took them over, this binary stops accepting then and drains. on an
+ * error everything stays with this binary.
+ * */
+static int hand_over(int channel, int sockfd, struct game_boards_array *games, const char *ratings_path)
+{
+	struct timeval timeout = { .tv_sec = UPGRADE_ACK_MS / 1000, .tv_usec = UPGRADE_ACK_MS % 1000 * 1000 };
+	struct session_details *parked = NULL, *session; // set whenever number_of_moving is, -O2 cannot tell
+	struct handover_game *moving = NULL;
+	unsigned long start = stats_now();
+	long number_of_moving = -1, handed_over = 0;
+	int metrics_fd = -1;
+	char ack = 1;
+	if(!park_sessions()) {
+		pthread_mutex_lock(&upgrade.monitor);
+		parked = upgrade.parked; // sessions that park later are not handed over, they just logged in and hold no game
+		pthread_mutex_unlock(&upgrade.monitor);
+		number_of_moving = plan_hand_over(parked, games, &moving);
+	}
+	if(number_of_moving >= 0) {
+		if(rating_save(ratings_path)) { // the next binary loads them
+			log_error("error writing ratings to %s", (unsigned long) ratings_path);
+		}
+		metrics_fd = metrics_release();
+		setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		if(send_hand_over(channel, sockfd, metrics_fd, parked, moving, number_of_moving) || upgrade_recv(channel, &ack, 1, NULL)) {
+			ack = 1;
+		}
+	}
+	if(ack) {
+		log_error("upgrade: the next binary did not take over, going on");
+		if(metrics_fd >= 0 && metrics_adopt(metrics_fd)) {
+			close(metrics_fd);
+		}
+		for(long i = 0; i < number_of_moving; ++i) {
+			pthread_mutex_lock(&moving[i].game->monitor);
+			update_move_deadline(moving[i].game);
+			pthread_mutex_unlock(&moving[i].game->monitor);
+		}
+		for(session = upgrade.parked; session; session = session->next_parked) {
+			session->handed_over = 0;
+		}
+		free(moving);
+		resume_sessions(UPGRADE_IDLE);
+		return -1;
+	}
+	if(metrics_fd >= 0) {
+		close(metrics_fd);
+	}
+	for(long i = 0; i < number_of_moving; ++i) { // nobody here holds them any more, the next binary opens their seats again
+		if(moving[i].game->shared && !shared_claim(moving[i].game->shared)) {
+			shared_release(moving[i].game->shared);
+		}
+		if(game_boards_array_remove(games, moving[i].game)) {
+			log_error("error on removing game %u", moving[i].game->id);
+		}
+	}
+	for(session = parked; session; session = session->next_parked) {
+		handed_over += session->handed_over;
+	}
+	free(moving);
+	archive_stop(); // the next binary appends to the archive now
+	resume_sessions(UPGRADE_DRAINING);
+	log_info("upgrade: handed %ld sessions and %ld games over in %lu us", handed_over, number_of_moving, (stats_now() - start) / 1000);
+	return 0;
+}
+
+/*
+ * takes the listening sockets, sessions and games over from the binary connected on channel. the
+ * sessions are returned in sessions, the caller starts their threads. on an error the old binary
+ * keeps everything.
+ * */
+static long take_over(int channel, struct game_boards_array *games, const char *ratings_path, int *sockfd, int *metrics_fd,
+	struct session_details ***sessions)
+{
+	char message[BOARD_SIZE * BOARD_SIZE + ARCHIVE_MAX_MOVES];
+	struct upgrade_header header;
+	struct upgrade_session record;
+	struct upgrade_game game_record;
+	struct session_details *session, *seats[2];
+	struct game_board *game, **taken;
+	size_t cells;
+	uint32_t i;
+	char has_metrics, ack = 0;
+	int fd;
+	*metrics_fd = -1;
+	if(upgrade_recv(channel, &header, sizeof(header), sockfd) || *sockfd < 0 || header.magic != UPGRADE_MAGIC
+	|| header.version != UPGRADE_VERSION || upgrade_recv(channel, &has_metrics, 1, metrics_fd)) {
+		return -1;
+	}
+	*sessions = calloc(header.number_of_sessions + 1, sizeof(struct session_details*));
+	taken = calloc(header.number_of_games + 1, sizeof(struct game_board*));
+	if(!*sessions || !taken) {
+		return -1;
+	}
+	for(i = 0; i < header.number_of_sessions; ++i) {
+		if(upgrade_recv(channel, &record, sizeof(record), &fd) || fd < 0) {
+			return -1;
+		}
+		session = calloc(1, sizeof(struct session_details));
+		if(!session || !(session->logged_in_user = calloc(1, sizeof(User)))) {
+			return -1;
+		}
+		memcpy(session->logged_in_user->username, record.username, USERNAMELEN);
+		memcpy(session->logged_in_user->password, record.password, PASSWORDLEN);
+		session->fd = fd;
+		session->multiplexed = record.multiplexed;
+		session->session_present = 1;
+		session->games = games;
+		(*sessions)[i] = session;
+	}
+	for(i = 0; i < header.number_of_games; ++i) {
+		if(upgrade_recv(channel, &game_record, sizeof(game_record), NULL) || !(game = game_new())
+		|| game_record.board_size != game->board_size || game_record.number_of_moves > ARCHIVE_MAX_MOVES
+		|| game_record.player1_session >= (int32_t) header.number_of_sessions || game_record.player2_session >= (int32_t) header.number_of_sessions) {
+			return -1;
+		}
+		cells = game->board_size * game->board_size;
+		if(upgrade_recv(channel, message, cells + game_record.number_of_moves, NULL)) {
+			return -1;
+		}
+		memcpy(game->matrix, message, cells);
+		memcpy(game->moves, message + cells, game_record.number_of_moves);
+		game->number_of_moves = game_record.number_of_moves;
+		game->id = game_record.id;
+		game->created_at = game_record.created_at;
+		game->whose_turn = game_record.whose_turn;
+		game->player1_last_x = game_record.player1_last_x;
+		game->player1_last_y = game_record.player1_last_y;
+		game->player2_last_x = game_record.player2_last_x;
+		game->player2_last_y = game_record.player2_last_y;
+		seats[0] = game_record.player1_session >= 0 ? (*sessions)[game_record.player1_session] : NULL;
+		seats[1] = game_record.player2_session >= 0 ? (*sessions)[game_record.player2_session] : NULL;
+		for(int seat = 0; seat < 2; ++seat) {
+			if(!(session = seats[seat])) {
+				continue;
+			}
+			if(!seat) {
+				game->player_1 = session->logged_in_user;
+				game->player1_fd = session->fd;
+				game->player1_multiplexed = session->multiplexed;
+			} else {
+				game->player_2 = session->logged_in_user;
+				game->player2_fd = session->fd;
+				game->player2_multiplexed = session->multiplexed;
+			}
+			if(!session->multiplexed) {
+				session->current_game = game;
+			} else if(joined_games_reserve(session)) {
+				return -1;
+			} else {
+				session->joined_games[session->number_of_joined_games++] = game;
+			}
+		}
+		game->host = game_record.host == 1 ? game->player_1 : game_record.host == 2 ? game->player_2 : NULL;
+		game->rematch = game_record.rematch == 1 ? game->player_1 : game_record.rematch == 2 ? game->player_2 : NULL;
+		taken[i] = game;
+	}
+	if(game_boards_array_add_batch(games, taken, header.number_of_games)) {
+		return -1;
+	}
+	atomic_store(&next_game_id, header.next_game_id);
+	if(rating_load(ratings_path)) {
+		log_error("error loading ratings from %s", (unsigned long) ratings_path);
+	}
+	if(upgrade_send(channel, &ack, 1, -1)) { // the old binary lets go of the sessions once it has this
+		return -1;
+	}
+	for(i = 0; i < header.number_of_games; ++i) {
+		pthread_mutex_lock(&taken[i]->monitor);
+		gauge_add(gauges.open_games, game_is_open(taken[i]));
+		if(game_is_open(taken[i])) {
+			taken[i]->shared = shared_publish(taken[i]->id);
+		}
+		update_move_deadline(taken[i]);
+		pthread_mutex_unlock(&taken[i]->monitor);
+	}
+	free(taken);
+	return header.number_of_sessions;
+}
+
+/*
+ * answers the requests of a connection until it logged in, returns its session or NULL if it did not
+ * log in. the connection's socket stays open either way.
+ * */
+static struct session_details* login_session(struct arguments *arguments)
+{
+	char buffer[BUFFER_LENGTH];
+	int n, n2;
+	unsigned char return_code, opcode;
+	int fd = arguments->fd;
+	uint32_t connection = arguments->connection;
+	struct timer *deadline = arguments->deadline;
+	struct session_details *session_details = NULL;
+	size_t bytes_written;
+	session_details = calloc(1, sizeof(struct session_details));
+	if(!session_details) {
+		return NULL;
+	}
+	session_details->games = arguments->games;
+	session_details->current_game = NULL;
+	session_details->fd = fd;
+	for(;;) {
+		memset(buffer, 0, BUFFER_LENGTH);
+		n = recv(fd, buffer, BUFFER_LENGTH - 1, 0);
+		if(n <= 0) {
+			if(n < 0) {
+				log_warning("error on recv: %s", (unsigned long) strerror(errno));
+			}
+			free(session_details);
+			return NULL;
+		}
+		capture(connection, CAPTURE_REQUEST, buffer, n);
+		if(buffer[0] != STATS_REQUEST) {
+			break;
+		}
+		arm_connection_deadline(deadline, fd, login_timeout); // a monitor that keeps asking for stats stays
+		dispatch_request(STATS_REQUEST, buffer, &session_details);
+		capture(connection, CAPTURE_REPLY, buffer, session_details->bytes_written);
+		if(send(fd, buffer, session_details->bytes_written, MSG_NOSIGNAL) < 0) {
+			log_warning("error on send: %s", (unsigned long) strerror(errno));
+		}
+	}
+	if(buffer[0] != LOGIN_REQUEST && buffer[0] != CREATE_USER_REQUEST) {
+		return_code = INVALID_REQUEST;
+		capture(connection, CAPTURE_REPLY, &return_code, 1);
+		n2 = send(fd, &return_code, 1, MSG_NOSIGNAL);
+		if(n2 < 0) {
+			log_warning("error on send: %s", (unsigned long) strerror(errno));
+		}
+		free(session_details);
+		return NULL;
+	}
+	opcode = (unsigned char) buffer[0];
+	return_code = dispatch_request(opcode, buffer, &session_details);
+	bytes_written = session_details->bytes_written;
+	capture(connection, CAPTURE_REPLY, buffer, bytes_written);
+	n2 = send(fd, buffer, bytes_written, MSG_NOSIGNAL);
+	if(n2 < 0 || return_code >= FATAL_ERRORS) {
+		if(n2 < 0) {
+			log_warning("error on send: %s", (unsigned long) strerror(errno));
+		}
+		free(session_details->logged_in_user);
+		free(session_details);
+		session_details = NULL;
+	} else {
+		arm_connection_deadline(deadline, fd, idle_timeout);
+	}
+	log_debug("end login %u", return_code);
+	return session_details;
+}
+
+void* connection_handler(void *arg)
+{
+	unsigned long span;
+	char buffer[BUFFER_LENGTH];
+	int n, n2, peer_fd;
+	char peer_multiplexed, counted;
+	uint32_t game_id;
+	struct game_board *game;
+	unsigned char return_code, opcode;
+	char result;
+	struct arguments *arguments = (struct arguments*) arg;
+	int fd = arguments->fd;
+	uint32_t connection = arguments->connection;
+	struct timer *deadline = arguments->deadline;
+	struct session_details *session_details = arguments->session ? arguments->session : login_session(arguments);
+	struct spectator *spectator = NULL; // outlives session_details, it owns the socket once the session spectated
+	size_t bytes_written;
+	if((counted = session_details && session_details->session_present)) {
+		count_session(1);
+	}
+	while(session_details && session_details->session_present) {
+		memset(buffer, 0, BUFFER_LENGTH);
+		trace_request_begin();
+		span = trace_span_begin();
+		n = receive_request(session_details, buffer);
+		trace_span_end("recv", span);
+		if(n <= 0) {
+			if(!session_details->handed_over) {
+				log_warning("error on recv: %s", (unsigned long) strerror(errno));
+			}
+			break;
+		}
+		arm_connection_deadline(deadline, fd, session_details->spectator ? 0 : idle_timeout); // spectators only listen
+		capture(connection, CAPTURE_REQUEST, buffer, n);
+		opcode = (unsigned char) buffer[0];
+		if(handler[opcode]) {
+			collect_match(session_details, 0);
+			collect_tournament_games(session_details, 0);
+			if(session_details->multiplexed && (opcode == ACTION_REQUEST || opcode == LEAVE_GAME_REQUEST || opcode == GAME_SNAPSHOT_REQUEST
+			|| opcode == REMATCH_REQUEST)) {
+				if(forward_game_request(session_details, buffer, n)) { // the game's node answers over the link
+					continue;
+				}
+				select_joined_game(buffer, session_details);
+			}
+			game = session_details->current_game; // the other player is looked up before a leaving player gives up the seat
+			peer_fd = game ? game_peer_fd(game, fd) : -1;
+			peer_multiplexed = game ? game_peer_multiplexed(game, fd) : 0;
+			game_id = game ? game->id : 0;
+			return_code = dispatch_request(opcode, buffer, &session_details);
+			if(session_details->handed_over) { // joined a game of another process, which answered
+				break;
+			}
+			if(session_details->forwarded) {
+				session_details->forwarded = 0;
+				continue;
+			}
+			bytes_written = session_details->bytes_written;
+			spectator = session_details->spectator;
+			if(spectator) {
+				timer_cancel(deadline);
+			}
+			if((return_code >= FATAL_ERRORS)) {
+				collect_match(session_details, 1);
+				collect_tournament_games(session_details, 1);
+				leave_games(connection, session_details);
+				stop_spectating(session_details);
+				close_links(session_details);
+				free(session_details->logged_in_user);
+				free(session_details->joined_games);
+				free(session_details);
+				session_details = NULL;
+			}
+			capture(connection, CAPTURE_REPLY, buffer, bytes_written);
+			span = trace_span_begin();
+			n2 = send_reply(fd, spectator, buffer, bytes_written);
+			trace_span_end("send reply", span);
+			if(n2 < 0) {
+				log_warning("error on send: %s", (unsigned long) strerror(errno));
+				break;
+			}
+			if(!session_details) {
+				break;
+			}
+			game = session_details->current_game;
+			switch((unsigned char)*buffer) {
+				case JOIN_RANDOM_GAME_REPLY: { // the other seat of a restored game may still be empty
+					buffer[0] = OTHER_PLAYER_PRESENT_NOTIFY;
+					send_notify(connection, game_peer_fd(game, fd), game_peer_multiplexed(game, fd), game->id, buffer, 1);
+				} break;
+				case ACTION_REPLY: {
+					if(fd == game->player1_fd) {
+						bytes_written = encode_action_notify(buffer, game->whose_turn, game->player1_last_x, game->player1_last_y);
+					} else {
+						bytes_written = encode_action_notify(buffer, game->whose_turn, game->player2_last_x, game->player2_last_y);
+					}
+					send_notify(connection, peer_fd, peer_multiplexed, game_id, buffer, bytes_written);
+				} break;
+				case GAME_IS_FINISHED: { // a multiplexed player learns the last move and the result together
+					result = buffer[1];
+					if(!peer_multiplexed) {
+						buffer[1] = game->whose_turn;
+						bytes_written = 2;
+					} else if(fd == game->player1_fd) {
+						bytes_written = encode_action_notify(buffer, game->whose_turn, game->player1_last_x, game->player1_last_y);
+					} else {
+						bytes_written = encode_action_notify(buffer, game->whose_turn, game->player2_last_x, game->player2_last_y);
+					}
+					send_notify(connection, peer_fd, peer_multiplexed, game_id, buffer, bytes_written);
+					if(game->match && tournament_report(game->match, result)) { // after the players learned the result
+						log_error("error on reporting game %u", game_id);
+					}
+				} break;
+				case REMATCH_REPLY: { // the other player's character in the game that started again, or a null for an offer
+					buffer[0] = REMATCH_NOTIFY;
+					buffer[1] = buffer[1] ? (buffer[1] == 'X' ? 'o' : 'X') : 0;
+					send_notify(connection, peer_fd, peer_multiplexed, game_id, buffer, 2);
+				} break;
+				case LEAVE_GAME_REPLY: {
+					buffer[0] = PEER_LEFT_NOTIFY;
+					send_notify(connection, peer_fd, peer_multiplexed, game_id, buffer, 1);
+				} break;
+				case MATCHMAKE_REPLY: {
+					if(matchmaker_enqueue(session_details->ticket)) {
+						expire_match(session_details->ticket);
+						free(session_details->ticket);
+						session_details->ticket = NULL;
+					}
+				} break;
+			}
+			if(session_details->multiplexed) {
+				session_details->current_game = NULL;
+			}
+		} else {
+			buffer[0] = NOT_IMPLEMENTED;
+			capture(connection, CAPTURE_REPLY, buffer, 1);
+			n2 = send_reply(fd, spectator, buffer, 1);
+			if(n2 < 0) {
+				log_warning("error on send: %s", (unsigned long) strerror(errno));
+				break;
+			}
+		}
+	}
+	log_debug("end connection");
+	if(counted) {
+		count_session(-1);
+	}
+	if(session_details && session_details->handed_over) { // the next binary serves the session and its games now
+		free(session_details->logged_in_user);
+		free(session_details->joined_games);
+		free(session_details);
+		free(arg);
+		close_connection(fd, deadline);
+		return NULL;
+	}
+	if(session_details) { // disconnected or logged out, the other players get their games to themselves
+		collect_match(session_details, 1);
+		collect_tournament_games(session_details, 1);
+		leave_games(connection, session_details);
+		stop_spectating(session_details);
+		close_links(session_details);
+		free(session_details->joined_games);
+	}
+	free(arg);
+	free(session_details);
+	if(spectator) {
+		timer_cancel_sync(deadline);
+		spectate_detach(spectator); // the writer thread sends the last replies and closes the socket
+	} else {
+		close_connection(fd, deadline);
+	}
+	return NULL;
+}
+
+void* connection_thread(void *arg)
+{
+	uint32_t connection = ((struct arguments*) arg)->connection; // connection_handler frees arg
+	struct timer deadline;
+	memset(&deadline, 0, sizeof(deadline));
+	((struct arguments*) arg)->deadline = &deadline;
+	arm_connection_deadline(&deadline, ((struct arguments*) arg)->fd, ((struct arguments*) arg)->session ? idle_timeout : login_timeout);
+	capture(connection, CAPTURE_OPEN, NULL, 0);
+	connection_handler(arg);
+	capture(connection, CAPTURE_CLOSE, NULL, 0);
+	gauge_add(gauges.connections, -1); // added by main when it admitted the connection
+	return NULL;
+}
+
+/*
+ * runs on the shared registry's thread: seats a player another process handed over in the game whose open
+ * seat it claimed and answers its JOIN_RANDOM_GAME_REQUEST, see join_shared_game. the session goes on on a
+ * connection thread of this process. the claimed entry is freed also if the seat was given up meanwhile.
+ * */
+static int adopt_shared_player(const struct shared_join *join, int fd)
+{
+	char buffer[BUFFER_LENGTH], seat = 0, peer_multiplexed = 0;
+	struct session_details *session = calloc(1, sizeof(struct session_details));
+	struct arguments *arg = malloc(sizeof(struct arguments));
+	struct game_board *game;
+	pthread_t thread;
+	size_t length = 0;
+	uint32_t connection = atomic_fetch_add(&number_of_connections, 1) + 1;
+	int n, peer_fd = -1;
+	if(session && arg && (session->logged_in_user = calloc(1, sizeof(User)))) {
+		memcpy(session->logged_in_user->username, join->username, USERNAMELEN);
+		memcpy(session->logged_in_user->password, join->password, PASSWORDLEN);
+		session->fd = fd;
+		session->multiplexed = join->multiplexed;
+		session->session_present = 1;
+		session->games = shared_games;
+	}
+	if(session && session->logged_in_user && !(session->multiplexed && joined_games_reserve(session))) {
+		pthread_mutex_lock(&shared_games->monitor);
+		game = find_game_to_spectate(shared_games, join->game_id);
+		if(game && game->shared == join->entry) {
+			pthread_mutex_lock(&game->monitor);
+			if(game_is_open(game) && (seat = take_seat(game, session))) {
+				game->shared = 0;
+				gauge_add(gauges.open_games, game_is_open(game) - 1);
+				update_move_deadline(game);
+				peer_fd = game_peer_fd(game, fd);
+				peer_multiplexed = game_peer_multiplexed(game, fd);
+				buffer[0] = JOIN_RANDOM_GAME_REPLY;
+				buffer[1] = seat;
+				n = snprintf(buffer + 2, BUFFER_LENGTH - 2, "%lu", game->board_size);
+				length = session->multiplexed ? append_game_id(buffer, 3 + n, game) : 3 + (size_t) n;
+				if(session->multiplexed) {
+					session->joined_games[session->number_of_joined_games++] = game;
+				} else {
+					session->current_game = game;
+				}
+			}
+			pthread_mutex_unlock(&game->monitor);
+		}
+		pthread_mutex_unlock(&shared_games->monitor);
+	}
+	shared_release(join->entry);
+	if(!seat) {
+		if(session) {
+			free(session->logged_in_user);
+			free(session->joined_games);
+		}
+		free(session);
+		free(arg);
+		return -1;
+	}
+	arg->fd = fd;
+	arg->connection = connection;
+	arg->games = shared_games;
+	arg->session = session;
+	log_info("connection %d joined game %u from another process", fd, join->game_id); // the user goes with the session, the logger may run later
+	gauge_add(gauges.connections, 1);
+	if(pthread_create(&thread, NULL, connection_thread, arg)) { // the other process keeps the player
+		log_error("failed to create thread");
+		gauge_add(gauges.connections, -1);
+		if(leave_game(session, session->multiplexed ? session->joined_games[0] : session->current_game)) {
+			log_error("error on leaving game %u", join->game_id);
+		}
+		free(session->logged_in_user);
+		free(session->joined_games);
+		free(session);
+		free(arg);
+		return -1;
+	}
+	pthread_detach(thread);
+	if(send(fd, buffer, length, MSG_NOSIGNAL) < 0) { // the player waits for it before its next request
+		log_warning("error on send: %s", (unsigned long) strerror(errno));
+	}
+	buffer[0] = OTHER_PLAYER_PRESENT_NOTIFY;
+	send_notify(connection, peer_fd, peer_multiplexed, join->game_id, buffer, 1);
+	return 0;
+}
+
+/*
+ * turns a connection away before a thread is spent on it. the client reads SERVER_BUSY as the reply to
+ * its first request. what the client sent already is read first, closing a socket with unread data
+ * resets the connection and the reset can overtake the reply.
+ * */
+static void reject_connection(int fd)
+{
+	char code = SERVER_BUSY, buffer[BUFFER_LENGTH];
+	if(send(fd, &code, 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+		log_debug("error on send: %s", (unsigned long) strerror(errno));
+	}
+	shutdown(fd, SHUT_WR);
+	while(recv(fd, buffer, BUFFER_LENGTH, MSG_DONTWAIT) > 0);
+	close(fd);
+	gauge_add(gauges.rejected, 1);
+}
+
+int main(int argc, char **argv)
+{
+	int sockfd, newsockfd, portno, channel = -1, metrics_fd = -1, unix_fd = -1, listener, ready, accept_error;
+	pthread_t thread;
+	pthread_attr_t attributes;
+	socklen_t clilen;
+	struct sockaddr_in serv_addr, cli_addr;
+	struct sockaddr_un unix_addr;
+	struct game_boards_array *games = NULL;
+	struct arguments *arg;
+	struct sigaction action;
+	sigset_t blocked_signals, previous_signals;
+	const char *snapshot_path = SNAPSHOT_FILE;
+	const char *archive_path = ARCHIVE_FILE;
+	unsigned long address;
+	unsigned short metrics_port = 0;
+	unsigned int trace_sample_rate = 0;
+	const char *trace_path = TRACE_FILE;
+	const char *capture_path = NULL;
+	const char *ratings_path = RATINGS_FILE;
+	const char *shared_name = NULL;
+	const char *cluster_nodes = NULL;
+	const char *unix_path = NULL;
+	unsigned int cluster_node = 0;
+	static const struct matchmaker_callbacks matchmaker_callbacks = { .pair = match_players, .expire = expire_match };
+	static const struct tournament_callbacks tournament_callbacks = { .start = start_tournament_games, .over = end_tournament };
+	static const struct shared_callbacks shared_callbacks = { .adopt = adopt_shared_player };
+	struct session_details **taken_sessions = NULL;
+	struct pollfd listeners[3];
+	long number_taken = 0;
+	char restore = 0, handed_over = 0, polling;
+	if(argc < 2) {
+		fprintf(stderr,"ERROR, no port provided\n");
+		fprintf(stderr, "usage: %s port [--restore] [--snapshot path] [--archive path | --no-archive] [--log-level level] [--metrics-port port] [--trace-sample n] [--trace path] [--capture path] [--ratings path] [--login-timeout s] [--idle-timeout s] [--move-timeout s] [--max-connections n] [--max-games n] [--max-pending n] [--workers n] [--upgrade path] [--shared name] [--cluster host:port,... --node i] [--unix path]\n", argv[0]);
+		exit(1);
+	}
+	for(int i = 2; i < argc; ++i) {
+		if(!strcmp(argv[i], "--restore")) {
+			restore = 1;
+		} else if(!strcmp(argv[i], "--snapshot") && i + 1 < argc) {
+			snapshot_path = argv[++i];
+		} else if(!strcmp(argv[i], "--archive") && i + 1 < argc) {
+			archive_path = argv[++i];
+		} else if(!strcmp(argv[i], "--no-archive")) {
+			archive_path = NULL;
+		} else if(!strcmp(argv[i], "--trace-sample") && i + 1 < argc) {
+			trace_sample_rate = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--capture") && i + 1 < argc) {
+			capture_path = argv[++i];
+		} else if(!strcmp(argv[i], "--ratings") && i + 1 < argc) {
+			ratings_path = argv[++i];
+		} else if(!strcmp(argv[i], "--login-timeout") && i + 1 < argc) {
+			login_timeout = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--idle-timeout") && i + 1 < argc) {
+			idle_timeout = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--move-timeout") && i + 1 < argc) {
+			move_timeout = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--max-connections") && i + 1 < argc) {
+			max_connections = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--max-games") && i + 1 < argc) {
+			max_games = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--max-pending") && i + 1 < argc) {
+			max_pending = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--workers") && i + 1 < argc) {
+			workers = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--upgrade") && i + 1 < argc) {
+			upgrade.path = argv[++i];
+		} else if(!strcmp(argv[i], "--shared") && i + 1 < argc) {
+			shared_name = argv[++i];
+		} else if(!strcmp(argv[i], "--cluster") && i + 1 < argc) {
+			cluster_nodes = argv[++i];
+		} else if(!strcmp(argv[i], "--node") && i + 1 < argc) {
+			cluster_node = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--unix") && i + 1 < argc) {
+			unix_path = argv[++i];
+		} else if(!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if(!strcmp(argv[i], "--metrics-port") && i + 1 < argc) {
+			metrics_port = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "--log-level") && i + 1 < argc) {
+			if(log_set_level(argv[++i])) {
+				fprintf(stderr, "unknown log level %s, expected debug, info, warning or error\n", argv[i]);
+				exit(1);
+			}
+		} else {
+			fprintf(stderr, "unknown argument %s\n", argv[i]);
+			exit(1);
+		}
+	}
+	// every thread inherits this mask, only the main thread is supposed to be interrupted by these
+	sigemptyset(&blocked_signals);
+	sigaddset(&blocked_signals, SIGUSR1);
+	sigaddset(&blocked_signals, SIGUSR2);
+	sigaddset(&blocked_signals, SIGINT);
+	sigaddset(&blocked_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+	if(log_start()) {
+		error("error starting the logger");
+	}
+	if(stats_init()) {
+		error("error initialising request statistics");
+	}
+	if(trace_init(trace_sample_rate)) {
+		error("error initialising tracing");
+	}
+	if(cluster_nodes && cluster_start(cluster_nodes, cluster_node)) { // before any game gets its id
+		error("error joining the cluster, check the nodes and the node index");
+	}
+	if(upgrade.path && (channel = upgrade_connect(upgrade.path)) >= 0) { // a server runs, this binary replaces it
+		log_info("upgrade: taking over from the server at %s", (unsigned long) upgrade.path);
+		restore = 0;
+	}
+	if(restore) {
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		games = game_boards_array_restore(snapshot_path);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if(!games) {
+			error("error restoring snapshot");
+		}
+		log_info("restored %lu games from %s in %lu us", games->number_of_elements, (unsigned long) snapshot_path,
+			(end.tv_sec - start.tv_sec) * 1000000ul + end.tv_nsec / 1000 - start.tv_nsec / 1000);
+	} else {
+		games = array_of_games_init(REALLOC_SIZE);
+	}
+	if(!games) {
+		error("error on mallocing stuff");
+	}
+	if(channel < 0 && rating_load(ratings_path)) { // taken over with the games otherwise
+		error("error loading ratings");
+	}
+	if(capture_path && capture_start(capture_path)) {
+		error("error opening the capture file");
+	}
+	if(timer_start()) {
+		error("error starting the timer wheel");
+	}
+	if(spectate_start()) {
+		error("error starting the spectator writer");
+	}
+	if(lobby_start(games)) {
+		error("error starting the lobby publisher");
+	}
+	if(matchmaker_start(&matchmaker_callbacks)) {
+		error("error starting the matchmaker");
+	}
+	if(tournament_start(&tournament_callbacks)) {
+		error("error starting the tournament workers");
+	}
+	if(workers && pool_start(workers)) {
+		error("error starting the worker pool");
+	}
+	shared_games = games;
+	if(shared_name && shared_start(shared_name, &shared_callbacks)) {
+		error("error opening the shared registry, its name has to start with a slash");
+	}
+	if(channel >= 0) {
+		if((number_taken = take_over(channel, games, ratings_path, &sockfd, &metrics_fd, &taken_sessions)) < 0) {
+			error("error taking over from the running server");
+		}
+		close(channel);
+		log_info("upgrade: took %ld sessions and %lu games over", number_taken, games->number_of_elements);
+	}
+	if(archive_path && archive_start(archive_path)) { // after the takeover, the server taken over appended to it until then
+		error("error opening the game archive");
+	}
+	if(metrics_fd >= 0 && metrics_adopt(metrics_fd)) {
+		error("error serving the metrics listener taken over");
+	} else if(metrics_fd < 0 && metrics_port && metrics_start(metrics_port)) {
+		error("error starting the metrics listener");
+	}
+	memset(&action, 0, sizeof(action));
+	sigemptyset(&action.sa_mask);
+	action.sa_handler = sigusr1_handler; // no SA_RESTART, accept has to return with EINTR
+	sigaction(SIGUSR1, &action, NULL);
+	action.sa_handler = sigusr2_handler;
+	sigaction(SIGUSR2, &action, NULL);
+	action.sa_handler = sigint_handler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+	if(channel < 0) {
+		sockfd = socket(AF_INET, SOCK_STREAM, 0);
+		if(sockfd < 0) {
+			error("ERROR opening socket");
+		}
+		int reuse = 1; // a restarted server must be able to bind while old connections linger in TIME_WAIT
+		if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+			error("ERROR setting SO_REUSEADDR");
+		}
+		memset((char *) &serv_addr, 0,  sizeof(serv_addr));
+		portno = atoi(argv[1]);
+		serv_addr.sin_family = AF_INET;
+		serv_addr.sin_addr.s_addr = INADDR_ANY;
+		serv_addr.sin_port = htons(portno);
+		if(bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+			error("ERROR on binding");
+		}
+		listen(sockfd, SOMAXCONN); // a backlog of 5 dropped connects of the load generator into one second syn retries
+	}
+	if(unix_path) { // bots and gateways on this host skip the tcp stack, the protocol is the same
+		if(strlen(unix_path) >= sizeof(unix_addr.sun_path)) {
+			error("ERROR unix socket path too long");
+		}
+		memset(&unix_addr, 0, sizeof(unix_addr));
+		unix_addr.sun_family = AF_UNIX;
+		strcpy(unix_addr.sun_path, unix_path);
+		if((unix_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+			error("ERROR opening unix socket");
+		}
+		unlink(unix_path); // left by a crashed server, or by the one this binary takes over from
+		if(bind(unix_fd, (struct sockaddr *) &unix_addr, sizeof(unix_addr)) < 0 || listen(unix_fd, SOMAXCONN) < 0) {
+			error("ERROR on binding the unix socket");
+		}
+		if(fcntl(unix_fd, F_SETFL, fcntl(unix_fd, F_GETFL) | O_NONBLOCK)) { // polled with the tcp socket
+			error("error making the unix socket non blocking");
+		}
+	}
+	if(unix_path && !upgrade.path && fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK)) {
+		error("error making the listening socket non blocking");
+	}
+	if(upgrade.path) {
+		if((upgrade.listener = upgrade_listen(upgrade.path)) < 0) {
+			error("error listening for upgrades");
+		}
+		if(pipe(upgrade.wake) || fcntl(upgrade.wake[0], F_SETFL, O_NONBLOCK) || fcntl(upgrade.wake[1], F_SETFL, O_NONBLOCK)) {
+			error("error creating the upgrade pipe");
+		}
+		if(fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK)) { // the next binary accepts on it as well until this one lets go
+			error("error making the listening socket non blocking");
+		}
+	}
+	if(pthread_attr_init(&attributes)) {
+		error("error initialising thread attributes structure");
+	}
+	if(pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED)) {
+		error("error setting thread attribute to detached state");
+	}
+	srandom(time(NULL));
+	for(long i = 0; i < number_taken; ++i) {
+		arg = malloc(sizeof(struct arguments));
+		if(!arg) {
+			error("error on malloc");
+		}
+		arg->fd = taken_sessions[i]->fd;
+		arg->connection = atomic_fetch_add(&number_of_connections, 1) + 1;
+		arg->games = games;
+		arg->session = taken_sessions[i];
+		gauge_add(gauges.connections, 1);
+		pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+		if(pthread_create(&thread, &attributes, connection_thread, arg)) {
+			error("failed to create thread");
+		}
+		pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+	}
+	free(taken_sessions);
+	listeners[0].fd = sockfd;
+	listeners[1].fd = unix_fd; // poll skips the negative ones
+	listeners[2].fd = upgrade.path ? upgrade.listener : -1;
+	listeners[0].events = listeners[1].events = listeners[2].events = POLLIN;
+	polling = unix_path || upgrade.path;
+	while(!shutdown_requested && !handed_over) {
+		clilen = sizeof(cli_addr);
+		listeners[0].revents = listeners[1].revents = listeners[2].revents = 0;
+		ready = polling ? poll(listeners, 3, -1) : 1; // without other listeners accept blocks on its own
+		if(ready > 0 && listeners[2].revents) {
+			if((channel = accept(upgrade.listener, NULL, NULL)) >= 0) {
+				handed_over = !hand_over(channel, sockfd, games, ratings_path);
+				close(channel);
+			}
+			continue;
+		}
+		listener = -1;
+		if(ready <= 0) { // interrupted by a signal, errno is poll's
+			newsockfd = -1;
+		} else if(!polling || listeners[0].revents) {
+			listener = sockfd;
+			newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+		} else {
+			listener = unix_fd;
+			newsockfd = accept(unix_fd, NULL, NULL);
+		}
+		accept_error = errno; // the snapshot and the trace below may change errno
+		if(snapshot_requested) {
+			snapshot_requested = 0;
+			if(game_boards_array_snapshot(games, snapshot_path)) {
+				log_error("error writing snapshot to %s", (unsigned long) snapshot_path);
+			}
+			if(rating_save(ratings_path)) {
+				log_error("error writing ratings to %s", (unsigned long) ratings_path);
+			}
+		}
+		if(trace_requested) {
+			trace_requested = 0;
+			if(trace_dump(trace_path)) {
+				log_error("error writing trace to %s", (unsigned long) trace_path);
+			} else {
+				log_info("trace written to %s", (unsigned long) trace_path);
+			}
+		}
+		if(newsockfd < 0) {
+			if(accept_error == EINTR || accept_error == EAGAIN || accept_error == EWOULDBLOCK) { // the next binary took the connection
+				continue;
+			}
+			error("error on accept");
+		}
+		if(max_connections && atomic_load(&gauges.connections) >= (long) max_connections) {
+			reject_connection(newsockfd);
+			continue;
+		}
+		if(listener == unix_fd) {
+			log_info("Got a connection on %s", (unsigned long) unix_path);
+		} else {
+			int nodelay = 1; // replies and notifies are small writes from two threads, nagle held the second one for a delayed ack
+			if(setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0) {
+				log_warning("error setting TCP_NODELAY: %s", (unsigned long) strerror(errno));
+			}
+			address = ntohl(cli_addr.sin_addr.s_addr);
+			log_info("Got a connection from %u.%u.%u.%u on port %u", address >> 24, (address >> 16) & 0xff, (address >> 8) & 0xff,
+				address & 0xff, ntohs(cli_addr.sin_port));
+		}
+		//int *copy_newsockfd = malloc(sizeof(int));
+		arg = malloc(sizeof(struct arguments));
+		if(arg) {
+			arg->fd = newsockfd;	
+			arg->connection = atomic_fetch_add(&number_of_connections, 1) + 1;
+			arg->games = games;
+			arg->session = NULL;
+			gauge_add(gauges.connections, 1); // counted here, so that a burst of accepts sees the connections before their threads run
+			pthread_sigmask(SIG_BLOCK, &blocked_signals, &previous_signals);
+			if(pthread_create(&thread, &attributes, connection_thread, arg)) {
+				log_error("failed to create thread");	
+				free(arg);
+				arg = NULL;
+				gauge_add(gauges.connections, -1);
+				reject_connection(newsockfd);
+			}
+			pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+		} else {
+			log_error("error on malloc");
+			reject_connection(newsockfd);
+		}
+	}
+	close(sockfd);
+	if(unix_path) {
+		close(unix_fd);
+		if(!handed_over) { // the next binary bound its own socket at the path
+			unlink(unix_path);
+		}
+	}
+	if(upgrade.path) {
+		close(upgrade.listener); // the socket file is the next binary's now if it took over
+	}
+	time_t drain_start = time(NULL);
+	while(handed_over && atomic_load(&gauges.connections) && !shutdown_requested && time(NULL) - drain_start < UPGRADE_DRAIN_SECONDS) {
+		usleep(100000); // the sessions that stayed end on their own
+	}
+	if(!handed_over && game_boards_array_snapshot(games, snapshot_path)) { // the next binary snapshots the games
+		log_error("error writing snapshot to %s", (unsigned long) snapshot_path);
+	}
+	if(!handed_over && rating_save(ratings_path)) {
+		log_error("error writing ratings to %s", (unsigned long) ratings_path);
+	}
+	shared_stop();
+	cluster_stop();
+	pool_stop();
+	tournament_stop();
+	matchmaker_stop();
+	lobby_stop();
+	spectate_stop();
+	timer_stop();
+	capture_stop();
+	archive_stop();
+	log_stop();
+	pthread_attr_destroy(&attributes);
 	return 0; 
 }
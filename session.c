@@ -0,0 +1,586 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "session.h"
+#include "protocol.h"
+
+static unsigned long session_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+void session_init(struct client_session *session, int fd, const struct session_handlers *handlers, void *context)
+{
+	memset(session, 0, sizeof(struct client_session));
+	session->fd = fd;
+	session->state = SESSION_CONNECTED;
+	session->pending = SESSION_NO_REQUEST;
+	session->handlers = handlers;
+	session->context = context;
+}
+
+void session_close(struct client_session *session)
+{
+	if(session->state == SESSION_CLOSED) {
+		return;
+	}
+	close(session->fd);
+	session->fd = -1;
+	session->state = SESSION_CLOSED;
+	for(size_t i = 0; i < session->number_of_games; ++i) {
+		free(session->games[i]);
+	}
+	free(session->games);
+	session->games = NULL;
+	session->number_of_games = session->games_size = 0;
+}
+
+/*
+ * returns -1 while another request is in flight or the request does not fit the state,
+ * -2 if the socket failed, in which case the session is closed
+ * */
+static int session_send(struct client_session *session, unsigned char opcode, struct client_game *game, const char *buffer,
+	size_t length)
+{
+	if(session->state == SESSION_CLOSED || session->pending != SESSION_NO_REQUEST || !length) {
+		return -1;
+	}
+	if(send(session->fd, buffer, length, MSG_NOSIGNAL) != (ssize_t) length) { // requests are tiny, a short write means a dead socket
+		session_close(session);
+		return -2;
+	}
+	session->pending = opcode;
+	session->pending_game = game;
+	session->sent_at = session_now();
+	return 0;
+}
+
+int session_login(struct client_session *session, unsigned char opcode, const char *username, const char *password)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->state != SESSION_CONNECTED || (opcode != LOGIN_REQUEST && opcode != CREATE_USER_REQUEST)) {
+		return -1;
+	}
+	return session_send(session, opcode, NULL, buffer, encode_credentials_request(buffer, opcode, username, password));
+}
+
+/*
+ * from MULTIPLEX_REPLY on the session can hold many games, only allowed in the lobby
+ * */
+int session_multiplex(struct client_session *session)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->state != SESSION_LOBBY || session->multiplexed) {
+		return -1;
+	}
+	return session_send(session, MULTIPLEX_REQUEST, NULL, buffer, encode_request(buffer, MULTIPLEX_REQUEST));
+}
+
+/*
+ * requests without operands: JOIN_RANDOM_GAME_REQUEST, CREATE_NEW_GAME_REQUEST, LOGOUT_REQUEST and
+ * LEAVE_GAME_REQUEST of a session that is not multiplexed
+ * */
+int session_request(struct client_session *session, unsigned char opcode)
+{
+	char buffer[BUFFER_LENGTH];
+	switch(opcode) {
+		case JOIN_RANDOM_GAME_REQUEST:
+		case CREATE_NEW_GAME_REQUEST: if(session->state != SESSION_LOBBY || (session->matchmaking && !session->multiplexed)) return -1; break;
+		case LEAVE_GAME_REQUEST: return session_leave(session, &session->game);
+		case LOGOUT_REQUEST: if(session->state != SESSION_LOBBY && session->state != SESSION_IN_GAME) return -1; break;
+		default: return -1;
+	}
+	return session_send(session, opcode, NULL, buffer, encode_request(buffer, opcode));
+}
+
+int session_leave(struct client_session *session, struct client_game *game)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->multiplexed) {
+		return session_send(session, LEAVE_GAME_REQUEST, game, buffer, encode_game_request(buffer, LEAVE_GAME_REQUEST, game->id));
+	}
+	if(session->state != SESSION_IN_GAME || game != &session->game) {
+		return -1;
+	}
+	return session_send(session, LEAVE_GAME_REQUEST, game, buffer, encode_request(buffer, LEAVE_GAME_REQUEST));
+}
+
+int session_move(struct client_session *session, struct client_game *game, unsigned long x, unsigned long y)
+{
+	char buffer[BUFFER_LENGTH];
+	size_t length;
+	int ret_value;
+	if(session->multiplexed) {
+		length = encode_game_action_request(buffer, game->id, x, y);
+	} else if(session->state == SESSION_IN_GAME && game == &session->game) {
+		length = encode_action_request(buffer, x, y);
+	} else {
+		return -1;
+	}
+	if(!(ret_value = session_send(session, ACTION_REQUEST, game, buffer, length))) {
+		game->last_x = x;
+		game->last_y = y;
+		game->my_turn = 0;
+	}
+	return ret_value;
+}
+
+int session_stats(struct client_session *session, unsigned char selector)
+{
+	char buffer[BUFFER_LENGTH];
+	return session_send(session, STATS_REQUEST, NULL, buffer, encode_stats_request(buffer, selector));
+}
+
+/*
+ * game id 0 asks for any game that is being played
+ * */
+int session_spectate(struct client_session *session, uint32_t game_id)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->state != SESSION_LOBBY) {
+		return -1;
+	}
+	return session_send(session, SPECTATE_REQUEST, NULL, buffer, encode_game_request(buffer, SPECTATE_REQUEST, game_id));
+}
+
+/*
+ * the open games from index first on, any number of times while in the lobby
+ * */
+int session_list_games(struct client_session *session, unsigned long first)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->state != SESSION_LOBBY) {
+		return -1;
+	}
+	return session_send(session, LIST_GAMES_REQUEST, NULL, buffer, encode_list_games_request(buffer, first));
+}
+
+/*
+ * waits for a game against a player of similar rating, see session.h
+ * */
+int session_matchmake(struct client_session *session)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->state != SESSION_LOBBY || session->matchmaking) {
+		return -1;
+	}
+	return session_send(session, MATCHMAKE_REQUEST, NULL, buffer, encode_request(buffer, MATCHMAKE_REQUEST));
+}
+
+/*
+ * signs up for the open tournament of format and size players, see session.h
+ * */
+int session_tournament(struct client_session *session, char format, unsigned long players)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->state != SESSION_LOBBY || !session->multiplexed || session->tournament) {
+		return -1;
+	}
+	return session_send(session, TOURNAMENT_REQUEST, NULL, buffer, encode_tournament_request(buffer, format, players));
+}
+
+/*
+ * asks for the board and the moves of game, e.g. after resuming a restored game or when the local board
+ * went out of sync. the local copy is replaced by the server's when the reply arrives.
+ * */
+int session_snapshot(struct client_session *session, struct client_game *game)
+{
+	char buffer[BUFFER_LENGTH];
+	if(session->multiplexed) {
+		return session_send(session, GAME_SNAPSHOT_REQUEST, game, buffer, encode_game_request(buffer, GAME_SNAPSHOT_REQUEST, game->id));
+	}
+	if(session->state != SESSION_IN_GAME || game != &session->game) {
+		return -1;
+	}
+	return session_send(session, GAME_SNAPSHOT_REQUEST, game, buffer, encode_request(buffer, GAME_SNAPSHOT_REQUEST));
+}
+
+/*
+ * asks for another game against the same player once game ended with a result, see session.h
+ * */
+int session_rematch(struct client_session *session, struct client_game *game)
+{
+	char buffer[BUFFER_LENGTH];
+	if(game->result != 'X' && game->result != 'O' && game->result != 'D') {
+		return -1;
+	}
+	size_t length;
+	int ret_value;
+	if(session->multiplexed) {
+		length = encode_game_request(buffer, REMATCH_REQUEST, game->id);
+	} else if(session->state == SESSION_IN_GAME && game == &session->game) {
+		length = encode_request(buffer, REMATCH_REQUEST);
+	} else {
+		return -1;
+	}
+	if(!(ret_value = session_send(session, REMATCH_REQUEST, game, buffer, length))) {
+		game->rematch |= SESSION_REMATCH_ASKED;
+	}
+	return ret_value;
+}
+
+static void session_mark(struct client_game *game, unsigned long x, unsigned long y, char character)
+{
+	if(game->board_size > SESSION_MAX_BOARD || x >= game->board_size || y >= game->board_size) {
+		return;
+	}
+	if(game->board[x * game->board_size + y] == ' ') {
+		--game->free_cells;
+	}
+	game->board[x * game->board_size + y] = character;
+}
+
+/*
+ * picks a random cell that is free on the local copy of the board, any cell if there is no copy
+ * */
+int session_random_free_cell(const struct client_game *game, unsigned int *seed, unsigned long *x, unsigned long *y)
+{
+	size_t cell, i;
+	if(!game->board_size) {
+		return -1;
+	}
+	if(game->board_size > SESSION_MAX_BOARD || !game->free_cells) {
+		cell = rand_r(seed) % (game->board_size * game->board_size);
+	} else {
+		i = rand_r(seed) % game->free_cells;
+		for(cell = 0; game->board[cell] != ' ' || i--; ++cell);
+	}
+	*x = cell / game->board_size;
+	*y = cell % game->board_size;
+	return 0;
+}
+
+/*
+ * GAME_SNAPSHOT_REPLY: game id, whose turn or the result, board size, the cells, then the moves, which the
+ * local copy does not need
+ * */
+static void session_load_snapshot(struct client_game *game, const char *message)
+{
+	const char *turn = message + strlen(message + 1) + 2;
+	char *cells;
+	size_t i;
+	game->board_size = strtoul(turn + 1, &cells, 10);
+	++cells;
+	game->my_turn = *turn == game->character;
+	if(*turn == 'X' || *turn == 'O' || *turn == 'D') {
+		game->result = *turn;
+	} else if(*turn == 'L' && game->result == SESSION_PLAYING) {
+		game->result = SESSION_PEER_LEFT;
+	}
+	if(game->board_size > SESSION_MAX_BOARD) {
+		return;
+	}
+	memcpy(game->board, cells, game->board_size * game->board_size);
+	for(game->free_cells = 0, i = 0; i < game->board_size * game->board_size; ++i) {
+		game->free_cells += game->board[i] == ' ';
+	}
+}
+
+/*
+ * CREATE_NEW_GAME_SUCCESS and JOIN_RANDOM_GAME_REPLY: character, uppercase if this player begins, then the
+ * board size and in multiplexed sessions the game id
+ * */
+static void session_enter_game(struct client_session *session, struct client_game *game, const char *message, char joined)
+{
+	char *next;
+	game->character = message[1] | 0x20;
+	game->my_turn = message[1] != game->character;
+	game->peer_present = joined;
+	game->result = SESSION_PLAYING;
+	game->board_size = strtoul(message + 2, &next, 10);
+	if(session->multiplexed) {
+		game->id = strtoul(next + 1, NULL, 10);
+	}
+	if(!game->board_size) {
+		game->board_size = BOARD_SIZE;
+	}
+	if(game->board_size <= SESSION_MAX_BOARD) {
+		memset(game->board, ' ', game->board_size * game->board_size);
+	}
+	game->free_cells = game->board_size * game->board_size;
+}
+
+/*
+ * REMATCH_REPLY and REMATCH_NOTIFY: the character in the game that started again, uppercase if this player
+ * begins. the other player is still there and the board is empty.
+ * */
+static void session_restart_game(struct client_game *game, char character)
+{
+	game->character = character | 0x20;
+	game->my_turn = character != game->character;
+	game->peer_present = 1;
+	game->result = SESSION_PLAYING;
+	game->rematch = 0;
+	if(game->board_size <= SESSION_MAX_BOARD) {
+		memset(game->board, ' ', game->board_size * game->board_size);
+	}
+	game->free_cells = game->board_size * game->board_size;
+}
+
+/*
+ * the new game of a multiplexed session
+ * */
+static struct client_game* session_add_game(struct client_session *session)
+{
+	struct client_game **games, *game;
+	if(session->number_of_games == session->games_size) {
+		games = realloc(session->games, sizeof(struct client_game*) * (session->games_size + REALLOC_SIZE));
+		if(!games) {
+			return NULL;
+		}
+		session->games = games;
+		session->games_size += REALLOC_SIZE;
+	}
+	if(!(game = calloc(1, sizeof(struct client_game)))) {
+		return NULL;
+	}
+	session->games[session->number_of_games++] = game;
+	return game;
+}
+
+static struct client_game* session_find_game(struct client_session *session, uint32_t id)
+{
+	for(size_t i = 0; i < session->number_of_games; ++i) {
+		if(session->games[i]->id == id) {
+			return session->games[i];
+		}
+	}
+	return NULL;
+}
+
+static void session_remove_game(struct client_session *session, struct client_game *game)
+{
+	for(size_t i = 0; i < session->number_of_games; ++i) {
+		if(session->games[i] == game) {
+			session->games[i] = session->games[--session->number_of_games];
+			free(game);
+			return;
+		}
+	}
+}
+
+/*
+ * notifications are sent by the other player's thread and can arrive at any time, also between a
+ * request and its reply. GAME_IS_FINISHED is both: the reply to a move that ended the game and the
+ * notification of the other player's last move. while a move of this player is in flight the other
+ * player cannot move, so it is the reply exactly then. multiplexed sessions are told about the other
+ * player's last move by an ACTION_NOTIFY, GAME_IS_FINISHED is always a reply to them.
+ * */
+static char session_is_notification(const struct client_session *session, unsigned char code)
+{
+	switch(code) {
+		case OTHER_PLAYER_PRESENT_NOTIFY:
+		case ACTION_NOTIFY:
+		case PEER_LEFT_NOTIFY:
+		case SPECTATE_NOTIFY:
+		case SPECTATE_SNAPSHOT_NOTIFY:
+		case MATCH_FOUND_NOTIFY:
+		case MATCH_EXPIRED_NOTIFY:
+		case TOURNAMENT_OVER_NOTIFY:
+		case REMATCH_NOTIFY:
+		case MOVE_TIMEOUT_NOTIFY: return 1;
+		case GAME_IS_FINISHED: return !session->multiplexed && session->pending != ACTION_REQUEST;
+		default: return 0;
+	}
+}
+
+/*
+ * message is laid out as in sessions that are not multiplexed, the game id has been taken out
+ * */
+static void session_handle_notification(struct client_session *session, struct client_game *game, const char *message)
+{
+	unsigned long x, y;
+	char *next;
+	game->updated_at = session_now();
+	switch((unsigned char) message[0]) {
+		case OTHER_PLAYER_PRESENT_NOTIFY: game->peer_present = 1; break;
+		case ACTION_NOTIFY: { // whose turn, x, y of the other player's move
+			x = strtoul(message + 2, &next, 10);
+			y = strtoul(next + 1, NULL, 10);
+			session_mark(game, x, y, game->character ^ ('x' ^ 'o'));
+			game->my_turn = message[1] == game->character;
+			game->peer_present = 1;
+			if(message[1] == 'X' || message[1] == 'O' || message[1] == 'D') { // the move ended the game
+				game->result = message[1];
+			}
+		} break;
+		case PEER_LEFT_NOTIFY: {
+			game->peer_present = 0;
+			if(game->result == SESSION_PLAYING) {
+				game->result = SESSION_PEER_LEFT;
+			}
+		} break;
+		case GAME_IS_FINISHED: game->result = message[1]; break;
+		case MOVE_TIMEOUT_NOTIFY: { // the player whose turn it was lost
+			game->result = message[1];
+			game->my_turn = 0;
+		} break;
+		case REMATCH_NOTIFY: { // the other player asked for a rematch, or agreed to this player's
+			if(message[1]) {
+				session_restart_game(game, message[1]);
+			} else if(game->result != SESSION_PLAYING) { // not a late offer for a game that already started again
+				game->rematch |= SESSION_REMATCH_OFFERED;
+			}
+		} break;
+	}
+	if(session->handlers->notify) {
+		session->handlers->notify(session, game, message);
+	}
+}
+
+/*
+ * MATCH_FOUND_NOTIFY starts a game like JOIN_RANDOM_GAME_REPLY, MATCH_EXPIRED_NOTIFY ends the wait without one
+ * */
+static void session_handle_match(struct client_session *session, const char *message)
+{
+	struct client_game *game = NULL;
+	session->matchmaking = 0;
+	if((unsigned char) message[0] == MATCH_FOUND_NOTIFY) {
+		if(!session->multiplexed) {
+			session->state = SESSION_IN_GAME;
+			game = &session->game;
+		} else if(!(game = session_add_game(session))) {
+			return; // the game is played without this session, as with a join
+		}
+		session_enter_game(session, game, message, 1);
+		game->updated_at = session_now();
+	}
+	if(session->handlers->notify) {
+		session->handlers->notify(session, game, message);
+	}
+}
+
+/*
+ * finds the game of a notification to a multiplexed session and moves the game id out of the message
+ * */
+static void session_handle_multiplexed_notification(struct client_session *session, char *message, size_t length)
+{
+	struct client_game *game;
+	char *end;
+	uint32_t id = strtoul(message + 1, &end, 10);
+	if(!(game = session_find_game(session, id))) { // a late notification of a game this session already left
+		return;
+	}
+	memmove(message + 1, end + 1, length - (end + 1 - message));
+	session_handle_notification(session, game, message);
+}
+
+static void session_handle_reply(struct client_session *session, const char *message)
+{
+	unsigned char opcode = session->pending;
+	struct client_game *game = session->pending_game;
+	switch((unsigned char) message[0]) {
+		case LOGIN_SUCCESS:
+		case CREATE_USER_SUCCESS: session->state = SESSION_LOBBY; break; // a new user is logged in
+		case MULTIPLEX_REPLY: session->multiplexed = 1; break;
+		case MATCHMAKE_REPLY: session->matchmaking = 1; break;
+		case TOURNAMENT_REPLY: session->tournament = 1; break;
+		case CREATE_NEW_GAME_SUCCESS:
+		case JOIN_RANDOM_GAME_REPLY: {
+			if(!session->multiplexed) {
+				session->state = SESSION_IN_GAME;
+				game = &session->game;
+			} else if(!(game = session_add_game(session))) {
+				break; // the game is played without this session, the server ends it once the other player gives up
+			}
+			session_enter_game(session, game, message, (unsigned char) message[0] == JOIN_RANDOM_GAME_REPLY);
+		} break;
+		case LEAVE_GAME_REPLY: if(!session->multiplexed) session->state = SESSION_LOBBY; break;
+		case LOGOUT_REPLY: session->state = SESSION_CONNECTED; break; // the server ends the connection next
+		case ACTION_REPLY: session_mark(game, game->last_x, game->last_y, game->character); break;
+		case GAME_SNAPSHOT_REPLY: session_load_snapshot(game, message); break;
+		case REMATCH_REPLY: if(message[1]) session_restart_game(game, message[1]); break; // else waiting for the other player
+		case GAME_IS_FINISHED: {
+			session_mark(game, game->last_x, game->last_y, game->character);
+			game->result = message[1];
+		} break;
+		case CANNOT_WRITE_HERE: { // the local board went out of sync, another cell has to be tried
+			session_mark(game, game->last_x, game->last_y, '?');
+			game->my_turn = 1;
+		} break;
+		case INVALID_OPERANDS: if(game && opcode != REMATCH_REQUEST) game->my_turn = 1; break;
+		case NO_PLAYER_PRESENT: { // an empty seat of a restored game, or the other player is gone
+			game->peer_present = 0;
+			game->my_turn = 1;
+		} break;
+		case NOT_YOUR_TURN: game->my_turn = 0; break;
+		case NO_FURTHER_ACTIONS_PERMITTED: {
+			if(game->result == SESSION_PLAYING) {
+				game->result = SESSION_PEER_LEFT;
+			}
+		} break;
+	}
+	if(game) {
+		game->updated_at = session_now();
+	}
+	session->pending = SESSION_NO_REQUEST; // the handler may already send the next request
+	session->pending_game = NULL;
+	if(session->handlers->reply) {
+		session->handlers->reply(session, game, opcode, message, session_now() - session->sent_at);
+	}
+	if(session->multiplexed && (unsigned char) message[0] == LEAVE_GAME_REPLY && game) {
+		session_remove_game(session, game);
+	}
+}
+
+/*
+ * reads everything the socket holds and handles every complete message.
+ * returns -1 when the server closed the connection, the session is closed then.
+ * */
+int session_receive(struct client_session *session)
+{
+	ssize_t n;
+	size_t length;
+	char message[BUFFER_LENGTH];
+	while(session->state != SESSION_CLOSED) {
+		n = recv(session->fd, session->buffer + session->received, BUFFER_LENGTH - session->received, 0);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			session_close(session);
+			return -1;
+		}
+		session->received += n;
+		while(session->state != SESSION_CLOSED && (length = session->multiplexed ?
+		multiplexed_message_length(session->buffer, session->received) : server_message_length(session->buffer, session->received))) {
+			memcpy(message, session->buffer, length); // the handlers may look at the message after it left the buffer
+			session->received -= length;
+			memmove(session->buffer, session->buffer + length, session->received);
+			if(!session_is_notification(session, (unsigned char) message[0])) {
+				if(session->pending != SESSION_NO_REQUEST) {
+					session_handle_reply(session, message);
+				}
+			} else if((unsigned char) message[0] == SPECTATE_NOTIFY || (unsigned char) message[0] == SPECTATE_SNAPSHOT_NOTIFY) {
+				if(session->handlers->notify) { // about a game this session watches, not one it plays
+					session->handlers->notify(session, NULL, message);
+				}
+			} else if((unsigned char) message[0] == TOURNAMENT_OVER_NOTIFY) {
+				session->tournament = 0;
+				if(session->handlers->notify) {
+					session->handlers->notify(session, NULL, message);
+				}
+			} else if((unsigned char) message[0] == MATCH_FOUND_NOTIFY || (unsigned char) message[0] == MATCH_EXPIRED_NOTIFY) {
+				session_handle_match(session, message);
+			} else if(session->multiplexed) {
+				session_handle_multiplexed_notification(session, message, length);
+			} else if(session->state == SESSION_IN_GAME) { // not a late notification of a game this session already left
+				session_handle_notification(session, &session->game, message);
+			}
+		}
+		if(session->received == BUFFER_LENGTH) { // no message is that long, the stream is out of sync
+			session_close(session);
+			return -1;
+		}
+	}
+	return -1;
+}
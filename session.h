@@ -0,0 +1,115 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "constants.h"
+
+/*
+ * the client side of the protocol as a state machine over one non-blocking socket, shared by the
+ * interactive client, the bots and the load generator. the owner polls the socket and calls
+ * session_receive when it is readable; the session splits the stream into messages, tells replies
+ * from notifications, keeps a copy of the board and whose turn it is, and reports every message to
+ * the owner's handlers. requests are only accepted while no other request is in flight, the server
+ * reads one request per recv and two requests sent together would be read as one.
+ * one process can run any number of sessions, they share no state.
+ *
+ * a session plays one game at a time, session->game. after session_multiplex it is multiplexed
+ * instead: it can hold any number of games, which the server tells apart by their game ids.
+ * a session that spectates stays in the lobby, the messages about watched games are passed to the
+ * handlers as they are, with a NULL game.
+ *
+ * after session_matchmake the session waits for the server to find a game, which starts with a
+ * MATCH_FOUND_NOTIFY to the notify handler, or MATCH_EXPIRED_NOTIFY with a NULL game. a session that is
+ * not multiplexed cannot create or join a game meanwhile.
+ *
+ * a multiplexed session can sign up for a tournament with session_tournament. its games start with
+ * MATCH_FOUND_NOTIFY as well, the tournament's end is a TOURNAMENT_OVER_NOTIFY to the notify handler
+ * with a NULL game.
+ *
+ * once a game ended with a result either player can ask for a rematch with session_rematch. the game starts
+ * again when both asked, with the sides swapped, under the same game id and without leaving it.
+ * */
+#define SESSION_MAX_BOARD 16 // larger boards are played without a local copy
+#define SESSION_NO_REQUEST 0xff // no request opcode uses this value
+
+enum {
+	SESSION_CONNECTED, // not logged in
+	SESSION_LOBBY, // logged in, a multiplexed session stays here while it plays
+	SESSION_IN_GAME, // holds a seat, also after the game ended until LEAVE_GAME_REPLY
+	SESSION_CLOSED
+};
+
+enum {
+	SESSION_PLAYING = 0, // values of result, the others are the server's 'X', 'O' and 'D'
+	SESSION_PEER_LEFT = 'L'
+};
+
+enum {
+	SESSION_REMATCH_ASKED = 1, // this session asked for a rematch
+	SESSION_REMATCH_OFFERED = 2 // the other player asked for one
+};
+
+struct client_game {
+	uint32_t id; // 0 in sessions that are not multiplexed
+	char character; // lowercase x or o, the character this session writes
+	char my_turn, peer_present;
+	char result; // SESSION_PLAYING until the game ends
+	char rematch; // SESSION_REMATCH_* flags of the finished game
+	size_t board_size, free_cells;
+	char board[SESSION_MAX_BOARD * SESSION_MAX_BOARD]; // ' ' for free cells, '?' for cells the server refused
+	unsigned long last_x, last_y; // the move in flight
+	unsigned long updated_at; // nanoseconds, CLOCK_MONOTONIC, when the server last sent something about the game
+	void *context; // owned by the caller
+};
+
+struct client_session;
+
+/*
+ * game is the game the message is about, NULL for messages about no game. the game of a
+ * multiplexed session is freed after the handler saw its LEAVE_GAME_REPLY.
+ * */
+struct session_handlers {
+	// the reply to the request with opcode, nanoseconds after it was sent
+	void (*reply)(struct client_session *session, struct client_game *game, unsigned char opcode, const char *message,
+		unsigned long nanoseconds);
+	// a message the server sent on behalf of the other player
+	void (*notify)(struct client_session *session, struct client_game *game, const char *message);
+};
+
+struct client_session {
+	int fd;
+	char state; // SESSION_*
+	char multiplexed;
+	char matchmaking; // waiting for MATCH_FOUND_NOTIFY or MATCH_EXPIRED_NOTIFY
+	char tournament; // signed up for a tournament, until TOURNAMENT_OVER_NOTIFY
+	unsigned char pending; // opcode of the request in flight
+	struct client_game *pending_game; // the game the request in flight is about
+	unsigned long sent_at;
+	struct client_game game; // the game of a session that is not multiplexed
+	struct client_game **games; // the games of a multiplexed session
+	size_t number_of_games, games_size;
+	size_t received;
+	char buffer[BUFFER_LENGTH];
+	const struct session_handlers *handlers;
+	void *context; // owned by the caller
+};
+
+void session_init(struct client_session *session, int fd, const struct session_handlers *handlers, void *context);
+int session_login(struct client_session *session, unsigned char opcode, const char *username, const char *password);
+int session_multiplex(struct client_session *session);
+int session_request(struct client_session *session, unsigned char opcode);
+int session_leave(struct client_session *session, struct client_game *game);
+int session_move(struct client_session *session, struct client_game *game, unsigned long x, unsigned long y);
+int session_stats(struct client_session *session, unsigned char selector);
+int session_spectate(struct client_session *session, uint32_t game_id);
+int session_snapshot(struct client_session *session, struct client_game *game);
+int session_rematch(struct client_session *session, struct client_game *game);
+int session_list_games(struct client_session *session, unsigned long first);
+int session_matchmake(struct client_session *session);
+int session_tournament(struct client_session *session, char format, unsigned long players);
+int session_receive(struct client_session *session);
+int session_random_free_cell(const struct client_game *game, unsigned int *seed, unsigned long *x, unsigned long *y);
+void session_close(struct client_session *session);
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "shared.h"
+#include "upgrade.h"
+#include "log.h"
+
+#define SEAT(generation, state) ((generation) << 8 | (state))
+#define SEAT_STATE(seat) ((seat) & 0xff)
+#define SEAT_GENERATION(seat) ((seat) >> 8)
+
+struct shared_game {
+	_Atomic uint64_t seat;
+	uint32_t process; // written before the seat is opened, read after it was seen open
+	uint32_t id;
+};
+
+struct shared_registry {
+	_Atomic uint32_t magic; // 0 while the first process sets the registry up
+	pthread_mutex_t monitor; // robust, guards the process table
+	_Atomic int32_t processes[SHARED_PROCESSES]; // the pid of the process in the slot, 0 for a free slot
+	struct shared_game games[SHARED_GAMES];
+};
+
+static struct {
+	struct shared_registry *registry;
+	const char *name;
+	const struct shared_callbacks *callbacks;
+	uint32_t process; // this process's slot
+	atomic_uint next; // where shared_publish looks for a free entry first
+	int listener;
+	int stop[2];
+	pthread_t thread;
+	char running;
+} shared = { .listener = -1, .stop = { -1, -1 } };
+
+static void shared_lock(void)
+{
+	if(pthread_mutex_lock(&shared.registry->monitor) == EOWNERDEAD) { // a process died holding it, the table is still whole
+		pthread_mutex_consistent(&shared.registry->monitor);
+	}
+}
+
+/*
+ * the unix socket of the process in slot, in the abstract namespace so that no file outlives it
+ * */
+static socklen_t shared_address(uint32_t process, struct sockaddr_un *address)
+{
+	int n;
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	n = snprintf(address->sun_path + 1, sizeof(address->sun_path) - 1, "tictactoe.%s.%u", shared.name, process);
+	if(n <= 0 || (size_t) n >= sizeof(address->sun_path) - 1) {
+		return 0;
+	}
+	return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+/*
+ * maps the registry named name, the first process to map it sets it up
+ * */
+static int shared_map(const char *name)
+{
+	pthread_mutexattr_t attributes;
+	uint32_t expected = 0;
+	int fd;
+	fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if(fd < 0) {
+		return -1;
+	}
+	if(ftruncate(fd, sizeof(struct shared_registry))) {
+		close(fd);
+		return -1;
+	}
+	shared.registry = mmap(NULL, sizeof(struct shared_registry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(shared.registry == MAP_FAILED) {
+		shared.registry = NULL;
+		return -1;
+	}
+	if(atomic_compare_exchange_strong(&shared.registry->magic, &expected, 1)) { // the memory of a new object is zeroed, every entry is free
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&shared.registry->monitor, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+		atomic_store(&shared.registry->magic, SHARED_MAGIC);
+	}
+	for(int i = 0; i < 100 && atomic_load(&shared.registry->magic) != SHARED_MAGIC; ++i) {
+		usleep(10000);
+	}
+	if(atomic_load(&shared.registry->magic) != SHARED_MAGIC) {
+		munmap(shared.registry, sizeof(struct shared_registry));
+		shared.registry = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * frees the entries of the process in slot, the caller holds the monitor
+ * */
+static void shared_free_entries(uint32_t process)
+{
+	struct shared_game *game;
+	uint64_t seat;
+	for(unsigned int i = 0; i < SHARED_GAMES; ++i) {
+		game = &shared.registry->games[i];
+		seat = atomic_load(&game->seat);
+		if(SEAT_STATE(seat) != SHARED_FREE && game->process == process) {
+			atomic_store(&game->seat, SEAT(SEAT_GENERATION(seat), SHARED_FREE));
+		}
+	}
+}
+
+/*
+ * takes a free slot of the process table, or the slot of a process that died. returns -1 if all are taken.
+ * */
+static int shared_register(void)
+{
+	int32_t pid;
+	int ret_value = -1;
+	shared_lock();
+	for(uint32_t i = 0; i < SHARED_PROCESSES; ++i) {
+		pid = atomic_load(&shared.registry->processes[i]);
+		if(pid && !(kill(pid, 0) && errno == ESRCH)) {
+			continue;
+		}
+		if(pid) {
+			log_warning("shared: process %d died, freeing its games", pid);
+			shared_free_entries(i);
+		}
+		atomic_store(&shared.registry->processes[i], getpid());
+		shared.process = i;
+		ret_value = 0;
+		break;
+	}
+	pthread_mutex_unlock(&shared.registry->monitor);
+	return ret_value;
+}
+
+/*
+ * takes the connections other processes hand over, one at a time
+ * */
+static void* shared_thread(void *arg)
+{
+	struct pollfd fds[2] = { { .fd = shared.listener, .events = POLLIN }, { .fd = shared.stop[0], .events = POLLIN } };
+	struct shared_join join;
+	int channel, fd;
+	char ack;
+	(void) arg;
+	for(;;) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			log_error("shared: error on poll: %s", (unsigned long) strerror(errno));
+			break;
+		}
+		if(fds[1].revents) {
+			break;
+		}
+		if((channel = accept(shared.listener, NULL, NULL)) < 0) {
+			continue;
+		}
+		if(!upgrade_recv(channel, &join, sizeof(join), &fd) && fd >= 0) {
+			if((ack = shared.callbacks->adopt(&join, fd) ? 1 : 0)) {
+				close(fd);
+			}
+			if(upgrade_send(channel, &ack, 1, -1)) {
+				log_warning("shared: error on answering a join: %s", (unsigned long) strerror(errno));
+			}
+		} else if(fd >= 0) {
+			close(fd);
+		}
+		close(channel);
+	}
+	return NULL;
+}
+
+int shared_start(const char *name, const struct shared_callbacks *callbacks)
+{
+	struct sockaddr_un address;
+	socklen_t length;
+	if(!name || name[0] != '/' || !callbacks || !callbacks->adopt) {
+		return -3;
+	}
+	shared.name = name + 1;
+	shared.callbacks = callbacks;
+	if(shared_map(name)) {
+		return -1;
+	}
+	if(shared_register()) {
+		munmap(shared.registry, sizeof(struct shared_registry));
+		shared.registry = NULL;
+		return -1;
+	}
+	if(!(length = shared_address(shared.process, &address)) || (shared.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+	|| bind(shared.listener, (struct sockaddr*) &address, length) || listen(shared.listener, SOMAXCONN) || pipe(shared.stop)) {
+		shared_stop();
+		return -1;
+	}
+	if(pthread_create(&shared.thread, NULL, shared_thread, NULL)) {
+		shared_stop();
+		return -2;
+	}
+	shared.running = 1;
+	return 0;
+}
+
+/*
+ * gives up this process's games and its slot. connections handed over while it stops are refused.
+ * */
+void shared_stop(void)
+{
+	if(!shared.registry) {
+		return;
+	}
+	if(shared.running && write(shared.stop[1], "", 1) == 1) {
+		pthread_join(shared.thread, NULL);
+	}
+	shared.running = 0;
+	if(shared.listener >= 0) {
+		close(shared.listener);
+		shared.listener = -1;
+	}
+	if(shared.stop[0] >= 0) {
+		close(shared.stop[0]);
+		close(shared.stop[1]);
+		shared.stop[0] = shared.stop[1] = -1;
+	}
+	shared_lock();
+	shared_free_entries(shared.process);
+	atomic_store(&shared.registry->processes[shared.process], 0);
+	pthread_mutex_unlock(&shared.registry->monitor);
+	munmap(shared.registry, sizeof(struct shared_registry));
+	shared.registry = NULL;
+}
+
+/*
+ * opens a seat of the game with id for the other processes, returns its entry or 0 if the table is full
+ * or there is no registry
+ * */
+unsigned int shared_publish(uint32_t game_id)
+{
+	struct shared_game *game;
+	unsigned int index;
+	uint64_t seat;
+	if(!shared.running) {
+		return 0;
+	}
+	for(unsigned int i = 0; i < SHARED_GAMES; ++i) {
+		index = atomic_fetch_add(&shared.next, 1) % SHARED_GAMES;
+		game = &shared.registry->games[index];
+		seat = atomic_load(&game->seat);
+		if(SEAT_STATE(seat) != SHARED_FREE
+		|| !atomic_compare_exchange_strong(&game->seat, &seat, SEAT(SEAT_GENERATION(seat) + 1, SHARED_RESERVED))) {
+			continue;
+		}
+		game->process = shared.process;
+		game->id = game_id;
+		atomic_store(&game->seat, SEAT(SEAT_GENERATION(seat) + 1, SHARED_OPEN)); // releases the fields with it
+		return index + 1;
+	}
+	return 0;
+}
+
+/*
+ * claims the open seat of entry, returns -1 if another process claimed it first
+ * */
+int shared_claim(unsigned int entry)
+{
+	struct shared_game *game;
+	uint64_t seat;
+	if(!shared.registry || !entry || entry > SHARED_GAMES) {
+		return -3;
+	}
+	game = &shared.registry->games[entry - 1];
+	seat = atomic_load(&game->seat);
+	if(SEAT_STATE(seat) != SHARED_OPEN || !atomic_compare_exchange_strong(&game->seat, &seat, SEAT(SEAT_GENERATION(seat), SHARED_CLAIMED))) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * frees a claimed entry, by the process owning its game
+ * */
+void shared_release(unsigned int entry)
+{
+	struct shared_game *game;
+	uint64_t seat;
+	if(!shared.registry || !entry || entry > SHARED_GAMES) {
+		return;
+	}
+	game = &shared.registry->games[entry - 1];
+	seat = atomic_load(&game->seat);
+	atomic_store(&game->seat, SEAT(SEAT_GENERATION(seat), SHARED_FREE));
+}
+
+/*
+ * claims an open seat of another process and hands the connection fd over to it, join names the player.
+ * returns 0 once the other process seated the player, the connection is that process's then, -1 if no
+ * seat was found.
+ * */
+int shared_join(struct shared_join *join, int fd)
+{
+	struct sockaddr_un address;
+	struct shared_game *game;
+	unsigned int start, index;
+	uint64_t seat;
+	uint32_t process;
+	socklen_t length;
+	int channel;
+	char ack;
+	if(!shared.running) {
+		return -1;
+	}
+	start = random() % SHARED_GAMES;
+	for(unsigned int i = 0; i < SHARED_GAMES; ++i) {
+		index = (start + i) % SHARED_GAMES;
+		game = &shared.registry->games[index];
+		seat = atomic_load(&game->seat);
+		if(SEAT_STATE(seat) != SHARED_OPEN) {
+			continue;
+		}
+		process = game->process;
+		join->game_id = game->id;
+		join->entry = index + 1;
+		if(process == shared.process || process >= SHARED_PROCESSES
+		|| !atomic_compare_exchange_strong(&game->seat, &seat, SEAT(SEAT_GENERATION(seat), SHARED_CLAIMED))) {
+			continue; // the fields were read before the claim, a claim that succeeded proves they were the entry's
+		}
+		if(!(length = shared_address(process, &address)) || (channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+			atomic_store(&game->seat, SEAT(SEAT_GENERATION(seat), SHARED_OPEN));
+			return -1;
+		}
+		if(connect(channel, (struct sockaddr*) &address, length)) { // the process stopped or died without freeing its games
+			atomic_store(&game->seat, SEAT(SEAT_GENERATION(seat), SHARED_FREE));
+			close(channel);
+			continue;
+		}
+		if(upgrade_send(channel, join, sizeof(*join), fd) || upgrade_recv(channel, &ack, 1, NULL)) {
+			log_warning("shared: error on handing a player over to process %u", process);
+			close(channel);
+			return -1;
+		}
+		close(channel);
+		if(!ack) {
+			return 0;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,53 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include <stdint.h>
+#include "constants.h"
+
+/*
+ * a registry of open games shared by the server processes of one host, so that a player of one process
+ * can join a game created in another. it lives in the POSIX shared memory object named at shared_start
+ * and holds no pointers: a process is a slot of the process table, a game an entry of the game table
+ * naming its process and its id there.
+ *
+ * an entry's seat word holds its state and a generation that grows whenever the entry is taken, the
+ * seat is claimed with a compare and swap of the whole word, so a claim never takes an entry that was
+ * given up and reused in between. whoever claimed an open seat, the process owning the game or another
+ * one, joins it. another process hands its player's connection over to the owner through the owner's
+ * unix socket, with a shared_join record and the descriptor, and the owner answers with one byte, 0
+ * once it seated the player. the owner frees the entry either way.
+ *
+ * the process table is guarded by a robust mutex, a process that took the slot of one that died frees
+ * the dead process's entries.
+ * */
+#define SHARED_GAMES 4096
+#define SHARED_PROCESSES 64
+#define SHARED_MAGIC 0x52545454u // "TTTR"
+
+enum {
+	SHARED_FREE,
+	SHARED_RESERVED, // being filled in by its process
+	SHARED_OPEN,
+	SHARED_CLAIMED
+};
+
+struct shared_join {
+	uint32_t game_id;
+	uint32_t entry; // 1 + the index in the game table
+	char username[USERNAMELEN + 1];
+	char password[PASSWORDLEN + 1];
+	uint8_t multiplexed;
+};
+
+struct shared_callbacks {
+	int (*adopt)(const struct shared_join *join, int fd); // seats the player, the connection is its own afterwards
+};
+
+int shared_start(const char *name, const struct shared_callbacks *callbacks);
+void shared_stop(void);
+unsigned int shared_publish(uint32_t game_id);
+int shared_claim(unsigned int entry);
+void shared_release(unsigned int entry);
+int shared_join(struct shared_join *join, int fd);
+
+#endif
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "constants.h"
+#include "spectate.h"
+#include "log.h"
+#include "metrics.h"
+
+#define SPECTATE_IOVECS 64 // messages per gathering write
+#define SPECTATE_SLOTS (SPECTATE_QUEUE_LENGTH + 2) // a reply and a partly sent message fit on top of the broadcasts
+
+struct broadcast {
+	atomic_uint references;
+	uint32_t game_id; // 0 for replies, they are never replaced by a snapshot
+	size_t length;
+	char data[];
+};
+
+/*
+ * the queue is a ring, queue[head] is sent first and offset of its bytes are already sent.
+ * everything but blocked and next is protected by monitor, ready also by spectate.monitor.
+ * */
+struct spectator {
+	int fd;
+	char held; // a reply is being prepared, nothing may be sent before it
+	char dropped, closing, ready;
+	char blocked; // the last write would have blocked, only the writer thread touches it
+	struct broadcast *queue[SPECTATE_SLOTS];
+	size_t head, length, offset;
+	struct spectator *next; // in the ready list
+	pthread_mutex_t monitor;
+};
+
+/*
+ * publishing threads put spectators that got something to send on the ready list and wake the writer
+ * through a pipe. the writer polls the pipe and the sockets of the spectators whose last write would
+ * have blocked, those stay away from the ready list until their socket is writable again.
+ * */
+static struct {
+	struct spectator *ready;
+	struct spectator **blocked; // only the writer thread touches these
+	size_t number_of_blocked, blocked_size;
+	int wake[2];
+	atomic_char wake_pending;
+	atomic_char running;
+	pthread_t writer;
+	pthread_mutex_t monitor;
+} spectate = { .wake = { -1, -1 }, .monitor = PTHREAD_MUTEX_INITIALIZER };
+
+struct broadcast* broadcast_new(uint32_t game_id, const char *message, size_t length)
+{
+	struct broadcast *broadcast = malloc(sizeof(struct broadcast) + length);
+	if(!broadcast) {
+		return NULL;
+	}
+	atomic_init(&broadcast->references, 1);
+	broadcast->game_id = game_id;
+	broadcast->length = length;
+	memcpy(broadcast->data, message, length);
+	return broadcast;
+}
+
+void broadcast_release(struct broadcast *broadcast)
+{
+	if(broadcast && atomic_fetch_sub(&broadcast->references, 1) == 1) {
+		free(broadcast);
+	}
+}
+
+void spectate_wake(void)
+{
+	if(!atomic_exchange(&spectate.wake_pending, 1) && write(spectate.wake[1], "", 1) < 0 && errno != EAGAIN) {
+		log_warning("spectate: error on waking the writer: %s", (unsigned long) strerror(errno));
+	}
+}
+
+static void spectator_mark_ready(struct spectator *spectator)
+{
+	pthread_mutex_lock(&spectate.monitor);
+	if(!spectator->ready) {
+		spectator->ready = 1;
+		spectator->next = spectate.ready;
+		spectate.ready = spectator;
+	}
+	pthread_mutex_unlock(&spectate.monitor);
+}
+
+/*
+ * the caller holds the spectator's monitor
+ * */
+static void spectator_clear(struct spectator *spectator)
+{
+	while(spectator->length) {
+		broadcast_release(spectator->queue[spectator->head]);
+		spectator->head = (spectator->head + 1) % SPECTATE_SLOTS;
+		--spectator->length;
+	}
+	spectator->offset = 0;
+}
+
+struct spectator* spectate_attach(int fd)
+{
+	struct spectator *spectator = calloc(1, sizeof(struct spectator));
+	if(!spectator || pthread_mutex_init(&spectator->monitor, NULL)) {
+		free(spectator);
+		return NULL;
+	}
+	spectator->fd = fd;
+	gauge_add(gauges.spectators, 1);
+	return spectator;
+}
+
+/*
+ * hands the spectator and its socket over to the writer thread, which sends what is still queued if
+ * that does not block and closes the socket. the spectator must not be in any game's list anymore.
+ * */
+void spectate_detach(struct spectator *spectator)
+{
+	pthread_mutex_lock(&spectator->monitor);
+	spectator->closing = 1;
+	spectator->held = 0;
+	pthread_mutex_unlock(&spectator->monitor);
+	spectator_mark_ready(spectator);
+	spectate_wake();
+}
+
+/*
+ * nothing is sent to the spectator until the next spectate_reply, which puts the reply in front of
+ * the broadcasts queued in the meantime. used by a request that subscribes to a game, so the reply
+ * with the board comes before the first move made after it.
+ * */
+void spectate_hold(struct spectator *spectator)
+{
+	pthread_mutex_lock(&spectator->monitor);
+	spectator->held = 1;
+	pthread_mutex_unlock(&spectator->monitor);
+}
+
+/*
+ * queues the reply to the spectating session's request in front of all queued broadcasts, only behind
+ * a message that is partly sent
+ * */
+int spectate_reply(struct spectator *spectator, const char *message, size_t length)
+{
+	struct broadcast *reply = broadcast_new(0, message, length);
+	size_t next;
+	if(!reply) {
+		return -1;
+	}
+	pthread_mutex_lock(&spectator->monitor);
+	if(spectator->dropped || spectator->closing || spectator->length == SPECTATE_SLOTS) {
+		pthread_mutex_unlock(&spectator->monitor);
+		broadcast_release(reply);
+		return -1;
+	}
+	spectator->head = (spectator->head + SPECTATE_SLOTS - 1) % SPECTATE_SLOTS;
+	next = (spectator->head + 1) % SPECTATE_SLOTS;
+	if(spectator->offset) {
+		spectator->queue[spectator->head] = spectator->queue[next];
+		spectator->queue[next] = reply;
+	} else {
+		spectator->queue[spectator->head] = reply;
+	}
+	++spectator->length;
+	spectator->held = 0;
+	pthread_mutex_unlock(&spectator->monitor);
+	spectator_mark_ready(spectator);
+	spectate_wake();
+	return 0;
+}
+
+/*
+ * queues a reference to broadcast, returns -1 if the queue is full. the caller wakes the writer with
+ * spectate_wake once it published to every spectator of the game.
+ * */
+int spectate_publish(struct spectator *spectator, struct broadcast *broadcast)
+{
+	char was_empty;
+	pthread_mutex_lock(&spectator->monitor);
+	if(spectator->dropped || spectator->closing) {
+		pthread_mutex_unlock(&spectator->monitor);
+		return 0;
+	}
+	if(spectator->length >= SPECTATE_QUEUE_LENGTH) {
+		pthread_mutex_unlock(&spectator->monitor);
+		return -1;
+	}
+	was_empty = !spectator->length;
+	atomic_fetch_add_explicit(&broadcast->references, 1, memory_order_relaxed);
+	spectator->queue[(spectator->head + spectator->length++) % SPECTATE_SLOTS] = broadcast;
+	pthread_mutex_unlock(&spectator->monitor);
+	if(was_empty) { // otherwise it is on the ready list, held, or waits for its socket already
+		spectator_mark_ready(spectator);
+	}
+	return 0;
+}
+
+/*
+ * replaces the queued broadcasts of the snapshot's game by the snapshot. drops the spectator if the
+ * broadcasts of other games still fill its queue.
+ * */
+void spectate_resync(struct spectator *spectator, struct broadcast *snapshot)
+{
+	size_t i, kept, first;
+	struct broadcast *broadcast;
+	pthread_mutex_lock(&spectator->monitor);
+	if(spectator->dropped || spectator->closing) {
+		pthread_mutex_unlock(&spectator->monitor);
+		return;
+	}
+	first = spectator->offset ? 1 : 0; // a partly sent message has to be finished
+	for(i = kept = first; i < spectator->length; ++i) {
+		broadcast = spectator->queue[(spectator->head + i) % SPECTATE_SLOTS];
+		if(broadcast->game_id == snapshot->game_id) {
+			broadcast_release(broadcast);
+		} else {
+			spectator->queue[(spectator->head + kept++) % SPECTATE_SLOTS] = broadcast;
+		}
+	}
+	spectator->length = kept;
+	if(spectator->length < SPECTATE_QUEUE_LENGTH) {
+		atomic_fetch_add_explicit(&snapshot->references, 1, memory_order_relaxed);
+		spectator->queue[(spectator->head + spectator->length++) % SPECTATE_SLOTS] = snapshot;
+		log_debug("spectate: fd %d fell behind game %u", spectator->fd, snapshot->game_id);
+	} else {
+		spectator->dropped = 1;
+		spectator_clear(spectator);
+		shutdown(spectator->fd, SHUT_RDWR); // its connection thread notices and cleans up
+		log_warning("spectate: dropped fd %d, it fell behind %u messages", spectator->fd, SPECTATE_QUEUE_LENGTH);
+	}
+	pthread_mutex_unlock(&spectator->monitor);
+}
+
+static void spectator_block(struct spectator *spectator)
+{
+	struct spectator **blocked;
+	if(spectator->blocked) {
+		return;
+	}
+	if(spectate.number_of_blocked == spectate.blocked_size) {
+		blocked = realloc(spectate.blocked, sizeof(struct spectator*) * (spectate.blocked_size + REALLOC_SIZE));
+		if(!blocked) { // retried on the next wake up instead of when the socket is writable
+			return;
+		}
+		spectate.blocked = blocked;
+		spectate.blocked_size += REALLOC_SIZE;
+	}
+	spectator->blocked = 1;
+	spectate.blocked[spectate.number_of_blocked++] = spectator;
+}
+
+static void spectator_unblock(struct spectator *spectator)
+{
+	for(size_t i = 0; i < spectate.number_of_blocked; ++i) {
+		if(spectate.blocked[i] == spectator) {
+			spectate.blocked[i] = spectate.blocked[--spectate.number_of_blocked];
+			break;
+		}
+	}
+	spectator->blocked = 0;
+}
+
+/*
+ * sends as much of the queue as the socket takes without blocking, the caller holds the spectator's
+ * monitor. a write never waits, so publishing threads wait for the monitor at most one syscall long.
+ * */
+static void spectator_send(struct spectator *spectator)
+{
+	struct iovec iov[SPECTATE_IOVECS];
+	struct msghdr message;
+	struct broadcast *broadcast;
+	size_t i, count, rest;
+	ssize_t n;
+	while(spectator->length && !spectator->held && !spectator->dropped) {
+		count = spectator->length < SPECTATE_IOVECS ? spectator->length : SPECTATE_IOVECS;
+		for(i = 0; i < count; ++i) {
+			broadcast = spectator->queue[(spectator->head + i) % SPECTATE_SLOTS];
+			iov[i].iov_base = broadcast->data + (i ? 0 : spectator->offset);
+			iov[i].iov_len = broadcast->length - (i ? 0 : spectator->offset);
+		}
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = iov;
+		message.msg_iovlen = count;
+		n = sendmsg(spectator->fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL); // writev with flags, the socket itself blocks
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			spectator_block(spectator);
+			return;
+		}
+		if(n < 0) {
+			spectator->dropped = 1;
+			spectator_clear(spectator);
+			return;
+		}
+		while(n > 0) {
+			broadcast = spectator->queue[spectator->head];
+			rest = broadcast->length - spectator->offset;
+			if((size_t) n < rest) {
+				spectator->offset += n;
+				break;
+			}
+			n -= rest;
+			broadcast_release(broadcast);
+			spectator->head = (spectator->head + 1) % SPECTATE_SLOTS;
+			--spectator->length;
+			spectator->offset = 0;
+		}
+	}
+}
+
+static void spectator_free(struct spectator *spectator)
+{
+	if(spectator->blocked) {
+		spectator_unblock(spectator);
+	}
+	pthread_mutex_lock(&spectator->monitor);
+	if(!spectator->dropped) {
+		spectator_send(spectator); // e.g. the reply to LOGOUT_REQUEST
+	}
+	spectator_clear(spectator);
+	pthread_mutex_unlock(&spectator->monitor);
+	close(spectator->fd);
+	pthread_mutex_destroy(&spectator->monitor);
+	free(spectator);
+	gauge_add(gauges.spectators, -1);
+}
+
+static void* spectate_writer(void *arg)
+{
+	(void) arg;
+	struct pollfd *fds = NULL, *new_fds;
+	struct spectator **ready = NULL, **new_ready, *spectator;
+	size_t fds_size = 0, ready_size = 0, number_of_ready, number_of_fds, i;
+	char drain[64], closing;
+	while(atomic_load(&spectate.running)) {
+		number_of_fds = spectate.number_of_blocked + 1;
+		if(number_of_fds > fds_size) {
+			if(!(new_fds = realloc(fds, sizeof(struct pollfd) * (number_of_fds + REALLOC_SIZE)))) {
+				log_error("spectate: cannot allocate poll descriptors");
+				usleep(1000);
+				continue;
+			}
+			fds = new_fds;
+			fds_size = number_of_fds + REALLOC_SIZE;
+		}
+		fds[0].fd = spectate.wake[0];
+		fds[0].events = POLLIN;
+		for(i = 0; i < spectate.number_of_blocked; ++i) {
+			fds[i + 1].fd = spectate.blocked[i]->fd;
+			fds[i + 1].events = POLLOUT;
+		}
+		if(poll(fds, number_of_fds, -1) < 0) {
+			if(errno != EINTR) {
+				log_error("spectate: error on poll: %s", (unsigned long) strerror(errno));
+			}
+			continue;
+		}
+		for(i = number_of_fds - 1; i > 0; --i) { // unblocking moves the last entry, which was already looked at
+			if(fds[i].revents) {
+				spectator = spectate.blocked[i - 1];
+				spectator_unblock(spectator);
+				pthread_mutex_lock(&spectator->monitor);
+				spectator_send(spectator);
+				pthread_mutex_unlock(&spectator->monitor);
+			}
+		}
+		if(fds[0].revents) {
+			while(read(spectate.wake[0], drain, sizeof(drain)) > 0);
+			atomic_store(&spectate.wake_pending, 0);
+		}
+		pthread_mutex_lock(&spectate.monitor); // copied out, next links are reused as soon as ready is cleared
+		for(number_of_ready = 0, spectator = spectate.ready; spectator; spectator = spectator->next) {
+			if(number_of_ready == ready_size) {
+				if(!(new_ready = realloc(ready, sizeof(struct spectator*) * (ready_size + REALLOC_SIZE)))) {
+					break; // the rest stays on the list, the next wake up gets it
+				}
+				ready = new_ready;
+				ready_size += REALLOC_SIZE;
+			}
+			spectator->ready = 0;
+			ready[number_of_ready++] = spectator;
+		}
+		spectate.ready = spectator;
+		pthread_mutex_unlock(&spectate.monitor);
+		for(i = 0; i < number_of_ready; ++i) {
+			spectator = ready[i];
+			pthread_mutex_lock(&spectator->monitor);
+			if(spectator->closing) {
+				pthread_mutex_unlock(&spectator->monitor);
+				pthread_mutex_lock(&spectate.monitor);
+				closing = !spectator->ready; // detached after it was copied out, it is on the list again
+				pthread_mutex_unlock(&spectate.monitor);
+				if(closing) {
+					spectator_free(spectator);
+				}
+				continue;
+			}
+			if(!spectator->blocked) {
+				spectator_send(spectator);
+			}
+			pthread_mutex_unlock(&spectator->monitor);
+		}
+	}
+	free(fds);
+	free(ready);
+	return NULL;
+}
+
+int spectate_start(void)
+{
+	if(pipe(spectate.wake)) {
+		return -1;
+	}
+	if(fcntl(spectate.wake[0], F_SETFL, O_NONBLOCK) || fcntl(spectate.wake[1], F_SETFL, O_NONBLOCK)) { // a wake up never blocks
+		close(spectate.wake[0]);
+		close(spectate.wake[1]);
+		spectate.wake[0] = spectate.wake[1] = -1;
+		return -1;
+	}
+	atomic_store(&spectate.running, 1);
+	if(pthread_create(&spectate.writer, NULL, spectate_writer, NULL)) {
+		close(spectate.wake[0]);
+		close(spectate.wake[1]);
+		spectate.wake[0] = spectate.wake[1] = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * spectators whose connections are still open are left to the exiting process
+ * */
+void spectate_stop(void)
+{
+	if(spectate.wake[0] < 0) {
+		return;
+	}
+	atomic_store(&spectate.running, 0);
+	atomic_store(&spectate.wake_pending, 0);
+	spectate_wake();
+	pthread_join(spectate.writer, NULL);
+	close(spectate.wake[0]);
+	close(spectate.wake[1]);
+	spectate.wake[0] = spectate.wake[1] = -1;
+	free(spectate.blocked);
+}
@@ -0,0 +1,36 @@
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * fan-out of game messages to spectators. a message is encoded once into a broadcast, an immutable
+ * reference counted buffer, and every spectator of the game queues a reference to it. one writer
+ * thread sends the queues with non-blocking gathering writes, the iovecs point into the broadcasts,
+ * so the message is never copied per spectator and a slow spectator never blocks a player's thread.
+ *
+ * once a session spectates, the writer thread owns all writes to its socket: the connection thread
+ * queues its replies with spectate_reply. a spectator's queue holds at most SPECTATE_QUEUE_LENGTH
+ * broadcasts. the caller of spectate_publish replaces what a full queue holds of a game by a snapshot
+ * with spectate_resync, a spectator that is still too far behind after that is dropped, i.e. its
+ * connection is shut down.
+ * */
+#define SPECTATE_QUEUE_LENGTH 64
+
+struct broadcast;
+struct spectator;
+
+int spectate_start(void);
+void spectate_stop(void);
+struct broadcast* broadcast_new(uint32_t game_id, const char *message, size_t length);
+void broadcast_release(struct broadcast *broadcast);
+struct spectator* spectate_attach(int fd);
+void spectate_detach(struct spectator *spectator);
+void spectate_hold(struct spectator *spectator);
+int spectate_reply(struct spectator *spectator, const char *message, size_t length);
+int spectate_publish(struct spectator *spectator, struct broadcast *broadcast);
+void spectate_resync(struct spectator *spectator, struct broadcast *snapshot);
+void spectate_wake(void);
+
+#endif
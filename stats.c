@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "stats.h"
+
+#define STATS_SUB_BUCKET_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_MIN_BITS 6 // values below 64 ns are bucketed linearly
+#define STATS_MAX_BITS 37 // about 137 s, longer requests end up in the last bucket
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_MIN_BITS + 2) * STATS_SUB_BUCKETS)
+
+/*
+ * counters of one thread, written only by that thread. the reader sums them with relaxed loads,
+ * a concurrent reader may see a request counted in one field and not yet in another.
+ * */
+struct stats_thread {
+	atomic_uint histogram[STATS_OPCODES][STATS_BUCKETS];
+	atomic_uint errors[STATS_OPCODES];
+	atomic_ulong max[STATS_OPCODES];
+	atomic_uint replies[NUMBER_OF_OPCODES];
+	struct stats_thread *next;
+};
+
+// counters of threads that already exited
+struct stats_totals {
+	unsigned long histogram[STATS_OPCODES][STATS_BUCKETS];
+	unsigned long errors[STATS_OPCODES];
+	unsigned long max[STATS_OPCODES];
+	unsigned long replies[NUMBER_OF_OPCODES];
+};
+
+static struct {
+	struct stats_thread *threads;
+	struct stats_totals retired;
+	pthread_mutex_t monitor;
+	pthread_key_t key;
+} stats = { .monitor = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct stats_thread *thread_stats = NULL;
+
+const char *stats_opcode_names[STATS_OPCODES] = {
+	[LOGIN_REQUEST] = "login",
+	[LOGOUT_REQUEST] = "logout",
+	[CREATE_USER_REQUEST] = "create_user",
+	[JOIN_RANDOM_GAME_REQUEST] = "join_random_game",
+	[CREATE_NEW_GAME_REQUEST] = "create_new_game",
+	[LEAVE_GAME_REQUEST] = "leave_game",
+	[ACTION_REQUEST] = "action",
+	[STATS_REQUEST] = "stats",
+	[MULTIPLEX_REQUEST] = "multiplex",
+	[SPECTATE_REQUEST] = "spectate",
+	[GAME_SNAPSHOT_REQUEST] = "game_snapshot",
+	[LIST_GAMES_REQUEST] = "list_games",
+	[MATCHMAKE_REQUEST] = "matchmake",
+	[TOURNAMENT_REQUEST] = "tournament",
+	[REMATCH_REQUEST] = "rematch",
+	[STATS_MATCH_WAIT] = "match_wait",
+	[STATS_CLASS_GAME] = "class_game",
+	[STATS_CLASS_LOBBY] = "class_lobby",
+	[STATS_CLASS_AUTH] = "class_auth"
+};
+
+#define stats_increment(counter) atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) + 1, memory_order_relaxed)
+
+static unsigned int stats_bucket(unsigned long value)
+{
+	unsigned int msb, bucket;
+	if(value < (1ul << STATS_MIN_BITS)) {
+		return value >> (STATS_MIN_BITS - STATS_SUB_BUCKET_BITS);
+	}
+	msb = 63 - __builtin_clzl(value);
+	bucket = (msb - STATS_MIN_BITS + 1) * STATS_SUB_BUCKETS + ((value >> (msb - STATS_SUB_BUCKET_BITS)) & (STATS_SUB_BUCKETS - 1));
+	return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+static unsigned long stats_bucket_upper_bound(unsigned int bucket)
+{
+	unsigned int group = bucket >> STATS_SUB_BUCKET_BITS, sub_bucket = bucket & (STATS_SUB_BUCKETS - 1);
+	if(!group) {
+		return ((unsigned long) sub_bucket + 1) << (STATS_MIN_BITS - STATS_SUB_BUCKET_BITS);
+	}
+	return (((unsigned long) STATS_SUB_BUCKETS + sub_bucket + 1) << (group - 1 + STATS_MIN_BITS - STATS_SUB_BUCKET_BITS)) - 1;
+}
+
+static void stats_thread_retire(void *arg)
+{
+	struct stats_thread *thread = arg, **link;
+	pthread_mutex_lock(&stats.monitor);
+	for(link = &stats.threads; *link != thread; link = &(*link)->next);
+	*link = thread->next;
+	for(int i = 0; i < STATS_OPCODES; ++i) {
+		for(int j = 0; j < STATS_BUCKETS; ++j) {
+			stats.retired.histogram[i][j] += thread->histogram[i][j];
+		}
+		stats.retired.errors[i] += thread->errors[i];
+		if(thread->max[i] > stats.retired.max[i]) {
+			stats.retired.max[i] = thread->max[i];
+		}
+	}
+	for(int i = 0; i < NUMBER_OF_OPCODES; ++i) {
+		stats.retired.replies[i] += thread->replies[i];
+	}
+	pthread_mutex_unlock(&stats.monitor);
+	free(thread);
+}
+
+static struct stats_thread* stats_thread_register(void)
+{
+	struct stats_thread *thread = calloc(1, sizeof(struct stats_thread));
+	if(!thread) {
+		return NULL;
+	}
+	pthread_mutex_lock(&stats.monitor);
+	thread->next = stats.threads;
+	stats.threads = thread;
+	pthread_mutex_unlock(&stats.monitor);
+	pthread_setspecific(stats.key, thread);
+	return thread;
+}
+
+unsigned long stats_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+static void stats_record_histogram(struct stats_thread *thread, unsigned char opcode, unsigned long nanoseconds)
+{
+	stats_increment(thread->histogram[opcode][stats_bucket(nanoseconds)]);
+	if(nanoseconds > atomic_load_explicit(&thread->max[opcode], memory_order_relaxed)) {
+		atomic_store_explicit(&thread->max[opcode], nanoseconds, memory_order_relaxed);
+	}
+}
+
+void stats_record(unsigned char opcode, unsigned char return_code, unsigned long nanoseconds)
+{
+	struct stats_thread *thread = thread_stats;
+	if(!thread && !(thread = thread_stats = stats_thread_register())) {
+		return;
+	}
+	stats_increment(thread->replies[return_code]);
+	if(opcode >= STATS_OPCODES) {
+		return;
+	}
+	stats_record_histogram(thread, opcode, nanoseconds);
+	if(return_code >= ANY_ERROR) {
+		stats_increment(thread->errors[opcode]);
+	}
+}
+
+/*
+ * a second view of a request already counted with stats_record, e.g. its class: only its latency
+ * is recorded, its reply is not counted again
+ * */
+void stats_record_latency(unsigned char opcode, unsigned long nanoseconds)
+{
+	struct stats_thread *thread = thread_stats;
+	if(opcode >= STATS_OPCODES || (!thread && !(thread = thread_stats = stats_thread_register()))) {
+		return;
+	}
+	stats_record_histogram(thread, opcode, nanoseconds);
+}
+
+int stats_opcode_summary(unsigned char opcode, struct stats_summary *summary)
+{
+	if(opcode >= STATS_OPCODES || !summary) {
+		return -3;
+	}
+	unsigned long histogram[STATS_BUCKETS], seen = 0, max;
+	struct stats_thread *thread;
+	memset(summary, 0, sizeof(struct stats_summary));
+	pthread_mutex_lock(&stats.monitor);
+	memcpy(histogram, stats.retired.histogram[opcode], sizeof(histogram));
+	summary->errors = stats.retired.errors[opcode];
+	summary->max = stats.retired.max[opcode];
+	for(thread = stats.threads; thread; thread = thread->next) {
+		for(int i = 0; i < STATS_BUCKETS; ++i) {
+			histogram[i] += atomic_load_explicit(&thread->histogram[opcode][i], memory_order_relaxed);
+		}
+		summary->errors += atomic_load_explicit(&thread->errors[opcode], memory_order_relaxed);
+		max = atomic_load_explicit(&thread->max[opcode], memory_order_relaxed);
+		summary->max = max > summary->max ? max : summary->max;
+	}
+	pthread_mutex_unlock(&stats.monitor);
+	for(int i = 0; i < STATS_BUCKETS; ++i) {
+		summary->count += histogram[i];
+	}
+	for(int i = 0; i < STATS_BUCKETS && summary->count; ++i) {
+		seen += histogram[i];
+		if(!summary->p50 && seen * 2 >= summary->count) {
+			summary->p50 = stats_bucket_upper_bound(i);
+		}
+		if(!summary->p99 && seen * 100 >= summary->count * 99) {
+			summary->p99 = stats_bucket_upper_bound(i);
+		}
+		if(!summary->p999 && seen * 1000 >= summary->count * 999) {
+			summary->p999 = stats_bucket_upper_bound(i);
+		}
+	}
+	summary->p50 = summary->p50 < summary->max ? summary->p50 : summary->max; // the last bucket's bound may overshoot
+	summary->p99 = summary->p99 < summary->max ? summary->p99 : summary->max;
+	summary->p999 = summary->p999 < summary->max ? summary->p999 : summary->max;
+	return 0;
+}
+
+unsigned long stats_reply_count(unsigned char return_code)
+{
+	unsigned long count;
+	struct stats_thread *thread;
+	pthread_mutex_lock(&stats.monitor);
+	count = stats.retired.replies[return_code];
+	for(thread = stats.threads; thread; thread = thread->next) {
+		count += atomic_load_explicit(&thread->replies[return_code], memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&stats.monitor);
+	return count;
+}
+
+/*
+ * the per-opcode latency table of the load generator and the replay tool, returns the number of
+ * requests and errors over all opcodes
+ * */
+void stats_print(FILE *output, unsigned long *requests, unsigned long *errors)
+{
+	struct stats_summary summary;
+	*requests = *errors = 0;
+	fprintf(output, "%-18s %10s %8s %10s %10s %10s %10s\n", "opcode", "count", "errors", "p50 us", "p99 us", "p999 us", "max us");
+	for(unsigned char opcode = 0; opcode < STATS_OPCODES; ++opcode) {
+		if(!stats_opcode_names[opcode] || stats_opcode_summary(opcode, &summary) || !summary.count) {
+			continue;
+		}
+		*requests += summary.count;
+		*errors += summary.errors;
+		fprintf(output, "%-18s %10lu %8lu %10.1f %10.1f %10.1f %10.1f\n", stats_opcode_names[opcode], summary.count, summary.errors,
+			summary.p50 / 1e3, summary.p99 / 1e3, summary.p999 / 1e3, summary.max / 1e3);
+	}
+}
+
+int stats_init(void)
+{
+	return pthread_key_create(&stats.key, stats_thread_retire);
+}
@@ -0,0 +1,33 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "constants.h"
+
+/*
+ * per-opcode request counters and latency histograms. every thread records into its own counters,
+ * which are only summed up when somebody asks for them, so recording costs a few plain stores.
+ * histograms are log-linear (hdr style): 8 buckets per power of two, about 12% relative precision.
+ * */
+#define STATS_OPCODES 20 // request opcodes below this value get a latency histogram
+#define STATS_MATCH_WAIT 16 // not an opcode, the histogram of how long players waited for the matchmaker
+#define STATS_CLASS_GAME 17 // not opcodes either, the latencies of the server's request classes
+#define STATS_CLASS_LOBBY 18
+#define STATS_CLASS_AUTH 19
+
+struct stats_summary {
+	unsigned long count, errors;
+	unsigned long p50, p99, p999, max; // nanoseconds, upper bounds of the histogram buckets
+};
+
+extern const char *stats_opcode_names[STATS_OPCODES];
+
+void stats_record(unsigned char opcode, unsigned char return_code, unsigned long nanoseconds);
+void stats_record_latency(unsigned char opcode, unsigned long nanoseconds);
+int stats_opcode_summary(unsigned char opcode, struct stats_summary *summary);
+unsigned long stats_reply_count(unsigned char return_code);
+unsigned long stats_now(void);
+void stats_print(FILE *output, unsigned long *requests, unsigned long *errors);
+int stats_init(void);
+
+#endif
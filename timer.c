@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "timer.h"
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_SPAN (1ul << (TIMER_SLOTS_BITS * TIMER_LEVELS)) // ticks
+
+static struct {
+	struct timer_link slots[TIMER_LEVELS][TIMER_SLOTS]; // circular lists, the slot is the head
+	struct timer_link expiring; // the timers of the slot whose callbacks run
+	unsigned long now; // the next tick to expire, counted from the start
+	unsigned long started_at; // milliseconds, CLOCK_MONOTONIC
+	struct timer *running; // the timer whose callback runs
+	char started;
+	pthread_t thread;
+	pthread_mutex_t monitor;
+	pthread_cond_t stop, done; // done: a callback returned
+} wheel = { .monitor = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+static unsigned long timer_milliseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000ul + now.tv_nsec / 1000000ul;
+}
+
+static void timer_list_init(struct timer_link *head)
+{
+	head->previous = head->next = head;
+}
+
+static void timer_link(struct timer_link *head, struct timer_link *link)
+{
+	link->previous = head->previous;
+	link->next = head;
+	head->previous->next = link;
+	head->previous = link;
+}
+
+static void timer_unlink(struct timer_link *link)
+{
+	link->previous->next = link->next;
+	link->next->previous = link->previous;
+	link->previous = link->next = NULL;
+}
+
+/*
+ * moves the timers of the list at from to the empty list at to
+ * */
+static void timer_list_move(struct timer_link *from, struct timer_link *to)
+{
+	if(from->next == from) {
+		return;
+	}
+	to->next = from->next;
+	to->previous = from->previous;
+	to->next->previous = to->previous->next = to;
+	timer_list_init(from);
+}
+
+/*
+ * puts timer into the slot of the lowest level its expiry falls into, the caller holds the monitor
+ * */
+static void timer_insert(struct timer *timer)
+{
+	unsigned long delta = timer->expires - wheel.now;
+	unsigned int level;
+	if(delta >= TIMER_SPAN) {
+		timer->expires = wheel.now + TIMER_SPAN - 1;
+		delta = TIMER_SPAN - 1;
+	}
+	for(level = 0; level < TIMER_LEVELS - 1 && delta >= 1ul << (TIMER_SLOTS_BITS * (level + 1)); ++level);
+	timer_link(&wheel.slots[level][(timer->expires >> (TIMER_SLOTS_BITS * level)) & TIMER_MASK], &timer->link);
+}
+
+/*
+ * moves the timers of a slot down to the levels below, returns the slot's index
+ * */
+static unsigned int timer_cascade(unsigned int level, unsigned int index)
+{
+	struct timer_link list;
+	timer_list_init(&list);
+	timer_list_move(&wheel.slots[level][index], &list);
+	while(list.next != &list) {
+		struct timer *timer = (struct timer*) list.next;
+		timer_unlink(&timer->link);
+		timer_insert(timer);
+	}
+	return index;
+}
+
+/*
+ * expires the timers of the tick wheel.now. the caller holds the monitor, it is released while the callbacks run.
+ * */
+static void timer_tick(void)
+{
+	struct timer *timer;
+	unsigned int index = wheel.now & TIMER_MASK, cascaded = index;
+	for(unsigned int level = 1; !cascaded && level < TIMER_LEVELS; ++level) { // the level below completed a turn
+		cascaded = timer_cascade(level, (wheel.now >> (TIMER_SLOTS_BITS * level)) & TIMER_MASK);
+	}
+	++wheel.now;
+	timer_list_move(&wheel.slots[0][index], &wheel.expiring);
+	while(wheel.expiring.next != &wheel.expiring) {
+		timer = (struct timer*) wheel.expiring.next;
+		timer_unlink(&timer->link);
+		wheel.running = timer;
+		pthread_mutex_unlock(&wheel.monitor);
+		timer->expire(timer);
+		pthread_mutex_lock(&wheel.monitor);
+		wheel.running = NULL;
+		pthread_cond_broadcast(&wheel.done);
+	}
+}
+
+static void* timer_thread(void *arg)
+{
+	struct timespec deadline;
+	unsigned long elapsed;
+	(void) arg;
+	pthread_mutex_lock(&wheel.monitor);
+	while(wheel.started) {
+		elapsed = (timer_milliseconds() - wheel.started_at) / TIMER_TICK_MS;
+		while(wheel.started && wheel.now <= elapsed) { // catches up on ticks a slow callback held up
+			timer_tick();
+		}
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += TIMER_TICK_MS * 1000000l;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+		deadline.tv_nsec %= 1000000000l;
+		while(wheel.started && pthread_cond_timedwait(&wheel.stop, &wheel.monitor, &deadline) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&wheel.monitor);
+	return NULL;
+}
+
+int timer_start(void)
+{
+	for(unsigned int level = 0; level < TIMER_LEVELS; ++level) {
+		for(unsigned int slot = 0; slot < TIMER_SLOTS; ++slot) {
+			timer_list_init(&wheel.slots[level][slot]);
+		}
+	}
+	timer_list_init(&wheel.expiring);
+	wheel.now = 0;
+	wheel.started_at = timer_milliseconds();
+	wheel.started = 1;
+	if(pthread_create(&wheel.thread, NULL, timer_thread, NULL)) {
+		wheel.started = 0;
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * timers that are still armed stay armed and never expire, their owners may still cancel them
+ * */
+void timer_stop(void)
+{
+	pthread_mutex_lock(&wheel.monitor);
+	if(!wheel.started) {
+		pthread_mutex_unlock(&wheel.monitor);
+		return;
+	}
+	wheel.started = 0;
+	pthread_cond_signal(&wheel.stop);
+	pthread_mutex_unlock(&wheel.monitor);
+	pthread_join(wheel.thread, NULL);
+}
+
+/*
+ * expire is called with timer once milliseconds passed, rounded up to whole ticks. an armed timer is
+ * moved to the new expiry.
+ * */
+int timer_arm(struct timer *timer, unsigned long milliseconds, void (*expire)(struct timer*), void *context)
+{
+	if(!timer || !expire) {
+		return -3;
+	}
+	pthread_mutex_lock(&wheel.monitor);
+	if(!wheel.started) {
+		pthread_mutex_unlock(&wheel.monitor);
+		return -1;
+	}
+	if(timer->link.next) {
+		timer_unlink(&timer->link);
+	}
+	timer->expire = expire;
+	timer->context = context;
+	timer->expires = wheel.now + (milliseconds + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	timer_insert(timer);
+	pthread_mutex_unlock(&wheel.monitor);
+	return 0;
+}
+
+void timer_cancel(struct timer *timer)
+{
+	pthread_mutex_lock(&wheel.monitor);
+	if(timer->link.next) {
+		timer_unlink(&timer->link);
+	}
+	pthread_mutex_unlock(&wheel.monitor);
+}
+
+/*
+ * timer_cancel that also waits for the timer's callback to return, unless the callback itself calls it
+ * */
+void timer_cancel_sync(struct timer *timer)
+{
+	pthread_mutex_lock(&wheel.monitor);
+	if(timer->link.next) {
+		timer_unlink(&timer->link);
+	}
+	while(wheel.running == timer && !pthread_equal(pthread_self(), wheel.thread)) {
+		pthread_cond_wait(&wheel.done, &wheel.monitor);
+	}
+	pthread_mutex_unlock(&wheel.monitor);
+}
+
+char timer_armed(struct timer *timer)
+{
+	char armed;
+	pthread_mutex_lock(&wheel.monitor);
+	armed = timer->link.next != NULL;
+	pthread_mutex_unlock(&wheel.monitor);
+	return armed;
+}
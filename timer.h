@@ -0,0 +1,39 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * deadlines on a hierarchical timing wheel. the wheel has TIMER_LEVELS levels of TIMER_SLOTS slots, a slot
+ * of the lowest level is one tick of TIMER_TICK_MS and a slot of every level above spans a whole turn of
+ * the level below. a timer sits in the list of the slot of the lowest level its expiry falls into, so
+ * arming and cancelling it is a list insert and unlink, whatever the number of timers. whenever the lowest
+ * level completed a turn the next slot of the level above is cascaded: its timers move down a level.
+ *
+ * one thread advances the wheel every tick and calls the expired timers' callbacks one after the other,
+ * without the wheel's lock. a callback may arm its timer again. timers live in their owners' structures,
+ * a zeroed timer is not armed. before an owner frees a timer it cancels it with timer_cancel_sync, which
+ * also waits for a callback that is running, so the owner must not hold a lock that callback takes.
+ * */
+#define TIMER_TICK_MS 10
+#define TIMER_SLOTS_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOTS_BITS)
+#define TIMER_LEVELS 4 // 2^24 ticks, about 46 hours, later expiries are cut to that
+
+struct timer_link {
+	struct timer_link *previous, *next; // NULL while the timer is not armed
+};
+
+struct timer {
+	struct timer_link link;
+	unsigned long expires; // tick
+	void (*expire)(struct timer *timer);
+	void *context; // owned by the caller
+};
+
+int timer_start(void);
+void timer_stop(void);
+int timer_arm(struct timer *timer, unsigned long milliseconds, void (*expire)(struct timer*), void *context);
+void timer_cancel(struct timer *timer);
+void timer_cancel_sync(struct timer *timer);
+char timer_armed(struct timer *timer);
+
+#endif
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "tournament.h"
+
+static struct {
+	struct tournament *open, *finished;
+	struct tournament_match *ready, *ready_tail; // matches waiting for a worker
+	struct tournament_callbacks callbacks;
+	uint32_t next_id;
+	char running;
+	pthread_t workers[TOURNAMENT_WORKERS];
+	unsigned int number_of_workers;
+	pthread_mutex_t monitor;
+	pthread_cond_t work;
+} tournaments = { .next_id = 1, .monitor = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER };
+
+static struct tournament_player bye; // the empty seats of a bracket with fewer players than leaves
+
+/*
+ * everything a tournament needs is allocated before the first player signs up, so that a full
+ * tournament always begins
+ * */
+static struct tournament* tournament_new(char format, size_t size)
+{
+	struct tournament *tournament = calloc(1, sizeof(struct tournament));
+	size_t matches;
+	if(!tournament) {
+		return NULL;
+	}
+	tournament->id = tournaments.next_id++;
+	tournament->format = format;
+	tournament->size = size;
+	if(format == TOURNAMENT_KNOCKOUT) {
+		for(tournament->bracket_size = 2; tournament->bracket_size < size; tournament->bracket_size *= 2);
+		matches = tournament->bracket_size; // by node, node 0 is not used
+		tournament->bracket = calloc(2 * tournament->bracket_size, sizeof(struct tournament_player*));
+	} else {
+		matches = (size + 1) / 2;
+	}
+	tournament->players = calloc(size, sizeof(struct tournament_player));
+	tournament->matches = calloc(matches, sizeof(struct tournament_match));
+	if(!tournament->players || !tournament->matches || (format == TOURNAMENT_KNOCKOUT && !tournament->bracket)) {
+		free(tournament->players);
+		free(tournament->matches);
+		free(tournament->bracket);
+		free(tournament);
+		return NULL;
+	}
+	return tournament;
+}
+
+static void tournament_free(struct tournament *tournament)
+{
+	free(tournament->players);
+	free(tournament->matches);
+	free(tournament->bracket);
+	free(tournament);
+}
+
+static void tournament_enqueue(struct tournament_match *match)
+{
+	match->next = NULL;
+	if(tournaments.ready_tail) {
+		tournaments.ready_tail->next = match;
+	} else {
+		tournaments.ready = match;
+	}
+	tournaments.ready_tail = match;
+	pthread_cond_signal(&tournaments.work);
+}
+
+static void tournament_finish(struct tournament *tournament)
+{
+	tournament->next = tournaments.finished;
+	tournaments.finished = tournament;
+	pthread_cond_signal(&tournaments.work);
+}
+
+/*
+ * better rated first, the earlier sign up first among equal ratings
+ * */
+static int compare_ratings(const void *a, const void *b)
+{
+	const struct tournament_player *x = a, *y = b;
+	if(x->rating != y->rating) {
+		return x->rating < y->rating ? 1 : -1;
+	}
+	return (x->seed > y->seed) - (x->seed < y->seed);
+}
+
+/*
+ * more points first, the better seed first among equal points
+ * */
+static int compare_points(const void *a, const void *b)
+{
+	const struct tournament_player *x = *(struct tournament_player* const*) a, *y = *(struct tournament_player* const*) b;
+	if(x->points != y->points) {
+		return x->points < y->points ? 1 : -1;
+	}
+	return (x->seed > y->seed) - (x->seed < y->seed);
+}
+
+/*
+ * decides the nodes from node up to the root that need no game, because a player meets a bye, and
+ * queues the match of the first node whose two players are known. the winner of the root is the champion.
+ * */
+static void knockout_advance(struct tournament *tournament, size_t node)
+{
+	struct tournament_player *left, *right;
+	struct tournament_match *match;
+	for(; node; node /= 2) {
+		left = tournament->bracket[2 * node];
+		right = tournament->bracket[2 * node + 1];
+		if(!left || !right) {
+			return;
+		}
+		if(left != &bye && right != &bye) {
+			match = &tournament->matches[node];
+			match->tournament = tournament;
+			match->node = node;
+			match->replays = 0;
+			match->player_x = left->seed < right->seed ? left : right; // the better seed begins
+			match->player_o = match->player_x == left ? right : left;
+			tournament_enqueue(match);
+			return;
+		}
+		tournament->bracket[node] = left == &bye ? right : left;
+	}
+	tournament->bracket[1]->place = 1;
+	tournament_finish(tournament);
+}
+
+/*
+ * the seed at a leaf of a bracket, so that the better seeds meet the latest: the leaves of a bracket twice
+ * as large are every leaf followed by its opponent, the seed that adds up with it to one less than the
+ * number of leaves. seeds count from 0 here.
+ * */
+static size_t knockout_seed(size_t leaf, size_t leaves)
+{
+	size_t seed;
+	if(leaves == 1) {
+		return 0;
+	}
+	seed = knockout_seed(leaf / 2, leaves / 2);
+	return leaf % 2 ? leaves - 1 - seed : seed;
+}
+
+static void knockout_begin(struct tournament *tournament)
+{
+	size_t leaves = tournament->bracket_size, seed, i;
+	for(i = 0; i < leaves; ++i) {
+		seed = knockout_seed(i, leaves);
+		tournament->bracket[leaves + i] = seed < tournament->number_of_players ? &tournament->players[seed] : &bye;
+	}
+	for(i = leaves / 2; i < leaves; ++i) {
+		knockout_advance(tournament, i);
+	}
+}
+
+/*
+ * queues the matches of the current round, or places the players after the last round. players are
+ * paired with the circle method: the last player stays, the others move one seat on every round.
+ * with an odd number of players the last one is a bye.
+ * */
+static void round_robin_pair(struct tournament *tournament)
+{
+	size_t seats = tournament->size + tournament->size % 2, a, b, i;
+	struct tournament_player **standings;
+	struct tournament_match *match;
+	if(tournament->round == tournament->rounds) {
+		if(!(standings = malloc(tournament->size * sizeof(struct tournament_player*)))) {
+			for(i = 0; i < tournament->size; ++i) { // by seed
+				tournament->players[i].place = i + 1;
+			}
+		} else {
+			for(i = 0; i < tournament->size; ++i) {
+				standings[i] = &tournament->players[i];
+			}
+			qsort(standings, tournament->size, sizeof(struct tournament_player*), compare_points);
+			for(i = 0; i < tournament->size; ++i) {
+				standings[i]->place = i + 1;
+			}
+			free(standings);
+		}
+		tournament_finish(tournament);
+		return;
+	}
+	for(i = 0; i < seats / 2; ++i) {
+		a = i ? (tournament->round + i) % (seats - 1) : seats - 1;
+		b = (tournament->round + seats - 1 - i) % (seats - 1);
+		if(a >= tournament->size || b >= tournament->size) {
+			continue;
+		}
+		match = &tournament->matches[tournament->playing++];
+		match->tournament = tournament;
+		match->replays = 0;
+		match->player_x = &tournament->players[(tournament->round + i) % 2 ? b : a]; // the colours alternate
+		match->player_o = &tournament->players[(tournament->round + i) % 2 ? a : b];
+		tournament_enqueue(match);
+	}
+}
+
+static void tournament_begin(struct tournament *tournament)
+{
+	qsort(tournament->players, tournament->number_of_players, sizeof(struct tournament_player), compare_ratings);
+	for(size_t i = 0; i < tournament->number_of_players; ++i) {
+		tournament->players[i].seed = i + 1;
+	}
+	if(tournament->format == TOURNAMENT_KNOCKOUT) {
+		knockout_begin(tournament);
+		return;
+	}
+	tournament->rounds = tournament->size + tournament->size % 2 - 1;
+	round_robin_pair(tournament);
+}
+
+static void* tournament_worker(void *arg)
+{
+	struct tournament_match *batch[TOURNAMENT_BATCH];
+	struct tournament *tournament;
+	size_t n;
+	(void) arg;
+	pthread_mutex_lock(&tournaments.monitor);
+	while(tournaments.running) {
+		if((tournament = tournaments.finished)) {
+			tournaments.finished = tournament->next;
+			pthread_mutex_unlock(&tournaments.monitor);
+			tournaments.callbacks.over(tournament);
+			tournament_free(tournament);
+			pthread_mutex_lock(&tournaments.monitor);
+			continue;
+		}
+		for(n = 0; n < TOURNAMENT_BATCH && tournaments.ready; ++n) {
+			batch[n] = tournaments.ready;
+			tournaments.ready = tournaments.ready->next;
+		}
+		if(!tournaments.ready) {
+			tournaments.ready_tail = NULL;
+		}
+		if(n) {
+			pthread_mutex_unlock(&tournaments.monitor);
+			tournaments.callbacks.start(batch, n);
+			pthread_mutex_lock(&tournaments.monitor);
+			continue;
+		}
+		pthread_cond_wait(&tournaments.work, &tournaments.monitor);
+	}
+	pthread_mutex_unlock(&tournaments.monitor);
+	return NULL;
+}
+
+int tournament_start(const struct tournament_callbacks *callbacks)
+{
+	if(!callbacks || !callbacks->start || !callbacks->over) {
+		return -3;
+	}
+	tournaments.callbacks = *callbacks;
+	tournaments.running = 1;
+	for(tournaments.number_of_workers = 0; tournaments.number_of_workers < TOURNAMENT_WORKERS; ++tournaments.number_of_workers) {
+		if(pthread_create(&tournaments.workers[tournaments.number_of_workers], NULL, tournament_worker, NULL)) {
+			break;
+		}
+	}
+	if(!tournaments.number_of_workers) {
+		tournaments.running = 0;
+		return -2;
+	}
+	return 0;
+}
+
+/*
+ * tournaments that have not finished are dropped, their games go on without them
+ * */
+void tournament_stop(void)
+{
+	pthread_mutex_lock(&tournaments.monitor);
+	if(!tournaments.running) {
+		pthread_mutex_unlock(&tournaments.monitor);
+		return;
+	}
+	tournaments.running = 0;
+	pthread_cond_broadcast(&tournaments.work);
+	pthread_mutex_unlock(&tournaments.monitor);
+	for(unsigned int i = 0; i < tournaments.number_of_workers; ++i) {
+		pthread_join(tournaments.workers[i], NULL);
+	}
+}
+
+/*
+ * signs owner up for the open tournament of format and size, a new one is opened if there is none.
+ * returns the tournament's id and sets signed_up to the number of players it has now, 0 if the format
+ * or the size is invalid or on error.
+ * */
+uint32_t tournament_sign_up(char format, size_t size, void *owner, int rating, size_t *signed_up)
+{
+	struct tournament *tournament, **link;
+	struct tournament_player *player;
+	uint32_t id;
+	if((format != TOURNAMENT_KNOCKOUT && format != TOURNAMENT_ROUND_ROBIN) || size < 2
+	|| size > (format == TOURNAMENT_KNOCKOUT ? TOURNAMENT_MAX_PLAYERS : TOURNAMENT_MAX_ROUND_ROBIN)) {
+		return 0;
+	}
+	pthread_mutex_lock(&tournaments.monitor);
+	for(link = &tournaments.open; *link && ((*link)->format != format || (*link)->size != size); link = &(*link)->next);
+	if(!tournaments.running || (!*link && !(*link = tournament_new(format, size)))) {
+		pthread_mutex_unlock(&tournaments.monitor);
+		return 0;
+	}
+	tournament = *link;
+	player = &tournament->players[tournament->number_of_players];
+	player->owner = owner;
+	player->rating = rating;
+	player->seed = tournament->number_of_players++;
+	id = tournament->id;
+	*signed_up = tournament->number_of_players;
+	if(tournament->number_of_players == tournament->size) {
+		*link = tournament->next;
+		tournament->next = NULL;
+		tournament_begin(tournament);
+	}
+	pthread_mutex_unlock(&tournaments.monitor);
+	return id;
+}
+
+/*
+ * result is the final whose_turn of the match's game: 'X', 'O' or 'D'. a player that gave up loses,
+ * the caller reports the other player's win.
+ * */
+int tournament_report(struct tournament_match *match, char result)
+{
+	struct tournament *tournament = match->tournament;
+	struct tournament_player *winner, *loser;
+	unsigned int level;
+	if(result != 'X' && result != 'O' && result != 'D') {
+		return -3;
+	}
+	pthread_mutex_lock(&tournaments.monitor);
+	if(tournament->format == TOURNAMENT_ROUND_ROBIN) {
+		match->player_x->points += result == 'X' ? 1 : result == 'D' ? 0.5 : 0;
+		match->player_o->points += result == 'O' ? 1 : result == 'D' ? 0.5 : 0;
+		if(!--tournament->playing) {
+			++tournament->round;
+			round_robin_pair(tournament);
+		}
+		pthread_mutex_unlock(&tournaments.monitor);
+		return 0;
+	}
+	if(result == 'D' && match->replays < TOURNAMENT_REPLAYS) {
+		++match->replays;
+		winner = match->player_x; // the seats are swapped
+		match->player_x = match->player_o;
+		match->player_o = winner;
+		tournament_enqueue(match);
+		pthread_mutex_unlock(&tournaments.monitor);
+		return 0;
+	}
+	if(result == 'D') {
+		winner = match->player_x->seed < match->player_o->seed ? match->player_x : match->player_o;
+	} else {
+		winner = result == 'X' ? match->player_x : match->player_o;
+	}
+	loser = winner == match->player_x ? match->player_o : match->player_x;
+	for(level = 0; match->node >> (level + 1); ++level);
+	loser->place = (1u << level) + 1; // the final's loser is second, the semi-finals' are third
+	tournament->bracket[match->node] = winner;
+	knockout_advance(tournament, match->node / 2);
+	pthread_mutex_unlock(&tournaments.monitor);
+	return 0;
+}
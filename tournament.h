@@ -0,0 +1,74 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * knockout and round robin tournaments. players sign up for a tournament of a format and a number of
+ * players, it begins once it is full. the players are seeded by rating, the best rated player is seed 1.
+ *
+ * a knockout is a bracket of the next power of two above the number of players, the best seeds get the
+ * byes and seeds 1 and 2 can only meet in the final. a match is started as soon as both its players are
+ * known, so a fast half of the bracket does not wait for a slow one. a drawn match is replayed with the
+ * seats swapped, after TOURNAMENT_REPLAYS draws the better seed goes on. a round robin pairs every player
+ * with every other one, one round after the other with the circle method, a win is worth a point and a
+ * draw half a point.
+ *
+ * matches that are ready wait in one queue for a pool of TOURNAMENT_WORKERS threads, a worker takes up to
+ * TOURNAMENT_BATCH of them at once and hands them to the start callback, which starts their games. the
+ * result of every started match comes back with tournament_report, whoever finished its game calls it.
+ * the over callback gets a tournament once every player has a place, the tournament is freed after it.
+ * the callbacks run on the workers without the tournaments' lock.
+ * */
+#define TOURNAMENT_WORKERS 4
+#define TOURNAMENT_BATCH 64
+#define TOURNAMENT_REPLAYS 2
+#define TOURNAMENT_MAX_PLAYERS 16384
+#define TOURNAMENT_MAX_ROUND_ROBIN 256 // n * (n - 1) / 2 games
+
+enum {
+	TOURNAMENT_KNOCKOUT = 'k',
+	TOURNAMENT_ROUND_ROBIN = 'r'
+};
+
+struct tournament_player {
+	void *owner; // the caller's player
+	int rating;
+	unsigned int seed; // the order of signing up until the tournament begins
+	unsigned int place; // 0 while the player is still in the running
+	double points; // round robin
+};
+
+struct tournament_match {
+	struct tournament *tournament;
+	struct tournament_player *player_x, *player_o; // x begins
+	unsigned int replays;
+	size_t node; // the match's node of a knockout bracket
+	struct tournament_match *next; // the queue of matches waiting for a worker
+};
+
+struct tournament {
+	uint32_t id;
+	char format; // TOURNAMENT_*
+	size_t number_of_players, size; // signed up, wanted
+	struct tournament_player *players;
+	struct tournament_match *matches; // knockout: by bracket node, round robin: the matches of the round
+	struct tournament_player **bracket; // knockout: the leaves and the winners of the nodes above them
+	size_t bracket_size; // leaves
+	unsigned int round, rounds; // round robin
+	size_t playing; // round robin: matches of the round still being played
+	struct tournament *next; // open or finished tournaments
+};
+
+struct tournament_callbacks {
+	void (*start)(struct tournament_match **matches, size_t number_of_matches);
+	void (*over)(const struct tournament *tournament);
+};
+
+int tournament_start(const struct tournament_callbacks *callbacks);
+void tournament_stop(void);
+uint32_t tournament_sign_up(char format, size_t size, void *owner, int rating, size_t *signed_up);
+int tournament_report(struct tournament_match *match, char result);
+
+#endif
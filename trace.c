@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define TRACE_RING_LENGTH 1024 // events per thread, must be a power of two
+#define TRACE_ORPHANS 64 // rings of exited threads kept for the next dump, the oldest go first
+
+struct trace_event {
+	atomic_ulong sequence; // index + 1 of the event stored in this slot, 0 while it is being written
+	const char *name;
+	unsigned long start, duration; // nanoseconds on CLOCK_MONOTONIC
+	unsigned long request;
+};
+
+struct trace_ring {
+	struct trace_event events[TRACE_RING_LENGTH];
+	atomic_ulong head;
+	unsigned int tid;
+	atomic_char orphaned;
+	struct trace_ring *next;
+};
+
+unsigned int trace_sample_rate = 0;
+
+static struct {
+	struct trace_ring *rings;
+	unsigned int next_tid;
+	pthread_mutex_t monitor;
+	pthread_key_t key;
+} tracer = { .monitor = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct trace_ring *thread_ring = NULL;
+static __thread unsigned long thread_requests = 0;
+static __thread char sampled = 0;
+
+/*
+ * clock_gettime goes through the vdso and reads the tsc itself on x86,
+ * without having to calibrate rdtsc against wall time here
+ * */
+static unsigned long trace_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+static void trace_ring_orphan(void *ring)
+{
+	atomic_store(&((struct trace_ring*) ring)->orphaned, 1);
+}
+
+/*
+ * a thread per connection leaves a ring behind with every connection, so without a dump only the
+ * newest TRACE_ORPHANS of them are kept. the list is newest first. called with the monitor held.
+ * */
+static void trace_prune_orphans(void)
+{
+	struct trace_ring *ring, **link;
+	unsigned int orphans = 0;
+	for(link = &tracer.rings; (ring = *link);) {
+		if(atomic_load(&ring->orphaned) && ++orphans > TRACE_ORPHANS) {
+			*link = ring->next;
+			free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+}
+
+static struct trace_ring* trace_ring_register(void)
+{
+	struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+	if(!ring) {
+		return NULL;
+	}
+	pthread_mutex_lock(&tracer.monitor);
+	trace_prune_orphans();
+	ring->tid = ++tracer.next_tid;
+	ring->next = tracer.rings;
+	tracer.rings = ring;
+	pthread_mutex_unlock(&tracer.monitor);
+	pthread_setspecific(tracer.key, ring);
+	return ring;
+}
+
+/*
+ * decides whether the request the calling thread is about to handle gets traced
+ * */
+void trace_request_begin(void)
+{
+	sampled = trace_sample_rate && !(thread_requests++ % trace_sample_rate);
+	if(sampled && !thread_ring && !(thread_ring = trace_ring_register())) {
+		sampled = 0;
+	}
+}
+
+unsigned long trace_span_begin(void)
+{
+	return sampled ? trace_now() : 0;
+}
+
+void trace_span_end(const char *name, unsigned long start)
+{
+	if(!start || !sampled) {
+		return;
+	}
+	struct trace_ring *ring = thread_ring;
+	unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	struct trace_event *event = &ring->events[head & (TRACE_RING_LENGTH - 1)];
+	atomic_store_explicit(&event->sequence, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	event->name = name;
+	event->start = start;
+	event->duration = trace_now() - start;
+	event->request = thread_requests;
+	atomic_store_explicit(&event->sequence, head + 1, memory_order_release);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * events being overwritten while the dump reads them are detected by their sequence and skipped
+ * */
+int trace_dump(const char *path)
+{
+	struct trace_ring *ring, **link;
+	struct trace_event *slot, event;
+	unsigned long head, first;
+	char separator = ' ';
+	FILE *output = fopen(path, "w");
+	if(!output) {
+		return -1;
+	}
+	fprintf(output, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+	pthread_mutex_lock(&tracer.monitor);
+	for(link = &tracer.rings; (ring = *link);) {
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		first = head > TRACE_RING_LENGTH ? head - TRACE_RING_LENGTH : 0;
+		for(unsigned long i = first; i < head; ++i) {
+			slot = &ring->events[i & (TRACE_RING_LENGTH - 1)];
+			if(atomic_load_explicit(&slot->sequence, memory_order_acquire) != i + 1) {
+				continue;
+			}
+			event.name = slot->name;
+			event.start = slot->start;
+			event.duration = slot->duration;
+			event.request = slot->request;
+			atomic_thread_fence(memory_order_acquire);
+			if(atomic_load_explicit(&slot->sequence, memory_order_relaxed) != i + 1) {
+				continue;
+			}
+			fprintf(output, "%c\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %lu.%03lu, \"dur\": %lu.%03lu, "
+				"\"args\": {\"request\": %lu}}", separator, event.name, getpid(), ring->tid,
+				event.start / 1000, event.start % 1000, event.duration / 1000, event.duration % 1000, event.request);
+			separator = ',';
+		}
+		if(atomic_load(&ring->orphaned)) { // the thread is gone, its events were just written out
+			*link = ring->next;
+			free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+	pthread_mutex_unlock(&tracer.monitor);
+	fprintf(output, "\n]}\n");
+	return fclose(output) ? -1 : 0;
+}
+
+int trace_init(unsigned int sample_rate)
+{
+	trace_sample_rate = sample_rate;
+	return pthread_key_create(&tracer.key, trace_ring_orphan);
+}
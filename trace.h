@@ -0,0 +1,20 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * sampled request tracing. one request out of every sample_rate handled by a thread is traced:
+ * every phase wrapped in trace_span_begin/trace_span_end is stored with its start and duration
+ * in a ring owned by the thread. trace_dump writes the rings of all threads as chrome trace event
+ * json, which chrome://tracing and perfetto can open. with tracing disabled or for requests that
+ * are not sampled a span costs one thread local load and a branch.
+ * */
+
+extern unsigned int trace_sample_rate; // 0 disables tracing
+
+void trace_request_begin(void);
+unsigned long trace_span_begin(void);
+void trace_span_end(const char *name, unsigned long start);
+int trace_dump(const char *path);
+int trace_init(unsigned int sample_rate);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "upgrade.h"
+
+static int upgrade_address(const char *path, struct sockaddr_un *address)
+{
+	if(!path || strlen(path) >= sizeof(address->sun_path)) {
+		return -3;
+	}
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	strcpy(address->sun_path, path);
+	return 0;
+}
+
+/*
+ * the socket the next binary connects to. a socket file left at path, by the process this one took
+ * over or by one that crashed, is replaced.
+ * */
+int upgrade_listen(const char *path)
+{
+	struct sockaddr_un address;
+	int fd;
+	if(upgrade_address(path, &address)) {
+		return -3;
+	}
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	unlink(path);
+	if(bind(fd, (struct sockaddr*) &address, sizeof(address)) || listen(fd, 1)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * connects to the server listening at path, -1 if there is none
+ * */
+int upgrade_connect(const char *path)
+{
+	struct sockaddr_un address;
+	int fd;
+	if(upgrade_address(path, &address)) {
+		return -3;
+	}
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr*) &address, sizeof(address))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * sends length bytes, with passed_fd attached to the first one unless it is negative
+ * */
+int upgrade_send(int channel, const void *data, size_t length, int passed_fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec vector = { .iov_base = (void*) data, .iov_len = length };
+	struct msghdr message = { .msg_iov = &vector, .msg_iovlen = 1 };
+	struct cmsghdr *header;
+	ssize_t n;
+	if(passed_fd >= 0) {
+		memset(control, 0, sizeof(control));
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &passed_fd, sizeof(int));
+	}
+	while(vector.iov_len) {
+		if((n = sendmsg(channel, &message, MSG_NOSIGNAL)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		vector.iov_base = (char*) vector.iov_base + n;
+		vector.iov_len -= n;
+		message.msg_control = NULL; // the descriptor went with the first bytes
+		message.msg_controllen = 0;
+	}
+	return 0;
+}
+
+/*
+ * receives exactly length bytes. the descriptor that came with them is stored in passed_fd, -1 if
+ * none did. a descriptor nobody asked for is closed.
+ * */
+int upgrade_recv(int channel, void *data, size_t length, int *passed_fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec vector = { .iov_base = data, .iov_len = length };
+	struct msghdr message = { .msg_iov = &vector, .msg_iovlen = 1 };
+	struct cmsghdr *header;
+	int fd;
+	ssize_t n;
+	if(passed_fd) {
+		*passed_fd = -1;
+	}
+	while(vector.iov_len) {
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		if((n = recvmsg(channel, &message, MSG_CMSG_CLOEXEC)) <= 0) {
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		for(header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+			if(header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+				continue;
+			}
+			memcpy(&fd, CMSG_DATA(header), sizeof(int));
+			if(passed_fd && *passed_fd < 0) {
+				*passed_fd = fd;
+			} else {
+				close(fd);
+			}
+		}
+		vector.iov_base = (char*) vector.iov_base + n;
+		vector.iov_len -= n;
+	}
+	return 0;
+}
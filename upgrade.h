@@ -0,0 +1,55 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "constants.h"
+
+/*
+ * hot upgrades. a server started with an upgrade socket listens on it for the binary that replaces it.
+ * the new binary connects, the old one parks its sessions between two requests and sends an
+ * upgrade_header carrying the listening socket, one upgrade_session carrying the connection per session
+ * it hands over and one upgrade_game per game those sessions play, followed by board_size * board_size
+ * cells and number_of_moves moves. the new binary answers with one byte, 0 once it took everything over,
+ * only then the old one lets go of the sessions. it keeps the sessions it could not hand over, e.g.
+ * spectators and players of a tournament, until they end or UPGRADE_DRAIN_SECONDS passed, and exits.
+ * all integers are in host byte order, both binaries run on the same machine.
+ * */
+#define UPGRADE_MAGIC 0x55545454u // "TTTU"
+#define UPGRADE_VERSION 1u
+#define UPGRADE_PARK_MS 1000 // the sessions that did not park by then call the upgrade off
+#define UPGRADE_ACK_MS 5000
+#define UPGRADE_DRAIN_SECONDS 300
+
+struct upgrade_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t next_game_id;
+	uint32_t number_of_sessions;
+	uint32_t number_of_games;
+};
+
+struct upgrade_session {
+	char username[USERNAMELEN + 1];
+	char password[PASSWORDLEN + 1];
+	uint8_t multiplexed;
+};
+
+struct upgrade_game {
+	uint32_t id;
+	uint32_t board_size;
+	int64_t created_at;
+	int32_t player1_session, player2_session; // index in the order the sessions were sent, -1 for an empty seat
+	uint64_t player1_last_x, player1_last_y;
+	uint64_t player2_last_x, player2_last_y;
+	char whose_turn;
+	uint8_t host, rematch; // 1 or 2 for the player in that seat, 0 for nobody
+	uint8_t number_of_moves;
+};
+
+int upgrade_listen(const char *path);
+int upgrade_connect(const char *path);
+int upgrade_send(int channel, const void *data, size_t length, int passed_fd);
+int upgrade_recv(int channel, void *data, size_t length, int *passed_fd);
+
+#endif